@@ -1,5 +1,9 @@
+pragma ComponentBehavior: Bound
+
 import QtQuick
 import QtQuick.Controls
+import QtQuick.Dialogs
+import QtQml.Models
 import Amble
 
 ApplicationWindow {
@@ -20,6 +24,32 @@ ApplicationWindow {
     //     }
     // }
 
+    Shortcut {
+        sequences: [StandardKey.Undo]
+        onActivated: circuitViewport.undo()
+    }
+
+    Shortcut {
+        sequences: [StandardKey.Redo]
+        onActivated: circuitViewport.redo()
+    }
+
+    FileDialog {
+        id: openDialog
+        title: "Open Schematic"
+        nameFilters: ["Amble schematics (*.amb)", "All files (*)"]
+        onAccepted: circuitViewport.loadSchematic(selectedFile.toString())
+    }
+
+    FileDialog {
+        id: saveDialog
+        title: "Save Schematic"
+        fileMode: FileDialog.SaveFile
+        defaultSuffix: "amb"
+        nameFilters: ["Amble schematics (*.amb)"]
+        onAccepted: circuitViewport.saveSchematic(selectedFile.toString())
+    }
+
     SplitView {
         anchors.fill: parent
         orientation: Qt.Horizontal
@@ -36,32 +66,68 @@ ApplicationWindow {
                 gridColor: '#898989'
                 gridSize: 20
 
+                // Part whose live operating point the panel shows: the last one clicked
+                property int livePart: -1
+                property var livePartValues: ({})
+
                 Component.onCompleted: {
                     console.log("CircuitViewport QML completed with size:", width, "x", height);
+                    if (hasRecoverableSession()) {
+                        console.log("Recovering unsaved session");
+                        recoverSession();
+                    }
+                }
+
+                onSchematicLoadProgress: function (loadedTiles: int, totalTiles: int) {
+                    fileStatus.text = "Loading: " + loadedTiles + " / " + totalTiles + " tiles";
+                }
+                onSchematicLoaded: function (path: string) {
+                    fileStatus.text = "Loaded " + path;
+                }
+                onSchematicError: function (message: string) {
+                    fileStatus.text = "Error: " + message;
+                }
+                onComponentSelected: function (componentId: int) {
+                    livePart = componentId;
+                    livePartValues = liveValues(componentId);
+                    liveValueSlider.reset(livePartValues.value);
                 }
+                onLiveSolutionChanged: livePartValues = liveValues(livePart)
             }
 
             // MouseArea to handle all mouse interactions
             MouseArea {
                 anchors.fill: parent
                 acceptedButtons: Qt.AllButtons
+                hoverEnabled: true
 
                 property bool dragging: false
+                property bool banding: false
                 property point lastMousePos: Qt.point(0, 0)
 
-                onPressed: function (mouse) {
+                onPressed: function (mouse: MouseEvent) {
                     lastMousePos = Qt.point(mouse.x, mouse.y);
 
                     if (mouse.button === Qt.LeftButton) {
                         if (mouse.modifiers & Qt.ControlModifier) {
                             // Ctrl+click for wire connections
-                            var componentId = circuitViewport.getComponentAtPosition(mouse.x, mouse.y);
+                            let componentId = circuitViewport.getComponentAtPosition(mouse.x, mouse.y);
                             if (componentId >= 0) {
                                 circuitViewport.handleWireConnection(componentId);
                             }
-                        } else {
-                            circuitViewport.selectComponent(mouse.x, mouse.y);
+                        } else if (circuitViewport.getComponentAtPosition(mouse.x, mouse.y) >= 0) {
+                            // Shift+click adds or removes a part from the selection
+                            if (mouse.modifiers & Qt.ShiftModifier)
+                                circuitViewport.toggleSelectionAt(mouse.x, mouse.y);
+                            else
+                                circuitViewport.selectComponent(mouse.x, mouse.y);
                             dragging = true;
+                        } else {
+                            // Empty space: box selection, or a lasso with Alt
+                            if (!(mouse.modifiers & Qt.ShiftModifier))
+                                circuitViewport.deselectAll();
+                            circuitViewport.beginSelectionBand(mouse.x, mouse.y, mouse.modifiers & Qt.AltModifier);
+                            banding = true;
                         }
                     } else if (mouse.button === Qt.MiddleButton) {
                         // Start panning
@@ -69,7 +135,7 @@ ApplicationWindow {
                     }
                 }
 
-                onReleased: function (mouse) {
+                onReleased: function (mouse: MouseEvent) {
                     if (mouse.button === Qt.RightButton) {
                         console.log("Right click detected at:", mouse.x, mouse.y);
                         contextMenu.x = mouse.x;
@@ -78,26 +144,36 @@ ApplicationWindow {
                     } else if (mouse.button === Qt.LeftButton && dragging) {
                         // Snap to grid when drag ends
                         circuitViewport.snapSelectedToGrid();
+                    } else if (mouse.button === Qt.LeftButton && banding) {
+                        circuitViewport.endSelectionBand(mouse.modifiers & Qt.ShiftModifier);
                     }
                     dragging = false;
+                    banding = false;
                 }
 
-                onPositionChanged: function (mouse) {
-                    var deltaX = mouse.x - lastMousePos.x;
-                    var deltaY = mouse.y - lastMousePos.y;
+                onPositionChanged: function (mouse: MouseEvent) {
+                    let deltaX = mouse.x - lastMousePos.x;
+                    let deltaY = mouse.y - lastMousePos.y;
 
                     if (dragging && mouse.buttons & Qt.LeftButton) {
                         circuitViewport.moveSelectedComponents(deltaX, deltaY);
+                    } else if (banding && mouse.buttons & Qt.LeftButton) {
+                        circuitViewport.extendSelectionBand(mouse.x, mouse.y);
                     } else if (mouse.buttons & Qt.MiddleButton) {
                         // Pan the viewport
-                        var currentPan = circuitViewport.panOffset;
+                        let currentPan = circuitViewport.panOffset;
                         circuitViewport.panOffset = Qt.point(currentPan.x + deltaX, currentPan.y + deltaY);
+                    } else if (!mouse.buttons) {
+                        // Highlight the pin under the pointer
+                        circuitViewport.hoverAt(mouse.x, mouse.y);
                     }
                     lastMousePos = Qt.point(mouse.x, mouse.y);
                 }
 
-                onWheel: function (wheel) {
-                    var zoomFactor = wheel.angleDelta.y > 0 ? 1.1 : 0.9;
+                onExited: circuitViewport.clearHover()
+
+                onWheel: function (wheel: WheelEvent) {
+                    let zoomFactor = wheel.angleDelta.y > 0 ? 1.1 : 0.9;
                     circuitViewport.zoom = circuitViewport.zoom * zoomFactor;
                 }
             }
@@ -140,6 +216,23 @@ ApplicationWindow {
 
                 MenuSeparator {}
 
+                // One entry per subcircuit definition, after the separator above
+                Instantiator {
+                    model: circuitViewport.subcircuits
+                    delegate: MenuItem {
+                        required property var modelData
+                        text: "Add " + modelData.name
+                        onTriggered: circuitViewport.instantiateSubcircuit(modelData.id, contextMenu.x, contextMenu.y)
+                    }
+                    onObjectAdded: (index, object) => contextMenu.insertItem(5 + index, object)
+                    onObjectRemoved: (index, object) => contextMenu.removeItem(object)
+                }
+
+                MenuSeparator {
+                    visible: circuitViewport.subcircuits.length > 0
+                    height: visible ? implicitHeight : 0
+                }
+
                 MenuItem {
                     text: "Clear All Components"
                     onTriggered: {
@@ -197,6 +290,231 @@ ApplicationWindow {
                     }
                 }
 
+                Row {
+                    spacing: 10
+
+                    Button {
+                        text: "Undo"
+                        enabled: circuitViewport.canUndo
+                        ToolTip.visible: hovered && enabled
+                        ToolTip.text: circuitViewport.undoText
+                        onClicked: circuitViewport.undo()
+                    }
+
+                    Button {
+                        text: "Redo"
+                        enabled: circuitViewport.canRedo
+                        ToolTip.visible: hovered && enabled
+                        ToolTip.text: circuitViewport.redoText
+                        onClicked: circuitViewport.redo()
+                    }
+                }
+
+                Text {
+                    text: "Subcircuits"
+                    color: "white"
+                    font.bold: true
+                    topPadding: 20
+                }
+
+                Row {
+                    spacing: 10
+
+                    TextField {
+                        id: subcircuitName
+                        placeholderText: "Name"
+                        width: 120
+                    }
+
+                    Button {
+                        text: "Define from Selection"
+                        enabled: circuitViewport.selectionCount > 0
+                        onClicked: {
+                            if (circuitViewport.defineSubcircuit(subcircuitName.text) >= 0)
+                                subcircuitName.clear();
+                        }
+                    }
+                }
+
+                Row {
+                    spacing: 10
+                    visible: circuitViewport.subcircuits.length > 0
+
+                    ComboBox {
+                        id: subcircuitChoice
+                        model: circuitViewport.subcircuits
+                        textRole: "name"
+                        valueRole: "id"
+                        width: 120
+                    }
+
+                    Button {
+                        text: "Redefine from Selection"
+                        onClicked: circuitViewport.redefineSubcircuit(subcircuitChoice.currentValue)
+                    }
+                }
+
+                Text {
+                    text: "Parts (" + partList.count + ")"
+                    color: "white"
+                    font.bold: true
+                    topPadding: 20
+                }
+
+                TextField {
+                    id: partFilter
+                    placeholderText: "Search labels"
+                    width: 200
+                }
+
+                // Rows follow the model's edit signals, so only changed delegates update
+                ListView {
+                    id: partList
+                    width: 200
+                    height: 120
+                    clip: true
+                    model: circuitViewport.componentModel
+                    delegate: Text {
+                        required property string label
+                        required property string type
+                        required property bool selected
+                        readonly property bool matches: partFilter.text.length === 0
+                                                        || label.toLowerCase().indexOf(partFilter.text.toLowerCase()) >= 0
+                        visible: matches
+                        height: matches ? implicitHeight : 0
+                        text: label + "  " + type
+                        color: selected ? "#4fc3f7" : "#cccccc"
+                        font.pointSize: 9
+                    }
+                }
+
+                Text {
+                    text: "Rule Check (" + circuitViewport.diagnostics.length + ")"
+                    color: "white"
+                    font.bold: true
+                    topPadding: 20
+                }
+
+                ListView {
+                    width: 200
+                    height: 80
+                    clip: true
+                    model: circuitViewport.diagnostics
+                    delegate: Text {
+                        required property var modelData
+                        text: modelData.label + ": " + modelData.message
+                        color: "#ff8a80"
+                        font.pointSize: 9
+                        width: 200
+                        elide: Text.ElideRight
+                    }
+                }
+
+                Text {
+                    text: "Live DC"
+                    color: "white"
+                    font.bold: true
+                    topPadding: 20
+                }
+
+                CheckBox {
+                    text: "Solve while editing"
+                    checked: circuitViewport.liveDc
+                    onToggled: circuitViewport.liveDc = checked
+                }
+
+                Text {
+                    visible: circuitViewport.liveDc && circuitViewport.liveDcError.length > 0
+                    text: circuitViewport.liveDcError
+                    color: "#ff8a80"
+                    font.pointSize: 9
+                    width: 200
+                    wrapMode: Text.WordWrap
+                }
+
+                Text {
+                    readonly property var values: circuitViewport.livePartValues
+                    visible: circuitViewport.liveDc && values.inputVoltage !== undefined
+                    text: visible ? values.label + ": " + values.inputVoltage.toPrecision(4) + " V to "
+                                    + values.outputVoltage.toPrecision(4) + " V"
+                                    + (values.current !== undefined ? ", " + values.current.toPrecision(4) + " A" : "")
+                                  : ""
+                    color: "#cccccc"
+                    font.pointSize: 9
+                }
+
+                // Scales the part's value up to two decades either way; the
+                // solution follows every step of the drag
+                Slider {
+                    id: liveValueSlider
+                    property real baseValue: 0
+                    function reset(partValue) {
+                        baseValue = partValue === undefined ? 0 : partValue;
+                        value = 0;
+                    }
+                    visible: circuitViewport.liveDc && baseValue > 0
+                    from: -2
+                    to: 2
+                    value: 0
+                    onMoved: circuitViewport.setComponentValue(circuitViewport.livePart, baseValue * Math.pow(10, value))
+                    onPressedChanged: {
+                        if (pressed)
+                            circuitViewport.beginUndoGroup();
+                        else
+                            circuitViewport.endUndoGroup();
+                    }
+                }
+
+                // Wires take the voltage of their net, parts the chosen
+                // quantity; a heat map of the live solution turns solving on
+                Row {
+                    spacing: 10
+
+                    Text {
+                        text: "Heat map"
+                        color: "#cccccc"
+                        anchors.verticalCenter: parent.verticalCenter
+                    }
+
+                    ComboBox {
+                        model: ["Off", "Current", "Power"]
+                        currentIndex: circuitViewport.heatMap
+                        width: 120
+                        onActivated: function (index: int) {
+                            circuitViewport.heatMap = index;
+                            if (index !== 0)
+                                circuitViewport.liveDc = true;
+                        }
+                    }
+                }
+
+                Text {
+                    text: "File"
+                    color: "white"
+                    font.bold: true
+                    topPadding: 20
+                }
+
+                Row {
+                    spacing: 10
+
+                    Button {
+                        text: "Open..."
+                        onClicked: openDialog.open()
+                    }
+
+                    Button {
+                        text: "Save..."
+                        onClicked: saveDialog.open()
+                    }
+                }
+
+                Text {
+                    id: fileStatus
+                    color: "#cccccc"
+                    font.pointSize: 9
+                }
+
                 Text {
                     text: "Zoom: " + Math.round(circuitViewport.zoom * 100) + "%"
                     color: "white"
@@ -222,6 +540,23 @@ ApplicationWindow {
                     }
                 }
 
+                Text {
+                    text: "Anti-aliasing"
+                    color: "white"
+                    font.bold: true
+                    topPadding: 20
+                }
+
+                // Entries follow the AntialiasingQuality enum
+                ComboBox {
+                    model: ["Off", "Analytic", "MSAA 2x", "MSAA 4x", "MSAA 8x"]
+                    currentIndex: circuitViewport.antialiasingQuality
+                    width: 120
+                    onActivated: function (index: int) {
+                        circuitViewport.antialiasingQuality = index;
+                    }
+                }
+
                 Text {
                     text: "Controls:"
                     color: "#cccccc"
@@ -230,7 +565,7 @@ ApplicationWindow {
                 }
 
                 Text {
-                    text: "• Right-click: Add components\n• Left-click: Select/drag components\n• Middle-click: Pan view\n• Mouse wheel: Zoom\n• Ctrl+click: Connect with wires"
+                    text: "• Right-click: Add components\n• Left-click: Select/drag components\n• Left-drag on empty space: Box select (Alt: lasso, Shift: add)\n• Middle-click: Pan view\n• Mouse wheel: Zoom\n• Ctrl+click: Connect with wires"
                     color: "#cccccc"
                     wrapMode: Text.WordWrap
                     width: parent.width - 20
@@ -0,0 +1,363 @@
+#include "BatchRunner.h"
+#include "CircuitViewport.h"
+#include "MemoryStats.h"
+#include "ModelReduction.h"
+#include "Netlist.h"
+#include "ResultCache.h"
+#include "SchematicFile.h"
+#include "Simulator.h"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+struct DesignRun
+{
+    QString path;
+    BatchRunner::ExitCode exitCode = BatchRunner::Success;
+    QString message;
+    qint64 elapsedMs = 0;
+};
+
+struct ReductionSettings
+{
+    int moments = 0; // 0 simulates the full netlist
+    double expansion = 0.0;
+};
+
+bool writeText(const QString& path, const QString& text, QString& error)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        error = file.errorString();
+        return false;
+    }
+    file.write(text.toUtf8());
+    if (!file.commit())
+    {
+        error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+// Macromodels of the netlist's RLC subnetworks, taken from the cache where it
+// has them; reused counts those
+QVector<Macromodel> reduceNetlist(const Netlist& netlist, const ReductionSettings& reduction,
+                                  const ResultCache* cache, int& reused)
+{
+    QVector<Macromodel> macromodels;
+    reused = 0;
+    if (reduction.moments < 1)
+        return macromodels;
+    for (const RlcSubnetwork& subnetwork : ModelReduction::subnetworks(netlist, reduction.moments))
+    {
+        Macromodel model;
+        if (cache && cache->loadMacromodel(netlist, subnetwork, reduction.moments, reduction.expansion, model))
+        {
+            ++reused;
+        }
+        else
+        {
+            if (!ModelReduction::reduce(netlist, subnetwork, reduction.moments, reduction.expansion, model))
+                continue;
+            if (cache)
+                cache->storeMacromodel(netlist, subnetwork, reduction.moments, reduction.expansion, model);
+        }
+        macromodels.append(std::move(model));
+    }
+    return macromodels;
+}
+
+DesignRun runDesign(const QString& path, const QVector<AnalysisSettings>& analyses,
+                    const ReductionSettings& reduction, const ResultCache* cache, const QDir& outputDir)
+{
+    DesignRun run;
+    run.path = path;
+    QElapsedTimer timer;
+    timer.start();
+
+    SchematicReader reader;
+    if (!reader.open(path))
+    {
+        run.exitCode = BatchRunner::LoadError;
+        run.message = reader.errorString();
+        return run;
+    }
+    QVector<Component> components;
+    QVector<Wire> wires;
+    reader.readAll(components, wires);
+    qint64 designBytes = 0;
+    for (const Component& comp : std::as_const(components))
+        designBytes += componentByteSize(comp);
+    for (const Wire& wire : std::as_const(wires))
+        designBytes += wireByteSize(wire);
+    const MemoryStats::Charge design(MemoryStats::DesignModel, QStringLiteral("designs"), designBytes);
+    const Netlist netlist = Netlist::flatten(components, wires, reader.readSubcircuits());
+    reader.close();
+
+    const QString baseName = QFileInfo(path).completeBaseName();
+    QString error;
+    if (!writeText(outputDir.filePath(baseName + QStringLiteral(".cir")), netlist.toText(), error))
+    {
+        run.exitCode = BatchRunner::OutputError;
+        run.message = error;
+        return run;
+    }
+
+    // Each analysis looks for its result in the cache first; the macromodels
+    // and the simulator are only built once one misses
+    QStringList done;
+    const CanonicalNetlist canonical = cache ? CanonicalNetlist::of(netlist) : CanonicalNetlist();
+    std::unique_ptr<MemoryStats::Charge> models;
+    std::unique_ptr<Simulator> simulator;
+    for (const AnalysisSettings& settings : analyses)
+    {
+        SimulationResult result;
+        const bool cached =
+            cache && cache->loadResult(canonical, settings, reduction.moments, reduction.expansion, result);
+        if (!cached)
+        {
+            if (!simulator)
+            {
+                int reused = 0;
+                QVector<Macromodel> macromodels = reduceNetlist(netlist, reduction, cache, reused);
+                qint64 macromodelBytes = 0;
+                if (!macromodels.isEmpty())
+                {
+                    int fullOrder = 0;
+                    int order = 0;
+                    for (const Macromodel& model : std::as_const(macromodels))
+                    {
+                        fullOrder += model.fullOrder;
+                        order += model.order;
+                        macromodelBytes += model.byteSize();
+                    }
+                    QString message = QStringLiteral("%1 subnetworks reduced from %2 to %3 unknowns")
+                                          .arg(macromodels.size())
+                                          .arg(fullOrder)
+                                          .arg(order);
+                    if (reused > 0)
+                        message += QStringLiteral(", %1 cached").arg(reused);
+                    done.append(message);
+                }
+                models = std::make_unique<MemoryStats::Charge>(MemoryStats::Simulation, QStringLiteral("macromodels"),
+                                                               macromodelBytes);
+                simulator = std::make_unique<Simulator>(netlist, std::move(macromodels));
+            }
+            result = simulator->run(settings);
+        }
+        const MemoryStats::Charge results(MemoryStats::Simulation, QStringLiteral("results"), result.byteSize());
+        if (!result.isValid())
+        {
+            run.exitCode = BatchRunner::SimulationError;
+            run.message = settings.name() + QStringLiteral(": ") + result.errorString;
+            return run;
+        }
+        if (cache && !cached)
+            cache->storeResult(canonical, settings, reduction.moments, reduction.expansion, result);
+
+        const QString fileName = baseName + QLatin1Char('.') + settings.name() + QStringLiteral(".csv");
+        if (!writeText(outputDir.filePath(fileName), Simulator::toCsv(netlist, result), error))
+        {
+            run.exitCode = BatchRunner::OutputError;
+            run.message = error;
+            return run;
+        }
+        done.append(settings.name() + QLatin1Char(' ') + result.solver + (cached ? QStringLiteral(" cached") : QString()));
+    }
+
+    run.elapsedMs = timer.elapsed();
+    run.message = done.join(QStringLiteral(", "));
+    return run;
+}
+} // namespace
+
+bool BatchRunner::isBatchInvocation(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--batch") == 0)
+            return true;
+    }
+    return false;
+}
+
+int BatchRunner::run(const QStringList& arguments)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Amble headless batch simulation"));
+    parser.addHelpOption();
+    parser.addOption({QStringLiteral("batch"), QStringLiteral("Run without a window.")});
+    parser.addOption({QStringLiteral("analysis"), QStringLiteral("Analysis to run: op or tran (repeatable, default op)."),
+                      QStringLiteral("name")});
+    parser.addOption({QStringLiteral("tstep"), QStringLiteral("Transient time step in seconds."),
+                      QStringLiteral("seconds"), QStringLiteral("1e-6")});
+    parser.addOption({QStringLiteral("tstop"), QStringLiteral("Transient end time in seconds."),
+                      QStringLiteral("seconds"), QStringLiteral("1e-3")});
+    parser.addOption({QStringLiteral("solver"),
+                      QStringLiteral("Linear solver: auto, direct, cg, bicgstab or partitioned (default auto: dense LU "
+                                     "up to %1 unknowns; above that partitioned for transient steps, otherwise cg "
+                                     "for symmetric systems and bicgstab).")
+                          .arg(LinearSolver::DirectLimit),
+                      QStringLiteral("method"), QStringLiteral("auto")});
+    parser.addOption({QStringLiteral("reduce"),
+                      QStringLiteral("Replace RLC subnetworks of at least %1 unknowns with macromodels matching this "
+                                     "many block moments (default 0: simulate the full netlist).")
+                          .arg(ModelReduction::MinimumUnknowns),
+                      QStringLiteral("moments"), QStringLiteral("0")});
+    parser.addOption({QStringLiteral("cache"),
+                      QStringLiteral("Directory of cached results and macromodels, reused while the netlist and "
+                                     "settings they came from are unchanged (default: %1).")
+                          .arg(ResultCache::defaultDirectory()),
+                      QStringLiteral("dir"), ResultCache::defaultDirectory()});
+    parser.addOption({QStringLiteral("no-cache"), QStringLiteral("Simulate everything and leave the cache alone.")});
+    parser.addOption({QStringLiteral("out"), QStringLiteral("Directory for result files."), QStringLiteral("dir"),
+                      QStringLiteral(".")});
+    parser.addOption({QStringLiteral("jobs"), QStringLiteral("Designs simulated at once (default: all cores)."),
+                      QStringLiteral("n")});
+    parser.addOption({QStringLiteral("memory"),
+                      QStringLiteral("Print memory use per subsystem, current and peak, after the run.")});
+    parser.addPositionalArgument(QStringLiteral("designs"), QStringLiteral("Schematic files (.amb)."),
+                                 QStringLiteral("design.amb..."));
+
+    if (!parser.parse(arguments))
+    {
+        err << parser.errorText() << '\n';
+        return UsageError;
+    }
+    if (parser.isSet(QStringLiteral("help")))
+    {
+        out << parser.helpText();
+        return Success;
+    }
+
+    const QStringList designs = parser.positionalArguments();
+    if (designs.isEmpty())
+    {
+        err << "No designs given\n" << parser.helpText();
+        return UsageError;
+    }
+
+    // Output files are named after the design, and the designs run at once,
+    // so two designs with one name would overwrite each other's results.
+    // Case is ignored because the output directory may not tell it apart.
+    QHash<QString, QString> designsByName;
+    for (const QString& path : designs)
+    {
+        const QString name = QFileInfo(path).completeBaseName().toCaseFolded();
+        const auto existing = designsByName.constFind(name);
+        if (existing != designsByName.constEnd())
+        {
+            err << "Designs " << existing.value() << " and " << path << " would write the same result files\n";
+            return UsageError;
+        }
+        designsByName.insert(name, path);
+    }
+
+    bool stepOk = false;
+    bool stopOk = false;
+    AnalysisSettings base;
+    base.step = parser.value(QStringLiteral("tstep")).toDouble(&stepOk);
+    base.stop = parser.value(QStringLiteral("tstop")).toDouble(&stopOk);
+    if (!stepOk || !stopOk || !(base.step > 0.0) || !(base.stop >= base.step))
+    {
+        err << "Invalid transient step or stop time\n";
+        return UsageError;
+    }
+
+    if (!LinearSolver::fromName(parser.value(QStringLiteral("solver")), base.solver))
+    {
+        err << "Unknown solver: " << parser.value(QStringLiteral("solver")) << '\n';
+        return UsageError;
+    }
+
+    // Macromodels are built once per design and serve every analysis, so they
+    // are expanded in the middle of the transient's band, 1 / stop to 1 / step
+    ReductionSettings reduction;
+    bool reduceOk = false;
+    reduction.moments = parser.value(QStringLiteral("reduce")).toInt(&reduceOk);
+    reduction.expansion = 1.0 / std::sqrt(base.step * base.stop);
+    if (!reduceOk || reduction.moments < 0)
+    {
+        err << "Invalid moment count\n";
+        return UsageError;
+    }
+
+    QStringList analysisNames = parser.values(QStringLiteral("analysis"));
+    if (analysisNames.isEmpty())
+        analysisNames.append(QStringLiteral("op"));
+    QVector<AnalysisSettings> analyses;
+    for (const QString& name : analysisNames)
+    {
+        AnalysisSettings settings = base;
+        if (!AnalysisSettings::fromName(name, settings.kind))
+        {
+            err << "Unknown analysis: " << name << '\n';
+            return UsageError;
+        }
+        analyses.append(settings);
+    }
+
+    if (parser.isSet(QStringLiteral("jobs")))
+    {
+        bool ok = false;
+        const int jobs = parser.value(QStringLiteral("jobs")).toInt(&ok);
+        if (!ok || jobs < 1)
+        {
+            err << "Invalid job count\n";
+            return UsageError;
+        }
+        QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    }
+
+    const QDir outputDir(parser.value(QStringLiteral("out")));
+    if (!QDir().mkpath(outputDir.path()))
+    {
+        err << "Cannot create output directory " << outputDir.path() << '\n';
+        return OutputError;
+    }
+
+    const ResultCache resultCache(parser.value(QStringLiteral("cache")));
+    const ResultCache* cache = parser.isSet(QStringLiteral("no-cache")) ? nullptr : &resultCache;
+
+    QElapsedTimer timer;
+    timer.start();
+    const QList<DesignRun> runs = QtConcurrent::blockingMapped<QList<DesignRun>>(
+        designs, [&analyses, &reduction, cache, &outputDir](const QString& path) { return runDesign(path, analyses, reduction, cache, outputDir); });
+
+    int exitCode = Success;
+    int failures = 0;
+    for (const DesignRun& run : runs)
+    {
+        if (run.exitCode == Success)
+        {
+            out << "ok     " << run.path << " (" << run.message << ") " << run.elapsedMs << " ms\n";
+        }
+        else
+        {
+            err << "FAILED " << run.path << ": " << run.message << '\n';
+            exitCode = qMax<int>(exitCode, run.exitCode);
+            ++failures;
+        }
+    }
+    out << designs.size() - failures << " of " << designs.size() << " designs passed in " << timer.elapsed()
+        << " ms on " << QThreadPool::globalInstance()->maxThreadCount() << " threads\n";
+    if (parser.isSet(QStringLiteral("memory")))
+        out << "Memory (after the run, and peak):\n" << MemoryStats::report();
+    return exitCode;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QStringList>
+
+// Headless load, simulate and export for scripts and compute farms:
+//
+//   Amble --batch [--analysis op|tran]... [--tstep s] [--tstop s]
+//                 [--reduce moments] [--cache dir | --no-cache] [--out dir]
+//                 [--jobs n] design.amb...
+//
+// Designs run in parallel on the global thread pool. Each analysis of a design
+// writes <out>/<design>.<analysis>.csv, next to <design>.cir with the
+// flattened netlist, so the designs' file names must differ. Results and
+// macromodels are kept in a ResultCache, so a rerun only simulates what
+// changed. Nothing here needs a GUI application or a GL context.
+class BatchRunner
+{
+public:
+    // The process exit code is the highest one of any design
+    enum ExitCode
+    {
+        Success = 0,
+        UsageError = 1,
+        LoadError = 2,
+        SimulationError = 3,
+        OutputError = 4
+    };
+
+    static bool isBatchInvocation(int argc, char* argv[]);
+    static int run(const QStringList& arguments);
+};
@@ -1,4 +1,9 @@
 #include "CircuitViewport.h"
+#include "SchematicFile.h"
+#include "EditCommands.h"
+#include "Netlist.h"
+#include "DesignModels.h"
+#include "MemoryStats.h"
 
 // --- ADD THIS INCLUDE ---
 #include <QOpenGLFramebufferObject>
@@ -6,25 +11,478 @@
 
 #include <QQuickWindow>
 #include <QOpenGLContext>
+#include <QOpenGLPixelTransferOptions>
 #include <QDebug> // Good to have for logging
+#include <QElapsedTimer>
 #include <QtMath> // For M_PI and trig functions
 #include <QtMath> // For M_PI and math functions
+#include <QUrl>
+#include <QFile>
+#include <QStandardPaths>
+#include <QSet>
+#include <QVariantMap>
+#include <QVector2D>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace
+{
+// How often pending journal segments are folded into the schematic file
+constexpr int CompactionIntervalMs = 60 * 1000;
+
+// QML hands us file URLs, C++ callers plain paths
+QString localFilePath(const QString& path)
+{
+    QUrl url(path);
+    return url.isLocalFile() ? url.toLocalFile() : path;
+}
+
+// Axis-aligned bounds of a part, including its rotation
+QRectF componentBounds(const Component& comp)
+{
+    QRectF rect(comp.position, QSizeF(comp.width, comp.height));
+    if (qFuzzyIsNull(comp.rotation))
+        return rect;
+
+    QTransform transform;
+    transform.translate(rect.center().x(), rect.center().y());
+    transform.rotate(comp.rotation);
+    transform.translate(-rect.center().x(), -rect.center().y());
+    return transform.mapRect(rect);
+}
+
+// Sinks for tessellation routines written against operator<<: one counts
+// the floats an item produces, the other writes them into a preallocated
+// buffer, so both passes of tessellateParallel share the same code
+struct FloatCounter
+{
+    qsizetype count = 0;
+    FloatCounter& operator<<(float) { ++count; return *this; }
+};
+
+struct FloatWriter
+{
+    float* out;
+    FloatWriter& operator<<(float value) { *out++ = value; return *this; }
+};
+
+// Items per worker; a single chunk is tessellated on the calling thread
+constexpr qsizetype TessellationChunk = 4096;
+
+// Tessellates itemCount items across the thread pool. Per-item float counts
+// are measured in parallel, an exclusive prefix sum turns them into offsets
+// (itemCount + 1 entries, returned in offsets) and each worker then writes
+// its chunk straight into one preallocated buffer. tessellate(i, sink) must
+// emit the same floats for every sink.
+template <typename Tessellate>
+QVector<float> tessellateParallel(qsizetype itemCount, const Tessellate& tessellate, QVector<qsizetype>& offsets)
+{
+    using Chunk = std::pair<qsizetype, qsizetype>;
+    std::vector<Chunk> chunks;
+    for (qsizetype begin = 0; begin < itemCount; begin += TessellationChunk)
+        chunks.emplace_back(begin, qMin(itemCount, begin + TessellationChunk));
+
+    auto forEachChunk = [&chunks](const std::function<void(const Chunk&)>& work)
+    {
+        if (chunks.size() > 1)
+            QtConcurrent::blockingMap(chunks, work);
+        else
+            std::for_each(chunks.begin(), chunks.end(), work);
+    };
+
+    offsets.resize(itemCount + 1);
+    qsizetype* counts = offsets.data();
+    counts[0] = 0;
+    forEachChunk([&](const Chunk& chunk)
+    {
+        for (qsizetype i = chunk.first; i < chunk.second; ++i)
+        {
+            FloatCounter counter;
+            tessellate(i, counter);
+            counts[i + 1] = counter.count;
+        }
+    });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    QVector<float> vertices(offsets.last());
+    float* out = vertices.data();
+    const qsizetype* first = offsets.constData();
+    forEachChunk([&](const Chunk& chunk)
+    {
+        FloatWriter writer{out + first[chunk.first]};
+        for (qsizetype i = chunk.first; i < chunk.second; ++i)
+            tessellate(i, writer);
+    });
+    return vertices;
+}
+
+// Part shapes are triangles of (x, y, e0, e1, e2) vertices. e is the
+// vertex's barycentric coordinate, except that it stays 1 across edges shared
+// with another triangle, so analytic antialiasing only fades the outline.
+constexpr int FloatsPerShapeVertex = 5;
+
+template <typename Sink>
+void appendTriangle(Sink& vertices, const QPointF& a, const QPointF& b, const QPointF& c, int outerEdges)
+{
+    const QPointF corners[] = {a, b, c};
+    for (int i = 0; i < 3; ++i)
+    {
+        vertices << float(corners[i].x()) << float(corners[i].y());
+        for (int edge = 0; edge < 3; ++edge)
+            vertices << (edge == i || !(outerEdges & (1 << edge)) ? 1.0f : 0.0f);
+    }
+}
+
+// Bit i of outerEdges marks the edge opposite corner i as part of the outline
+template <typename Sink>
+void appendRect(Sink& vertices, float left, float top, float right, float bottom)
+{
+    appendTriangle(vertices, QPointF(left, top), QPointF(right, top), QPointF(left, bottom), 0b110);
+    appendTriangle(vertices, QPointF(right, top), QPointF(right, bottom), QPointF(left, bottom), 0b101);
+}
+
+template <typename Sink>
+void appendComponentShape(Sink& vertices, const Component& comp)
+{
+    float x = comp.position.x();
+    float y = comp.position.y();
+    float w = comp.width;
+    float h = comp.height;
+
+    if (comp.type == "Resistor")
+    {
+        // Resistor: Rectangle with zigzag pattern
+        // Main body (2 triangles = 6 vertices)
+        appendRect(vertices, x, y, x + w, y + h);
+    }
+    else if (comp.type == "Capacitor")
+    {
+        // Capacitor: Two parallel lines
+        float mid = x + w / 2;
+        float gap = w * 0.1f;
+        // Left plate
+        appendRect(vertices, mid - gap, y, mid - gap / 2, y + h);
+        // Right plate
+        appendRect(vertices, mid + gap / 2, y, mid + gap, y + h);
+    }
+    else if (comp.type == "Inductor")
+    {
+        // Inductor: Coil shape (simplified as rectangle for now)
+        appendRect(vertices, x, y, x + w, y + h);
+    }
+    else if (comp.type == "Voltage Source")
+    {
+        // Voltage Source: Circle (simplified as diamond)
+        float cx = x + w / 2, cy = y + h / 2;
+        appendTriangle(vertices, QPointF(cx, y), QPointF(x + w, cy), QPointF(cx, y + h), 0b111);
+        appendTriangle(vertices, QPointF(x, cy), QPointF(x + w, cy), QPointF(cx, y + h), 0b111);
+    }
+    else
+    {
+        // Default: filled rectangle
+        appendRect(vertices, x, y, x + w, y + h);
+    }
+}
+
+// Pin radius in world units, and how close in pixels the pointer has to be
+// to hover one
+constexpr float TerminalRadius = 3.5f;
+constexpr float TerminalHoverPixels = 6.0f;
+
+// Per-instance pin flags, matching the terminal shader
+constexpr int TerminalConnected = 1;
+constexpr int TerminalHovered = 2;
+constexpr int TerminalFlagged = 4; // Rule check finding; drawn as a wide red ring
+
+// Delay between the last edit and re-measuring the design model
+constexpr int MemorySampleIntervalMs = 250;
+
+// Label sizes in world units, and the on-screen heights in pixels below
+// which text is dropped and above which it is fully opaque
+constexpr float LabelTextSize = 10.0f;
+constexpr float ValueTextSize = 9.0f;
+constexpr float MinLegiblePixels = 4.0f;
+constexpr float FullLegiblePixels = 8.0f;
+constexpr int FloatsPerGlyph = 12;
+
+// Value with an SI prefix and the unit for the part type, e.g. "4.7 kOhm" using
+// the ohm sign; empty for parts without a value
+QString formatValue(const Component& comp)
+{
+    QString unit;
+    if (comp.type == "Resistor")
+        unit = QChar(0x03a9);
+    else if (comp.type == "Capacitor")
+        unit = QStringLiteral("F");
+    else if (comp.type == "Inductor")
+        unit = QStringLiteral("H");
+    else if (comp.type == "Voltage Source")
+        unit = QStringLiteral("V");
+    else
+        return QString();
+
+    static const double Scales[] = {1e9, 1e6, 1e3, 1.0, 1e-3, 1e-6, 1e-9, 1e-12};
+    static const char16_t Prefixes[] = {u'G', u'M', u'k', 0, u'm', 0x00b5, u'n', u'p'};
+
+    const double magnitude = qAbs(comp.value);
+    int i = 3;
+    if (magnitude > 0.0)
+    {
+        i = 0;
+        while (i < 7 && magnitude < Scales[i])
+            ++i;
+    }
+
+    QString text = QString::number(comp.value / Scales[i], 'g', 3) + QLatin1Char(' ');
+    if (Prefixes[i])
+        text += QChar(Prefixes[i]);
+    return text + unit;
+}
+
+// Compiles and links one program. Qt keeps the linked binary in its disk
+// cache, keyed by the driver and a hash of the sources, so later runs skip
+// compilation
+QOpenGLShaderProgram* buildProgram(const char* name, const QString& vertexShader, const QString& fragmentShader)
+{
+    auto* program = new QOpenGLShaderProgram();
+    if (!program->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, vertexShader))
+        qWarning() << name << "Vertex Shader Error:" << program->log();
+    if (!program->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShader))
+        qWarning() << name << "Fragment Shader Error:" << program->log();
+    if (!program->link())
+        qWarning() << name << "Link Error:" << program->log();
+    return program;
+}
+
+// MSAA samples for the viewport framebuffer; 0 renders single-sampled
+int sampleCount(CircuitViewport::AntialiasingQuality quality)
+{
+    switch (quality)
+    {
+    case CircuitViewport::Msaa2x:
+        return 2;
+    case CircuitViewport::Msaa4x:
+        return 4;
+    case CircuitViewport::Msaa8x:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Line segments (x0, y0, x1, y1) for one wire: its routed polyline, or a straight
+// line between the part centers when it has no route
+template <typename Sink>
+void appendWireSegments(Sink& vertices, const Wire& wire, const QHash<int, QPointF>& centers)
+{
+    if (wire.points.size() >= 2)
+    {
+        // Routed polyline, one line segment per leg
+        for (qsizetype i = 1; i < wire.points.size(); ++i)
+        {
+            vertices << wire.points[i - 1].x() << wire.points[i - 1].y();
+            vertices << wire.points[i].x() << wire.points[i].y();
+        }
+        return;
+    }
+
+    auto from = centers.constFind(wire.fromComponentId);
+    auto to = centers.constFind(wire.toComponentId);
+    if (from != centers.constEnd() && to != centers.constEnd())
+    {
+        // Straight line between part centers
+        vertices << from->x() << from->y();
+        vertices << to->x() << to->y();
+    }
+}
+
+void recordGpuBytes(const char* item, qint64 bytes)
+{
+    MemoryStats::set(MemoryStats::GpuBuffers, QString::fromLatin1(item), bytes);
+}
+
+QPointF componentCenter(const Component& comp)
+{
+    return QPointF(comp.position.x() + comp.width / 2, comp.position.y() + comp.height / 2);
+}
+
+QHash<int, QPointF> componentCenters(const QVector<Component>& components)
+{
+    QHash<int, QPointF> centers;
+    centers.reserve(components.size());
+    for (const Component& comp : components)
+        centers.insert(comp.id, componentCenter(comp));
+    return centers;
+}
+
+// Pin instances (x, y, flags, unused) for one part
+template <typename Sink>
+void appendTerminalInstances(Sink& instances, const Component& comp, const QSet<int>& connectedOutputs,
+                             const QSet<int>& connectedInputs)
+{
+    for (bool output : {false, true})
+    {
+        const QVector<QPointF>& terminals = output ? comp.outputTerminals : comp.inputTerminals;
+        const QSet<int>& connected = output ? connectedOutputs : connectedInputs;
+        for (int i = 0; i < terminals.size(); ++i)
+        {
+            const int flags = i == 0 && connected.contains(comp.id) ? TerminalConnected : 0;
+            instances << terminals[i].x() << terminals[i].y() << float(flags) << 0.0f;
+        }
+    }
+}
+
+// Opacity of text drawn at the given on-screen height: dropped below the
+// legibility threshold, faded in up to full size
+float legibilityAlpha(float pixels)
+{
+    if (pixels < MinLegiblePixels)
+        return 0.0f;
+    return qMin(1.0f, (pixels - MinLegiblePixels) / (FullLegiblePixels - MinLegiblePixels));
+}
+
+// Edits larger than this reset the list models instead of signalling each
+// row; rebuilding the delegates is then cheaper
+constexpr int MaxRowSignals = 256;
+
+DesignChange resetChange()
+{
+    DesignChange change;
+    change.reset = true;
+    return change;
+}
+
+// Flat x, y pairs from QML
+QVector<QPointF> pointsFromCoordinates(const QList<qreal>& coordinates)
+{
+    QVector<QPointF> points;
+    points.reserve(coordinates.size() / 2);
+    for (qsizetype i = 0; i + 1 < coordinates.size(); i += 2)
+        points.append(QPointF(coordinates[i], coordinates[i + 1]));
+    return points;
+}
+
+QVector<int> sortedUnique(QVector<int> values)
+{
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    return values;
+}
+} // namespace
+
+void DesignChange::touchComponents(int first, int last)
+{
+    if (first < 0 || first > last)
+        return;
+    firstComponent = firstComponent < 0 ? first : qMin(firstComponent, first);
+    lastComponent = qMax(lastComponent, last);
+}
+
+void DesignChange::touchWires(int first, int last)
+{
+    if (first < 0 || first > last)
+        return;
+    firstWire = firstWire < 0 ? first : qMin(firstWire, first);
+    lastWire = qMax(lastWire, last);
+}
+
+void DesignChange::merge(const DesignChange& other)
+{
+    if (other.firstComponent >= 0)
+        touchComponents(other.firstComponent, other.lastComponent);
+    if (other.firstWire >= 0)
+        touchWires(other.firstWire, other.lastWire);
+    componentsAdded += other.componentsAdded;
+    componentsRemoved += other.componentsRemoved;
+    wiresAdded += other.wiresAdded;
+    wiresRemoved += other.wiresRemoved;
+    reset = reset || other.reset;
+    valuesChanged = valuesChanged || other.valuesChanged;
+}
 
 // --- CircuitViewport Implementation ---
 
 CircuitViewport::CircuitViewport(QQuickItem* parent)
-    : QQuickFramebufferObject(parent)
+    : QQuickItem(parent)
 {
     setFlag(QQuickItem::ItemHasContents, true);
     setFlag(QQuickItem::ItemAcceptsInputMethod, true);
     setAcceptedMouseButtons(Qt::AllButtons);
     setAcceptHoverEvents(true);
-    setMirrorVertically(true);
+
+    m_compactionTimer.setInterval(CompactionIntervalMs);
+    connect(&m_compactionTimer, &QTimer::timeout, this, [this]() { compactJournal(); });
+
+    m_componentModel = new ComponentListModel(m_components, this);
+    m_wireModel = new WireListModel(m_wires, this);
+
+    m_ruleChecker = new RuleChecker;
+    m_ruleChecker->moveToThread(&m_ruleThread);
+    connect(&m_ruleThread, &QThread::finished, m_ruleChecker, &QObject::deleteLater);
+    connect(m_ruleChecker, &RuleChecker::checked, this, &CircuitViewport::applyRuleResults);
+    m_ruleThread.start(QThread::LowPriority);
+
+    m_memoryTimer.setSingleShot(true);
+    m_memoryTimer.setInterval(MemorySampleIntervalMs);
+    connect(&m_memoryTimer, &QTimer::timeout, this, &CircuitViewport::updateMemoryStats);
+
+    m_liveDcTimer.setSingleShot(true);
+    m_liveDcTimer.setInterval(0);
+    connect(&m_liveDcTimer, &QTimer::timeout, this, &CircuitViewport::updateLiveDc);
+    connect(this, &CircuitViewport::subcircuitsChanged, this, &CircuitViewport::scheduleLiveDc);
+}
+
+QAbstractListModel* CircuitViewport::componentModel() const
+{
+    return m_componentModel;
+}
+
+QAbstractListModel* CircuitViewport::wireModel() const
+{
+    return m_wireModel;
+}
+
+CircuitViewport::~CircuitViewport()
+{
+    cancelSchematicLoad();
+    waitForCompaction();
+    m_journal.close();
+    m_ruleThread.quit();
+    m_ruleThread.wait();
+    MemoryStats::clear(MemoryStats::DesignModel);
 }
 
-QQuickFramebufferObject::Renderer* CircuitViewport::createRenderer() const
+QSGNode* CircuitViewport::updatePaintNode(QSGNode* node, UpdatePaintNodeData* data)
 {
-    return new CircuitRenderer();
+    Q_UNUSED(data);
+
+    auto* renderer = static_cast<CircuitRenderer*>(node);
+    if (!renderer)
+    {
+        // The renderer issues OpenGL calls inside the scene graph's pass
+        if (window()->rendererInterface()->graphicsApi() != QSGRendererInterface::OpenGL)
+        {
+            qWarning() << "CircuitViewport requires the OpenGL scene graph backend";
+            return nullptr;
+        }
+        renderer = new CircuitRenderer();
+    }
+
+    renderer->synchronize(this);
+    renderer->markDirty(QSGNode::DirtyMaterial);
+    return renderer;
+}
+
+void CircuitViewport::geometryChange(const QRectF& newGeometry, const QRectF& oldGeometry)
+{
+    QQuickItem::geometryChange(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size())
+        update();
 }
 
 void CircuitViewport::setGridSize(float size)
@@ -54,6 +512,15 @@ void CircuitViewport::setBackgroundColor(const QColor& color)
     update();
 }
 
+void CircuitViewport::setAntialiasingQuality(AntialiasingQuality quality)
+{
+    if (m_antialiasingQuality == quality)
+        return;
+    m_antialiasingQuality = quality;
+    emit antialiasingQualityChanged();
+    update();
+}
+
 void CircuitViewport::setZoom(float z)
 {
     z = qMax(0.1f, qMin(10.0f, z)); // Clamp zoom between 0.1x and 10x
@@ -77,264 +544,2347 @@ void CircuitViewport::addComponent(const QString& type, float x, float y)
 {
     // Convert screen coordinates to world coordinates
     QPointF worldPos = screenToWorld(QPointF(x, y));
-    QPointF snappedPos = snapToGrid(worldPos);
+    Component newComponent = createComponent(type, snapToGrid(worldPos));
+    insertComponent(newComponent);
+    recordEdit(std::make_unique<AddComponentCommand>(newComponent));
+    notifyComponentAdded();
+}
 
-    // Choose color based on component type
+Component CircuitViewport::createComponent(const QString& type, const QPointF& position)
+{
+    // Choose color, designator prefix and default value based on component type
     QColor componentColor = QColor(100, 150, 255); // Default blue
+    QString prefix = "U";
+    double value = 0.0;
     if (type == "Resistor")
+    {
         componentColor = QColor(255, 100, 100); // Red
+        prefix = "R";
+        value = 1.0e3; // 1 kOhm
+    }
     else if (type == "Capacitor")
+    {
         componentColor = QColor(100, 255, 100); // Green
+        prefix = "C";
+        value = 1.0e-6; // 1 uF
+    }
     else if (type == "Inductor")
+    {
         componentColor = QColor(255, 255, 100); // Yellow
+        prefix = "L";
+        value = 1.0e-3; // 1 mH
+    }
     else if (type == "Voltage Source")
+    {
         componentColor = QColor(255, 150, 100); // Orange
+        prefix = "V";
+        value = 5.0; // 5 V
+    }
 
-    Component newComponent(m_nextComponentId++, type, snappedPos, componentColor);
-    newComponent.setupTerminals();
-    m_components.append(newComponent);
-    emit componentAdded();
-    update();
+    Component newComponent(m_nextComponentId++, type, position, componentColor);
+    newComponent.label = prefix + QString::number(newComponent.id);
+    newComponent.value = value;
+    return newComponent;
 }
 
-void CircuitViewport::clearComponents()
+QList<int> CircuitViewport::addComponents(const QString& type, const QList<qreal>& positions)
 {
-    m_components.clear();
-    m_wires.clear();
-    m_nextComponentId = 1;
-    m_selectedComponentId = -1;
-    update();
+    return addComponents(type, pointsFromCoordinates(positions));
 }
 
-void CircuitViewport::selectComponent(float x, float y)
+QVector<int> CircuitViewport::addComponents(const QString& type, const QVector<QPointF>& positions)
 {
-    QPointF worldPos = screenToWorld(QPointF(x, y));
-    int componentId = getComponentAt(worldPos);
-
-    qDebug() << "Selecting at screen" << QPointF(x, y) << "world" << worldPos << "found component" << componentId;
-
-    // Deselect all first
-    for (Component& comp : m_components)
+    if (positions.isEmpty())
+        return {};
+
+    QVector<Component> components;
+    QVector<int> ids;
+    components.reserve(positions.size());
+    ids.reserve(positions.size());
+    for (const QPointF& position : positions)
     {
-        comp.selected = false;
+        components.append(createComponent(type, position));
+        ids.append(components.last().id);
     }
+    insertComponents(components);
+    recordEdit(std::make_unique<AddComponentsCommand>(components));
+    notifyComponentAdded();
+    return ids;
+}
 
-    if (componentId >= 0)
+void CircuitViewport::moveComponents(const QList<int>& ids, qreal deltaX, qreal deltaY)
+{
+    const QPointF delta(deltaX, deltaY);
+    if (ids.isEmpty() || delta.isNull())
+        return;
+    translateComponents(ids, delta);
+    recordEdit(std::make_unique<MoveComponentsCommand>(ids, delta));
+}
+
+void CircuitViewport::setComponentPositions(const QList<int>& ids, const QList<qreal>& positions)
+{
+    setComponentPositions(ids, pointsFromCoordinates(positions));
+}
+
+void CircuitViewport::setComponentPositions(const QVector<int>& ids, const QVector<QPointF>& positions)
+{
+    QVector<int> placed;
+    QVector<QPointF> before;
+    QVector<QPointF> after;
+    for (qsizetype i = 0; i < ids.size() && i < positions.size(); ++i)
     {
-        for (Component& comp : m_components)
+        if (const Component* comp = findComponent(ids[i]))
         {
-            if (comp.id == componentId)
-            {
-                comp.selected = true;
-                m_selectedComponentId = componentId;
-                qDebug() << "Selected component" << componentId << "at position" << comp.position;
-                emit componentSelected(componentId);
-                break;
-            }
+            placed.append(ids[i]);
+            before.append(comp->position);
+            after.append(positions[i]);
         }
     }
-    else
+    if (placed.isEmpty())
+        return;
+    placeComponents(placed, after);
+    recordEdit(std::make_unique<PlaceComponentsCommand>(placed, before, after));
+}
+
+void CircuitViewport::deleteComponents(const QList<int>& ids)
+{
+    QVector<Component> components;
+    QVector<int> wireIndices;
+    for (int id : sortedUnique(ids))
     {
-        m_selectedComponentId = -1;
+        const Component* comp = findComponent(id);
+        if (!comp)
+            continue;
+        components.append(*comp);
+        wireIndices.append(m_wiresByComponent.value(id));
     }
+    if (components.isEmpty())
+        return;
 
-    update();
+    wireIndices = sortedUnique(wireIndices);
+    QVector<Wire> wires;
+    wires.reserve(wireIndices.size());
+    for (int index : wireIndices)
+        wires.append(m_wires[index]);
+
+    QVector<int> componentIds;
+    componentIds.reserve(components.size());
+    for (const Component& comp : components)
+        componentIds.append(comp.id);
+
+    beginBatch();
+    eraseWires(wireIndices);
+    eraseComponents(componentIds);
+    recordEdit(std::make_unique<DeleteComponentsCommand>(components, wireIndices, wires));
+    endBatch();
 }
 
-void CircuitViewport::deselectAll()
+void CircuitViewport::connectComponents(const QList<int>& fromIds, const QList<int>& toIds)
 {
-    for (Component& comp : m_components)
+    QVector<Wire> wires;
+    QVector<WireRouter::Request> requests;
+    for (qsizetype i = 0; i < fromIds.size() && i < toIds.size(); ++i)
     {
-        comp.selected = false;
+        Wire wire(fromIds[i], toIds[i]);
+        WireRouter::Request request;
+        if (fromIds[i] == toIds[i] || !routeRequest(wire, request))
+            continue;
+        wires.append(wire);
+        requests.append(request);
     }
-    m_selectedComponentId = -1;
-    update();
+    if (wires.isEmpty())
+        return;
+
+    // Routed together, in parallel, against the same obstacles
+    QVector<QVector<QPointF>> paths = WireRouter::routeAll(m_spatialIndex, m_gridSize, requests);
+    QVector<int> indices;
+    indices.reserve(wires.size());
+    for (qsizetype i = 0; i < wires.size(); ++i)
+    {
+        wires[i].points = paths[i];
+        indices.append(int(m_wires.size() + i));
+    }
+    insertWires(indices, wires);
+    recordEdit(std::make_unique<AddWiresCommand>(indices, wires));
 }
 
-void CircuitViewport::moveSelectedComponents(float deltaX, float deltaY)
+void CircuitViewport::beginBatch()
 {
-    // Convert screen delta to world delta
-    QPointF worldDelta = QPointF(deltaX / m_zoom, deltaY / m_zoom);
+    ++m_batchDepth;
+}
 
-    bool moved = false;
-    for (Component& comp : m_components)
+void CircuitViewport::endBatch()
+{
+    if (m_batchDepth == 0)
     {
-        if (comp.selected)
-        {
-            comp.position += worldDelta;
-            moved = true;
-            qDebug() << "Moving component" << comp.id << "to" << comp.position;
-        }
+        qWarning() << "endBatch() without beginBatch()";
+        return;
     }
+    if (--m_batchDepth > 0)
+        return;
 
-    if (moved)
-    {
-        update();
-    }
+    if (m_batchCommands.size() == 1)
+        recordEdit(std::move(m_batchCommands.front()));
+    else if (!m_batchCommands.empty())
+        recordEdit(std::make_unique<BatchCommand>(std::move(m_batchCommands)));
+    m_batchCommands.clear();
+    flushChanges();
 }
 
-void CircuitViewport::snapSelectedToGrid()
+void CircuitViewport::noteChange(const DesignChange& change)
 {
-    for (Component& comp : m_components)
+    // Moves are sorted out by noteComponentsTouched(); every other edit
+    // reaches the cached layer
+    if (change.changesNetlist())
+        m_renderChange.staticEdit = true;
+    m_pendingChange.merge(change);
+    if (m_batchDepth == 0)
+        flushChanges();
+}
+
+void CircuitViewport::noteComponentsTouched(const QVector<int>& ids)
+{
+    // Moved or edited parts, and the wires rerouted with them
+    DesignChange change;
+    for (int id : ids)
     {
-        if (comp.selected)
-        {
-            comp.position = snapToGrid(comp.position);
-        }
+        auto index = m_componentIndex.constFind(id);
+        if (index != m_componentIndex.constEnd())
+            change.touchComponents(index.value(), index.value());
+        if (m_selection.contains(id))
+            m_renderChange.movedIds.insert(id);
+        else
+            m_renderChange.staticEdit = true;
+        auto attached = m_wiresByComponent.constFind(id);
+        if (attached == m_wiresByComponent.constEnd())
+            continue;
+        for (int wire : attached.value())
+            change.touchWires(wire, wire);
     }
-    update();
+    noteChange(change);
 }
 
-void CircuitViewport::mousePressEvent(QMouseEvent* event)
+void CircuitViewport::notifySelectionChanged()
 {
-    event->accept();
-    m_lastMousePos = event->position();
+    if (m_batchDepth > 0)
+        m_pendingSelectionChange = true;
+    else
+        emit selectionChanged();
+}
 
-    if (event->button() == Qt::RightButton)
+void CircuitViewport::notifyComponentAdded()
+{
+    if (m_batchDepth > 0)
+        m_pendingComponentAdded = true;
+    else
+        emit componentAdded();
+}
+
+void CircuitViewport::flushChanges()
+{
+    if (m_pendingSelectionChange)
     {
-        m_lastRightClickPos = event->position();
-        qDebug() << "Right mouse press at:" << event->position();
+        m_pendingSelectionChange = false;
+        emit selectionChanged();
     }
-    else if (event->button() == Qt::LeftButton)
+    if (m_pendingComponentAdded)
     {
-        QPointF worldPos = screenToWorld(event->position());
-        int componentId = getComponentAt(worldPos);
-
-        if (componentId >= 0)
-        {
-            selectComponent(event->position().x(), event->position().y());
-            m_dragging = true;
-        }
-        else
-        {
-            deselectAll();
-        }
+        m_pendingComponentAdded = false;
+        emit componentAdded();
     }
-    else if (event->button() == Qt::MiddleButton)
+    if (!m_pendingChange.isEmpty())
     {
-        m_panning = true;
+        const DesignChange change = m_pendingChange;
+        m_pendingChange = DesignChange();
+        emit designChanged(change);
+        if (change.changesNetlist())
+            scheduleLiveDc();
+    }
+    if (!m_ruleDelta.isEmpty())
+    {
+        RuleChecker* checker = m_ruleChecker;
+        QMetaObject::invokeMethod(checker, [checker, delta = m_ruleDelta]() { checker->apply(delta); },
+                                  Qt::QueuedConnection);
+        m_ruleDelta = RuleCheckDelta();
     }
+    if (!m_memoryTimer.isActive())
+        m_memoryTimer.start();
+}
 
-    QQuickFramebufferObject::mousePressEvent(event);
+void CircuitViewport::applyRuleResults(bool reset, const QVector<int>& componentIds,
+                                       const QVector<Diagnostic>& diagnostics)
+{
+    // Results arrive in the order the deltas were sent
+    if (reset)
+        m_diagnostics.clear();
+    for (int id : componentIds)
+        m_diagnostics.remove(id);
+    for (const Diagnostic& diagnostic : diagnostics)
+        m_diagnostics[diagnostic.componentId].append(diagnostic);
+    emit diagnosticsChanged();
+    update();
 }
 
-void CircuitViewport::mouseReleaseEvent(QMouseEvent* event)
+QVariantList CircuitViewport::diagnosticList() const
 {
-    event->accept();
-    if (event->button() == Qt::RightButton)
+    QList<int> ids = m_diagnostics.keys();
+    std::sort(ids.begin(), ids.end());
+
+    // Findings for parts deleted since the check was sent are skipped
+    QVariantList result;
+    for (int id : ids)
     {
-        // Emit signal for context menu with coordinates
-        qDebug() << "Right mouse release at:" << event->position();
-        emit rightClicked(event->position().x(), event->position().y());
-    }
-    else if (event->button() == Qt::LeftButton)
+        auto index = m_componentIndex.constFind(id);
+        if (index == m_componentIndex.constEnd())
+            continue;
+        const Component& comp = m_components[index.value()];
+        for (const Diagnostic& diagnostic : *m_diagnostics.constFind(id))
+        {
+            QString message;
+            switch (diagnostic.rule)
+            {
+            case Diagnostic::UnconnectedPart:
+                message = tr("Not connected");
+                break;
+            case Diagnostic::FloatingTerminal:
+                message = diagnostic.output ? tr("Output terminal is floating") : tr("Input terminal is floating");
+                break;
+            case Diagnostic::ShortedSource:
+                message = tr("Source is shorted");
+                break;
+            case Diagnostic::SourceInductorLoop:
+                message = tr("In a loop of sources and inductors");
+                break;
+            }
+            QVariantMap entry;
+            entry.insert(QStringLiteral("componentId"), id);
+            entry.insert(QStringLiteral("label"), comp.label);
+            entry.insert(QStringLiteral("rule"), int(diagnostic.rule));
+            entry.insert(QStringLiteral("message"), message);
+            result.append(entry);
+        }
+    }
+    return result;
+}
+
+void CircuitViewport::updateMemoryStats()
+{
+    // Unused capacity counts too; it is what a shrinking design keeps
+    qint64 components = (m_components.capacity() - m_components.size()) * qint64(sizeof(Component));
+    for (const Component& comp : std::as_const(m_components))
+        components += componentByteSize(comp);
+    qint64 wires = (m_wires.capacity() - m_wires.size()) * qint64(sizeof(Wire));
+    for (const Wire& wire : std::as_const(m_wires))
+        wires += wireByteSize(wire);
+    qint64 subcircuits = 0;
+    for (const SubcircuitDefinition& definition : std::as_const(m_subcircuits))
+        subcircuits += qint64(sizeof(SubcircuitDefinition)) + subcircuitByteSize(definition);
+
+    // Hash nodes hold the key, the value and about two pointers of overhead
+    constexpr qint64 NodeOverhead = 2 * sizeof(void*);
+    qint64 indexes = m_componentIndex.size() * (2 * qint64(sizeof(int)) + NodeOverhead) +
+                     m_spatialIndex.size() * (qint64(sizeof(int) + sizeof(QRectF)) + NodeOverhead);
+    for (const QVector<int>& attached : std::as_const(m_wiresByComponent))
+        indexes += qint64(sizeof(int)) + qint64(sizeof(QVector<int>)) + NodeOverhead + attached.size() * qint64(sizeof(int));
+
+    m_componentBytes = components;
+    m_wireBytes = wires;
+    MemoryStats::set(MemoryStats::DesignModel, QStringLiteral("components"), components);
+    MemoryStats::set(MemoryStats::DesignModel, QStringLiteral("wires"), wires);
+    MemoryStats::set(MemoryStats::DesignModel, QStringLiteral("subcircuits"), subcircuits);
+    MemoryStats::set(MemoryStats::DesignModel, QStringLiteral("indexes"), indexes);
+    MemoryStats::set(MemoryStats::DesignModel, QStringLiteral("undo history"), m_history.memoryUsage());
+}
+
+void CircuitViewport::setLiveDc(bool enabled)
+{
+    if (m_liveDcEnabled == enabled)
+        return;
+    m_liveDcEnabled = enabled;
+    if (enabled)
+    {
+        updateLiveDc();
+    }
+    else
+    {
+        m_liveDcTimer.stop();
+        m_liveDc.clear();
+        m_liveNetlist = Netlist();
+        MemoryStats::set(MemoryStats::Simulation, QStringLiteral("live operating point"), 0);
+        if (!m_heatMapExternal)
+        {
+            ++m_heatMapNetlistRevision;
+            heatMapSampleChanged(false);
+        }
+        emit liveSolutionChanged();
+    }
+    emit liveDcChanged();
+}
+
+QVariantMap CircuitViewport::liveValues(int componentId) const
+{
+    QVariantMap values;
+    auto index = m_componentIndex.constFind(componentId);
+    if (index == m_componentIndex.constEnd())
+        return values;
+    const Component& comp = m_components[index.value()];
+    values.insert(QStringLiteral("label"), comp.label);
+    values.insert(QStringLiteral("value"), comp.value);
+
+    // Nothing while the last solve failed or the netlist is a batch behind
+    const QVector<double>& voltages = m_liveDc.nodeVoltages();
+    auto nodes = m_liveNetlist.componentNodes.constFind(componentId);
+    if (nodes == m_liveNetlist.componentNodes.constEnd() || voltages.size() != m_liveNetlist.nodeCount)
+        return values;
+    values.insert(QStringLiteral("inputVoltage"), voltages[nodes->first]);
+    values.insert(QStringLiteral("outputVoltage"), voltages[nodes->second]);
+    auto element = m_liveNetlist.componentElements.constFind(componentId);
+    if (element != m_liveNetlist.componentElements.constEnd())
+        values.insert(QStringLiteral("current"), m_liveDc.elementCurrents().value(element.value()));
+    return values;
+}
+
+void CircuitViewport::scheduleLiveDc()
+{
+    // Edits arrive in bursts while a value is dragged; one solve serves them all
+    if (m_liveDcEnabled && !m_liveDcTimer.isActive())
+        m_liveDcTimer.start();
+}
+
+void CircuitViewport::updateLiveDc()
+{
+    if (!m_liveDcEnabled)
+        return;
+    Netlist netlist = Netlist::flatten(m_components, m_wires, m_subcircuits);
+    // The renderer maps parts and wires to values again only when they land
+    // on other nodes or elements
+    const bool renumbered = netlist.nodeCount != m_liveNetlist.nodeCount
+                            || netlist.componentNodes != m_liveNetlist.componentNodes
+                            || netlist.componentElements != m_liveNetlist.componentElements;
+    m_liveNetlist = std::move(netlist);
+    m_liveDc.update(m_liveNetlist);
+    MemoryStats::set(MemoryStats::Simulation, QStringLiteral("live operating point"), m_liveDc.byteSize());
+    if (!m_heatMapExternal)
+    {
+        if (renumbered)
+            ++m_heatMapNetlistRevision;
+        heatMapSampleChanged(false);
+    }
+    emit liveSolutionChanged();
+}
+
+void CircuitViewport::setHeatMap(HeatMap heatMap)
+{
+    if (m_heatMap == heatMap)
+        return;
+    m_heatMap = heatMap;
+    // Parts are now measured in another quantity
+    heatMapSampleChanged(false);
+    emit heatMapChanged();
+}
+
+void CircuitViewport::setHeatMapNetlist(const Netlist& netlist)
+{
+    m_heatMapExternal = netlist.nodeCount > 0;
+    m_heatMapNetlist = m_heatMapExternal ? netlist : Netlist();
+    m_heatMapVoltages.clear();
+    m_heatMapCurrents.clear();
+    ++m_heatMapNetlistRevision;
+    heatMapSampleChanged(false);
+}
+
+void CircuitViewport::setHeatMapSample(const QVector<double>& voltages, const QVector<double>& currents)
+{
+    if (!m_heatMapExternal)
+    {
+        qWarning() << "CircuitViewport: heat map sample without a netlist";
+        return;
+    }
+    if (voltages.size() != m_heatMapNetlist.nodeCount || currents.size() != m_heatMapNetlist.elements.size())
+    {
+        qWarning() << "CircuitViewport: heat map sample of" << voltages.size() << "nodes and" << currents.size()
+                   << "elements does not fit the netlist";
+        return;
+    }
+    const bool first = m_heatMapVoltages.isEmpty();
+    m_heatMapVoltages = voltages;
+    m_heatMapCurrents = currents;
+    heatMapSampleChanged(!first);
+}
+
+const QVector<double>& CircuitViewport::heatMapVoltages() const
+{
+    return m_heatMapExternal ? m_heatMapVoltages : m_liveDc.nodeVoltages();
+}
+
+const QVector<double>& CircuitViewport::heatMapCurrents() const
+{
+    return m_heatMapExternal ? m_heatMapCurrents : m_liveDc.elementCurrents();
+}
+
+void CircuitViewport::heatMapSampleChanged(bool widenRange)
+{
+    // The scale is worked out once the heat map is shown
+    ++m_heatMapSampleRevision;
+    if (m_heatMap == NoHeatMap)
+        return;
+
+    const Netlist& netlist = heatMapNetlist();
+    const QVector<double>& voltages = heatMapVoltages();
+    const QVector<double>& currents = heatMapCurrents();
+
+    constexpr double infinity = std::numeric_limits<double>::infinity();
+    QPair<double, double> voltageRange(infinity, -infinity);
+    QPair<double, double> componentRange(infinity, -infinity);
+    // A failed solve leaves the values of an earlier netlist
+    if (voltages.size() == netlist.nodeCount && currents.size() == netlist.elements.size())
+    {
+        for (double voltage : voltages)
+        {
+            voltageRange.first = qMin(voltageRange.first, voltage);
+            voltageRange.second = qMax(voltageRange.second, voltage);
+        }
+        for (auto it = netlist.componentElements.constBegin(); it != netlist.componentElements.constEnd(); ++it)
+        {
+            const double current = currents.value(it.value());
+            const QPair<int, int> nodes = netlist.componentNodes.value(it.key(), qMakePair(-1, -1));
+            const double value = m_heatMap == PowerHeatMap
+                                     ? current * (voltages.value(nodes.first) - voltages.value(nodes.second))
+                                     : qAbs(current);
+            componentRange.first = qMin(componentRange.first, value);
+            componentRange.second = qMax(componentRange.second, value);
+        }
+    }
+
+    // An animation keeps one scale across its samples
+    const auto settle = [widenRange](QPair<double, double>& range, const QPair<double, double>& sample) {
+        if (sample.first > sample.second)
+            range = widenRange ? range : qMakePair(0.0, 0.0);
+        else if (widenRange)
+            range = qMakePair(qMin(range.first, sample.first), qMax(range.second, sample.second));
+        else
+            range = sample;
+    };
+    settle(m_heatMapVoltageRange, voltageRange);
+    settle(m_heatMapComponentRange, componentRange);
+    update();
+}
+
+QVariantList CircuitViewport::memoryUsage()
+{
+    updateMemoryStats();
+
+    QVariantList result;
+    auto toMap = [](const MemoryStats::Usage& usage)
+    {
+        QVariantMap entry;
+        entry.insert(QStringLiteral("name"), usage.name);
+        entry.insert(QStringLiteral("bytes"), usage.bytes);
+        entry.insert(QStringLiteral("peakBytes"), usage.peakBytes);
+        return entry;
+    };
+    for (const MemoryStats::SubsystemUsage& subsystem : MemoryStats::snapshot())
+    {
+        QVariantList items;
+        for (const MemoryStats::Usage& item : subsystem.items)
+            items.append(toMap(item));
+        QVariantMap entry = toMap(subsystem.total);
+        entry.insert(QStringLiteral("items"), items);
+        result.append(entry);
+    }
+    return result;
+}
+
+void CircuitViewport::resetMemoryPeaks()
+{
+    MemoryStats::resetPeaks();
+}
+
+QVector<QPointF> CircuitViewport::diagnosticMarkers() const
+{
+    QVector<QPointF> markers;
+    for (auto it = m_diagnostics.cbegin(); it != m_diagnostics.cend(); ++it)
+    {
+        auto index = m_componentIndex.constFind(it.key());
+        if (index == m_componentIndex.constEnd())
+            continue;
+        const Component& comp = m_components[index.value()];
+        for (const Diagnostic& diagnostic : it.value())
+        {
+            const QVector<QPointF>& terminals = diagnostic.output ? comp.outputTerminals : comp.inputTerminals;
+            if (diagnostic.rule == Diagnostic::FloatingTerminal && !terminals.isEmpty())
+                markers.append(terminals.first());
+            else
+                markers.append(QPointF(comp.position.x() + comp.width / 2, comp.position.y() + comp.height / 2));
+        }
+    }
+    return markers;
+}
+
+void CircuitViewport::clearComponents()
+{
+    cancelSchematicLoad();
+    if (m_components.isEmpty() && m_wires.isEmpty())
+        return;
+
+    // The command shares the cleared data instead of copying it
+    QVector<Component> components = m_components;
+    QVector<Wire> wires = m_wires;
+    clearDesign();
+    recordEdit(std::make_unique<ClearDesignCommand>(components, wires));
+}
+
+void CircuitViewport::selectComponent(float x, float y)
+{
+    QPointF worldPos = screenToWorld(QPointF(x, y));
+    int componentId = getComponentAt(worldPos);
+
+    qDebug() << "Selecting at screen" << QPointF(x, y) << "world" << worldPos << "found component" << componentId;
+
+    // Clicking a part of the current selection keeps the group for dragging
+    if (componentId >= 0 && m_selection.contains(componentId))
+    {
+        emit componentSelected(componentId);
+        return;
+    }
+
+    clearSelection();
+    if (componentId >= 0)
+    {
+        setSelected(componentId, true);
+        emit componentSelected(componentId);
+    }
+    notifySelectionChanged();
+    update();
+}
+
+void CircuitViewport::toggleSelectionAt(float x, float y)
+{
+    int componentId = getComponentAt(screenToWorld(QPointF(x, y)));
+    if (componentId < 0)
+        return;
+
+    setSelected(componentId, !m_selection.contains(componentId));
+    notifySelectionChanged();
+    update();
+}
+
+void CircuitViewport::deselectAll()
+{
+    if (m_selection.isEmpty())
+        return;
+    clearSelection();
+    notifySelectionChanged();
+    update();
+}
+
+void CircuitViewport::selectInRect(float x1, float y1, float x2, float y2, bool extend)
+{
+    QRectF rect = QRectF(screenToWorld(QPointF(x1, y1)), screenToWorld(QPointF(x2, y2))).normalized();
+
+    // Dragging to the right selects enclosed parts, to the left touched ones
+    const bool enclosedOnly = x2 >= x1;
+    if (!extend)
+        clearSelection();
+    for (int id : m_spatialIndex.query(rect))
+    {
+        if (!enclosedOnly || rect.contains(m_spatialIndex.rect(id)))
+            setSelected(id, true);
+    }
+    notifySelectionChanged();
+    update();
+}
+
+void CircuitViewport::selectInLasso(const QVariantList& points, bool extend)
+{
+    QPolygonF lasso;
+    lasso.reserve(points.size());
+    for (const QVariant& point : points)
+        lasso.append(screenToWorld(point.toPointF()));
+    selectInPolygon(lasso, extend);
+}
+
+void CircuitViewport::selectInPolygon(const QPolygonF& polygon, bool extend)
+{
+    if (!extend)
+        clearSelection();
+
+    // Candidates come from the bounding box; parts whose center lies inside
+    // the lasso are selected
+    if (polygon.size() >= 3)
+    {
+        for (int id : m_spatialIndex.query(polygon.boundingRect()))
+        {
+            if (polygon.containsPoint(m_spatialIndex.rect(id).center(), Qt::OddEvenFill))
+                setSelected(id, true);
+        }
+    }
+    notifySelectionChanged();
+    update();
+}
+
+void CircuitViewport::beginSelectionBand(float x, float y, bool lasso)
+{
+    m_bandActive = true;
+    m_bandLasso = lasso;
+    m_band.clear();
+    m_band << QPointF(x, y) << QPointF(x, y);
+    update();
+}
+
+void CircuitViewport::extendSelectionBand(float x, float y)
+{
+    if (!m_bandActive)
+        return;
+
+    QPointF point(x, y);
+    if (!m_bandLasso)
+    {
+        m_band.last() = point;
+    }
+    else if ((point - m_band.last()).manhattanLength() >= 3.0)
+    {
+        // Skip sub-pixel jitter so long lassos stay short
+        m_band.append(point);
+    }
+    update();
+}
+
+void CircuitViewport::endSelectionBand(bool extend)
+{
+    if (!m_bandActive)
+        return;
+
+    const QPolygonF band = m_band;
+    cancelSelectionBand();
+    if (m_bandLasso)
+    {
+        QPolygonF lasso;
+        lasso.reserve(band.size());
+        for (const QPointF& point : band)
+            lasso.append(screenToWorld(point));
+        selectInPolygon(lasso, extend);
+    }
+    else
+    {
+        selectInRect(band.first().x(), band.first().y(), band.last().x(), band.last().y(), extend);
+    }
+}
+
+void CircuitViewport::cancelSelectionBand()
+{
+    m_bandActive = false;
+    m_band.clear();
+    update();
+}
+
+QPolygonF CircuitViewport::selectionOutline() const
+{
+    QPolygonF outline;
+    if (!m_bandActive)
+        return outline;
+
+    if (m_bandLasso)
+    {
+        outline.reserve(m_band.size());
+        for (const QPointF& point : m_band)
+            outline.append(screenToWorld(point));
+    }
+    else
+    {
+        QRectF rect = QRectF(screenToWorld(m_band.first()), screenToWorld(m_band.last())).normalized();
+        outline << rect.topLeft() << rect.topRight() << rect.bottomRight() << rect.bottomLeft();
+    }
+    return outline;
+}
+
+QVector<int> CircuitViewport::selectedIds() const
+{
+    // Model order keeps commands and definitions independent of hashing
+    QVector<int> ids(m_selection.cbegin(), m_selection.cend());
+    std::sort(ids.begin(), ids.end(), [this](int a, int b)
+    {
+        return m_componentIndex.value(a) < m_componentIndex.value(b);
+    });
+    return ids;
+}
+
+void CircuitViewport::setSelected(int componentId, bool selected)
+{
+    Component* comp = findComponent(componentId);
+    if (!comp)
+        return;
+    comp->selected = selected;
+    if (selected)
+        m_selection.insert(componentId);
+    else
+        m_selection.remove(componentId);
+    ++m_renderChange.selectionRevision;
+    const int row = m_componentIndex.value(componentId);
+    m_componentModel->rowsChanged(row, row, {ComponentListModel::SelectedRole});
+}
+
+void CircuitViewport::clearSelection()
+{
+    const QVector<int> ids(m_selection.cbegin(), m_selection.cend());
+    for (int id : ids)
+    {
+        if (Component* comp = findComponent(id))
+            comp->selected = false;
+    }
+    m_selection.clear();
+    ++m_renderChange.selectionRevision;
+    componentRowsChanged(ids, {ComponentListModel::SelectedRole});
+}
+
+void CircuitViewport::componentRowsChanged(const QVector<int>& ids, const QList<int>& roles)
+{
+    // One signal spanning the rows; views only refresh the delegates they show
+    int first = m_components.size();
+    int last = -1;
+    for (int id : ids)
+    {
+        const int row = m_componentIndex.value(id, -1);
+        if (row < 0)
+            continue;
+        first = qMin(first, row);
+        last = qMax(last, row);
+    }
+    m_componentModel->rowsChanged(first, last, roles);
+}
+
+void CircuitViewport::moveSelectedComponents(float deltaX, float deltaY)
+{
+    // Convert screen delta to world delta
+    QPointF worldDelta = QPointF(deltaX / m_zoom, deltaY / m_zoom);
+
+    QVector<int> ids = selectedIds();
+    if (!ids.isEmpty())
+    {
+        translateComponents(ids, worldDelta);
+        recordEdit(std::make_unique<MoveComponentsCommand>(ids, worldDelta));
+    }
+}
+
+void CircuitViewport::snapSelectedToGrid()
+{
+    QVector<int> ids;
+    QVector<QPointF> before;
+    QVector<QPointF> after;
+    for (int id : selectedIds())
+    {
+        const Component* comp = findComponent(id);
+        QPointF snapped = snapToGrid(comp->position);
+        if (snapped != comp->position)
+        {
+            ids.append(id);
+            before.append(comp->position);
+            after.append(snapped);
+        }
+    }
+
+    if (!ids.isEmpty())
+    {
+        placeComponents(ids, after);
+        recordEdit(std::make_unique<PlaceComponentsCommand>(ids, before, after));
+    }
+
+    // The drag is over; the next one starts a new undo step
+    m_history.closeMergeWindow();
+    update();
+}
+
+void CircuitViewport::setComponentLabel(int componentId, const QString& label)
+{
+    Component* comp = findComponent(componentId);
+    if (!comp || comp->label == label)
+        return;
+
+    const QString oldLabel = comp->label;
+    const double value = comp->value;
+    setComponentProperties(componentId, label, value);
+    recordEdit(std::make_unique<SetPropertiesCommand>(componentId, oldLabel, value, label, value));
+    if (!m_undoGroupOpen)
+        m_history.closeMergeWindow();
+}
+
+void CircuitViewport::setComponentValue(int componentId, double value)
+{
+    Component* comp = findComponent(componentId);
+    if (!comp || comp->value == value)
+        return;
+
+    const QString label = comp->label;
+    const double oldValue = comp->value;
+    setComponentProperties(componentId, label, value);
+    recordEdit(std::make_unique<SetPropertiesCommand>(componentId, label, oldValue, label, value));
+    if (!m_undoGroupOpen)
+        m_history.closeMergeWindow();
+}
+
+int CircuitViewport::defineSubcircuit(const QString& name)
+{
+    SubcircuitDefinition definition;
+    if (!definitionFromSelection(definition))
+        return -1;
+
+    definition.id = m_nextSubcircuitId;
+    definition.name = name.isEmpty() ? QStringLiteral("Block%1").arg(definition.id) : name;
+    setSubcircuitDefinition(definition);
+    recordEdit(std::make_unique<DefineSubcircuitCommand>(nullptr, definition));
+    qDebug() << "Defined subcircuit" << definition.name << "with" << definition.components.size() << "parts";
+    return definition.id;
+}
+
+bool CircuitViewport::redefineSubcircuit(int definitionId)
+{
+    auto it = m_subcircuits.constFind(definitionId);
+    if (it == m_subcircuits.constEnd())
+        return false;
+
+    // A block cannot contain itself
+    for (int id : std::as_const(m_selection))
+    {
+        const Component& comp = m_components[m_componentIndex.value(id)];
+        if (comp.subcircuitId >= 0 &&
+            (comp.subcircuitId == definitionId || definitionUses(comp.subcircuitId, definitionId)))
+        {
+            qWarning() << "Cannot redefine" << it->name << "in terms of itself";
+            return false;
+        }
+    }
+
+    const SubcircuitDefinition before = it.value();
+    SubcircuitDefinition definition;
+    if (!definitionFromSelection(definition))
+        return false;
+    definition.id = before.id;
+    definition.name = before.name;
+    setSubcircuitDefinition(definition);
+    recordEdit(std::make_unique<DefineSubcircuitCommand>(&before, definition));
+    return true;
+}
+
+void CircuitViewport::instantiateSubcircuit(int definitionId, float x, float y)
+{
+    auto it = m_subcircuits.constFind(definitionId);
+    if (it == m_subcircuits.constEnd())
+        return;
+
+    QPointF snappedPos = snapToGrid(screenToWorld(QPointF(x, y)));
+    Component instance(m_nextComponentId++, QStringLiteral("Subcircuit"), snappedPos, QColor(170, 170, 200),
+                       float(it->size.width()), float(it->size.height()));
+    instance.subcircuitId = definitionId;
+    instance.label = QStringLiteral("X") + QString::number(instance.id);
+    instance.setupTerminals();
+    insertComponent(instance);
+    recordEdit(std::make_unique<AddComponentCommand>(instance));
+    notifyComponentAdded();
+}
+
+QString CircuitViewport::exportNetlist() const
+{
+    return Netlist::flatten(m_components, m_wires, m_subcircuits).toText();
+}
+
+QVariantList CircuitViewport::subcircuitList() const
+{
+    QList<int> ids = m_subcircuits.keys();
+    std::sort(ids.begin(), ids.end());
+
+    QVariantList result;
+    for (int id : ids)
+    {
+        const SubcircuitDefinition& definition = *m_subcircuits.constFind(id);
+        QVariantMap entry;
+        entry.insert(QStringLiteral("id"), definition.id);
+        entry.insert(QStringLiteral("name"), definition.name);
+        entry.insert(QStringLiteral("parts"), definition.components.size());
+        result.append(entry);
+    }
+    return result;
+}
+
+void CircuitViewport::undo()
+{
+    if (m_batchDepth > 0)
+    {
+        qWarning() << "Cannot undo inside a batch";
+        return;
+    }
+    m_history.undo(*this);
+    emit undoStateChanged();
+}
+
+void CircuitViewport::redo()
+{
+    if (m_batchDepth > 0)
+    {
+        qWarning() << "Cannot redo inside a batch";
+        return;
+    }
+    m_history.redo(*this);
+    emit undoStateChanged();
+}
+
+void CircuitViewport::beginUndoGroup()
+{
+    // The first edit of the group starts a new step
+    m_history.closeMergeWindow();
+    m_undoGroupOpen = true;
+}
+
+void CircuitViewport::endUndoGroup()
+{
+    m_undoGroupOpen = false;
+    m_history.closeMergeWindow();
+}
+
+void CircuitViewport::setUndoMemoryBudget(qint64 bytes)
+{
+    if (bytes == m_history.memoryBudget())
+        return;
+    m_history.setMemoryBudget(bytes);
+    emit undoMemoryBudgetChanged();
+    emit undoStateChanged();
+}
+
+void CircuitViewport::recordEdit(std::unique_ptr<EditCommand> command)
+{
+    if (m_batchDepth > 0)
+    {
+        m_batchCommands.push_back(std::move(command));
+        return;
+    }
+    m_history.push(std::move(command));
+    emit undoStateChanged();
+}
+
+void CircuitViewport::insertComponent(const Component& component)
+{
+    applyAddComponent(component);
+    journal().logAddComponent(component);
+    DesignChange change;
+    change.touchComponents(m_components.size() - 1, m_components.size() - 1);
+    change.componentsAdded = 1;
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::removeComponent(int componentId)
+{
+    const int index = m_componentIndex.value(componentId, -1);
+    if (index < 0)
+        return;
+    applyRemoveComponent(componentId);
+    journal().logRemoveComponent(componentId);
+    DesignChange change;
+    change.touchComponents(index, qMin<int>(index, m_components.size() - 1));
+    change.componentsRemoved = 1;
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::translateComponents(const QVector<int>& ids, const QPointF& delta)
+{
+    applyMoveComponents(ids, delta);
+    journal().logMoveComponents(ids, delta);
+    noteComponentsTouched(ids);
+    update();
+}
+
+void CircuitViewport::placeComponents(const QVector<int>& ids, const QVector<QPointF>& positions)
+{
+    applySetPositions(ids, positions);
+    journal().logSetPositions(ids, positions);
+    noteComponentsTouched(ids);
+    update();
+}
+
+void CircuitViewport::insertWire(const Wire& wire)
+{
+    applyAddWire(wire);
+    journal().logAddWire(wire);
+    DesignChange change;
+    change.touchWires(m_wires.size() - 1, m_wires.size() - 1);
+    change.wiresAdded = 1;
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::removeWire(int index)
+{
+    if (index < 0 || index >= m_wires.size())
+        return;
+    applyRemoveWire(index);
+    journal().logRemoveWire(index);
+    // Later wires shift down
+    DesignChange change;
+    change.touchWires(index, qMax<int>(index, m_wires.size() - 1));
+    change.wiresRemoved = 1;
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::insertComponents(const QVector<Component>& components)
+{
+    if (components.isEmpty())
+        return;
+    const int first = m_components.size();
+    applyAddComponents(components);
+    journal().logAddComponents(components);
+    DesignChange change;
+    change.touchComponents(first, m_components.size() - 1);
+    change.componentsAdded = components.size();
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::eraseComponents(const QVector<int>& ids)
+{
+    // Removal moves the last parts into the freed slots
+    int lowest = m_components.size();
+    int removed = 0;
+    for (int id : ids)
+    {
+        const int index = m_componentIndex.value(id, -1);
+        if (index < 0)
+            continue;
+        lowest = qMin(lowest, index);
+        ++removed;
+    }
+    if (removed == 0)
+        return;
+
+    applyRemoveComponents(ids);
+    journal().logRemoveComponents(ids);
+    DesignChange change;
+    change.touchComponents(lowest, m_components.size() - 1);
+    change.componentsRemoved = removed;
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::insertWires(const QVector<int>& indices, const QVector<Wire>& wires)
+{
+    if (indices.isEmpty() || indices.size() != wires.size())
+        return;
+    applyInsertWires(indices, wires);
+    journal().logInsertWires(indices, wires);
+    DesignChange change;
+    change.touchWires(indices.first(), m_wires.size() - 1);
+    change.wiresAdded = wires.size();
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::eraseWires(const QVector<int>& indices)
+{
+    if (indices.isEmpty())
+        return;
+    applyRemoveWires(indices);
+    journal().logRemoveWires(indices);
+    DesignChange change;
+    change.touchWires(indices.first(), qMax<int>(indices.first(), m_wires.size() - 1));
+    change.wiresRemoved = indices.size();
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::replaceDesign(const QVector<Component>& components, const QVector<Wire>& wires)
+{
+    applyClear();
+    journal().logClear();
+    QVector<Component> unselected = components;
+    for (Component& comp : unselected)
+        comp.selected = false;
+    applyAddComponents(unselected);
+    journal().logAddComponents(unselected);
+    if (!wires.isEmpty())
+    {
+        m_wireModel->beginInsert(0, wires.size() - 1);
+        for (const Wire& wire : wires)
+            m_ruleDelta.addWire(wire.fromComponentId, wire.toComponentId, 1);
+        m_wires = wires;
+        rebuildWireIndex();
+        m_wireModel->endInsert();
+        QVector<int> indices(wires.size());
+        std::iota(indices.begin(), indices.end(), 0);
+        journal().logInsertWires(indices, wires);
+    }
+    noteChange(resetChange());
+    update();
+}
+
+void CircuitViewport::clearDesign()
+{
+    applyClear();
+    journal().logClear();
+    noteChange(resetChange());
+    update();
+}
+
+void CircuitViewport::setComponentProperties(int componentId, const QString& label, double value)
+{
+    applySetProperties(componentId, label, value);
+    journal().logSetProperties(componentId, label, value);
+    DesignChange change;
+    const int index = m_componentIndex.value(componentId, -1);
+    change.touchComponents(index, index);
+    change.valuesChanged = true;
+    noteChange(change);
+    update();
+}
+
+void CircuitViewport::setSubcircuitDefinition(const SubcircuitDefinition& definition)
+{
+    applyDefineSubcircuit(definition);
+    journal().logDefineSubcircuit(definition);
+    update();
+}
+
+void CircuitViewport::removeSubcircuitDefinition(int definitionId)
+{
+    applyRemoveSubcircuit(definitionId);
+    journal().logRemoveSubcircuit(definitionId);
+    update();
+}
+
+void CircuitViewport::mousePressEvent(QMouseEvent* event)
+{
+    event->accept();
+    m_lastMousePos = event->position();
+
+    if (event->button() == Qt::RightButton)
+    {
+        m_lastRightClickPos = event->position();
+        qDebug() << "Right mouse press at:" << event->position();
+    }
+    else if (event->button() == Qt::LeftButton)
+    {
+        QPointF worldPos = screenToWorld(event->position());
+        int componentId = getComponentAt(worldPos);
+
+        const bool extend = event->modifiers().testFlag(Qt::ShiftModifier);
+        if (componentId >= 0)
+        {
+            if (extend)
+                toggleSelectionAt(event->position().x(), event->position().y());
+            else
+                selectComponent(event->position().x(), event->position().y());
+            m_dragging = true;
+        }
+        else
+        {
+            // Empty space starts a box, or a lasso with Alt held
+            if (!extend)
+                deselectAll();
+            beginSelectionBand(event->position().x(), event->position().y(),
+                               event->modifiers().testFlag(Qt::AltModifier));
+        }
+    }
+    else if (event->button() == Qt::MiddleButton)
+    {
+        m_panning = true;
+    }
+
+    QQuickItem::mousePressEvent(event);
+}
+
+void CircuitViewport::mouseReleaseEvent(QMouseEvent* event)
+{
+    event->accept();
+    if (event->button() == Qt::RightButton)
+    {
+        // Emit signal for context menu with coordinates
+        qDebug() << "Right mouse release at:" << event->position();
+        emit rightClicked(event->position().x(), event->position().y());
+    }
+    else if (event->button() == Qt::LeftButton)
+    {
+        if (m_dragging)
+        {
+            // Snap to grid when drag ends
+            snapSelectedToGrid();
+        }
+        endSelectionBand(event->modifiers().testFlag(Qt::ShiftModifier));
+        m_dragging = false;
+        m_panning = false;
+    }
+    QQuickItem::mouseReleaseEvent(event);
+}
+
+void CircuitViewport::mouseMoveEvent(QMouseEvent* event)
+{
+    event->accept();
+    QPointF currentPos = event->position();
+
+    if (m_panning && event->buttons() & Qt::MiddleButton)
+    {
+        QPointF delta = currentPos - m_lastMousePos;
+        setPanOffset(m_panOffset + delta);
+    }
+    else if (m_dragging && event->buttons() & Qt::LeftButton && !m_selection.isEmpty())
+    {
+        QPointF delta = currentPos - m_lastMousePos;
+        moveSelectedComponents(delta.x(), delta.y());
+    }
+    else if (m_bandActive && event->buttons() & Qt::LeftButton)
+    {
+        extendSelectionBand(currentPos.x(), currentPos.y());
+    }
+
+    m_lastMousePos = currentPos;
+    QQuickItem::mouseMoveEvent(event);
+}
+
+void CircuitViewport::wheelEvent(QWheelEvent* event)
+{
+    event->accept();
+    float zoomFactor = event->angleDelta().y() > 0 ? 1.1f : 0.9f;
+    setZoom(m_zoom * zoomFactor);
+}
+
+void CircuitViewport::hoverMoveEvent(QHoverEvent* event)
+{
+    hoverAt(event->position().x(), event->position().y());
+    QQuickItem::hoverMoveEvent(event);
+}
+
+void CircuitViewport::hoverLeaveEvent(QHoverEvent* event)
+{
+    clearHover();
+    QQuickItem::hoverLeaveEvent(event);
+}
+
+void CircuitViewport::hoverAt(float x, float y)
+{
+    const QPointF worldPos = screenToWorld(QPointF(x, y));
+    const double reach = TerminalHoverPixels / m_zoom;
+
+    // Pins sit on their part's outline, so the parts near the pointer are enough
+    TerminalRef nearest;
+    double nearestDistance = reach * reach;
+    QRectF region(worldPos - QPointF(reach, reach), QSizeF(2 * reach, 2 * reach));
+    for (int id : m_spatialIndex.query(region))
+    {
+        const int index = m_componentIndex.value(id, -1);
+        if (index < 0)
+            continue;
+        const Component& comp = m_components[index];
+        for (bool output : {false, true})
+        {
+            const QVector<QPointF>& terminals = output ? comp.outputTerminals : comp.inputTerminals;
+            for (int i = 0; i < terminals.size(); ++i)
+            {
+                const QPointF d = terminals[i] - worldPos;
+                const double distance = d.x() * d.x() + d.y() * d.y();
+                if (distance <= nearestDistance)
+                {
+                    nearest = TerminalRef{id, output, i};
+                    nearestDistance = distance;
+                }
+            }
+        }
+    }
+
+    if (nearest != m_hoveredTerminal)
+    {
+        m_hoveredTerminal = nearest;
+        update();
+    }
+    else if (m_creatingWire)
+    {
+        // The wire preview follows the pointer
+        update();
+    }
+    m_wirePointer = worldPos;
+}
+
+void CircuitViewport::clearHover()
+{
+    if (!m_hoveredTerminal.isValid())
+        return;
+    m_hoveredTerminal = TerminalRef();
+    update();
+}
+
+void CircuitViewport::startWire(int componentId)
+{
+    m_creatingWire = true;
+    m_wireStartComponentId = componentId;
+    if (const Component* comp = findComponent(componentId); comp && !comp->outputTerminals.isEmpty())
+        m_wirePointer = comp->outputTerminals.first();
+    emit wireStarted(componentId);
+    update();
+}
+
+QVector<QPointF> CircuitViewport::wirePreview() const
+{
+    if (!m_creatingWire)
+        return {};
+    const int index = m_componentIndex.value(m_wireStartComponentId, -1);
+    if (index < 0 || m_components[index].outputTerminals.isEmpty())
+        return {};
+
+    // From the source's output to the hovered pin, or else to the pointer
+    QPointF end = m_wirePointer;
+    const int target = m_hoveredTerminal.isValid() ? m_componentIndex.value(m_hoveredTerminal.componentId, -1) : -1;
+    if (target >= 0)
+    {
+        const Component& comp = m_components[target];
+        const QVector<QPointF>& terminals = m_hoveredTerminal.output ? comp.outputTerminals : comp.inputTerminals;
+        if (m_hoveredTerminal.index < terminals.size())
+            end = terminals[m_hoveredTerminal.index];
+    }
+    return {m_components[index].outputTerminals.first(), end};
+}
+
+void CircuitViewport::finishWire(int componentId)
+{
+    if (m_creatingWire && m_wireStartComponentId >= 0 && componentId >= 0 && componentId != m_wireStartComponentId)
+    {
+        // Find the components
+        Component* startComp = findComponent(m_wireStartComponentId);
+        Component* endComp = findComponent(componentId);
+
+        if (startComp && endComp)
+        {
+            // Create wire between components, routed from the output terminal
+            // to the input terminal around other parts
+            Wire newWire(m_wireStartComponentId, componentId);
+            WireRouter::Request request;
+            if (routeRequest(newWire, request))
+                newWire.points = WireRouter::route(m_spatialIndex, m_gridSize, request);
+
+            insertWire(newWire);
+            recordEdit(std::make_unique<AddWireCommand>(newWire, m_wires.size() - 1));
+            qDebug() << "Created wire from component" << m_wireStartComponentId << "to" << componentId;
+            emit wireFinished(m_wireStartComponentId, componentId);
+        }
+    }
+    cancelWire();
+}
+
+void CircuitViewport::cancelWire()
+{
+    m_creatingWire = false;
+    m_wireStartComponentId = -1;
+    update();
+}
+
+void CircuitViewport::handleWireConnection(int componentId)
+{
+    if (!m_creatingWire)
+    {
+        // Start a new wire
+        startWire(componentId);
+        qDebug() << "Starting wire from component" << componentId;
+    }
+    else
+    {
+        // Finish the wire
+        finishWire(componentId);
+    }
+}
+
+int CircuitViewport::getComponentAtPosition(float x, float y)
+{
+    QPointF worldPos = screenToWorld(QPointF(x, y));
+    return getComponentAt(worldPos);
+}
+
+bool CircuitViewport::saveSchematic(const QString& path)
+{
+    if (m_schematicReader)
+    {
+        qWarning() << "Cannot save while a schematic is still loading";
+        emit schematicError(tr("Cannot save while a schematic is still loading"));
+        return false;
+    }
+
+    waitForCompaction();
+
+    const QString filePath = localFilePath(path);
+    const bool sameSession = m_journal.isOpen() && m_journal.schematicPath() == filePath;
+    if (!sameSession)
+        EditJournal::removeSegments(filePath);
+
+    SchematicInfo info;
+    info.nextComponentId = m_nextComponentId;
+    info.gridSize = m_gridSize;
+    info.revision = sameSession ? m_journal.rotate() : 1;
+
+    QString error;
+    if (!SchematicWriter::write(filePath, m_components, m_wires, m_subcircuits, info, &error))
+    {
+        qWarning() << "Failed to save schematic" << path << ":" << error;
+        emit schematicError(error);
+        return false;
+    }
+
+    if (sameSession)
+    {
+        m_journal.discardSegmentsBefore(info.revision);
+    }
+    else
+    {
+        // The session now lives in the new file, so the old journal is obsolete
+        QString oldPath = m_journal.isOpen() ? m_journal.schematicPath() : QString();
+        m_journal.close();
+        if (!oldPath.isEmpty())
+        {
+            EditJournal::removeSegments(oldPath);
+            if (oldPath == defaultSessionPath())
+                QFile::remove(oldPath);
+        }
+        m_schematicPath = filePath;
+        startJournal(filePath, info.revision);
+    }
+    return true;
+}
+
+bool CircuitViewport::loadSchematic(const QString& path)
+{
+    cancelSchematicLoad();
+
+    // Edits that never reached the file are replayed from its journal
+    const QString filePath = localFilePath(path);
+    m_journal.flush();
+    if (!EditJournal::segments(filePath).isEmpty())
+        return recoverSchematic(filePath);
+
+    auto reader = QSharedPointer<SchematicReader>::create();
+    if (!reader->open(filePath))
+    {
+        qWarning() << "Failed to load schematic" << path << ":" << reader->errorString();
+        emit schematicError(reader->errorString());
+        return false;
+    }
+
+    waitForCompaction();
+    applyClear();
+    noteChange(resetChange());
+    m_history.clear();
+    emit undoStateChanged();
+    m_creatingWire = false;
+    m_wireStartComponentId = -1;
+
+    SchematicInfo info = reader->info();
+    m_nextComponentId = qMax(1, info.nextComponentId);
+    if (info.gridSize > 0.0f)
+        setGridSize(info.gridSize);
+
+    // Definitions are small and every tile may refer to them, so they come first
+    resetSubcircuits(reader->readSubcircuits());
+
+    m_schematicReader = reader;
+    m_schematicPath = filePath;
+    startJournal(filePath, qMax<quint64>(info.revision, 1));
+
+    // Decode the visible region first so the view fills in immediately
+    const int totalTiles = reader->tileCount();
+    QVector<int> visibleTiles = reader->tilesIntersecting(visibleWorldRect());
+    QVector<Component> components;
+    QVector<Wire> wires;
+    reader->readTiles(visibleTiles, components, wires);
+
+    QVector<bool> loaded(totalTiles, false);
+    bool visiblePrefix = true;
+    for (int i = 0; i < visibleTiles.size(); ++i)
+    {
+        loaded[visibleTiles[i]] = true;
+        visiblePrefix = visiblePrefix && visibleTiles[i] == i;
+    }
+    m_loadedOutOfOrder = !visiblePrefix || !reader->storedInDesignOrder();
+    QVector<int> remainingTiles;
+    for (int tile = 0; tile < totalTiles; ++tile)
+    {
+        if (!loaded[tile])
+            remainingTiles.append(tile);
+    }
+
+    qDebug() << "Loaded" << visibleTiles.size() << "visible tiles of" << totalTiles << "from" << filePath;
+    appendLoadedBatch(m_loadGeneration.loadAcquire(), components, wires, visibleTiles.size(), totalTiles);
+
+    if (!remainingTiles.isEmpty())
+        streamSchematicTiles(remainingTiles, totalTiles);
+    return true;
+}
+
+void CircuitViewport::cancelSchematicLoad()
+{
+    m_loadGeneration.ref();
+    if (m_loaderThread)
+        m_loaderThread->wait();
+    m_loaderThread = nullptr;
+    m_schematicReader.reset();
+}
+
+void CircuitViewport::streamSchematicTiles(const QVector<int>& tiles, int totalTiles)
+{
+    QSharedPointer<SchematicReader> reader = m_schematicReader;
+    const int generation = m_loadGeneration.loadAcquire();
+    const int loadedBefore = totalTiles - tiles.size();
+
+    QThread* thread = QThread::create([this, reader, tiles, generation, totalTiles, loadedBefore]()
     {
-        if (m_dragging)
+        // Hand results to the GUI thread in batches to bound the number of updates
+        constexpr int BatchComponents = 16384;
+        QVector<Component> components;
+        QVector<Wire> wires;
+        int loadedTiles = loadedBefore;
+
+        for (qsizetype i = 0; i < tiles.size(); ++i)
         {
-            // Snap to grid when drag ends
-            snapSelectedToGrid();
+            if (m_loadGeneration.loadAcquire() != generation)
+                return;
+
+            reader->readTiles({tiles[i]}, components, wires);
+            ++loadedTiles;
+
+            if (i + 1 == tiles.size() || components.size() >= BatchComponents)
+            {
+                QMetaObject::invokeMethod(this, [this, generation, components, wires, loadedTiles, totalTiles]()
+                {
+                    appendLoadedBatch(generation, components, wires, loadedTiles, totalTiles);
+                }, Qt::QueuedConnection);
+                components.clear();
+                wires.clear();
+            }
         }
-        m_dragging = false;
-        m_panning = false;
+    });
+
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+    m_loaderThread = thread;
+    thread->start(QThread::LowPriority);
+}
+
+void CircuitViewport::appendLoadedBatch(int generation, const QVector<Component>& components, const QVector<Wire>& wires,
+                                        int loadedTiles, int totalTiles)
+{
+    // Drop batches from a load that was cancelled or replaced
+    if (generation != m_loadGeneration.loadAcquire())
+        return;
+
+    if (!components.isEmpty())
+    {
+        m_componentModel->beginInsert(m_components.size(), m_components.size() + components.size() - 1);
+        m_components.reserve(m_components.size() + components.size());
+        for (const Component& comp : components)
+        {
+            m_componentIndex.insert(comp.id, m_components.size());
+            m_spatialIndex.insert(comp.id, componentBounds(comp));
+            m_ruleDelta.addPart(comp.id, RuleCheckDelta::kindOf(comp.type));
+            m_components.append(comp);
+        }
+        m_componentModel->endInsert();
+    }
+    if (!wires.isEmpty())
+    {
+        m_wireModel->beginInsert(m_wires.size(), m_wires.size() + wires.size() - 1);
+        for (const Wire& wire : wires)
+        {
+            m_wiresByComponent[wire.fromComponentId].append(m_wires.size());
+            m_wiresByComponent[wire.toComponentId].append(m_wires.size());
+            m_ruleDelta.addWire(wire.fromComponentId, wire.toComponentId, 1);
+            m_wires.append(wire);
+        }
+        m_wireModel->endInsert();
+    }
+    DesignChange change;
+    change.touchComponents(m_components.size() - components.size(), m_components.size() - 1);
+    change.componentsAdded = components.size();
+    change.touchWires(m_wires.size() - wires.size(), m_wires.size() - 1);
+    change.wiresAdded = wires.size();
+    noteChange(change);
+    emit schematicLoadProgress(loadedTiles, totalTiles);
+
+    if (loadedTiles >= totalTiles)
+    {
+        m_schematicReader.reset();
+        // The journal addresses wires by their position here, so the file
+        // must hold them in this order before recovery can replay onto it
+        if (m_loadedOutOfOrder)
+            compactJournal(true);
+        m_loadedOutOfOrder = false;
+        emit schematicLoaded(m_schematicPath);
     }
-    QQuickFramebufferObject::mouseReleaseEvent(event);
+    update();
 }
 
-void CircuitViewport::mouseMoveEvent(QMouseEvent* event)
+bool CircuitViewport::hasRecoverableSession() const
 {
-    event->accept();
-    QPointF currentPos = event->position();
+    return !m_journal.isOpen() && !EditJournal::segments(defaultSessionPath()).isEmpty();
+}
 
-    if (m_panning && event->buttons() & Qt::MiddleButton)
+bool CircuitViewport::recoverSession()
+{
+    if (!hasRecoverableSession())
+        return false;
+    return recoverSchematic(defaultSessionPath());
+}
+
+QString CircuitViewport::defaultSessionPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + QStringLiteral("/autosave/untitled.amb");
+}
+
+EditJournal& CircuitViewport::journal()
+{
+    // The untitled session starts journaling on its first edit; whatever an
+    // earlier untitled session left behind was not recovered and is dropped
+    if (!m_journal.isOpen() && m_schematicPath.isEmpty())
     {
-        QPointF delta = currentPos - m_lastMousePos;
-        setPanOffset(m_panOffset + delta);
+        QFile::remove(defaultSessionPath());
+        startJournal(defaultSessionPath(), 1);
     }
-    else if (m_dragging && event->buttons() & Qt::LeftButton && m_selectedComponentId >= 0)
+    return m_journal;
+}
+
+void CircuitViewport::startJournal(const QString& path, quint64 firstSegment)
+{
+    m_journal.close();
+    EditJournal::removeSegments(path);
+    m_journal.open(path, firstSegment);
+    m_compactionTimer.start();
+}
+
+bool CircuitViewport::recoverSchematic(const QString& filePath)
+{
+    cancelSchematicLoad();
+    waitForCompaction();
+    m_journal.close();
+
+    SchematicInfo info;
+    QVector<Component> components;
+    QVector<Wire> wires;
+    QHash<int, SubcircuitDefinition> subcircuits;
+    if (QFile::exists(filePath))
     {
-        QPointF delta = currentPos - m_lastMousePos;
-        moveSelectedComponents(delta.x(), delta.y());
+        SchematicReader reader;
+        if (!reader.open(filePath))
+        {
+            qWarning() << "Failed to recover schematic" << filePath << ":" << reader.errorString();
+            emit schematicError(reader.errorString());
+            return false;
+        }
+        info = reader.info();
+        reader.readAll(components, wires);
+        subcircuits = reader.readSubcircuits();
     }
 
-    m_lastMousePos = currentPos;
-    QQuickFramebufferObject::mouseMoveEvent(event);
+    applyClear();
+    m_history.clear();
+    emit undoStateChanged();
+    m_creatingWire = false;
+    m_wireStartComponentId = -1;
+    resetSubcircuits(subcircuits);
+    applyAddComponents(components);
+    m_wireModel->beginReset();
+    for (const Wire& wire : std::as_const(wires))
+        m_ruleDelta.addWire(wire.fromComponentId, wire.toComponentId, 1);
+    m_wires = wires;
+    rebuildWireIndex();
+    m_wireModel->endReset();
+    m_nextComponentId = qMax(m_nextComponentId, info.nextComponentId);
+    if (info.gridSize > 0.0f)
+        setGridSize(info.gridSize);
+
+    // A corrupt tail only loses the records after it
+    QString error;
+    if (!EditJournal::replay(filePath, info.revision, *this, &error))
+        emit schematicError(tr("Recovered up to a damaged journal record: %1").arg(error));
+
+    // Fold the recovered edits into the file so the replayed segments can go
+    QVector<quint64> replayed = EditJournal::segments(filePath);
+    info.nextComponentId = m_nextComponentId;
+    info.gridSize = m_gridSize;
+    info.revision = replayed.isEmpty() ? 1 : replayed.last() + 1;
+    if (SchematicWriter::write(filePath, m_components, m_wires, m_subcircuits, info, &error))
+    {
+        startJournal(filePath, info.revision);
+    }
+    else
+    {
+        // Keep the old segments; new edits follow them
+        qWarning() << "Could not fold recovered edits into" << filePath << ":" << error;
+        m_journal.open(filePath, info.revision);
+        m_compactionTimer.start();
+    }
+
+    m_schematicPath = filePath == defaultSessionPath() ? QString() : filePath;
+    qDebug() << "Recovered session" << filePath << "components:" << m_components.size() << "wires:" << m_wires.size();
+    noteChange(resetChange());
+    emit schematicLoaded(filePath);
+    update();
+    return true;
 }
 
-void CircuitViewport::wheelEvent(QWheelEvent* event)
+void CircuitViewport::compactJournal(bool force)
 {
-    event->accept();
-    float zoomFactor = event->angleDelta().y() > 0 ? 1.1f : 0.9f;
-    setZoom(m_zoom * zoomFactor);
+    // Never snapshot a design that is still streaming in
+    if (m_compactionThread || m_schematicReader || !m_journal.isOpen())
+        return;
+    if (!force && m_journal.bytesSinceRotate() == 0)
+        return;
+
+    const QString path = m_journal.schematicPath();
+    SchematicInfo info;
+    info.nextComponentId = m_nextComponentId;
+    info.gridSize = m_gridSize;
+    info.revision = m_journal.rotate();
+
+    // Implicitly shared copies; the writer never blocks the GUI thread
+    const QVector<Component> components = m_components;
+    const QVector<Wire> wires = m_wires;
+    const QHash<int, SubcircuitDefinition> subcircuits = m_subcircuits;
+
+    QThread* thread = QThread::create([this, path, components, wires, subcircuits, info]()
+    {
+        QString error;
+        if (!SchematicWriter::write(path, components, wires, subcircuits, info, &error))
+        {
+            qWarning() << "Journal compaction failed for" << path << ":" << error;
+            return;
+        }
+
+        QMetaObject::invokeMethod(this, [this, path, info]()
+        {
+            if (m_journal.schematicPath() == path)
+                m_journal.discardSegmentsBefore(info.revision);
+        }, Qt::QueuedConnection);
+    });
+
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+    m_compactionThread = thread;
+    thread->start(QThread::LowPriority);
 }
 
-void CircuitViewport::startWire(int componentId)
+void CircuitViewport::waitForCompaction()
 {
-    m_creatingWire = true;
-    m_wireStartComponentId = componentId;
-    emit wireStarted(componentId);
+    if (m_compactionThread)
+        m_compactionThread->wait();
 }
 
-void CircuitViewport::finishWire(int componentId)
+Component* CircuitViewport::findComponent(int componentId)
 {
-    if (m_creatingWire && m_wireStartComponentId >= 0 && componentId >= 0 && componentId != m_wireStartComponentId)
+    auto it = m_componentIndex.constFind(componentId);
+    if (it == m_componentIndex.constEnd())
+        return nullptr;
+    return &m_components[it.value()];
+}
+
+const Component* CircuitViewport::componentById(int componentId) const
+{
+    auto it = m_componentIndex.constFind(componentId);
+    if (it == m_componentIndex.constEnd())
+        return nullptr;
+    return &m_components[it.value()];
+}
+
+RenderChange CircuitViewport::takeRenderChange()
+{
+    const RenderChange change = m_renderChange;
+    m_renderChange.movedIds.clear();
+    m_renderChange.staticEdit = false;
+    return change;
+}
+
+void CircuitViewport::applyAddComponent(const Component& component)
+{
+    m_componentModel->beginInsert(m_components.size(), m_components.size());
+    appendComponent(component);
+    m_componentModel->endInsert();
+}
+
+void CircuitViewport::appendComponent(const Component& component)
+{
+    m_componentIndex.insert(component.id, m_components.size());
+    m_spatialIndex.insert(component.id, componentBounds(component));
+    m_ruleDelta.addPart(component.id, RuleCheckDelta::kindOf(component.type));
+    m_components.append(component);
+    m_nextComponentId = qMax(m_nextComponentId, component.id + 1);
+}
+
+void CircuitViewport::applyMoveComponents(const QVector<int>& ids, const QPointF& delta)
+{
+    for (int id : ids)
     {
-        // Find the components
-        Component* startComp = nullptr;
-        Component* endComp = nullptr;
+        if (Component* comp = findComponent(id))
+        {
+            comp->position += delta;
+            comp->setupTerminals();
+            m_spatialIndex.update(id, componentBounds(*comp));
+        }
+    }
+    componentRowsChanged(ids, {ComponentListModel::XRole, ComponentListModel::YRole});
+    rerouteWires(ids);
+}
 
-        for (Component& comp : m_components)
+void CircuitViewport::applySetPositions(const QVector<int>& ids, const QVector<QPointF>& positions)
+{
+    for (qsizetype i = 0; i < ids.size() && i < positions.size(); ++i)
+    {
+        if (Component* comp = findComponent(ids[i]))
         {
-            if (comp.id == m_wireStartComponentId)
-                startComp = &comp;
-            if (comp.id == componentId)
-                endComp = &comp;
+            comp->position = positions[i];
+            comp->setupTerminals();
+            m_spatialIndex.update(ids[i], componentBounds(*comp));
         }
+    }
+    componentRowsChanged(ids, {ComponentListModel::XRole, ComponentListModel::YRole});
+    rerouteWires(ids);
+}
 
-        if (startComp && endComp)
+void CircuitViewport::applyAddWire(const Wire& wire)
+{
+    m_ruleDelta.addWire(wire.fromComponentId, wire.toComponentId, 1);
+    m_wireModel->beginInsert(m_wires.size(), m_wires.size());
+    m_wiresByComponent[wire.fromComponentId].append(m_wires.size());
+    m_wiresByComponent[wire.toComponentId].append(m_wires.size());
+    m_wires.append(wire);
+    m_wireModel->endInsert();
+}
+
+void CircuitViewport::applyAddComponents(const QVector<Component>& components)
+{
+    if (components.isEmpty())
+        return;
+    m_componentModel->beginInsert(m_components.size(), m_components.size() + components.size() - 1);
+    m_components.reserve(m_components.size() + components.size());
+    m_componentIndex.reserve(m_components.size() + components.size());
+    for (const Component& comp : components)
+        appendComponent(comp);
+    m_componentModel->endInsert();
+}
+
+void CircuitViewport::applyRemoveComponents(const QVector<int>& ids)
+{
+    if (ids.size() <= MaxRowSignals)
+    {
+        for (int id : ids)
+            applyRemoveComponent(id);
+        return;
+    }
+
+    m_componentModel->beginReset();
+    for (int id : ids)
+        takeComponent(id);
+    m_componentModel->endReset();
+}
+
+void CircuitViewport::applyInsertWires(const QVector<int>& indices, const QVector<Wire>& wires)
+{
+    if (indices.isEmpty() || wires.isEmpty())
+        return;
+    for (qsizetype i = 0; i < indices.size() && i < wires.size(); ++i)
+        m_ruleDelta.addWire(wires[i].fromComponentId, wires[i].toComponentId, 1);
+
+    // Appends keep the wire index current; inserts merge and rebuild it once
+    if (indices.first() >= m_wires.size())
+    {
+        m_wireModel->beginInsert(m_wires.size(), m_wires.size() + wires.size() - 1);
+        for (const Wire& wire : wires)
         {
-            // Create wire between components
-            Wire newWire(m_wireStartComponentId, componentId);
+            m_wiresByComponent[wire.fromComponentId].append(m_wires.size());
+            m_wiresByComponent[wire.toComponentId].append(m_wires.size());
+            m_wires.append(wire);
+        }
+        m_wireModel->endInsert();
+        return;
+    }
 
-            // Add terminal positions as wire route points
-            QPointF startPos = startComp->getTerminal(true, 0); // Output terminal
-            QPointF endPos = endComp->getTerminal(false, 0);    // Input terminal
-            newWire.points.append(startPos);
-            newWire.points.append(endPos);
+    QVector<Wire> merged;
+    merged.reserve(m_wires.size() + wires.size());
+    qsizetype next = 0;
+    for (qsizetype i = 0; i < indices.size() && i < wires.size(); ++i)
+    {
+        while (merged.size() < indices[i] && next < m_wires.size())
+            merged.append(std::move(m_wires[next++]));
+        merged.append(wires[i]);
+    }
+    while (next < m_wires.size())
+        merged.append(std::move(m_wires[next++]));
+    m_wireModel->beginReset();
+    m_wires = std::move(merged);
+    rebuildWireIndex();
+    m_wireModel->endReset();
+}
 
-            m_wires.append(newWire);
-            qDebug() << "Created wire from component" << m_wireStartComponentId << "to" << componentId;
-            emit wireFinished(m_wireStartComponentId, componentId);
+void CircuitViewport::applyRemoveWires(const QVector<int>& indices)
+{
+    if (indices.isEmpty())
+        return;
+    for (int index : indices)
+    {
+        if (index >= 0 && index < m_wires.size())
+            m_ruleDelta.addWire(m_wires[index].fromComponentId, m_wires[index].toComponentId, -1);
+    }
+
+    unindexWires(indices);
+
+    if (indices.size() <= MaxRowSignals)
+    {
+        // From the back, so the earlier indices stay valid
+        for (auto it = indices.crbegin(); it != indices.crend(); ++it)
+        {
+            if (*it < 0 || *it >= m_wires.size())
+                continue;
+            m_wireModel->beginRemove(*it, *it);
+            m_wires.removeAt(*it);
+            m_wireModel->endRemove();
         }
+        return;
     }
-    cancelWire();
+
+    // One compacting pass instead of a shift per wire
+    m_wireModel->beginReset();
+    qsizetype write = qMax(0, indices.first());
+    qsizetype k = 0;
+    for (qsizetype read = write; read < m_wires.size(); ++read)
+    {
+        while (k < indices.size() && indices[k] < read)
+            ++k;
+        if (k < indices.size() && indices[k] == read)
+            continue;
+        if (write != read)
+            m_wires[write] = std::move(m_wires[read]);
+        ++write;
+    }
+    m_wires.resize(write);
+    m_wireModel->endReset();
 }
 
-void CircuitViewport::cancelWire()
+void CircuitViewport::rebuildWireIndex()
 {
-    m_creatingWire = false;
-    m_wireStartComponentId = -1;
-    update();
+    m_wiresByComponent.clear();
+    for (qsizetype i = 0; i < m_wires.size(); ++i)
+    {
+        m_wiresByComponent[m_wires[i].fromComponentId].append(int(i));
+        m_wiresByComponent[m_wires[i].toComponentId].append(int(i));
+    }
+}
+
+void CircuitViewport::unindexWires(const QVector<int>& indices)
+{
+    // Called before the wires at the ascending indices are removed: drops
+    // their entries and shifts only the wires above the first cut
+    auto replace = [this](int componentId, int from, int to)
+    {
+        auto attached = m_wiresByComponent.find(componentId);
+        if (attached == m_wiresByComponent.end())
+            return;
+        const qsizetype pos = attached->indexOf(from);
+        if (pos < 0)
+            return;
+        if (to >= 0)
+            (*attached)[pos] = to;
+        else
+            attached->removeAt(pos);
+        if (attached->isEmpty())
+            m_wiresByComponent.erase(attached);
+    };
+
+    qsizetype first = m_wires.size();
+    for (int index : indices)
+    {
+        if (index < 0 || index >= m_wires.size())
+            continue;
+        first = qMin<qsizetype>(first, index);
+        replace(m_wires[index].fromComponentId, index, -1);
+        replace(m_wires[index].toComponentId, index, -1);
+    }
+
+    qsizetype removed = 0;
+    qsizetype k = 0;
+    for (qsizetype i = first; i < m_wires.size(); ++i)
+    {
+        while (k < indices.size() && indices[k] <= i)
+        {
+            if (indices[k] >= 0)
+                ++removed;
+            ++k;
+        }
+        if (k > 0 && indices[k - 1] == i)
+            continue;
+        if (removed > 0)
+        {
+            replace(m_wires[i].fromComponentId, int(i), int(i - removed));
+            replace(m_wires[i].toComponentId, int(i), int(i - removed));
+        }
+    }
+}
+
+bool CircuitViewport::routeRequest(const Wire& wire, WireRouter::Request& request) const
+{
+    auto from = m_componentIndex.constFind(wire.fromComponentId);
+    auto to = m_componentIndex.constFind(wire.toComponentId);
+    if (from == m_componentIndex.constEnd() || to == m_componentIndex.constEnd())
+        return false;
+
+    const Component& start = m_components[from.value()];
+    const Component& end = m_components[to.value()];
+    request.start = start.getTerminal(true, 0);
+    request.startCenter = componentBounds(start).center();
+    request.end = end.getTerminal(false, 0);
+    request.endCenter = componentBounds(end).center();
+    return true;
+}
+
+void CircuitViewport::rerouteWires(const QVector<int>& componentIds)
+{
+    // Only wires attached to the given parts change
+    QSet<int> seen;
+    QVector<int> indices;
+    QVector<WireRouter::Request> requests;
+    for (int id : componentIds)
+    {
+        auto attached = m_wiresByComponent.constFind(id);
+        if (attached == m_wiresByComponent.constEnd())
+            continue;
+        for (int index : attached.value())
+        {
+            WireRouter::Request request;
+            if (seen.contains(index) || !routeRequest(m_wires[index], request))
+                continue;
+            seen.insert(index);
+            indices.append(index);
+            requests.append(request);
+        }
+    }
+    if (requests.isEmpty())
+        return;
+
+    QVector<QVector<QPointF>> paths = WireRouter::routeAll(m_spatialIndex, m_gridSize, requests);
+    int first = m_wires.size();
+    int last = -1;
+    for (qsizetype i = 0; i < indices.size(); ++i)
+    {
+        m_wires[indices[i]].points = paths[i];
+        first = qMin(first, indices[i]);
+        last = qMax(last, indices[i]);
+    }
+    m_wireModel->rowsChanged(first, last, {WireListModel::PointsRole});
+}
+
+void CircuitViewport::applyRemoveComponent(int componentId)
+{
+    const int index = m_componentIndex.value(componentId, -1);
+    if (index < 0)
+        return;
+
+    // The last part moves into the freed slot: its row goes, the slot's row changes
+    const int last = m_components.size() - 1;
+    m_componentModel->beginRemove(last, last);
+    takeComponent(componentId);
+    m_componentModel->endRemove();
+    if (index != last)
+        m_componentModel->rowsChanged(index, index);
+}
+
+void CircuitViewport::takeComponent(int componentId)
+{
+    auto it = m_componentIndex.find(componentId);
+    if (it == m_componentIndex.end())
+        return;
+
+    // Swap with the last component so removal is O(1)
+    int index = it.value();
+    m_componentIndex.erase(it);
+    m_spatialIndex.remove(componentId);
+    int last = m_components.size() - 1;
+    if (index != last)
+    {
+        m_components.swapItemsAt(index, last);
+        m_componentIndex[m_components[index].id] = index;
+    }
+    m_components.removeLast();
+    m_ruleDelta.removePart(componentId);
+
+    if (m_selection.remove(componentId))
+    {
+        ++m_renderChange.selectionRevision;
+        notifySelectionChanged();
+    }
+}
+
+void CircuitViewport::applyRemoveWire(int index)
+{
+    if (index >= 0 && index < m_wires.size())
+    {
+        m_ruleDelta.addWire(m_wires[index].fromComponentId, m_wires[index].toComponentId, -1);
+        unindexWires({index});
+        m_wireModel->beginRemove(index, index);
+        m_wires.removeAt(index);
+        m_wireModel->endRemove();
+    }
+}
+
+void CircuitViewport::applyClear()
+{
+    m_componentModel->beginReset();
+    m_wireModel->beginReset();
+    m_components.clear();
+    m_wires.clear();
+    m_componentIndex.clear();
+    m_spatialIndex.clear();
+    m_wiresByComponent.clear();
+    m_wireModel->endReset();
+    m_componentModel->endReset();
+    m_nextComponentId = 1;
+    m_ruleDelta = RuleCheckDelta();
+    m_ruleDelta.reset = true;
+    if (!m_selection.isEmpty())
+    {
+        m_selection.clear();
+        ++m_renderChange.selectionRevision;
+        notifySelectionChanged();
+    }
+}
+
+void CircuitViewport::applySetProperties(int componentId, const QString& label, double value)
+{
+    if (Component* comp = findComponent(componentId))
+    {
+        comp->label = label;
+        comp->value = value;
+        const int row = m_componentIndex.value(componentId);
+        m_componentModel->rowsChanged(row, row, {ComponentListModel::LabelRole, ComponentListModel::ValueRole});
+    }
+}
+
+void CircuitViewport::applyDefineSubcircuit(const SubcircuitDefinition& definition)
+{
+    auto previous = m_subcircuits.constFind(definition.id);
+    const bool resized = previous != m_subcircuits.constEnd() && previous->size != definition.size;
+
+    SubcircuitDefinition stored = definition;
+    stored.revision = ++m_subcircuitRevision;
+    m_subcircuits.insert(stored.id, stored);
+    m_nextSubcircuitId = qMax(m_nextSubcircuitId, stored.id + 1);
+
+    // Instances only hold a reference; they change only if the outline does
+    if (resized)
+    {
+        QVector<int> ids;
+        for (Component& comp : m_components)
+        {
+            if (comp.subcircuitId == stored.id)
+            {
+                comp.width = float(stored.size.width());
+                comp.height = float(stored.size.height());
+                comp.setupTerminals();
+                m_spatialIndex.update(comp.id, componentBounds(comp));
+                ids.append(comp.id);
+            }
+        }
+        rerouteWires(ids);
+        m_renderChange.staticEdit = true;
+    }
+    emit subcircuitsChanged();
+}
+
+void CircuitViewport::applyRemoveSubcircuit(int definitionId)
+{
+    if (m_subcircuits.remove(definitionId) == 0)
+        return;
+    ++m_subcircuitRevision;
+    emit subcircuitsChanged();
+}
+
+void CircuitViewport::resetSubcircuits(const QHash<int, SubcircuitDefinition>& definitions)
+{
+    m_subcircuits = definitions;
+    m_nextSubcircuitId = 1;
+    for (SubcircuitDefinition& definition : m_subcircuits)
+    {
+        definition.revision = ++m_subcircuitRevision;
+        m_nextSubcircuitId = qMax(m_nextSubcircuitId, definition.id + 1);
+    }
+    ++m_subcircuitRevision;
+    emit subcircuitsChanged();
 }
 
-void CircuitViewport::handleWireConnection(int componentId)
-{
-    if (!m_creatingWire)
+bool CircuitViewport::definitionFromSelection(SubcircuitDefinition& definition) const
+{
+    const QVector<int> ids = selectedIds();
+    if (ids.isEmpty())
+        return false;
+
+    QRectF bounds;
+    for (int id : ids)
+    {
+        const Component& comp = m_components[m_componentIndex.value(id)];
+        bounds |= QRectF(comp.position, QSizeF(comp.width, comp.height));
+    }
+
+    // Contents are stored relative to the block's top-left corner; the
+    // leftmost part provides the input port, the rightmost the output
+    const QPointF origin = bounds.topLeft();
+    double leftmost = std::numeric_limits<double>::max();
+    double rightmost = std::numeric_limits<double>::lowest();
+    definition.components.clear();
+    definition.wires.clear();
+    definition.size = bounds.size();
+    QVector<int> wireIndices;
+    for (int id : ids)
+    {
+        Component local = m_components[m_componentIndex.value(id)];
+        local.selected = false;
+        local.position -= origin;
+        local.setupTerminals();
+        if (local.position.x() < leftmost)
+        {
+            leftmost = local.position.x();
+            definition.inputComponentId = local.id;
+        }
+        if (local.position.x() + local.width > rightmost)
+        {
+            rightmost = local.position.x() + local.width;
+            definition.outputComponentId = local.id;
+        }
+        definition.components.append(local);
+
+        // Wires between two selected parts go into the block; each is found
+        // from its source part only
+        for (int index : m_wiresByComponent.value(id))
+        {
+            const Wire& wire = m_wires[index];
+            if (wire.fromComponentId == id && m_selection.contains(wire.toComponentId))
+                wireIndices.append(index);
+        }
+    }
+
+    std::sort(wireIndices.begin(), wireIndices.end());
+    wireIndices.erase(std::unique(wireIndices.begin(), wireIndices.end()), wireIndices.end());
+    for (int index : wireIndices)
     {
-        // Start a new wire
-        startWire(componentId);
-        qDebug() << "Starting wire from component" << componentId;
+        Wire local = m_wires[index];
+        for (QPointF& point : local.points)
+            point -= origin;
+        definition.wires.append(local);
     }
-    else
+    return true;
+}
+
+bool CircuitViewport::definitionUses(int definitionId, int usedId, int depth) const
+{
+    auto it = m_subcircuits.constFind(definitionId);
+    if (it == m_subcircuits.constEnd() || depth > 32)
+        return false;
+
+    for (const Component& comp : it->components)
     {
-        // Finish the wire
-        finishWire(componentId);
+        if (comp.subcircuitId >= 0 && (comp.subcircuitId == usedId || definitionUses(comp.subcircuitId, usedId, depth + 1)))
+            return true;
     }
+    return false;
 }
 
-int CircuitViewport::getComponentAtPosition(float x, float y)
+QRectF CircuitViewport::visibleWorldRect() const
 {
-    QPointF worldPos = screenToWorld(QPointF(x, y));
-    return getComponentAt(worldPos);
+    return QRectF(screenToWorld(QPointF(0, 0)), screenToWorld(QPointF(width(), height())));
 }
 
 QPointF CircuitViewport::screenToWorld(const QPointF& screenPos) const
@@ -349,14 +2899,19 @@ QPointF CircuitViewport::worldToScreen(const QPointF& worldPos) const
 
 int CircuitViewport::getComponentAt(const QPointF& pos) const
 {
-    for (const Component& comp : m_components)
+    // Of overlapping parts, the earliest in the model wins
+    int found = -1;
+    int foundIndex = std::numeric_limits<int>::max();
+    for (int id : m_spatialIndex.query(pos))
     {
-        if (comp.containsPoint(pos))
+        int index = m_componentIndex.value(id, -1);
+        if (index >= 0 && index < foundIndex && m_components[index].containsPoint(pos))
         {
-            return comp.id;
+            found = id;
+            foundIndex = index;
         }
     }
-    return -1;
+    return found;
 }
 
 QPointF CircuitViewport::snapToGrid(const QPointF& pos) const
@@ -374,53 +2929,275 @@ CircuitRenderer::CircuitRenderer()
 
 CircuitRenderer::~CircuitRenderer()
 {
-    delete m_gridProgram;
+    releaseResources();
+}
+
+void CircuitRenderer::releaseResources()
+{
+    if (!m_initialized)
+        return;
+
+    delete m_lineProgram;
     delete m_componentProgram;
-    delete m_wireProgram;
     delete m_dotProgram;
+    delete m_instanceProgram;
+    delete m_textProgram;
+    delete m_terminalProgram;
+    delete m_layerProgram;
+    delete m_glyphTexture;
+    delete m_staticLayer;
+    delete m_staticLayerSamples;
+    delete m_heatMapItems;
+    delete m_heatMapValueTexture;
+    m_lineProgram = m_componentProgram = m_dotProgram = nullptr;
+    m_instanceProgram = m_textProgram = m_terminalProgram = m_layerProgram = nullptr;
+    m_glyphTexture = nullptr;
+    m_staticLayer = m_staticLayerSamples = nullptr;
+    m_heatMapItems = m_heatMapValueTexture = nullptr;
+    m_layerSamples = -1;
+    qDeleteAll(m_subcircuitGeometry);
+    m_subcircuitGeometry.clear();
+
+    for (QOpenGLBuffer* buffer : {&m_gridVBO, &m_componentVBO, &m_wireVBO, &m_wireItemVBO, &m_dotVBO, &m_quadVBO,
+                                  &m_textInstanceVBO, &m_terminalVBO})
+        buffer->destroy();
+    for (QOpenGLVertexArrayObject* vao : {&m_gridVAO, &m_componentVAO, &m_wireVAO, &m_dotVAO, &m_textVAO,
+                                          &m_terminalVAO, &m_overlayVAO, &m_overlayShapeVAO, &m_layerVAO})
+        vao->destroy();
+    m_overlayStream.destroy();
+
+    // Everything is rebuilt if the node renders again
+    m_initialized = false;
+    m_gridDirty = m_componentsDirty = m_wiresDirty = m_dotsDirty = true;
+    m_subcircuitsDirty = m_textLayoutDirty = m_staticLayerDirty = m_terminalsDirty = true;
+    m_heatMapItemsDirty = m_heatMapValuesDirty = true;
+    MemoryStats::clear(MemoryStats::GpuBuffers);
+    MemoryStats::clear(MemoryStats::RendererCopies);
+}
+
+QSGRenderNode::StateFlags CircuitRenderer::changedStates() const
+{
+    return BlendState | ScissorState | StencilState | DepthState | ColorState | ViewportState | RenderTargetState;
 }
 
-void CircuitRenderer::synchronize(QQuickFramebufferObject* item)
+QSGRenderNode::RenderingFlags CircuitRenderer::flags() const
 {
-    auto* vp = static_cast<CircuitViewport*>(item);
+    return BoundedRectRendering;
+}
+
+QRectF CircuitRenderer::rect() const
+{
+    return QRectF(QPointF(0, 0), QSizeF(m_viewportSize));
+}
 
+void CircuitRenderer::synchronize(CircuitViewport* vp)
+{
     QSize newSize = vp->size().toSize();
+    const qreal pixelRatio = vp->window() ? vp->window()->effectiveDevicePixelRatio() : 1.0;
+    m_layerSize = (vp->size() * pixelRatio).toSize();
     QColor newGridColor = vp->gridColor();
-    QVector<Component> newComponents = vp->components();
-    QVector<Wire> newWires = vp->wires();
+
+    // Copies still held from the last sync share the viewport's data unless
+    // an edit came before the frame let them go; then the renderer holds the
+    // previous version of the design, which shows up as the peak. Its size is
+    // the viewport's total from when it was copied.
+    qint64 staleBytes = 0;
+    if (!m_components.isSharedWith(vp->components()))
+        staleBytes += m_componentBytes;
+    if (!m_wires.isSharedWith(vp->wires()))
+        staleBytes += m_wireBytes;
+    MemoryStats::set(MemoryStats::RendererCopies, QStringLiteral("previous design"), staleBytes);
     float newZoom = vp->zoom();
     QPointF newPanOffset = vp->panOffset();
 
     if (newSize != m_viewportSize || !qFuzzyCompare(m_gridSize, vp->gridSize()) || newGridColor != m_gridColor ||
-        !qFuzzyCompare(m_zoom, newZoom) || m_panOffset != newPanOffset)
+        !qFuzzyCompare(m_zoom, newZoom) || m_panOffset != newPanOffset || vp->backgroundColor() != m_backgroundColor)
     {
         m_gridDirty = true;
         m_dotsDirty = true;
+        m_textCullDirty = true;
+        m_staticLayerDirty = true;
     }
 
-    if (newComponents != m_components)
+    // Moves of selected parts only change the overlay; a new selection moves
+    // parts between it and the cached layer
+    const RenderChange change = vp->takeRenderChange();
+    const bool selectionChanged = change.selectionRevision != m_selectionRevision;
+    if (change.staticEdit || selectionChanged)
     {
         m_componentsDirty = true;
+        m_wiresDirty = true;
+        m_terminalsDirty = true;
+        m_textLayoutDirty = true;
+        m_staticLayerDirty = true;
+        m_heatMapItemsDirty = m_heatMapItemsDirty || change.staticEdit;
+
+        m_overlayComponents.clear();
+        m_overlayWires.clear();
+        m_overlaySlots.clear();
+        m_overlayWireSlots.clear();
+        m_overlayCenters.clear();
+        m_connectedOutputs.clear();
+        m_connectedInputs.clear();
+        copyOverlayParts(vp, vp->selection());
+        m_selectionRevision = change.selectionRevision;
+    }
+    else if (!change.movedIds.isEmpty())
+    {
+        copyOverlayParts(vp, change.movedIds);
     }
 
-    if (newWires != m_wires)
+    // Looked up afresh each time: the pin may have moved with its part
+    m_hoveredPinFlags = 0;
+    const TerminalRef hovered = vp->hoveredTerminal();
+    if (const Component* comp = hovered.isValid() ? vp->componentById(hovered.componentId) : nullptr)
     {
-        m_wiresDirty = true;
+        const QVector<QPointF>& terminals = hovered.output ? comp->outputTerminals : comp->inputTerminals;
+        if (hovered.index < terminals.size())
+        {
+            m_hoveredPin = terminals[hovered.index];
+            m_hoveredPinFlags = TerminalHovered;
+            for (int index : hovered.index == 0 ? vp->attachedWires(comp->id) : QVector<int>())
+            {
+                const Wire& wire = vp->wires()[index];
+                if ((hovered.output ? wire.fromComponentId : wire.toComponentId) == comp->id)
+                    m_hoveredPinFlags |= TerminalConnected;
+            }
+        }
+    }
+
+    m_selectionOutline = vp->selectionOutline();
+    m_wirePreview = vp->wirePreview();
+    m_diagnosticMarkers = vp->diagnosticMarkers();
+
+    // A different sample count recreates the cached layer on the next frame
+    if (vp->antialiasingQuality() != m_antialiasingQuality)
+    {
+        m_antialiasingQuality = vp->antialiasingQuality();
+        m_staticLayerDirty = true;
+    }
+
+    // Definitions are shared, not compared; the revision says when they changed
+    if (vp->subcircuitRevision() != m_subcircuitRevision)
+    {
+        m_subcircuits = vp->subcircuitDefinitions();
+        m_subcircuitRevision = vp->subcircuitRevision();
+        m_subcircuitsDirty = true;
+        m_staticLayerDirty = true;
+    }
+
+    // New heat map values are one texture upload and a redraw of the cached
+    // layer from the buffers it already has
+    if (vp->heatMap() != m_heatMap)
+    {
+        m_heatMap = vp->heatMap();
+        m_staticLayerDirty = true;
+    }
+    if (m_heatMap != CircuitViewport::NoHeatMap && vp->heatMapNetlistRevision() != m_heatMapNetlistRevision)
+    {
+        m_heatMapNetlist = vp->heatMapNetlist();
+        m_heatMapNetlistRevision = vp->heatMapNetlistRevision();
+        m_heatMapItemsDirty = true;
+        m_staticLayerDirty = true;
+    }
+    if (m_heatMap != CircuitViewport::NoHeatMap && vp->heatMapSampleRevision() != m_heatMapSampleRevision)
+    {
+        const QVector<double>& voltages = vp->heatMapVoltages();
+        const QVector<double>& currents = vp->heatMapCurrents();
+        m_heatMapValues.clear();
+        if (voltages.size() == m_heatMapNetlist.nodeCount && currents.size() == m_heatMapNetlist.elements.size())
+        {
+            m_heatMapValues.reserve(voltages.size() + currents.size());
+            for (double voltage : voltages)
+                m_heatMapValues.append(float(voltage));
+            for (double current : currents)
+                m_heatMapValues.append(float(current));
+        }
+        const QPair<double, double> voltageRange = vp->heatMapVoltageRange();
+        const QPair<double, double> componentRange = vp->heatMapComponentRange();
+        m_heatMapVoltageRange = QVector2D(voltageRange.first, voltageRange.second);
+        m_heatMapComponentRange = QVector2D(componentRange.first, componentRange.second);
+        m_heatMapSampleRevision = vp->heatMapSampleRevision();
+        m_heatMapValuesDirty = true;
+        m_staticLayerDirty = true;
     }
 
     m_viewportSize = newSize;
     m_gridSize = vp->gridSize();
     m_gridColor = newGridColor;
     m_backgroundColor = vp->backgroundColor();
-    m_components = newComponents;
-    m_wires = newWires;
     m_zoom = newZoom;
     m_panOffset = newPanOffset;
 
-    qDebug() << "Synchronized - Size:" << m_viewportSize << "Grid Size:" << m_gridSize << "Components:" << m_components.size() << "Wires:" << m_wires.size() << "Zoom:" << m_zoom;
+    // Sharing the design is free; the next frame rebuilds from it and lets go
+    if (m_componentsDirty || m_wiresDirty || m_terminalsDirty || m_textLayoutDirty || m_subcircuitsDirty ||
+        (m_heatMap != CircuitViewport::NoHeatMap && m_heatMapItemsDirty))
+    {
+        m_components = vp->components();
+        m_wires = vp->wires();
+        m_designCopied = true;
+        m_componentBytes = vp->componentBytes();
+        m_wireBytes = vp->wireBytes();
+        m_staticLayerDirty = true;
+        MemoryStats::set(MemoryStats::RendererCopies, QStringLiteral("previous design"), 0);
+    }
+
+    qDebug() << "Synchronized - Size:" << m_viewportSize << "Grid Size:" << m_gridSize << "Components:" << vp->components().size() << "Wires:" << vp->wires().size() << "Zoom:" << m_zoom;
+}
+
+void CircuitRenderer::copyOverlayParts(const CircuitViewport* vp, const QSet<int>& ids)
+{
+    // Part by part, so a drag copies what it moves and not the design
+    const QVector<Wire>& wires = vp->wires();
+    for (int id : ids)
+    {
+        const Component* comp = vp->componentById(id);
+        if (!comp)
+            continue;
+        const int slot = m_overlaySlots.value(id, int(m_overlayComponents.size()));
+        if (slot == m_overlayComponents.size())
+        {
+            m_overlaySlots.insert(id, slot);
+            m_overlayComponents.append(*comp);
+        }
+        else
+        {
+            m_overlayComponents[slot] = *comp;
+        }
+
+        // A wire occupies output 0 of its source and input 0 of its target
+        for (int index : vp->attachedWires(id))
+        {
+            const Wire& wire = wires[index];
+            const int wireSlot = m_overlayWireSlots.value(index, int(m_overlayWires.size()));
+            if (wireSlot == m_overlayWires.size())
+            {
+                m_overlayWireSlots.insert(index, wireSlot);
+                m_overlayWires.append(wire);
+            }
+            else
+            {
+                m_overlayWires[wireSlot] = wire;
+            }
+            if (wire.fromComponentId == id)
+                m_connectedOutputs.insert(id);
+            if (wire.toComponentId == id)
+                m_connectedInputs.insert(id);
+
+            // Without a route the wire runs between the part centers
+            if (wire.points.size() < 2)
+            {
+                for (int end : {wire.fromComponentId, wire.toComponentId})
+                {
+                    if (const Component* part = vp->componentById(end))
+                        m_overlayCenters.insert(end, componentCenter(*part));
+                }
+            }
+        }
+    }
 }
 
-void CircuitRenderer::render()
+void CircuitRenderer::render(const RenderState* state)
 {
     if (!m_initialized)
     {
@@ -435,25 +3212,25 @@ void CircuitRenderer::render()
         m_gridDirty = false;
     }
 
-    // Reset QML State
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    // Clear Background
-    glClearColor(m_backgroundColor.redF(), m_backgroundColor.greenF(), m_backgroundColor.blueF(), 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
+    if (m_layerSize.isEmpty())
+        return;
 
-    // --- FIX: Use Physical FBO Size for Viewport ---
-    if (framebufferObject())
+    // Update geometry if needed
+    if (m_subcircuitsDirty)
     {
-        QSize physicalSize = framebufferObject()->size();
-        glViewport(0, 0, physicalSize.width(), physicalSize.height());
+        updateSubcircuitGeometry();
+        m_subcircuitsDirty = false;
+        m_componentsDirty = true; // Instance buffers belong to the geometry
+    }
 
-        // Update geometry if needed
+    // The design buffers wait for a sync that copies the design; after
+    // releaseResources() that may come a frame late
+    if (m_designCopied)
+    {
         if (m_componentsDirty)
         {
             updateComponentGeometry();
+            updateSubcircuitInstances();
             m_componentsDirty = false;
         }
 
@@ -463,171 +3240,499 @@ void CircuitRenderer::render()
             m_wiresDirty = false;
         }
 
-        if (m_dotsDirty)
+        if (m_terminalsDirty)
+        {
+            updateTerminalGeometry();
+            m_terminalsDirty = false;
+        }
+
+        if (m_heatMap != CircuitViewport::NoHeatMap && m_heatMapItemsDirty)
+        {
+            updateHeatMapItems();
+            m_heatMapItemsDirty = false;
+        }
+
+        if (m_textLayoutDirty)
         {
-            updateDotGeometry();
-            m_dotsDirty = false;
+            updateTextLayout();
+            m_textLayoutDirty = false;
+            m_textCullDirty = true;
         }
 
-        // Render in order: grid, dots, components, wires
-        renderGrid();
-        renderDots();
-        renderComponents();
-        renderWires();
+        m_components.clear();
+        m_wires.clear();
+        m_componentBytes = m_wireBytes = 0;
+        m_designCopied = false;
+    }
+
+    if (m_heatMap != CircuitViewport::NoHeatMap && m_heatMapValuesDirty)
+    {
+        // The sample as it is, padded to whole rows
+        const int rows = qMax(1, int((m_heatMapValues.size() + HeatMapRow - 1) / HeatMapRow));
+        QVector<float> texels(m_heatMapValues);
+        texels.resize(qsizetype(rows) * HeatMapRow);
+        updateHeatMapTexture("heat map values", m_heatMapValueTexture, QOpenGLTexture::R32F, QOpenGLTexture::Red, rows,
+                             texels);
+        m_heatMapValuesDirty = false;
+    }
+
+    if (m_dotsDirty)
+    {
+        updateDotGeometry();
+        m_dotsDirty = false;
+    }
+
+    if (m_textCullDirty)
+    {
+        updateTextInstances();
+        m_textCullDirty = false;
+    }
+
+    // The scene graph's target is bound; keep it for after the cached layer
+    GLint target = 0;
+    GLint viewport[4] = {};
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    updateStaticLayer();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, GLuint(target));
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    // Clip like any other item
+    if (state->scissorEnabled())
+    {
+        const QRect scissor = state->scissorRect();
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(scissor.x(), scissor.y(), scissor.width(), scissor.height());
+    }
+    else
+    {
+        glDisable(GL_SCISSOR_TEST);
+    }
+    if (state->stencilEnabled())
+    {
+        glEnable(GL_STENCIL_TEST);
+        glStencilFunc(GL_EQUAL, state->stencilValue(), 0xff);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    }
+    else
+    {
+        glDisable(GL_STENCIL_TEST);
+    }
+
+    // Item coordinates to the window, then the item's clip space onto its rectangle
+    const QMatrix4x4 itemTransform = *state->projectionMatrix() * *matrix();
+    QMatrix4x4 itemFromClip;
+    itemFromClip.translate(m_viewportSize.width() / 2.0f, m_viewportSize.height() / 2.0f);
+    itemFromClip.scale(m_viewportSize.width() / 2.0f, -m_viewportSize.height() / 2.0f);
+    m_targetTransform = itemTransform * itemFromClip;
+    m_targetSize = QSize(viewport[2], viewport[3]);
+
+    // The overlay lands in the window, which is multisampled only if the
+    // application asked for it
+    GLint targetSamples = 0;
+    glGetIntegerv(GL_SAMPLES, &targetSamples);
+    const bool analytic = m_antialiasingQuality == CircuitViewport::AnalyticAntialiasing ||
+                          (sampleCount(m_antialiasingQuality) > 0 && targetSamples == 0);
+    m_edgeSmoothing = analytic ? 1.0f : 0.0f;
+
+    // One textured quad for the cached layer, then only the items being edited
+    drawStaticLayer(itemTransform, float(inheritedOpacity()));
+    renderOverlay();
+}
+
+void CircuitRenderer::updateStaticLayer()
+{
+    // The cached layer follows the item's pixel size and sample count
+    const int samples = sampleCount(m_antialiasingQuality);
+    if (!m_staticLayer || m_staticLayer->size() != m_layerSize || m_layerSamples != samples)
+    {
+        delete m_staticLayer;
+        delete m_staticLayerSamples;
+        m_staticLayerSamples = nullptr;
+        m_staticLayer = new QOpenGLFramebufferObject(m_layerSize);
+        if (samples > 0)
+        {
+            QOpenGLFramebufferObjectFormat format;
+            format.setSamples(samples);
+            m_staticLayerSamples = new QOpenGLFramebufferObject(m_layerSize, format);
+        }
+        m_layerSamples = samples;
+        m_staticLayerDirty = true;
+        // RGBA8 colour only, plus the multisampled copy it is resolved from
+        const qint64 pixels = qint64(m_layerSize.width()) * m_layerSize.height();
+        recordGpuBytes("cached layer", pixels * 4 * (1 + samples));
     }
 
-    // Cleanup is handled in individual render methods
+    if (!m_staticLayerDirty)
+        return;
+
+    QOpenGLFramebufferObject* layer = m_staticLayerSamples ? m_staticLayerSamples : m_staticLayer;
+    layer->bind();
+    glViewport(0, 0, m_layerSize.width(), m_layerSize.height());
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_STENCIL_TEST);
+    m_targetTransform.setToIdentity();
+    m_targetSize = m_layerSize;
+    m_edgeSmoothing = m_antialiasingQuality == CircuitViewport::AnalyticAntialiasing ? 1.0f : 0.0f;
+    renderStaticLayer();
+
+    if (m_staticLayerSamples)
+        QOpenGLFramebufferObject::blitFramebuffer(m_staticLayer, m_staticLayerSamples);
+    m_staticLayerDirty = false;
+}
+
+void CircuitRenderer::drawStaticLayer(const QMatrix4x4& itemTransform, float opacity)
+{
+    if (!m_layerProgram || !m_staticLayer)
+        return;
+
+    m_layerProgram->bind();
+    m_layerProgram->setUniformValue("projection", itemTransform);
+    m_layerProgram->setUniformValue("itemSize", QVector2D(m_viewportSize.width(), m_viewportSize.height()));
+    m_layerProgram->setUniformValue("opacity", opacity);
+    m_layerProgram->setUniformValue("layer", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_staticLayer->texture());
+
+    m_layerVAO.bind();
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    m_layerVAO.release();
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_layerProgram->release();
 }
 
-QOpenGLFramebufferObject* CircuitRenderer::createFramebufferObject(const QSize& size)
+void CircuitRenderer::renderStaticLayer()
 {
-    // This requires <QOpenGLFramebufferObject> to be included
-    QOpenGLFramebufferObjectFormat format;
-    format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
-    format.setSamples(4);
-    return new QOpenGLFramebufferObject(size, format);
+    glClearColor(m_backgroundColor.redF(), m_backgroundColor.greenF(), m_backgroundColor.blueF(), 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Render in order: grid, dots, subcircuits, components, wires, text
+    renderGrid();
+    renderDots();
+    renderSubcircuits();
+    renderComponents();
+    renderWires();
+    renderText();
 }
 
 void CircuitRenderer::initializeGL()
 {
-    m_gridProgram = new QOpenGLShaderProgram();
+    QElapsedTimer timer;
+    timer.start();
 
     bool isES = QOpenGLContext::currentContext()->isOpenGLES();
     QString version = isES ? "#version 300 es\n" : "#version 330 core\n";
 
-    QString vertexShader = version + R"(
+    // Heat map lookup shared by the line and part programs: an item's texel in
+    // the item texture names the texels of its values, and the value is
+    // mapped from heatRange onto a color scale running from blue through
+    // green and yellow to red. heatMode is 0 for none, 1 for a net's voltage,
+    // 2 for the magnitude of a part's current and 3 for the power it absorbs.
+    // Alpha is 0 for an item without a value.
+    const QString heatMapFunctions = QStringLiteral(R"(
+        uniform highp sampler2D heatItems;
+        uniform highp sampler2D heatValues;
+        uniform int heatMode;
+        uniform vec2 heatRange;
+        vec4 heatTexel(highp sampler2D map, int index) {
+            return texelFetch(map, ivec2(index % %1, index / %1), 0);
+        }
+        float heatValue(float texel) {
+            return texel < 0.0 ? 0.0 : heatTexel(heatValues, int(texel + 0.5)).r;
+        }
+        vec3 colorMap(float t) {
+            const vec3 stops[5] = vec3[5](vec3(0.15, 0.25, 0.95), vec3(0.0, 0.75, 0.9), vec3(0.2, 0.85, 0.3),
+                                          vec3(1.0, 0.85, 0.1), vec3(1.0, 0.2, 0.15));
+            float x = clamp(t, 0.0, 1.0) * 4.0;
+            int i = min(int(x), 3);
+            return mix(stops[i], stops[i + 1], x - float(i));
+        }
+        vec4 heatColor(int item) {
+            vec4 texels = heatTexel(heatItems, item);
+            float value;
+            if (heatMode == 1) {
+                if (texels.x < 0.0)
+                    return vec4(0.0);
+                value = heatValue(texels.x);
+            } else {
+                if (texels.z < 0.0)
+                    return vec4(0.0);
+                value = heatValue(texels.z);
+                value = heatMode == 2 ? abs(value) : value * (heatValue(texels.x) - heatValue(texels.y));
+            }
+            float span = heatRange.y - heatRange.x;
+            return vec4(colorMap(span > 0.0 ? (value - heatRange.x) / span : 0.5), 1.0);
+        }
+    )").arg(HeatMapRow);
+
+    // Line program for the grid and wires: each segment is an instanced quad
+    // expanded in pixels, since wide GL lines are not available in core
+    // profiles. With smoothing the quad grows by a pixel on each side and
+    // the fragment shader fades the edges by their coverage. Wires carry their
+    // heat map item per instance.
+    QString lineVertexShader = version + heatMapFunctions + R"(
+        layout (location = 0) in vec2 corner;
+        layout (location = 1) in vec4 segment;
+        layout (location = 2) in float item;
+        uniform mat4 projection;
+        uniform vec2 viewportSize;
+        uniform vec4 lineColor;
+        uniform float lineWidth;
+        uniform float smoothing;
+        out float vAcross;
+        out vec4 vColor;
+        void main() {
+            vec4 heat = heatMode > 0 ? heatColor(int(item + 0.5)) : vec4(0.0);
+            vColor = heat.a > 0.0 ? vec4(heat.rgb, lineColor.a) : lineColor;
+            vec2 a = (projection * vec4(segment.xy, 0.0, 1.0)).xy * 0.5 * viewportSize;
+            vec2 b = (projection * vec4(segment.zw, 0.0, 1.0)).xy * 0.5 * viewportSize;
+            vec2 direction = b - a;
+            float len = length(direction);
+            direction = len > 0.0001 ? direction / len : vec2(1.0, 0.0);
+            float halfWidth = lineWidth * 0.5 + smoothing;
+            vAcross = (corner.y * 2.0 - 1.0) * halfWidth;
+            vec2 p = mix(a - direction * halfWidth, b + direction * halfWidth, corner.x)
+                     + vec2(-direction.y, direction.x) * vAcross;
+            gl_Position = vec4(p / (0.5 * viewportSize), 0.0, 1.0);
+        }
+    )";
+
+    QString lineFragmentShader = version + (isES ? "precision mediump float;\n" : "") + R"(
+        uniform float lineWidth;
+        uniform float smoothing;
+        in float vAcross;
+        in vec4 vColor;
+        out vec4 FragColor;
+        void main() {
+            float coverage = smoothing > 0.0 ? clamp(lineWidth * 0.5 + 0.5 - abs(vAcross), 0.0, 1.0) : 1.0;
+            FragColor = vec4(vColor.rgb, vColor.a * coverage);
+        }
+    )";
+
+    m_lineProgram = buildProgram("Line", lineVertexShader, lineFragmentShader);
+
+    // Create component shader program; each draw is one part, so its heat map
+    // item is a uniform
+    QString componentVertexShader = version + heatMapFunctions + R"(
         layout (location = 0) in vec2 position;
+        layout (location = 1) in vec3 edge;
         uniform mat4 projection;
+        uniform vec4 componentColor;
+        uniform int heatItem;
+        out vec3 vEdge;
+        out vec4 vColor;
         void main() {
+            vec4 heat = heatMode > 0 && heatItem >= 0 ? heatColor(heatItem) : vec4(0.0);
+            vColor = heat.a > 0.0 ? vec4(heat.rgb, componentColor.a) : componentColor;
+            vEdge = edge;
             gl_Position = projection * vec4(position, 0.0, 1.0);
         }
     )";
 
-    QString fragmentShader;
-    if (isES)
-    {
-        fragmentShader = version + R"(
-            precision mediump float;
-            uniform vec4 gridColor;
-            out vec4 FragColor;
-            void main() {
-                FragColor = gridColor;
-            }
-        )";
-    }
-    else
-    {
-        fragmentShader = version + R"(
-            uniform vec4 gridColor;
-            out vec4 FragColor;
-            void main() {
-                FragColor = gridColor;
+    // With smoothing, the last pixel inside the outline fades by its distance
+    // to the nearest outer edge
+    QString componentFragmentShader = version + (isES ? "precision mediump float;\n" : "") + R"(
+        uniform float smoothing;
+        in vec3 vEdge;
+        in vec4 vColor;
+        out vec4 FragColor;
+        void main() {
+            float coverage = 1.0;
+            if (smoothing > 0.0) {
+                vec3 pixels = vEdge / max(fwidth(vEdge), vec3(0.0001));
+                coverage = clamp(min(min(pixels.x, pixels.y), pixels.z), 0.0, 1.0);
             }
-        )";
-    }
+            FragColor = vec4(vColor.rgb, vColor.a * coverage);
+        }
+    )";
 
-    if (!m_gridProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShader))
-        qWarning() << "Vertex Shader Error:" << m_gridProgram->log();
+    m_componentProgram = buildProgram("Component", componentVertexShader, componentFragmentShader);
 
-    if (!m_gridProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShader))
-        qWarning() << "Fragment Shader Error:" << m_gridProgram->log();
+    // Create dot shader program with circle rendering
+    QString dotVertexShader = version + R"(
+        layout (location = 0) in vec2 position;
+        layout (location = 1) in vec2 local;
+        uniform mat4 projection;
+        out vec2 vLocal;
+        void main() {
+            vLocal = local;
+            gl_Position = projection * vec4(position, 0.0, 1.0);
+        }
+    )";
 
-    if (!m_gridProgram->link())
-        qWarning() << "Link Error:" << m_gridProgram->log();
+    QString dotFragmentShader = version + (isES ? "precision mediump float;\n" : "") + R"(
+        uniform vec4 dotColor;
+        uniform float smoothing;
+        in vec2 vLocal;
+        out vec4 FragColor;
+        void main() {
+            float coverage = 1.0;
+            if (smoothing > 0.0) {
+                float d = max(abs(vLocal.x), abs(vLocal.y));
+                float edge = max(fwidth(d), 0.0001);
+                coverage = 1.0 - smoothstep(1.0 - edge, 1.0, d);
+            }
+            FragColor = vec4(dotColor.rgb, dotColor.a * coverage);
+        }
+    )";
 
-    // Create component shader program
-    m_componentProgram = new QOpenGLShaderProgram();
+    m_dotProgram = buildProgram("Dot", dotVertexShader, dotFragmentShader);
 
-    QString componentVertexShader = version + R"(
+    // Instanced program for subcircuits: per-vertex color, per-instance
+    // offset, rotation about the block's center and highlight
+    QString instanceVertexShader = version + R"(
         layout (location = 0) in vec2 position;
+        layout (location = 1) in vec4 color;
+        layout (location = 2) in vec4 instance;
         uniform mat4 projection;
+        uniform vec2 blockSize;
+        out vec4 vColor;
         void main() {
-            gl_Position = projection * vec4(position, 0.0, 1.0);
+            vec2 local = position - blockSize * 0.5;
+            float c = cos(instance.z);
+            float s = sin(instance.z);
+            vec2 rotated = vec2(c * local.x - s * local.y, s * local.x + c * local.y) + blockSize * 0.5;
+            gl_Position = projection * vec4(rotated + instance.xy, 0.0, 1.0);
+            vColor = mix(color, vec4(1.0, 1.0, 0.0, 1.0), instance.w * 0.6);
         }
     )";
 
-    QString componentFragmentShader;
-    if (isES)
-    {
-        componentFragmentShader = version + R"(
-            precision mediump float;
-            uniform vec4 componentColor;
-            out vec4 FragColor;
-            void main() {
-                FragColor = componentColor;
-            }
-        )";
-    }
-    else
-    {
-        componentFragmentShader = version + R"(
-            uniform vec4 componentColor;
-            out vec4 FragColor;
-            void main() {
-                FragColor = componentColor;
-            }
-        )";
-    }
+    QString instanceFragmentShader = version + (isES ? "precision mediump float;\n" : "") + R"(
+        in vec4 vColor;
+        out vec4 FragColor;
+        void main() {
+            FragColor = vColor;
+        }
+    )";
+
+    m_instanceProgram = buildProgram("Instance", instanceVertexShader, instanceFragmentShader);
+
+    // Text program: one instanced quad per glyph, alpha from the distance
+    // field with a screen-space edge width so it stays sharp at any zoom
+    QString textVertexShader = version + R"(
+        layout (location = 0) in vec2 corner;
+        layout (location = 1) in vec4 glyphRect;
+        layout (location = 2) in vec4 glyphUV;
+        layout (location = 3) in vec4 glyphColor;
+        uniform mat4 projection;
+        out vec2 vUV;
+        out vec4 vColor;
+        void main() {
+            vUV = mix(glyphUV.xy, glyphUV.zw, corner);
+            vColor = glyphColor;
+            gl_Position = projection * vec4(glyphRect.xy + corner * glyphRect.zw, 0.0, 1.0);
+        }
+    )";
 
-    if (!m_componentProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, componentVertexShader))
-        qWarning() << "Component Vertex Shader Error:" << m_componentProgram->log();
+    QString textFragmentShader = version + (isES ? "precision mediump float;\n" : "") + R"(
+        uniform sampler2D atlas;
+        uniform float smoothing;
+        in vec2 vUV;
+        in vec4 vColor;
+        out vec4 FragColor;
+        void main() {
+            float distance = texture(atlas, vUV).r;
+            float edge = max(fwidth(distance), 0.0001);
+            float alpha = smoothing > 0.0 ? smoothstep(0.5 - edge, 0.5 + edge, distance) : step(0.5, distance);
+            FragColor = vec4(vColor.rgb, vColor.a * alpha);
+        }
+    )";
 
-    if (!m_componentProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, componentFragmentShader))
-        qWarning() << "Component Fragment Shader Error:" << m_componentProgram->log();
+    m_textProgram = buildProgram("Text", textVertexShader, textFragmentShader);
 
-    if (!m_componentProgram->link())
-        qWarning() << "Component Link Error:" << m_componentProgram->log();
+    // Terminal program: one instanced disc per pin. Connected pins are filled,
+    // open ones drawn as rings, and the hovered one is enlarged and tinted.
+    // Rule check findings are wide red rings around the pin or part.
+    QString terminalVertexShader = version + R"(
+        layout (location = 0) in vec2 corner;
+        layout (location = 1) in vec4 terminal;
+        uniform mat4 projection;
+        uniform float radius;
+        out vec2 vLocal;
+        flat out int vFlags;
+        void main() {
+            vFlags = int(terminal.z + 0.5);
+            float r = (vFlags & 4) != 0 ? radius * 2.5 : ((vFlags & 2) != 0 ? radius * 1.6 : radius);
+            vLocal = corner * 2.0 - 1.0;
+            gl_Position = projection * vec4(terminal.xy + vLocal * r, 0.0, 1.0);
+        }
+    )";
 
-    // Create wire shader program (same as grid/component)
-    m_wireProgram = new QOpenGLShaderProgram();
-    if (!m_wireProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, componentVertexShader))
-        qWarning() << "Wire Vertex Shader Error:" << m_wireProgram->log();
-    if (!m_wireProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, componentFragmentShader))
-        qWarning() << "Wire Fragment Shader Error:" << m_wireProgram->log();
-    if (!m_wireProgram->link())
-        qWarning() << "Wire Link Error:" << m_wireProgram->log();
+    QString terminalFragmentShader = version + (isES ? "precision mediump float;\n" : "") + R"(
+        uniform float smoothing;
+        in vec2 vLocal;
+        flat in int vFlags;
+        out vec4 FragColor;
+        void main() {
+            float d = length(vLocal);
+            float edge = max(fwidth(d) * smoothing, 0.0001);
+            float alpha = 1.0 - smoothstep(1.0 - edge, 1.0, d);
+            bool connected = (vFlags & 1) != 0;
+            bool hovered = (vFlags & 2) != 0;
+            bool flagged = (vFlags & 4) != 0;
+            if (flagged)
+                alpha *= smoothstep(0.75 - edge, 0.75, d);
+            else if (!connected && !hovered)
+                alpha *= smoothstep(0.45 - edge, 0.45, d); // Open pins are rings
+            if (alpha <= 0.0)
+                discard;
+            vec3 color = flagged ? vec3(1.0, 0.25, 0.2)
+                                 : (hovered ? vec3(1.0, 0.6, 0.1) : (connected ? vec3(0.35, 0.9, 0.45) : vec3(1.0)));
+            FragColor = vec4(color, alpha);
+        }
+    )";
 
-    // Create dot shader program with circle rendering
-    m_dotProgram = new QOpenGLShaderProgram();
+    m_terminalProgram = buildProgram("Terminal", terminalVertexShader, terminalFragmentShader);
 
-    QString dotVertexShader = version + R"(
-        layout (location = 0) in vec2 position;
+    // Cached layer program: one textured quad over the item
+    QString layerVertexShader = version + R"(
+        layout (location = 0) in vec2 corner;
         uniform mat4 projection;
+        uniform vec2 itemSize;
+        out vec2 vUV;
         void main() {
-            gl_Position = projection * vec4(position, 0.0, 1.0);
+            vUV = vec2(corner.x, 1.0 - corner.y); // The layer's first row is the item's bottom
+            gl_Position = projection * vec4(corner * itemSize, 0.0, 1.0);
         }
     )";
 
-    QString dotFragmentShader;
-    if (isES)
-    {
-        dotFragmentShader = version + R"(
-            precision mediump float;
-            uniform vec4 dotColor;
-            out vec4 FragColor;
-            void main() {
-                FragColor = dotColor;
-            }
-        )";
-    }
-    else
+    QString layerFragmentShader = version + (isES ? "precision mediump float;\n" : "") + R"(
+        uniform sampler2D layer;
+        uniform float opacity;
+        in vec2 vUV;
+        out vec4 FragColor;
+        void main() {
+            FragColor = vec4(texture(layer, vUV).rgb, opacity);
+        }
+    )";
+
+    m_layerProgram = buildProgram("Layer", layerVertexShader, layerFragmentShader);
+
+    qDebug() << "Shader programs ready in" << timer.elapsed() << "ms";
+
+    // The atlas is built once; zooming only rescales the quads
+    if (m_glyphAtlas.build(GlyphAtlas::defaultCharacters()))
     {
-        dotFragmentShader = version + R"(
-            uniform vec4 dotColor;
-            out vec4 FragColor;
-            void main() {
-                FragColor = dotColor;
-            }
-        )";
+        const QImage& atlas = m_glyphAtlas.image();
+        m_glyphTexture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        m_glyphTexture->setFormat(QOpenGLTexture::R8_UNorm);
+        m_glyphTexture->setSize(atlas.width(), atlas.height());
+        m_glyphTexture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+        m_glyphTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
+        m_glyphTexture->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::UInt8);
+        QOpenGLPixelTransferOptions options;
+        options.setAlignment(1);
+        m_glyphTexture->setData(QOpenGLTexture::Red, QOpenGLTexture::UInt8, atlas.constBits(), &options);
+        recordGpuBytes("glyph atlas", qint64(atlas.width()) * atlas.height());
     }
 
-    if (!m_dotProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, dotVertexShader))
-        qWarning() << "Dot Vertex Shader Error:" << m_dotProgram->log();
-    if (!m_dotProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, dotFragmentShader))
-        qWarning() << "Dot Fragment Shader Error:" << m_dotProgram->log();
-    if (!m_dotProgram->link())
-        qWarning() << "Dot Link Error:" << m_dotProgram->log();
-
     // Create all VAOs and VBOs
     m_gridVAO.create();
     m_gridVBO.create();
@@ -637,6 +3742,85 @@ void CircuitRenderer::initializeGL()
     m_wireVBO.create();
     m_dotVAO.create();
     m_dotVBO.create();
+    m_overlayVAO.create();
+    m_overlayShapeVAO.create();
+    m_overlayStream.create(this);
+
+    // Unit quad shared by every line segment, glyph and pin, per-item
+    // attributes advance per instance
+    static const float corners[] = {0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+    m_quadVBO.create();
+    m_quadVBO.bind();
+    m_quadVBO.allocate(corners, sizeof(corners));
+    recordGpuBytes("quad", sizeof(corners));
+    m_quadVBO.release();
+
+    m_layerVAO.create();
+    m_layerVAO.bind();
+    m_quadVBO.bind();
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
+    glEnableVertexAttribArray(0);
+    m_quadVBO.release();
+    m_layerVAO.release();
+
+    // Segment buffers are attached to attribute 1 when they are filled
+    for (QOpenGLVertexArrayObject* vao : {&m_gridVAO, &m_wireVAO, &m_overlayVAO})
+    {
+        vao->bind();
+        m_quadVBO.bind();
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribDivisor(1, 1);
+        m_quadVBO.release();
+        vao->release();
+    }
+
+    // Wires also carry their heat map item, one float per segment
+    m_wireVAO.bind();
+    m_wireItemVBO.create();
+    m_wireItemVBO.bind();
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(float), nullptr);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+    m_wireItemVBO.release();
+    m_wireVAO.release();
+
+    m_textVAO.create();
+    m_textVAO.bind();
+    m_quadVBO.bind();
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
+    glEnableVertexAttribArray(0);
+    m_quadVBO.release();
+
+    m_textInstanceVBO.create();
+    m_textInstanceVBO.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    m_textInstanceVBO.bind();
+    const int stride = FloatsPerGlyph * sizeof(float);
+    for (int attribute = 1; attribute <= 3; ++attribute)
+    {
+        glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<void*>((attribute - 1) * 4 * sizeof(float)));
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+    m_textInstanceVBO.release();
+    m_textVAO.release();
+
+    m_terminalVAO.create();
+    m_terminalVAO.bind();
+    m_quadVBO.bind();
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
+    glEnableVertexAttribArray(0);
+    m_quadVBO.release();
+    m_terminalVBO.create();
+    m_terminalVBO.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    m_terminalVBO.bind();
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    m_terminalVBO.release();
+    m_terminalVAO.release();
 }
 
 void CircuitRenderer::updateGridGeometry()
@@ -681,9 +3865,10 @@ void CircuitRenderer::updateGridGeometry()
         m_gridVAO.bind();
         m_gridVBO.bind();
         m_gridVBO.allocate(vertices.data(), vertices.size() * sizeof(float));
+        recordGpuBytes("grid", vertices.size() * sizeof(float));
 
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
-        glEnableVertexAttribArray(0);
+        // One segment (x0, y0, x1, y1) per instance
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
 
         m_gridVBO.release();
         m_gridVAO.release();
@@ -692,233 +3877,364 @@ void CircuitRenderer::updateGridGeometry()
 
 void CircuitRenderer::renderGrid()
 {
-    if (!m_gridProgram || m_viewportSize.isEmpty())
+    if (!m_lineProgram || m_viewportSize.isEmpty())
         return;
 
-    m_gridProgram->bind();
-
-    // Use world-to-screen transformation
-    QMatrix4x4 projection;
-    projection.setToIdentity();
-    projection.ortho(-m_panOffset.x() / m_zoom,
-                     (m_viewportSize.width() - m_panOffset.x()) / m_zoom,
-                     (m_viewportSize.height() - m_panOffset.y()) / m_zoom,
-                     -m_panOffset.y() / m_zoom, -1, 1);
-    projection.scale(m_zoom, m_zoom, 1);
-
-    m_gridProgram->setUniformValue("projection", projection);
+    bindLineProgram(viewProjection());
 
     // Convert QColor to QVector4D for proper uniform setting
     QVector4D colorVec(m_gridColor.redF(), m_gridColor.greenF(),
                        m_gridColor.blueF(), m_gridColor.alphaF());
-    m_gridProgram->setUniformValue("gridColor", colorVec);
+    m_lineProgram->setUniformValue("lineColor", colorVec);
+    m_lineProgram->setUniformValue("lineWidth", 1.0f);
 
     m_gridVAO.bind();
 
-    // Set line width to make grid more visible
-    glLineWidth(1.0f);
-
     if (m_gridVertexCount > 0)
     {
-        glDrawArrays(GL_LINES, 0, m_gridVertexCount);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_gridVertexCount / 2);
     }
 
     m_gridVAO.release();
-    m_gridProgram->release();
+    m_lineProgram->release();
+}
+
+void CircuitRenderer::bindLineProgram(const QMatrix4x4& projection)
+{
+    m_lineProgram->bind();
+    m_lineProgram->setUniformValue("projection", projection);
+    m_lineProgram->setUniformValue("viewportSize", QVector2D(m_targetSize.width(), m_targetSize.height()));
+    m_lineProgram->setUniformValue("smoothing", edgeSmoothing());
+    m_lineProgram->setUniformValue("heatMode", 0);
 }
 
 void CircuitRenderer::updateComponentGeometry()
 {
+    m_componentDraws.clear();
     if (m_components.isEmpty())
         return;
 
-    QVector<float> vertices;
+    // Create filled shapes for each component; selected ones belong to the overlay
+    QVector<const Component*> order;
+    order.reserve(m_components.size());
+    for (const Component& comp : std::as_const(m_components))
+    {
+        if (comp.subcircuitId < 0 && !comp.selected)
+            order.append(&comp);
+    }
 
-    // Create filled shapes for each component
-    for (const Component& comp : m_components)
+    QVector<qsizetype> offsets;
+    QVector<float> vertices = tessellateParallel(order.size(), [&order](qsizetype i, auto& sink)
     {
-        float x = comp.position.x();
-        float y = comp.position.y();
-        float w = comp.width;
-        float h = comp.height;
+        appendComponentShape(sink, *order[i]);
+    }, offsets);
 
-        if (comp.type == "Resistor")
-        {
-            // Resistor: Rectangle with zigzag pattern
-            // Main body (2 triangles = 6 vertices)
-            vertices << x << y << x + w << y << x << y + h;
-            vertices << x + w << y << x + w << y + h << x << y + h;
-        }
-        else if (comp.type == "Capacitor")
-        {
-            // Capacitor: Two parallel lines
-            float mid = x + w / 2;
-            float gap = w * 0.1f;
-            // Left plate
-            vertices << mid - gap << y << mid - gap / 2 << y << mid - gap << y + h;
-            vertices << mid - gap / 2 << y << mid - gap / 2 << y + h << mid - gap << y + h;
-            // Right plate
-            vertices << mid + gap / 2 << y << mid + gap << y << mid + gap / 2 << y + h;
-            vertices << mid + gap << y << mid + gap << y + h << mid + gap / 2 << y + h;
-        }
-        else if (comp.type == "Inductor")
-        {
-            // Inductor: Coil shape (simplified as rectangle for now)
-            vertices << x << y << x + w << y << x << y + h;
-            vertices << x + w << y << x + w << y + h << x << y + h;
-        }
-        else if (comp.type == "Voltage Source")
-        {
-            // Voltage Source: Circle (simplified as diamond)
-            float cx = x + w / 2, cy = y + h / 2;
-            vertices << cx << y << x + w << cy << cx << y + h;
-            vertices << x << cy << x + w << cy << cx << y + h;
-        }
-        else
-        {
-            // Default: filled rectangle
-            vertices << x << y << x + w << y << x << y + h;
-            vertices << x + w << y << x + w << y + h << x << y + h;
-        }
+    m_componentDraws.reserve(order.size());
+    for (qsizetype i = 0; i < order.size(); ++i)
+    {
+        const QColor& color = order[i]->color;
+        m_componentDraws.append(ComponentDraw{int(offsets[i] / FloatsPerShapeVertex),
+                                              int((offsets[i + 1] - offsets[i]) / FloatsPerShapeVertex),
+                                              QVector4D(color.redF(), color.greenF(), color.blueF(), color.alphaF()),
+                                              int(order[i] - m_components.constData())});
     }
 
     // Store vertex count for rendering
-    m_componentVertexCount = vertices.size() / 2;
+    m_componentVertexCount = vertices.size() / FloatsPerShapeVertex;
 
     if (!vertices.isEmpty())
     {
         m_componentVAO.bind();
         m_componentVBO.bind();
         m_componentVBO.allocate(vertices.data(), vertices.size() * sizeof(float));
+        recordGpuBytes("components", vertices.size() * sizeof(float));
 
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
+        const int stride = FloatsPerShapeVertex * sizeof(float);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, nullptr);
         glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void*>(2 * sizeof(float)));
+        glEnableVertexAttribArray(1);
 
         m_componentVBO.release();
         m_componentVAO.release();
     }
 }
 
-void CircuitRenderer::renderComponents()
+void CircuitRenderer::tessellateDefinition(const SubcircuitDefinition& definition, const QTransform& transform,
+                                           int depth, QVector<float>& triangles, QVector<float>& lines) const
 {
-    if (!m_componentProgram || m_components.isEmpty())
-        return;
+    auto appendVertex = [&transform](QVector<float>& out, const QPointF& point, const QColor& color)
+    {
+        QPointF mapped = transform.map(point);
+        out << float(mapped.x()) << float(mapped.y()) << color.redF() << color.greenF() << color.blueF() << color.alphaF();
+    };
+
+    // Block body and outline
+    const float w = float(definition.size.width());
+    const float h = float(definition.size.height());
+    const QColor fill(90, 90, 120, 90);
+    const QColor outline(180, 180, 210);
+    for (const QPointF& point : {QPointF(0, 0), QPointF(w, 0), QPointF(0, h), QPointF(w, 0), QPointF(w, h), QPointF(0, h)})
+        appendVertex(triangles, point, fill);
+    for (const QPointF& point : {QPointF(0, 0), QPointF(w, 0), QPointF(w, 0), QPointF(w, h),
+                                 QPointF(w, h), QPointF(0, h), QPointF(0, h), QPointF(0, 0)})
+        appendVertex(lines, point, outline);
+
+    QHash<int, const Component*> byId;
+    byId.reserve(definition.components.size());
+    for (const Component& comp : definition.components)
+    {
+        byId.insert(comp.id, &comp);
 
-    m_componentProgram->bind();
+        if (comp.subcircuitId >= 0)
+        {
+            // Nested blocks are baked into this definition's geometry
+            auto nested = m_subcircuits.constFind(comp.subcircuitId);
+            if (nested == m_subcircuits.constEnd() || depth >= 32)
+                continue;
+            QTransform local;
+            local.translate(comp.position.x() + comp.width / 2, comp.position.y() + comp.height / 2);
+            local.rotate(comp.rotation);
+            local.translate(-comp.width / 2, -comp.height / 2);
+            tessellateDefinition(nested.value(), local * transform, depth + 1, triangles, lines);
+            continue;
+        }
 
-    // Use world-to-screen transformation like the grid
-    QMatrix4x4 projection;
-    projection.setToIdentity();
-    projection.ortho(-m_panOffset.x() / m_zoom,
-                     (m_viewportSize.width() - m_panOffset.x()) / m_zoom,
-                     (m_viewportSize.height() - m_panOffset.y()) / m_zoom,
-                     -m_panOffset.y() / m_zoom, -1, 1);
-    projection.scale(m_zoom, m_zoom, 1);
-    m_componentProgram->setUniformValue("projection", projection);
+        QVector<float> shape;
+        appendComponentShape(shape, comp);
+        for (qsizetype i = 0; i + 1 < shape.size(); i += FloatsPerShapeVertex)
+            appendVertex(triangles, QPointF(shape[i], shape[i + 1]), comp.color);
+    }
 
-    m_componentVAO.bind();
+    const QColor wireColor(255, 255, 0);
+    for (const Wire& wire : definition.wires)
+    {
+        if (wire.points.size() >= 2)
+        {
+            for (qsizetype i = 1; i < wire.points.size(); ++i)
+            {
+                appendVertex(lines, wire.points[i - 1], wireColor);
+                appendVertex(lines, wire.points[i], wireColor);
+            }
+            continue;
+        }
 
-    // Render each component with its own color
-    int vertexOffset = 0;
-    for (const Component& comp : m_components)
+        const Component* from = byId.value(wire.fromComponentId);
+        const Component* to = byId.value(wire.toComponentId);
+        if (!from || !to)
+            continue;
+        appendVertex(lines, from->getTerminal(true, 0), wireColor);
+        appendVertex(lines, to->getTerminal(false, 0), wireColor);
+    }
+}
+
+void CircuitRenderer::updateSubcircuitGeometry()
+{
+    // Release geometry of definitions that are gone
+    for (auto it = m_subcircuitGeometry.begin(); it != m_subcircuitGeometry.end();)
     {
-        QVector4D colorVec(comp.color.redF(), comp.color.greenF(),
-                           comp.color.blueF(), comp.color.alphaF());
-        if (comp.selected)
+        if (!m_subcircuits.contains(it.key()))
+        {
+            delete it.value();
+            it = m_subcircuitGeometry.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // One tessellation per definition, however many instances use it
+    for (const SubcircuitDefinition& definition : m_subcircuits)
+    {
+        SubcircuitGeometry*& geometry = m_subcircuitGeometry[definition.id];
+        if (!geometry)
         {
-            // Highlight selected components
-            colorVec = QVector4D(1.0f, 1.0f, 0.0f, 1.0f); // Yellow
+            geometry = new SubcircuitGeometry;
+            geometry->vao.create();
+            geometry->shapeVBO.create();
+            geometry->instanceVBO.create();
+
+            geometry->vao.bind();
+            geometry->shapeVBO.bind();
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), nullptr);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void*>(2 * sizeof(float)));
+            glEnableVertexAttribArray(1);
+            geometry->shapeVBO.release();
+
+            geometry->instanceVBO.bind();
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
+            glEnableVertexAttribArray(2);
+            glVertexAttribDivisor(2, 1);
+            geometry->instanceVBO.release();
+            geometry->vao.release();
         }
-        m_componentProgram->setUniformValue("componentColor", colorVec);
 
-        int triangleCount = 2; // Default for most components
-        if (comp.type == "Capacitor")
-            triangleCount = 4; // Two plates
-        if (comp.type == "Voltage Source")
-            triangleCount = 2; // Diamond shape
+        QVector<float> triangles;
+        QVector<float> lines;
+        tessellateDefinition(definition, QTransform(), 0, triangles, lines);
+        geometry->triangleVertexCount = triangles.size() / 6;
+        geometry->lineVertexCount = lines.size() / 6;
+        geometry->size = definition.size;
+
+        triangles += lines;
+        geometry->shapeVBO.bind();
+        geometry->shapeVBO.allocate(triangles.constData(), triangles.size() * sizeof(float));
+        geometry->shapeVBO.release();
+    }
+
+    qint64 bytes = 0;
+    for (const SubcircuitGeometry* geometry : std::as_const(m_subcircuitGeometry))
+        bytes += (geometry->triangleVertexCount + geometry->lineVertexCount) * 6 * qint64(sizeof(float));
+    recordGpuBytes("subcircuit shapes", bytes);
+}
 
-        // Draw filled triangles
-        glDrawArrays(GL_TRIANGLES, vertexOffset, triangleCount * 3);
-        vertexOffset += triangleCount * 3;
+void CircuitRenderer::updateSubcircuitInstances()
+{
+    // Only transforms are uploaded per instance; selected ones are streamed
+    // with the overlay
+    QHash<int, QVector<float>> instanceData;
+    for (const Component& comp : m_components)
+    {
+        if (comp.subcircuitId >= 0 && !comp.selected && m_subcircuitGeometry.contains(comp.subcircuitId))
+        {
+            instanceData[comp.subcircuitId] << float(comp.position.x()) << float(comp.position.y())
+                                            << qDegreesToRadians(comp.rotation) << 0.0f;
+        }
     }
 
-    m_componentVAO.release();
-    m_componentProgram->release();
+    for (auto it = m_subcircuitGeometry.begin(); it != m_subcircuitGeometry.end(); ++it)
+    {
+        const QVector<float> data = instanceData.value(it.key());
+        SubcircuitGeometry* geometry = it.value();
+        geometry->instanceCount = data.size() / 4;
+        if (data.isEmpty())
+            continue;
+        geometry->instanceVBO.bind();
+        geometry->instanceVBO.allocate(data.constData(), data.size() * sizeof(float));
+        geometry->instanceVBO.release();
+    }
 
-    // Render connection terminals as small circles
-    renderTerminals();
+    qint64 bytes = 0;
+    for (const SubcircuitGeometry* geometry : std::as_const(m_subcircuitGeometry))
+        bytes += geometry->instanceCount * 4 * qint64(sizeof(float));
+    recordGpuBytes("subcircuit instances", bytes);
 }
 
-void CircuitRenderer::renderTerminals()
+void CircuitRenderer::renderSubcircuits()
 {
-    if (!m_componentProgram || m_components.isEmpty())
+    if (!m_instanceProgram || m_subcircuitGeometry.isEmpty())
         return;
 
-    // Reuse component program for terminals
-    m_componentProgram->bind();
+    m_instanceProgram->bind();
+    m_instanceProgram->setUniformValue("projection", viewProjection());
 
-    // Use the same projection as components
-    QMatrix4x4 projection;
-    projection.setToIdentity();
-    projection.ortho(-m_panOffset.x() / m_zoom,
-                     (m_viewportSize.width() - m_panOffset.x()) / m_zoom,
-                     (m_viewportSize.height() - m_panOffset.y()) / m_zoom,
-                     -m_panOffset.y() / m_zoom, -1, 1);
-    projection.scale(m_zoom, m_zoom, 1);
-    m_componentProgram->setUniformValue("projection", projection);
+    // One draw call per definition and primitive type
+    glLineWidth(1.0f);
+    for (SubcircuitGeometry* geometry : std::as_const(m_subcircuitGeometry))
+    {
+        if (geometry->instanceCount == 0)
+            continue;
+
+        m_instanceProgram->setUniformValue("blockSize", QVector2D(geometry->size.width(), geometry->size.height()));
+        geometry->vao.bind();
+        glDrawArraysInstanced(GL_TRIANGLES, 0, geometry->triangleVertexCount, geometry->instanceCount);
+        glDrawArraysInstanced(GL_LINES, geometry->triangleVertexCount, geometry->lineVertexCount,
+                              geometry->instanceCount);
+        geometry->vao.release();
+    }
 
-    // Set terminal color (white for visibility)
-    QVector4D terminalColor(1.0f, 1.0f, 1.0f, 1.0f);
-    m_componentProgram->setUniformValue("componentColor", terminalColor);
+    m_instanceProgram->release();
+}
 
-    // Create temporary vertex data for terminals
-    QVector<float> terminalVertices;
-    float terminalSize = 3.0f; // Small circles
+void CircuitRenderer::renderComponents()
+{
+    if (!m_componentProgram || (m_componentDraws.isEmpty() && m_terminalCount == 0))
+        return;
 
-    for (const Component& comp : m_components)
+    m_componentProgram->bind();
+    m_componentProgram->setUniformValue("projection", viewProjection());
+    m_componentProgram->setUniformValue("smoothing", edgeSmoothing());
+
+    const bool heat = bindHeatMap(m_componentProgram, m_heatMap == CircuitViewport::PowerHeatMap ? 3 : 2,
+                                  m_heatMapComponentRange);
+
+    m_componentVAO.bind();
+
+    // Render each component with its own color, or its heat map value's
+    for (const ComponentDraw& draw : std::as_const(m_componentDraws))
     {
-        // Input terminals
-        for (const QPointF& terminal : comp.inputTerminals)
-        {
-            float x = terminal.x();
-            float y = terminal.y();
-            float r = terminalSize;
+        m_componentProgram->setUniformValue("componentColor", draw.color);
+        m_componentProgram->setUniformValue("heatItem", draw.item);
+        glDrawArrays(GL_TRIANGLES, draw.firstVertex, draw.vertexCount);
+    }
 
-            // Simple square for terminal (2 triangles)
-            terminalVertices << x - r << y - r << x + r << y - r << x - r << y + r;
-            terminalVertices << x + r << y - r << x + r << y + r << x - r << y + r;
-        }
+    m_componentVAO.release();
+    if (heat)
+        releaseHeatMap();
+    m_componentProgram->release();
 
-        // Output terminals
-        for (const QPointF& terminal : comp.outputTerminals)
-        {
-            float x = terminal.x();
-            float y = terminal.y();
-            float r = terminalSize;
+    // Render connection terminals as small circles
+    renderTerminals();
+}
 
-            // Simple square for terminal (2 triangles)
-            terminalVertices << x - r << y - r << x + r << y - r << x - r << y + r;
-            terminalVertices << x + r << y - r << x + r << y + r << x - r << y + r;
-        }
+void CircuitRenderer::updateTerminalGeometry()
+{
+    m_terminalCount = 0;
+    if (m_components.isEmpty())
+        return;
+
+    // Pins of selected parts move with them and belong to the overlay
+    QVector<const Component*> order;
+    order.reserve(m_components.size());
+    for (const Component& comp : std::as_const(m_components))
+    {
+        if (!comp.selected)
+            order.append(&comp);
     }
 
-    if (!terminalVertices.isEmpty())
+    // A wire occupies output 0 of its source and input 0 of its target
+    QSet<int> connectedOutputs;
+    QSet<int> connectedInputs;
+    for (const Wire& wire : std::as_const(m_wires))
     {
-        // Create temporary VBO for terminals
-        QOpenGLBuffer terminalVBO;
-        terminalVBO.create();
-        terminalVBO.bind();
-        terminalVBO.allocate(terminalVertices.data(), terminalVertices.size() * sizeof(float));
+        connectedOutputs.insert(wire.fromComponentId);
+        connectedInputs.insert(wire.toComponentId);
+    }
 
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
-        glEnableVertexAttribArray(0);
+    QVector<qsizetype> offsets;
+    QVector<float> instances = tessellateParallel(order.size(), [&](qsizetype index, auto& sink)
+    {
+        appendTerminalInstances(sink, *order[index], connectedOutputs, connectedInputs);
+    }, offsets);
 
-        glDrawArrays(GL_TRIANGLES, 0, terminalVertices.size() / 2);
+    m_terminalCount = instances.size() / 4;
+    if (m_terminalCount == 0)
+        return;
 
-        terminalVBO.release();
-    }
+    m_terminalVBO.bind();
+    m_terminalVBO.allocate(instances.constData(), instances.size() * sizeof(float));
+    recordGpuBytes("terminals", instances.size() * sizeof(float));
+    m_terminalVBO.release();
+}
 
-    m_componentProgram->release();
+void CircuitRenderer::renderTerminals()
+{
+    if (!m_terminalProgram || m_terminalCount == 0)
+        return;
+
+    m_terminalProgram->bind();
+    m_terminalProgram->setUniformValue("projection", viewProjection());
+    m_terminalProgram->setUniformValue("radius", TerminalRadius);
+    m_terminalProgram->setUniformValue("smoothing", maskSmoothing());
+
+    // Every pin in one draw call
+    m_terminalVAO.bind();
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_terminalCount);
+    m_terminalVAO.release();
+
+    m_terminalProgram->release();
 }
 
 void CircuitRenderer::updateDotGeometry()
@@ -954,27 +4270,31 @@ void CircuitRenderer::updateDotGeometry()
     {
         for (float y = startY; y <= worldBottom; y += dotSpacing)
         {
-            // Create a small square for each dot (2 triangles = 6 vertices)
+            // Create a small square for each dot (2 triangles = 6 vertices),
+            // each vertex followed by its corner in the square's [-1, 1] frame
             float half = dotSize / 2.0f;
 
             // Triangle 1
-            vertices << x - half << y - half;
-            vertices << x + half << y - half;
-            vertices << x - half << y + half;
+            vertices << x - half << y - half << -1.0f << -1.0f;
+            vertices << x + half << y - half << 1.0f << -1.0f;
+            vertices << x - half << y + half << -1.0f << 1.0f;
 
             // Triangle 2
-            vertices << x + half << y - half;
-            vertices << x + half << y + half;
-            vertices << x - half << y + half;
+            vertices << x + half << y - half << 1.0f << -1.0f;
+            vertices << x + half << y + half << 1.0f << 1.0f;
+            vertices << x - half << y + half << -1.0f << 1.0f;
         }
     }
 
     m_dotVAO.bind();
     m_dotVBO.bind();
     m_dotVBO.allocate(vertices.data(), vertices.size() * sizeof(float));
+    recordGpuBytes("grid dots", vertices.size() * sizeof(float));
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
     glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), reinterpret_cast<void*>(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
 
     m_dotVBO.release();
     m_dotVAO.release();
@@ -982,48 +4302,66 @@ void CircuitRenderer::updateDotGeometry()
 
 void CircuitRenderer::updateWireGeometry()
 {
+    m_wireVertexCount = 0;
     if (m_wires.isEmpty())
         return;
 
-    QVector<float> vertices;
-
-    for (const Wire& wire : m_wires)
+    // Wires attached to a selected part move with it and belong to the overlay
+    QSet<int> selected;
+    for (const Component& comp : std::as_const(m_components))
     {
-        // Find component positions
-        QPointF fromPos, toPos;
-        bool foundFrom = false, foundTo = false;
+        if (comp.selected)
+            selected.insert(comp.id);
+    }
 
-        for (const Component& comp : m_components)
+    QVector<const Wire*> order;
+    order.reserve(m_wires.size());
+    bool unrouted = false;
+    for (const Wire& wire : std::as_const(m_wires))
+    {
+        if (!selected.contains(wire.fromComponentId) && !selected.contains(wire.toComponentId))
         {
-            if (comp.id == wire.fromComponentId)
-            {
-                fromPos = QPointF(comp.position.x() + comp.width / 2, comp.position.y() + comp.height / 2);
-                foundFrom = true;
-            }
-            if (comp.id == wire.toComponentId)
-            {
-                toPos = QPointF(comp.position.x() + comp.width / 2, comp.position.y() + comp.height / 2);
-                foundTo = true;
-            }
+            order.append(&wire);
+            unrouted = unrouted || wire.points.size() < 2;
         }
+    }
 
-        if (foundFrom && foundTo)
-        {
-            // Simple straight line for now
-            vertices << fromPos.x() << fromPos.y();
-            vertices << toPos.x() << toPos.y();
-        }
+    // Only needed for wires without a route; built before the workers start
+    const QHash<int, QPointF> centers = unrouted ? componentCenters(m_components) : QHash<int, QPointF>();
+
+    QVector<qsizetype> offsets;
+    QVector<float> vertices = tessellateParallel(order.size(), [&order, &centers](qsizetype index, auto& sink)
+    {
+        appendWireSegments(sink, *order[index], centers);
+    }, offsets);
+
+    m_wireVertexCount = vertices.size() / 2;
+
+    // Heat map item of each segment: wires follow the parts. Only topology
+    // changes reach here; new values leave both buffers as they are.
+    QVector<float> items;
+    items.reserve(vertices.size() / 4);
+    for (qsizetype i = 0; i < order.size(); ++i)
+    {
+        const float item = float(m_components.size() + (order[i] - m_wires.constData()));
+        items.insert(items.size(), (offsets[i + 1] - offsets[i]) / 4, item);
     }
 
     m_wireVAO.bind();
     m_wireVBO.bind();
     m_wireVBO.allocate(vertices.data(), vertices.size() * sizeof(float));
+    recordGpuBytes("wires", vertices.size() * sizeof(float));
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
-    glEnableVertexAttribArray(0);
+    // One segment (x0, y0, x1, y1) per instance
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
 
     m_wireVBO.release();
     m_wireVAO.release();
+
+    m_wireItemVBO.bind();
+    m_wireItemVBO.allocate(items.constData(), items.size() * sizeof(float));
+    recordGpuBytes("wire items", items.size() * sizeof(float));
+    m_wireItemVBO.release();
 }
 
 void CircuitRenderer::renderDots()
@@ -1032,22 +4370,13 @@ void CircuitRenderer::renderDots()
         return;
 
     m_dotProgram->bind();
-
-    // Use world-to-screen transformation
-    QMatrix4x4 projection;
-    projection.setToIdentity();
-    projection.ortho(-m_panOffset.x() / m_zoom,
-                     (m_viewportSize.width() - m_panOffset.x()) / m_zoom,
-                     (m_viewportSize.height() - m_panOffset.y()) / m_zoom,
-                     -m_panOffset.y() / m_zoom, -1, 1);
-    projection.scale(m_zoom, m_zoom, 1);
-
-    m_dotProgram->setUniformValue("projection", projection);
+    m_dotProgram->setUniformValue("projection", viewProjection());
 
     // Set dot color (darker than grid)
     QVector4D dotColorVec(m_gridColor.redF() * 1.5f, m_gridColor.greenF() * 1.5f,
                           m_gridColor.blueF() * 1.5f, m_gridColor.alphaF());
     m_dotProgram->setUniformValue("dotColor", dotColorVec);
+    m_dotProgram->setUniformValue("smoothing", edgeSmoothing());
 
     m_dotVAO.bind();
 
@@ -1077,33 +4406,461 @@ void CircuitRenderer::renderDots()
 
 void CircuitRenderer::renderWires()
 {
-    if (!m_wireProgram || m_wires.isEmpty())
+    if (!m_lineProgram || m_wireVertexCount == 0)
+        return;
+
+    bindLineProgram(viewProjection());
+
+    // Set wire color (yellow), unless the heat map colors them by voltage
+    QVector4D wireColorVec(1.0f, 1.0f, 0.0f, 1.0f);
+    m_lineProgram->setUniformValue("lineColor", wireColorVec);
+    m_lineProgram->setUniformValue("lineWidth", 3.0f);
+    const bool heat = bindHeatMap(m_lineProgram, 1, m_heatMapVoltageRange);
+
+    m_wireVAO.bind();
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_wireVertexCount / 2);
+    m_wireVAO.release();
+
+    if (heat)
+        releaseHeatMap();
+    m_lineProgram->release();
+}
+
+void CircuitRenderer::updateHeatMapItems()
+{
+    const qsizetype count = m_components.size() + m_wires.size();
+    const int rows = qMax(1, int((count + HeatMapRow - 1) / HeatMapRow));
+    QVector<float> texels(qsizetype(rows) * HeatMapRow * 4, -1.0f);
+    const Netlist& netlist = m_heatMapNetlist;
+
+    // Parts: the nodes of their terminals and the current of their element,
+    // which follows the voltages in the value texture
+    for (qsizetype i = 0; i < m_components.size(); ++i)
+    {
+        const int id = m_components[i].id;
+        auto nodes = netlist.componentNodes.constFind(id);
+        if (nodes == netlist.componentNodes.constEnd())
+            continue;
+        float* texel = texels.data() + i * 4;
+        texel[0] = float(nodes->first);
+        texel[1] = float(nodes->second);
+        auto element = netlist.componentElements.constFind(id);
+        if (element != netlist.componentElements.constEnd())
+            texel[2] = float(netlist.nodeCount + element.value());
+    }
+
+    // Wires: the net of the output they leave, or of the input they reach
+    for (qsizetype i = 0; i < m_wires.size(); ++i)
+    {
+        const Wire& wire = m_wires[i];
+        int net = -1;
+        auto from = netlist.componentNodes.constFind(wire.fromComponentId);
+        auto to = netlist.componentNodes.constFind(wire.toComponentId);
+        if (from != netlist.componentNodes.constEnd())
+            net = from->second;
+        else if (to != netlist.componentNodes.constEnd())
+            net = to->first;
+        float* texel = texels.data() + (m_components.size() + i) * 4;
+        texel[0] = texel[1] = float(net);
+    }
+
+    updateHeatMapTexture("heat map items", m_heatMapItems, QOpenGLTexture::RGBA32F, QOpenGLTexture::RGBA, rows, texels);
+}
+
+void CircuitRenderer::updateHeatMapTexture(const char* item, QOpenGLTexture*& texture,
+                                           QOpenGLTexture::TextureFormat format,
+                                           QOpenGLTexture::PixelFormat pixelFormat, int rows,
+                                           const QVector<float>& texels)
+{
+    // Storage is reallocated only when the rows run out; otherwise the texels
+    // replace the old ones in place
+    if (!texture || texture->height() < rows)
+    {
+        delete texture;
+        texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        texture->setFormat(format);
+        texture->setSize(HeatMapRow, rows);
+        texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+        texture->allocateStorage(pixelFormat, QOpenGLTexture::Float32);
+    }
+    QOpenGLPixelTransferOptions options;
+    options.setAlignment(4);
+    texture->setData(0, 0, 0, HeatMapRow, rows, 1, pixelFormat, QOpenGLTexture::Float32, texels.constData(), &options);
+    const int channels = pixelFormat == QOpenGLTexture::RGBA ? 4 : 1;
+    recordGpuBytes(item, qint64(texture->width()) * texture->height() * channels * qint64(sizeof(float)));
+}
+
+bool CircuitRenderer::heatMapShown() const
+{
+    return m_heatMap != CircuitViewport::NoHeatMap && !m_heatMapValues.isEmpty() && m_heatMapItems
+           && m_heatMapValueTexture;
+}
+
+bool CircuitRenderer::bindHeatMap(QOpenGLShaderProgram* program, int mode, const QVector2D& range)
+{
+    const bool shown = heatMapShown();
+    program->setUniformValue("heatMode", shown ? mode : 0);
+    if (!shown)
+        return false;
+    program->setUniformValue("heatRange", range);
+    program->setUniformValue("heatItems", 1);
+    program->setUniformValue("heatValues", 2);
+    m_heatMapItems->bind(1, QOpenGLTexture::ResetTextureUnit);
+    m_heatMapValueTexture->bind(2, QOpenGLTexture::ResetTextureUnit);
+    return true;
+}
+
+void CircuitRenderer::releaseHeatMap()
+{
+    m_heatMapItems->release(1, QOpenGLTexture::ResetTextureUnit);
+    m_heatMapValueTexture->release(2, QOpenGLTexture::ResetTextureUnit);
+}
+
+void CircuitRenderer::renderOverlay()
+{
+    // Everything here may change every frame, so it is gathered into one block
+    // and streamed; offsets below are in floats from the start of the block
+    QVector<float> data;
+
+    // Selected primitive parts (shape triangles)
+    for (const Component& comp : std::as_const(m_overlayComponents))
+    {
+        if (comp.subcircuitId < 0)
+            appendComponentShape(data, comp);
+    }
+    const int partVertices = data.size() / FloatsPerShapeVertex;
+
+    // Wires attached to the selection (x0, y0, x1, y1 segments)
+    const qsizetype wiresBegin = data.size();
+    for (const Wire& wire : std::as_const(m_overlayWires))
+        appendWireSegments(data, wire, m_overlayCenters);
+    const int wireSegments = (data.size() - wiresBegin) / 4;
+
+    // Selection band (closed) and the wire being drawn (open), as segments
+    const qsizetype bandBegin = data.size();
+    for (qsizetype i = 0; m_selectionOutline.size() >= 2 && i < m_selectionOutline.size(); ++i)
+    {
+        const QPointF& from = m_selectionOutline[i];
+        const QPointF& to = m_selectionOutline[(i + 1) % m_selectionOutline.size()];
+        data << from.x() << from.y() << to.x() << to.y();
+    }
+    const qsizetype previewBegin = data.size();
+    for (qsizetype i = 1; i < m_wirePreview.size(); ++i)
+    {
+        data << m_wirePreview[i - 1].x() << m_wirePreview[i - 1].y();
+        data << m_wirePreview[i].x() << m_wirePreview[i].y();
+    }
+
+    // Pins of selected parts, rule check markers, then the hovered pin again
+    // on top (x, y, flags, unused)
+    const qsizetype terminalsBegin = data.size();
+    for (const Component& comp : std::as_const(m_overlayComponents))
+        appendTerminalInstances(data, comp, m_connectedOutputs, m_connectedInputs);
+    for (const QPointF& marker : std::as_const(m_diagnosticMarkers))
+        data << marker.x() << marker.y() << float(TerminalFlagged) << 0.0f;
+    if (m_hoveredPinFlags != 0)
+        data << m_hoveredPin.x() << m_hoveredPin.y() << float(m_hoveredPinFlags) << 0.0f;
+    const int terminalCount = (data.size() - terminalsBegin) / 4;
+
+    // Labels of selected parts
+    const qsizetype textBegin = data.size();
+    if (!m_overlayComponents.isEmpty() && !m_viewportSize.isEmpty())
+    {
+        const QRectF visible = itemProjection().inverted().mapRect(QRectF(-1.0, -1.0, 2.0, 2.0));
+        const float pixelsPerUnit = visible.width() > 0.0 ? m_viewportSize.width() / visible.width() : 0.0f;
+        QVector<TextRun> runs;
+        QVector<float> glyphs;
+        for (const Component& comp : std::as_const(m_overlayComponents))
+            layoutLabels(comp, runs, glyphs);
+        for (const TextRun& run : std::as_const(runs))
+        {
+            const float alpha = legibilityAlpha(run.height * pixelsPerUnit);
+            if (alpha <= 0.0f)
+                continue;
+            const float* source = glyphs.constData() + run.firstGlyph * FloatsPerGlyph;
+            for (int i = 0; i < run.glyphCount * FloatsPerGlyph; ++i)
+                data << ((i + 1) % FloatsPerGlyph == 0 ? alpha : source[i]);
+        }
+    }
+    const int glyphCount = (data.size() - textBegin) / FloatsPerGlyph;
+
+    // Selected subcircuit instances, grouped by definition
+    QHash<int, QVector<float>> instanceData;
+    for (const Component& comp : std::as_const(m_overlayComponents))
+    {
+        if (comp.subcircuitId >= 0 && m_subcircuitGeometry.contains(comp.subcircuitId))
+        {
+            instanceData[comp.subcircuitId] << float(comp.position.x()) << float(comp.position.y())
+                                            << qDegreesToRadians(comp.rotation) << 1.0f;
+        }
+    }
+    QHash<int, qsizetype> instancesBegin;
+    for (auto it = instanceData.cbegin(); it != instanceData.cend(); ++it)
+    {
+        instancesBegin.insert(it.key(), data.size());
+        data += it.value();
+    }
+
+    if (data.isEmpty())
+        return;
+    const qsizetype base = m_overlayStream.upload(data.constData(), data.size() * sizeof(float));
+    recordGpuBytes("overlay stream", m_overlayStream.byteSize());
+    if (base < 0)
         return;
+    auto at = [base](qsizetype floats) { return reinterpret_cast<void*>(base + floats * sizeof(float)); };
+    const QMatrix4x4 projection = viewProjection();
+
+    // Same order as the static layer: subcircuits, parts, wires, pins, text
+    if (!instancesBegin.isEmpty() && m_instanceProgram)
+    {
+        m_instanceProgram->bind();
+        m_instanceProgram->setUniformValue("projection", projection);
+        glLineWidth(1.0f);
+        for (auto it = instancesBegin.cbegin(); it != instancesBegin.cend(); ++it)
+        {
+            SubcircuitGeometry* geometry = m_subcircuitGeometry.value(it.key());
+            const int count = instanceData.value(it.key()).size() / 4;
+            m_instanceProgram->setUniformValue("blockSize", QVector2D(geometry->size.width(), geometry->size.height()));
+            geometry->vao.bind();
+            m_overlayStream.bind();
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), at(it.value()));
+            glDrawArraysInstanced(GL_TRIANGLES, 0, geometry->triangleVertexCount, count);
+            glDrawArraysInstanced(GL_LINES, geometry->triangleVertexCount, geometry->lineVertexCount, count);
+
+            // Point the instance attribute back at the static instances
+            geometry->instanceVBO.bind();
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
+            geometry->vao.release();
+        }
+        m_instanceProgram->release();
+    }
+
+    // Selected parts are highlighted in yellow, like their wires
+    if (partVertices > 0 && m_componentProgram)
+    {
+        m_componentProgram->bind();
+        m_componentProgram->setUniformValue("projection", projection);
+        m_componentProgram->setUniformValue("smoothing", edgeSmoothing());
+        m_componentProgram->setUniformValue("componentColor", QVector4D(1.0f, 1.0f, 0.0f, 1.0f));
+        m_componentProgram->setUniformValue("heatMode", 0);
+        m_overlayShapeVAO.bind();
+        m_overlayStream.bind();
+        const int stride = FloatsPerShapeVertex * sizeof(float);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, at(0));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, at(2));
+        glEnableVertexAttribArray(1);
+        glDrawArrays(GL_TRIANGLES, 0, partVertices);
+        m_overlayShapeVAO.release();
+        m_componentProgram->release();
+    }
+
+    auto drawSegments = [&](qsizetype begin, int count, const QVector4D& color, float width)
+    {
+        if (count == 0)
+            return;
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), at(begin));
+        m_lineProgram->setUniformValue("lineColor", color);
+        m_lineProgram->setUniformValue("lineWidth", width);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    };
+
+    bindLineProgram(projection);
+    m_overlayVAO.bind();
+    m_overlayStream.bind();
+    drawSegments(wiresBegin, wireSegments, QVector4D(1.0f, 1.0f, 0.0f, 1.0f), 3.0f);
+    m_overlayVAO.release();
+    m_lineProgram->release();
+
+    if (terminalCount > 0 && m_terminalProgram)
+    {
+        m_terminalProgram->bind();
+        m_terminalProgram->setUniformValue("projection", projection);
+        m_terminalProgram->setUniformValue("radius", TerminalRadius);
+        m_terminalProgram->setUniformValue("smoothing", maskSmoothing());
+        m_terminalVAO.bind();
+        m_overlayStream.bind();
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), at(terminalsBegin));
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, terminalCount);
+        m_terminalVBO.bind();
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), nullptr);
+        m_terminalVAO.release();
+        m_terminalProgram->release();
+    }
+
+    if (glyphCount > 0 && m_textProgram && m_glyphTexture)
+    {
+        m_textProgram->bind();
+        m_textProgram->setUniformValue("projection", projection);
+        m_textProgram->setUniformValue("atlas", 0);
+        m_textProgram->setUniformValue("smoothing", maskSmoothing());
+        m_glyphTexture->bind(0);
+        m_textVAO.bind();
+        const int stride = FloatsPerGlyph * sizeof(float);
+        for (QOpenGLBuffer* buffer : {static_cast<QOpenGLBuffer*>(nullptr), &m_textInstanceVBO})
+        {
+            // First at the streamed glyphs to draw, then back at the static ones
+            if (buffer)
+                buffer->bind();
+            else
+                m_overlayStream.bind();
+            for (int attribute = 1; attribute <= 3; ++attribute)
+            {
+                const qsizetype offset = (attribute - 1) * 4;
+                glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, stride,
+                                      buffer ? reinterpret_cast<void*>(offset * sizeof(float)) : at(textBegin + offset));
+            }
+            if (!buffer)
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, glyphCount);
+        }
+        m_textVAO.release();
+        m_glyphTexture->release(0);
+        m_textProgram->release();
+    }
 
-    m_wireProgram->bind();
+    // Band and wire preview go on top of everything
+    bindLineProgram(projection);
+    m_overlayVAO.bind();
+    m_overlayStream.bind();
+    drawSegments(bandBegin, int(previewBegin - bandBegin) / 4, QVector4D(0.4f, 0.7f, 1.0f, 1.0f), 1.0f);
+    drawSegments(previewBegin, int(terminalsBegin - previewBegin) / 4, QVector4D(1.0f, 1.0f, 0.0f, 0.6f), 2.0f);
+    m_overlayVAO.release();
+    m_lineProgram->release();
+
+    m_overlayStream.release();
+    m_overlayStream.fence();
+}
+
+QMatrix4x4 CircuitRenderer::viewProjection() const
+{
+    return m_targetTransform * itemProjection();
+}
 
-    // Use world-to-screen transformation
+QMatrix4x4 CircuitRenderer::itemProjection() const
+{
     QMatrix4x4 projection;
-    projection.setToIdentity();
     projection.ortho(-m_panOffset.x() / m_zoom,
                      (m_viewportSize.width() - m_panOffset.x()) / m_zoom,
                      (m_viewportSize.height() - m_panOffset.y()) / m_zoom,
                      -m_panOffset.y() / m_zoom, -1, 1);
     projection.scale(m_zoom, m_zoom, 1);
+    return projection;
+}
+
+void CircuitRenderer::layoutLabels(const Component& comp, QVector<TextRun>& runs, QVector<float>& glyphs) const
+{
+    // Centers a line of text on the anchor's x with its baseline on the anchor's y
+    auto layout = [&](const QString& text, const QPointF& anchor, float size, const QColor& color)
+    {
+        float width = 0.0f;
+        for (QChar c : text)
+            width += m_glyphAtlas.advance(c) * size;
+
+        TextRun run;
+        run.height = size;
+        run.firstGlyph = glyphs.size() / FloatsPerGlyph;
+        float penX = anchor.x() - width / 2.0f;
+        for (QChar c : text)
+        {
+            const GlyphAtlas::Glyph* glyph = m_glyphAtlas.glyph(c);
+            if (glyph && !glyph->plane.isEmpty())
+            {
+                QRectF quad(penX + glyph->plane.x() * size, anchor.y() + glyph->plane.y() * size,
+                            glyph->plane.width() * size, glyph->plane.height() * size);
+                glyphs << quad.x() << quad.y() << quad.width() << quad.height()
+                       << glyph->uv.left() << glyph->uv.top() << glyph->uv.right() << glyph->uv.bottom()
+                       << color.redF() << color.greenF() << color.blueF() << 1.0f;
+                run.bounds |= quad;
+                ++run.glyphCount;
+            }
+            penX += m_glyphAtlas.advance(c) * size;
+        }
+        if (run.glyphCount > 0)
+            runs.append(run);
+    };
+
+    const QColor labelColor(220, 220, 220);
+    const QColor valueColor(150, 200, 255);
+    const QRectF bounds = componentBounds(comp);
+    if (!comp.label.isEmpty())
+        layout(comp.label, QPointF(bounds.center().x(), bounds.top() - 4.0f), LabelTextSize, labelColor);
+
+    const QString value = formatValue(comp);
+    if (!value.isEmpty())
+        layout(value, QPointF(bounds.center().x(), bounds.bottom() + ValueTextSize + 2.0f), ValueTextSize, valueColor);
+}
 
-    m_wireProgram->setUniformValue("projection", projection);
+void CircuitRenderer::updateTextLayout()
+{
+    m_textRuns.clear();
+    m_textGlyphs.clear();
 
-    // Set wire color (yellow)
-    QVector4D wireColorVec(1.0f, 1.0f, 0.0f, 1.0f);
-    m_wireProgram->setUniformValue("componentColor", wireColorVec);
+    // Labels of selected parts are laid out with the overlay every frame
+    for (const Component& comp : std::as_const(m_components))
+    {
+        if (!comp.selected)
+            layoutLabels(comp, m_textRuns, m_textGlyphs);
+    }
+    MemoryStats::set(MemoryStats::RendererCopies, QStringLiteral("text layout"),
+                     m_textGlyphs.capacity() * qint64(sizeof(float)) + m_textRuns.capacity() * qint64(sizeof(TextRun)));
+}
 
-    m_wireVAO.bind();
+void CircuitRenderer::updateTextInstances()
+{
+    m_textGlyphCount = 0;
+    if (m_textRuns.isEmpty() || m_viewportSize.isEmpty())
+        return;
 
-    glLineWidth(3.0f);
-    glDrawArrays(GL_LINES, 0, m_wires.size() * 2);
+    // Visible world rectangle and the screen pixels per world unit
+    const QRectF visible = itemProjection().inverted().mapRect(QRectF(-1.0, -1.0, 2.0, 2.0));
+    if (visible.width() <= 0.0)
+        return;
+    const float pixelsPerUnit = m_viewportSize.width() / visible.width();
 
-    m_wireVAO.release();
-    m_wireProgram->release();
+    QVector<float> instances;
+    for (const TextRun& run : std::as_const(m_textRuns))
+    {
+        const float alpha = legibilityAlpha(run.height * pixelsPerUnit);
+        if (alpha <= 0.0f || !run.bounds.intersects(visible))
+            continue;
+
+        const int first = instances.size();
+        const float* source = m_textGlyphs.constData() + run.firstGlyph * FloatsPerGlyph;
+        instances.resize(first + run.glyphCount * FloatsPerGlyph);
+        std::copy(source, source + run.glyphCount * FloatsPerGlyph, instances.begin() + first);
+        for (int i = first + FloatsPerGlyph - 1; i < instances.size(); i += FloatsPerGlyph)
+            instances[i] = alpha;
+    }
+
+    m_textGlyphCount = instances.size() / FloatsPerGlyph;
+    if (m_textGlyphCount == 0)
+        return;
+
+    m_textInstanceVBO.bind();
+    m_textInstanceVBO.allocate(instances.constData(), instances.size() * sizeof(float));
+    recordGpuBytes("text", instances.size() * sizeof(float));
+    m_textInstanceVBO.release();
+}
+
+void CircuitRenderer::renderText()
+{
+    if (!m_textProgram || !m_glyphTexture || m_textGlyphCount == 0)
+        return;
+
+    m_textProgram->bind();
+    m_textProgram->setUniformValue("projection", viewProjection());
+    m_textProgram->setUniformValue("atlas", 0);
+    m_textProgram->setUniformValue("smoothing", maskSmoothing());
+    m_glyphTexture->bind(0);
+
+    // Every visible glyph in one draw call
+    m_textVAO.bind();
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_textGlyphCount);
+    m_textVAO.release();
+
+    m_glyphTexture->release(0);
+    m_textProgram->release();
 }
 
 void CircuitRenderer::renderResistor(const Component& comp)
@@ -1,16 +1,51 @@
 #pragma once
 
-#include <QQuickFramebufferObject>
-#include <QOpenGLFunctions>
+#include <QQuickItem>
+#include <QSGRenderNode>
+#include <QOpenGLExtraFunctions>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
 #include <QOpenGLVertexArrayObject>
+#include <QOpenGLTexture>
+#include <QOpenGLFramebufferObject>
+#include <QMatrix4x4>
+#include <QVector2D>
+#include <QVector4D>
 #include <QColor>
 #include <QMouseEvent>
 #include <QWheelEvent>
+#include <QHoverEvent>
 #include <QPointF>
 #include <QVector>
 #include <QString>
+#include <QSharedPointer>
+#include <QPointer>
+#include <QThread>
+#include <QAtomicInt>
+#include <QTimer>
+#include <QHash>
+#include <QSizeF>
+#include <QSet>
+#include <QPolygonF>
+#include <QTransform>
+#include <QVariantList>
+#include <QVariantMap>
+#include <QAbstractListModel>
+#include "EditJournal.h"
+#include "UndoHistory.h"
+#include "SpatialIndex.h"
+#include "WireRouter.h"
+#include "GlyphAtlas.h"
+#include "StreamingBuffer.h"
+#include "RuleChecker.h"
+#include "LiveOperatingPoint.h"
+#include "Netlist.h"
+#include <memory>
+#include <vector>
+
+class SchematicReader;
+class ComponentListModel;
+class WireListModel;
 
 // Wire connection structure
 struct Wire
@@ -42,7 +77,10 @@ struct Component
     float width;
     float height;
     bool selected;
-    float rotation; // For future use
+    float rotation; // Degrees, clockwise about the part's center
+    QString label;  // Reference designator, e.g. "R1"
+    double value;   // Primary value in SI units (ohms, farads, henries, volts)
+    int subcircuitId; // Definition this part instantiates, -1 for primitives
 
     // Connection terminals (input/output points)
     QVector<QPointF> inputTerminals;
@@ -50,7 +88,8 @@ struct Component
 
     Component(int componentId, const QString& t, const QPointF& pos, const QColor& c = QColor(255, 255, 255),
               float w = 40.0f, float h = 20.0f)
-        : id(componentId), type(t), position(pos), color(c), width(w), height(h), selected(false), rotation(0.0f)
+        : id(componentId), type(t), position(pos), color(c), width(w), height(h), selected(false), rotation(0.0f),
+          value(0.0), subcircuitId(-1)
     {
         setupTerminals();
     }
@@ -78,6 +117,26 @@ struct Component
             inputTerminals.append(QPointF(position.x(), position.y() + height / 2));          // Negative
             outputTerminals.append(QPointF(position.x() + width, position.y() + height / 2)); // Positive
         }
+        else if (type == "Subcircuit")
+        {
+            // Block ports: the definition's input on the left, its output on the right
+            inputTerminals.append(QPointF(position.x(), position.y() + height / 2));
+            outputTerminals.append(QPointF(position.x() + width, position.y() + height / 2));
+        }
+
+        // Terminals turn with the part
+        if (!qFuzzyIsNull(rotation))
+        {
+            QPointF center(position.x() + width / 2, position.y() + height / 2);
+            QTransform transform;
+            transform.translate(center.x(), center.y());
+            transform.rotate(rotation);
+            transform.translate(-center.x(), -center.y());
+            for (QPointF& terminal : inputTerminals)
+                terminal = transform.map(terminal);
+            for (QPointF& terminal : outputTerminals)
+                terminal = transform.map(terminal);
+        }
     }
 
     // Equality operator for Qt container comparison
@@ -89,7 +148,11 @@ struct Component
                color == other.color &&
                qFuzzyCompare(width, other.width) &&
                qFuzzyCompare(height, other.height) &&
-               selected == other.selected;
+               selected == other.selected &&
+               label == other.label &&
+               value == other.value &&
+               subcircuitId == other.subcircuitId &&
+               rotation == other.rotation;
     }
 
     bool operator!=(const Component& other) const
@@ -118,7 +181,113 @@ struct Component
     }
 };
 
-class CircuitViewport : public QQuickFramebufferObject
+// One pin of a part: its index-th output or input terminal
+struct TerminalRef
+{
+    int componentId = -1;
+    bool output = false;
+    int index = 0;
+
+    bool isValid() const { return componentId >= 0; }
+    bool operator==(const TerminalRef& other) const
+    {
+        return componentId == other.componentId && output == other.output && index == other.index;
+    }
+    bool operator!=(const TerminalRef& other) const { return !(*this == other); }
+};
+
+// Reusable block. Instances are Components of type "Subcircuit" that refer to
+// a definition by id and place it with their position and rotation, so the
+// model holds each block's contents once however often it is used.
+struct SubcircuitDefinition
+{
+    int id = -1;
+    QString name;
+    QVector<Component> components; // Local coordinates, origin at the block's top-left
+    QVector<Wire> wires;
+    QSizeF size;
+    // Ports: the instance's input terminal is this part's input, its output
+    // terminal this part's output
+    int inputComponentId = -1;
+    int outputComponentId = -1;
+    int revision = 0; // Bumped on every change so renderers re-tessellate once
+};
+
+// Approximate heap footprints, for the undo budget and memory accounting
+inline qint64 componentByteSize(const Component& comp)
+{
+    return qint64(sizeof(Component)) + (comp.type.size() + comp.label.size()) * qint64(sizeof(QChar)) +
+           (comp.inputTerminals.size() + comp.outputTerminals.size()) * qint64(sizeof(QPointF));
+}
+
+inline qint64 wireByteSize(const Wire& wire)
+{
+    return qint64(sizeof(Wire)) + wire.points.size() * qint64(sizeof(QPointF));
+}
+
+inline qint64 subcircuitByteSize(const SubcircuitDefinition& definition)
+{
+    qint64 bytes = definition.name.size() * qint64(sizeof(QChar));
+    for (const Component& comp : definition.components)
+        bytes += componentByteSize(comp);
+    for (const Wire& wire : definition.wires)
+        bytes += wireByteSize(wire);
+    return bytes;
+}
+
+// What a batch of model edits touched, reported once per batch. Ranges are
+// indices into components() and wires() after the edit and include the slots
+// that removals filled by moving the last part or shifting later wires.
+struct DesignChange
+{
+    Q_GADGET
+    QML_VALUE_TYPE(designChange)
+    Q_PROPERTY(int firstComponent MEMBER firstComponent)
+    Q_PROPERTY(int lastComponent MEMBER lastComponent)
+    Q_PROPERTY(int componentsAdded MEMBER componentsAdded)
+    Q_PROPERTY(int componentsRemoved MEMBER componentsRemoved)
+    Q_PROPERTY(int firstWire MEMBER firstWire)
+    Q_PROPERTY(int lastWire MEMBER lastWire)
+    Q_PROPERTY(int wiresAdded MEMBER wiresAdded)
+    Q_PROPERTY(int wiresRemoved MEMBER wiresRemoved)
+    Q_PROPERTY(bool reset MEMBER reset)
+    Q_PROPERTY(bool valuesChanged MEMBER valuesChanged)
+
+public:
+    int firstComponent = -1; // -1 when no part changed
+    int lastComponent = -1;
+    int componentsAdded = 0;
+    int componentsRemoved = 0;
+    int firstWire = -1; // -1 when no wire changed
+    int lastWire = -1;
+    int wiresAdded = 0;
+    int wiresRemoved = 0;
+    bool reset = false; // The design was cleared or replaced as a whole
+    bool valuesChanged = false; // A part's label or value was edited
+
+    bool isEmpty() const { return firstComponent < 0 && firstWire < 0 && componentsRemoved == 0 && wiresRemoved == 0 && !reset; }
+    // False for moves and reroutes, which leave the netlist as it was
+    bool changesNetlist() const
+    {
+        return componentsAdded > 0 || componentsRemoved > 0 || wiresAdded > 0 || wiresRemoved > 0 || reset ||
+               valuesChanged;
+    }
+    void touchComponents(int first, int last);
+    void touchWires(int first, int last);
+    void merge(const DesignChange& other);
+};
+
+// What the renderer picks up at its next sync, so it never compares or scans
+// the design. Moves of selected parts only change the overlay, which holds
+// copies of those parts; anything else redraws the cached layer.
+struct RenderChange
+{
+    QSet<int> movedIds; // Selected parts moved since the last sync
+    bool staticEdit = false; // An edit outside the selection, or one that changed the connectivity
+    int selectionRevision = 0; // Bumped whenever a part is selected or deselected
+};
+
+class CircuitViewport : public QQuickItem, private EditJournal::Target
 {
     Q_OBJECT
     QML_ELEMENT
@@ -128,10 +297,47 @@ class CircuitViewport : public QQuickFramebufferObject
     Q_PROPERTY(QColor backgroundColor READ backgroundColor WRITE setBackgroundColor NOTIFY backgroundColorChanged)
     Q_PROPERTY(float zoom READ zoom WRITE setZoom NOTIFY zoomChanged)
     Q_PROPERTY(QPointF panOffset READ panOffset WRITE setPanOffset NOTIFY panOffsetChanged)
+    Q_PROPERTY(bool canUndo READ canUndo NOTIFY undoStateChanged)
+    Q_PROPERTY(bool canRedo READ canRedo NOTIFY undoStateChanged)
+    Q_PROPERTY(QString undoText READ undoText NOTIFY undoStateChanged)
+    Q_PROPERTY(QString redoText READ redoText NOTIFY undoStateChanged)
+    Q_PROPERTY(qint64 undoMemoryBudget READ undoMemoryBudget WRITE setUndoMemoryBudget NOTIFY undoMemoryBudgetChanged)
+    Q_PROPERTY(QVariantList subcircuits READ subcircuitList NOTIFY subcircuitsChanged)
+    Q_PROPERTY(int selectionCount READ selectionCount NOTIFY selectionChanged)
+    Q_PROPERTY(QAbstractListModel* componentModel READ componentModel CONSTANT)
+    Q_PROPERTY(QAbstractListModel* wireModel READ wireModel CONSTANT)
+    Q_PROPERTY(QVariantList diagnostics READ diagnosticList NOTIFY diagnosticsChanged)
+    Q_PROPERTY(bool liveDc READ liveDc WRITE setLiveDc NOTIFY liveDcChanged)
+    Q_PROPERTY(QString liveDcError READ liveDcError NOTIFY liveSolutionChanged)
+    Q_PROPERTY(HeatMap heatMap READ heatMap WRITE setHeatMap NOTIFY heatMapChanged)
+    Q_PROPERTY(AntialiasingQuality antialiasingQuality READ antialiasingQuality WRITE setAntialiasingQuality NOTIFY antialiasingQualityChanged)
 
 public:
+    // How edges are smoothed. Analytic coverage costs a few shader
+    // instructions and no extra memory, so it suits software rasterisers and
+    // low-end GPUs; the MSAA modes multisample the viewport's framebuffer.
+    enum AntialiasingQuality
+    {
+        NoAntialiasing,
+        AnalyticAntialiasing,
+        Msaa2x,
+        Msaa4x,
+        Msaa8x
+    };
+    Q_ENUM(AntialiasingQuality)
+
+    // What the heat map colors parts by; wires always show the voltage of
+    // their net
+    enum HeatMap
+    {
+        NoHeatMap,
+        CurrentHeatMap, // Magnitude of the current through each part
+        PowerHeatMap    // Power each part absorbs, negative for one that delivers it
+    };
+    Q_ENUM(HeatMap)
+
     explicit CircuitViewport(QQuickItem* parent = nullptr);
-    Renderer* createRenderer() const override;
+    ~CircuitViewport() override;
 
     float gridSize() const { return m_gridSize; }
     void setGridSize(float size);
@@ -142,6 +348,9 @@ public:
     QColor backgroundColor() const { return m_backgroundColor; }
     void setBackgroundColor(const QColor& color);
 
+    AntialiasingQuality antialiasingQuality() const { return m_antialiasingQuality; }
+    void setAntialiasingQuality(AntialiasingQuality quality);
+
     // Zoom and pan
     float zoom() const { return m_zoom; }
     void setZoom(float z);
@@ -154,9 +363,43 @@ public:
     Q_INVOKABLE void clearComponents();
     Q_INVOKABLE void selectComponent(float x, float y);
     Q_INVOKABLE void deselectAll();
+    Q_INVOKABLE void toggleSelectionAt(float x, float y);
+    Q_INVOKABLE void selectInRect(float x1, float y1, float x2, float y2, bool extend);
+    Q_INVOKABLE void selectInLasso(const QVariantList& points, bool extend);
+    void selectInPolygon(const QPolygonF& polygon, bool extend); // World coordinates
+    int selectionCount() const { return m_selection.size(); }
+    const QSet<int>& selection() const { return m_selection; }
+
+    // Interactive box (or lasso) selection in screen coordinates
+    Q_INVOKABLE void beginSelectionBand(float x, float y, bool lasso);
+    Q_INVOKABLE void extendSelectionBand(float x, float y);
+    Q_INVOKABLE void endSelectionBand(bool extend);
+    Q_INVOKABLE void cancelSelectionBand();
+    QPolygonF selectionOutline() const; // World coordinates, empty when idle
     Q_INVOKABLE void moveSelectedComponents(float deltaX, float deltaY);
     Q_INVOKABLE void snapSelectedToGrid();
+    Q_INVOKABLE void setComponentLabel(int componentId, const QString& label);
+    Q_INVOKABLE void setComponentValue(int componentId, double value);
     const QVector<Component>& components() const { return m_components; }
+    // Row-level views of components() and wires() for QML lists and inspectors
+    QAbstractListModel* componentModel() const;
+    QAbstractListModel* wireModel() const;
+
+    // Bulk edits, each one undo step and one designChanged(). Positions are
+    // world coordinates; from QML they are flat x, y arrays.
+    Q_INVOKABLE QList<int> addComponents(const QString& type, const QList<qreal>& positions);
+    QVector<int> addComponents(const QString& type, const QVector<QPointF>& positions);
+    Q_INVOKABLE void moveComponents(const QList<int>& ids, qreal deltaX, qreal deltaY);
+    Q_INVOKABLE void setComponentPositions(const QList<int>& ids, const QList<qreal>& positions);
+    void setComponentPositions(const QVector<int>& ids, const QVector<QPointF>& positions);
+    Q_INVOKABLE void deleteComponents(const QList<int>& ids); // Attached wires go too
+    // Wires fromIds[i] -> toIds[i], routed together
+    Q_INVOKABLE void connectComponents(const QList<int>& fromIds, const QList<int>& toIds);
+
+    // Calls between these form one transaction: one undo step and one
+    // designChanged() when the outermost batch ends. Batches nest.
+    Q_INVOKABLE void beginBatch();
+    Q_INVOKABLE void endBatch();
 
     // Wire management
     Q_INVOKABLE void startWire(int componentId);
@@ -164,36 +407,172 @@ public:
     Q_INVOKABLE void cancelWire();
     Q_INVOKABLE void handleWireConnection(int componentId);
     Q_INVOKABLE int getComponentAtPosition(float x, float y);
+
+    // Pin under the pointer, highlighted by the renderer
+    Q_INVOKABLE void hoverAt(float x, float y);
+    Q_INVOKABLE void clearHover();
+    TerminalRef hoveredTerminal() const { return m_hoveredTerminal; }
+    // Line from the pending wire's source pin to the pointer, empty when no
+    // wire is being drawn
+    QVector<QPointF> wirePreview() const;
     const QVector<Wire>& wires() const { return m_wires; }
+    const Component* componentById(int componentId) const;
+    QVector<int> attachedWires(int componentId) const { return m_wiresByComponent.value(componentId); }
+    // Edits since the last call; the renderer takes them once per sync
+    RenderChange takeRenderChange();
+    // Heap footprints as of the last memory stats update
+    qint64 componentBytes() const { return m_componentBytes; }
+    qint64 wireBytes() const { return m_wireBytes; }
+
+    // Electrical rule check, run on a worker thread after each change to the
+    // connectivity. Findings are {componentId, label, rule, message} maps.
+    QVariantList diagnosticList() const;
+    QVector<QPointF> diagnosticMarkers() const; // World positions of the flagged pins and parts
+
+    // Live operating point: while enabled, the design is solved again within
+    // the frame of every edit, by updating a resident factorization rather
+    // than refactoring (see LiveOperatingPoint)
+    bool liveDc() const { return m_liveDcEnabled; }
+    void setLiveDc(bool enabled);
+    QString liveDcError() const { return m_liveDc.errorString(); }
+    // {label, value} of a part, with {inputVoltage, outputVoltage, current}
+    // once solved; the current flows from the input terminal to the output
+    Q_INVOKABLE QVariantMap liveValues(int componentId) const;
+    const Netlist& liveNetlist() const { return m_liveNetlist; }
+    const LiveOperatingPoint& liveOperatingPoint() const { return m_liveDc; }
+
+    // Heat map overlay, by default of the live operating point. A change of
+    // values only uploads them to the renderer; the design is not tessellated
+    // again.
+    HeatMap heatMap() const { return m_heatMap; }
+    void setHeatMap(HeatMap heatMap);
+    // Shows other values than the live operating point, the samples of a
+    // transient result for instance. The netlist is a flattening of the
+    // current design, and each sample holds the voltage of each of its nodes
+    // and the current of each of its elements, as SimulationResult does, so
+    // animating a result costs one small upload per frame. The color scale
+    // spans every sample shown since the netlist was set. An empty netlist
+    // returns to the live operating point.
+    void setHeatMapNetlist(const Netlist& netlist);
+    void setHeatMapSample(const QVector<double>& voltages, const QVector<double>& currents);
+    const Netlist& heatMapNetlist() const { return m_heatMapExternal ? m_heatMapNetlist : m_liveNetlist; }
+    const QVector<double>& heatMapVoltages() const;
+    const QVector<double>& heatMapCurrents() const;
+    // Of the values shown: lowest and highest node voltage, and lowest and
+    // highest value per part (current or power)
+    QPair<double, double> heatMapVoltageRange() const { return m_heatMapVoltageRange; }
+    QPair<double, double> heatMapComponentRange() const { return m_heatMapComponentRange; }
+    int heatMapNetlistRevision() const { return m_heatMapNetlistRevision; }
+    int heatMapSampleRevision() const { return m_heatMapSampleRevision; }
+
+    // Bytes held per subsystem (see MemoryStats), current and peak:
+    // [{name, bytes, peakBytes, items: [{name, bytes, peakBytes}]}]
+    Q_INVOKABLE QVariantList memoryUsage();
+    Q_INVOKABLE void resetMemoryPeaks();
+
+    // Subcircuits
+    Q_INVOKABLE int defineSubcircuit(const QString& name);
+    Q_INVOKABLE bool redefineSubcircuit(int definitionId);
+    Q_INVOKABLE void instantiateSubcircuit(int definitionId, float x, float y);
+    Q_INVOKABLE QString exportNetlist() const;
+    QVariantList subcircuitList() const;
+    const QHash<int, SubcircuitDefinition>& subcircuitDefinitions() const { return m_subcircuits; }
+    int subcircuitRevision() const { return m_subcircuitRevision; }
+
+    // Undo/redo
+    Q_INVOKABLE void undo();
+    Q_INVOKABLE void redo();
+    // Property edits between these merge into one undo step, e.g. a slider
+    // drag; outside a group every edit is its own step
+    Q_INVOKABLE void beginUndoGroup();
+    Q_INVOKABLE void endUndoGroup();
+    bool canUndo() const { return m_history.canUndo(); }
+    bool canRedo() const { return m_history.canRedo(); }
+    QString undoText() const { return m_history.undoText(); }
+    QString redoText() const { return m_history.redoText(); }
+    qint64 undoMemoryBudget() const { return m_history.memoryBudget(); }
+    void setUndoMemoryBudget(qint64 bytes);
+
+    // Edits that are applied and journaled but not recorded in the undo
+    // history; undo and redo are expressed in these
+    void insertComponent(const Component& component);
+    void removeComponent(int componentId);
+    void translateComponents(const QVector<int>& ids, const QPointF& delta);
+    void placeComponents(const QVector<int>& ids, const QVector<QPointF>& positions);
+    void insertWire(const Wire& wire);
+    void removeWire(int index);
+    void insertComponents(const QVector<Component>& components);
+    void eraseComponents(const QVector<int>& ids);
+    void insertWires(const QVector<int>& indices, const QVector<Wire>& wires); // Ascending final indices
+    void eraseWires(const QVector<int>& indices);                             // Ascending
+    void replaceDesign(const QVector<Component>& components, const QVector<Wire>& wires);
+    void clearDesign();
+    void setComponentProperties(int componentId, const QString& label, double value);
+    void setSubcircuitDefinition(const SubcircuitDefinition& definition);
+    void removeSubcircuitDefinition(int definitionId);
+
+    // Persistence
+    Q_INVOKABLE bool saveSchematic(const QString& path);
+    Q_INVOKABLE bool loadSchematic(const QString& path);
+
+    // Crash recovery for the untitled session; named schematics recover on load
+    Q_INVOKABLE bool hasRecoverableSession() const;
+    Q_INVOKABLE bool recoverSession();
 
     // Coordinate transformation
     QPointF screenToWorld(const QPointF& screenPos) const;
     QPointF worldToScreen(const QPointF& worldPos) const;
 
 protected:
+    QSGNode* updatePaintNode(QSGNode* node, UpdatePaintNodeData* data) override;
+    void geometryChange(const QRectF& newGeometry, const QRectF& oldGeometry) override;
     void mousePressEvent(QMouseEvent* event) override;
     void mouseReleaseEvent(QMouseEvent* event) override;
     void mouseMoveEvent(QMouseEvent* event) override;
     void wheelEvent(QWheelEvent* event) override;
+    void hoverMoveEvent(QHoverEvent* event) override;
+    void hoverLeaveEvent(QHoverEvent* event) override;
 
 signals:
     void gridSizeChanged();
     void gridColorChanged();
     void backgroundColorChanged();
+    void antialiasingQualityChanged();
     void rightClicked(float x, float y);
     void componentAdded();
+    void designChanged(const DesignChange& change);
     void zoomChanged();
     void panOffsetChanged();
     void componentSelected(int componentId);
     void wireStarted(int componentId);
     void wireFinished(int fromId, int toId);
+    void schematicLoadProgress(int loadedTiles, int totalTiles);
+    void schematicLoaded(const QString& path);
+    void schematicError(const QString& message);
+    void undoStateChanged();
+    void undoMemoryBudgetChanged();
+    void subcircuitsChanged();
+    void selectionChanged();
+    void diagnosticsChanged();
+    void liveDcChanged();
+    void liveSolutionChanged();
+    void heatMapChanged();
 
 private:
     float m_gridSize = 20.0f;
     QColor m_gridColor = QColor(200, 100, 100, 255);
     QColor m_backgroundColor = QColor(30, 30, 30, 255);
+    AntialiasingQuality m_antialiasingQuality = Msaa4x;
     QVector<Component> m_components;
     QVector<Wire> m_wires;
+    QHash<int, int> m_componentIndex; // Component id -> index in m_components
+    QHash<int, SubcircuitDefinition> m_subcircuits;
+    int m_nextSubcircuitId = 1;
+    int m_subcircuitRevision = 0;
+    SpatialIndex m_spatialIndex;                  // Component bounds, for routing and hit tests
+    QHash<int, QVector<int>> m_wiresByComponent;  // Component id -> indices of attached wires
+    ComponentListModel* m_componentModel = nullptr;
+    WireListModel* m_wireModel = nullptr;
     QPointF m_lastRightClickPos;
 
     // Zoom and pan
@@ -202,31 +581,169 @@ private:
 
     // Selection and interaction
     int m_nextComponentId = 1;
-    int m_selectedComponentId = -1;
+    QSet<int> m_selection; // Ids of selected parts; mirrors Component::selected
     bool m_dragging = false;
+    bool m_bandActive = false;
+    bool m_bandLasso = false;
+    QPolygonF m_band; // Screen coordinates; two corners for a box
     QPointF m_lastMousePos;
     bool m_panning = false;
 
     // Wire creation
     bool m_creatingWire = false;
     int m_wireStartComponentId = -1;
+    QPointF m_wirePointer; // World position of the pointer while drawing a wire
+    TerminalRef m_hoveredTerminal;
+
+    // Schematic loading; tiles outside the view stream in on a worker thread
+    QSharedPointer<SchematicReader> m_schematicReader;
+    QString m_schematicPath;
+    QPointer<QThread> m_loaderThread;
+    QAtomicInt m_loadGeneration;
+    bool m_loadedOutOfOrder = false; // Streaming appends in a different order than the design's
+
+    // Autosave: every mutation is journaled, the journal is folded into the
+    // schematic file in the background
+    EditJournal m_journal;
+    QTimer m_compactionTimer;
+    QPointer<QThread> m_compactionThread;
+
+    UndoHistory m_history;
+
+    // Open batch: its edits and the change they add up to
+    int m_batchDepth = 0;
+    bool m_undoGroupOpen = false;
+    std::vector<std::unique_ptr<EditCommand>> m_batchCommands;
+    DesignChange m_pendingChange;
+    bool m_pendingSelectionChange = false;
+    bool m_pendingComponentAdded = false;
+    RenderChange m_renderChange; // Not held back by batches; the renderer only draws
+
+    // Rule check: connectivity edits pending for the checker, and its findings
+    QThread m_ruleThread;
+    RuleChecker* m_ruleChecker = nullptr; // Lives on m_ruleThread
+    RuleCheckDelta m_ruleDelta;
+    QHash<int, QVector<Diagnostic>> m_diagnostics; // Component id -> findings
+
+    // Design model accounting, refreshed a moment after edits settle
+    QTimer m_memoryTimer;
+    qint64 m_componentBytes = 0;
+    qint64 m_wireBytes = 0;
+
+    // Live operating point, solved once per batch of edits in the next
+    // iteration of the event loop
+    bool m_liveDcEnabled = false;
+    Netlist m_liveNetlist;
+    LiveOperatingPoint m_liveDc;
+    QTimer m_liveDcTimer;
+
+    // Heat map: the netlist its values are numbered in and revisions that
+    // tell the renderer what to upload again
+    HeatMap m_heatMap = NoHeatMap;
+    bool m_heatMapExternal = false; // Values set by setHeatMapSample
+    Netlist m_heatMapNetlist;
+    QVector<double> m_heatMapVoltages;
+    QVector<double> m_heatMapCurrents;
+    QPair<double, double> m_heatMapVoltageRange{0.0, 0.0};
+    QPair<double, double> m_heatMapComponentRange{0.0, 0.0};
+    int m_heatMapNetlistRevision = 0;
+    int m_heatMapSampleRevision = 0;
 
     // Helper methods
     int getComponentAt(const QPointF& pos) const;
     QPointF snapToGrid(const QPointF& pos) const;
+    QVector<int> selectedIds() const;
+    void setSelected(int componentId, bool selected);
+    void clearSelection();
+    void componentRowsChanged(const QVector<int>& ids, const QList<int>& roles);
+    QRectF visibleWorldRect() const;
+    void cancelSchematicLoad();
+    void streamSchematicTiles(const QVector<int>& tiles, int totalTiles);
+    void appendLoadedBatch(int generation, const QVector<Component>& components, const QVector<Wire>& wires,
+                           int loadedTiles, int totalTiles);
+
+    // Journaling
+    static QString defaultSessionPath();
+    EditJournal& journal();
+    void startJournal(const QString& path, quint64 firstSegment);
+    bool recoverSchematic(const QString& path);
+    void compactJournal(bool force = false);
+    void waitForCompaction();
+
+    // Model mutations shared by the public API and journal replay
+    Component* findComponent(int componentId);
+    void applyAddComponent(const Component& component);
+    void appendComponent(const Component& component); // Without row signals
+    void takeComponent(int componentId);                // Without row signals
+    void applyMoveComponents(const QVector<int>& ids, const QPointF& delta);
+    void applySetPositions(const QVector<int>& ids, const QVector<QPointF>& positions);
+    void applyAddWire(const Wire& wire);
+    void applyClear();
+    void applySetProperties(int componentId, const QString& label, double value);
+    void applyRemoveComponent(int componentId);
+    void applyRemoveWire(int index);
+    void applyAddComponents(const QVector<Component>& components);
+    void applyRemoveComponents(const QVector<int>& ids);
+    void applyInsertWires(const QVector<int>& indices, const QVector<Wire>& wires);
+    void applyRemoveWires(const QVector<int>& indices);
+    void rebuildWireIndex();
+    void unindexWires(const QVector<int>& indices);
+    bool routeRequest(const Wire& wire, WireRouter::Request& request) const;
+    void rerouteWires(const QVector<int>& componentIds);
+    void applyDefineSubcircuit(const SubcircuitDefinition& definition);
+    void applyRemoveSubcircuit(int definitionId);
+    void resetSubcircuits(const QHash<int, SubcircuitDefinition>& definitions);
+    bool definitionFromSelection(SubcircuitDefinition& definition) const;
+    bool definitionUses(int definitionId, int usedId, int depth = 0) const;
+    void recordEdit(std::unique_ptr<EditCommand> command);
+    Component createComponent(const QString& type, const QPointF& position);
+    // Change notification, held back while a batch is open
+    void noteChange(const DesignChange& change);
+    void noteComponentsTouched(const QVector<int>& ids);
+    void notifySelectionChanged();
+    void notifyComponentAdded();
+    void flushChanges();
+    void applyRuleResults(bool reset, const QVector<int>& componentIds, const QVector<Diagnostic>& diagnostics);
+    void updateMemoryStats();
+    void scheduleLiveDc();
+    void updateLiveDc();
+    void heatMapSampleChanged(bool widenRange);
+
+    // EditJournal::Target
+    void replayAddComponent(const Component& component) override { applyAddComponent(component); }
+    void replayMoveComponents(const QVector<int>& ids, const QPointF& delta) override { applyMoveComponents(ids, delta); }
+    void replaySetPositions(const QVector<int>& ids, const QVector<QPointF>& positions) override { applySetPositions(ids, positions); }
+    void replayAddWire(const Wire& wire) override { applyAddWire(wire); }
+    void replayClear() override { applyClear(); }
+    void replaySetProperties(int componentId, const QString& label, double value) override { applySetProperties(componentId, label, value); }
+    void replayRemoveComponent(int componentId) override { applyRemoveComponent(componentId); }
+    void replayRemoveWire(int index) override { applyRemoveWire(index); }
+    void replayDefineSubcircuit(const SubcircuitDefinition& definition) override { applyDefineSubcircuit(definition); }
+    void replayRemoveSubcircuit(int definitionId) override { applyRemoveSubcircuit(definitionId); }
+    void replayAddComponents(const QVector<Component>& components) override { applyAddComponents(components); }
+    void replayRemoveComponents(const QVector<int>& ids) override { applyRemoveComponents(ids); }
+    void replayInsertWires(const QVector<int>& indices, const QVector<Wire>& wires) override { applyInsertWires(indices, wires); }
+    void replayRemoveWires(const QVector<int>& indices) override { applyRemoveWires(indices); }
 };
 
-// Inherit from QOpenGLFunctions instead of specific version
-class CircuitRenderer : public QQuickFramebufferObject::Renderer,
-                        protected QOpenGLFunctions
+// Scene graph node that draws the viewport with OpenGL straight into the
+// window's render pass, so there is no private framebuffer to composite.
+// Inherit from QOpenGLExtraFunctions (GL 3.3 / ES 3.0) for instanced drawing
+class CircuitRenderer : public QSGRenderNode,
+                        protected QOpenGLExtraFunctions
 {
 public:
     CircuitRenderer();
-    ~CircuitRenderer();
+    ~CircuitRenderer() override;
+
+    // Called from updatePaintNode() while the GUI thread is blocked
+    void synchronize(CircuitViewport* item);
 
-    void render() override;
-    void synchronize(QQuickFramebufferObject* item) override;
-    QOpenGLFramebufferObject* createFramebufferObject(const QSize& size) override;
+    void render(const RenderState* state) override;
+    void releaseResources() override;
+    StateFlags changedStates() const override;
+    RenderingFlags flags() const override;
+    QRectF rect() const override;
 
 private:
     void initializeGL();
@@ -234,46 +751,201 @@ private:
     void updateComponentGeometry();
     void updateWireGeometry();
     void updateDotGeometry();
+    void updateSubcircuitGeometry();
+    void updateSubcircuitInstances();
+    void tessellateDefinition(const SubcircuitDefinition& definition, const QTransform& transform, int depth,
+                              QVector<float>& triangles, QVector<float>& lines) const;
+    void updateStaticLayer();
+    void renderStaticLayer();
+    void drawStaticLayer(const QMatrix4x4& itemTransform, float opacity);
     void renderGrid();
     void renderDots();
     void renderComponents();
+    void renderSubcircuits();
+    void updateTerminalGeometry();
     void renderTerminals();
     void renderWires();
+    void updateTextLayout();
+    void updateTextInstances();
+    void renderText();
+    void renderOverlay();
+    // Copies the given selected parts, and the wires attached to them, into
+    // the overlay, replacing earlier copies of the same parts
+    void copyOverlayParts(const CircuitViewport* vp, const QSet<int>& ids);
+    void updateHeatMapItems();
+    void updateHeatMapTexture(const char* item, QOpenGLTexture*& texture, QOpenGLTexture::TextureFormat format,
+                              QOpenGLTexture::PixelFormat pixelFormat, int rows, const QVector<float>& texels);
+    bool heatMapShown() const;
+    // Points the program's heat map uniforms at the textures, heatMode 0 when
+    // nothing is shown; true when the textures were bound
+    bool bindHeatMap(QOpenGLShaderProgram* program, int mode, const QVector2D& range);
+    void releaseHeatMap();
+    QMatrix4x4 itemProjection() const; // World to the item's own clip space
+    QMatrix4x4 viewProjection() const; // World to the current target
+    void bindLineProgram(const QMatrix4x4& projection);
+    // Shader edge smoothing: geometry only needs it when the current target
+    // is not multisampled, while text and pins are alpha masks that MSAA
+    // cannot smooth
+    float edgeSmoothing() const { return m_edgeSmoothing; }
+    float maskSmoothing() const { return m_antialiasingQuality == CircuitViewport::NoAntialiasing ? 0.0f : 1.0f; }
     void renderResistor(const Component& comp);
     void renderCapacitor(const Component& comp);
     void renderInductor(const Component& comp);
     void renderVoltageSource(const Component& comp);
 
-    QOpenGLShaderProgram* m_gridProgram = nullptr;
+    QOpenGLShaderProgram* m_lineProgram = nullptr; // Grid and wires, one quad per segment
     QOpenGLShaderProgram* m_componentProgram = nullptr;
-    QOpenGLShaderProgram* m_wireProgram = nullptr;
     QOpenGLShaderProgram* m_dotProgram = nullptr;
+    QOpenGLShaderProgram* m_instanceProgram = nullptr;
+    QOpenGLShaderProgram* m_textProgram = nullptr;
+    QOpenGLShaderProgram* m_terminalProgram = nullptr;
+    QOpenGLShaderProgram* m_layerProgram = nullptr; // Textured quad for the cached layer
+    QOpenGLTexture* m_glyphTexture = nullptr;
     QOpenGLBuffer m_gridVBO;
     QOpenGLBuffer m_componentVBO;
     QOpenGLBuffer m_wireVBO;
+    QOpenGLBuffer m_wireItemVBO; // Heat map item of each wire segment
     QOpenGLBuffer m_dotVBO;
     QOpenGLVertexArrayObject m_gridVAO;
     QOpenGLVertexArrayObject m_componentVAO;
     QOpenGLVertexArrayObject m_wireVAO;
     QOpenGLVertexArrayObject m_dotVAO;
 
+    // One tessellation per definition, drawn once per frame for all of its
+    // instances with a per-instance transform buffer
+    struct SubcircuitGeometry
+    {
+        QOpenGLVertexArrayObject vao;
+        QOpenGLBuffer shapeVBO;    // x, y, r, g, b, a; triangles then lines
+        QOpenGLBuffer instanceVBO; // x, y, rotation (radians), highlight
+        int triangleVertexCount = 0;
+        int lineVertexCount = 0;
+        int instanceCount = 0;
+        QSizeF size;
+    };
+    QHash<int, SubcircuitGeometry*> m_subcircuitGeometry;
+
+    // Labels are laid out once per model change into world-space glyph quads
+    // (x, y, w, h, u0, v0, u1, v1, r, g, b, a); view changes only re-cull the
+    // runs and upload the visible glyphs as one instanced batch
+    struct TextRun
+    {
+        QRectF bounds;
+        float height = 0.0f; // Em size in world units
+        int firstGlyph = 0;
+        int glyphCount = 0;
+    };
+    void layoutLabels(const Component& comp, QVector<TextRun>& runs, QVector<float>& glyphs) const;
+    GlyphAtlas m_glyphAtlas;
+    QVector<TextRun> m_textRuns;
+    QVector<float> m_textGlyphs;
+    QOpenGLBuffer m_quadVBO; // Unit quad shared by the instanced text and terminals
+    QOpenGLBuffer m_textInstanceVBO;
+    QOpenGLVertexArrayObject m_textVAO;
+
+    // One instance per pin (x, y, flags, unused), rebuilt only when parts or
+    // wires change
+    QOpenGLBuffer m_terminalVBO;
+    QOpenGLVertexArrayObject m_terminalVAO;
+    QSet<int> m_connectedOutputs; // Parts in the overlay whose output 0 has a wire
+    QSet<int> m_connectedInputs;  // Parts in the overlay whose input 0 has a wire
+
+    // Primitive parts, each drawn with its own color
+    struct ComponentDraw
+    {
+        int firstVertex;
+        int vertexCount;
+        QVector4D color;
+        int item; // Heat map item: the part's index
+    };
+    QVector<ComponentDraw> m_componentDraws;
+
+    // Heat map. Parts and then wires are items, each a texel of the item
+    // texture holding the texels of the value texture it is colored by:
+    // (node A, node B, element current, unused), -1 for none. The value
+    // texture holds a voltage per node followed by a current per element, one
+    // sample of a result as it is. Both are rows of HeatMapRow texels, and
+    // the shaders map values through a color map, so new values are one
+    // upload and a redraw of the cached layer; the item texture follows the
+    // design's topology, and the geometry is left alone.
+    static constexpr int HeatMapRow = 1024;
+    CircuitViewport::HeatMap m_heatMap = CircuitViewport::NoHeatMap;
+    Netlist m_heatMapNetlist;
+    int m_heatMapNetlistRevision = -1;
+    int m_heatMapSampleRevision = -1;
+    QVector<float> m_heatMapValues; // Empty when the values do not fit the netlist
+    QVector2D m_heatMapVoltageRange;
+    QVector2D m_heatMapComponentRange;
+    QOpenGLTexture* m_heatMapItems = nullptr;        // RGBA32F
+    QOpenGLTexture* m_heatMapValueTexture = nullptr; // R32F
+    bool m_heatMapItemsDirty = true;
+    bool m_heatMapValuesDirty = true;
+
+    // The static buffers and the cached layer hold everything except the
+    // selection and the wires attached to it. Those, the hovered pin, the
+    // selection band and the wire being drawn form the overlay, which is
+    // rebuilt every frame and streamed through a ring of buffer regions.
+    // With MSAA the layer is rendered multisampled and resolved into the
+    // texture that is drawn into the window.
+    QOpenGLFramebufferObject* m_staticLayer = nullptr;
+    QOpenGLFramebufferObject* m_staticLayerSamples = nullptr;
+    int m_layerSamples = -1; // Requested for the layer, 0 when single-sampled
+    QOpenGLVertexArrayObject m_layerVAO;
+    StreamingBuffer m_overlayStream;
+    QOpenGLVertexArrayObject m_overlayVAO;      // Line segments
+    QOpenGLVertexArrayObject m_overlayShapeVAO; // Part shapes
+    QVector<Component> m_overlayComponents; // Copies of the selected parts
+    QVector<Wire> m_overlayWires;           // and of the wires attached to them
+    QHash<int, int> m_overlaySlots;         // Part id -> index in m_overlayComponents
+    QHash<int, int> m_overlayWireSlots;     // Wire index -> index in m_overlayWires
+    QHash<int, QPointF> m_overlayCenters;   // Ends of the overlay's wires without a route
+    int m_selectionRevision = -1;
+    QPointF m_hoveredPin;
+    int m_hoveredPinFlags = 0; // Terminal flags, 0 when no pin is hovered
+    QVector<QPointF> m_diagnosticMarkers; // Rule check findings, drawn as flagged pins
+
     // Data copied from UI
     float m_gridSize = 20.0f;
     QColor m_gridColor;
     QColor m_backgroundColor;
+    CircuitViewport::AntialiasingQuality m_antialiasingQuality = CircuitViewport::Msaa4x;
     QSize m_viewportSize;
+    QSize m_layerSize; // Physical pixels
+    // The design, copied only for a rebuild of the static buffers and let go
+    // once they are built, so that the viewport's edits in between, a drag's
+    // above all, never find its vectors shared
     QVector<Component> m_components;
     QVector<Wire> m_wires;
+    bool m_designCopied = false;
+    qint64 m_componentBytes = 0; // Footprints of the copies, for memory stats
+    qint64 m_wireBytes = 0;
+    QHash<int, SubcircuitDefinition> m_subcircuits;
+    int m_subcircuitRevision = -1;
+    QPolygonF m_selectionOutline;
+    QVector<QPointF> m_wirePreview;
     float m_zoom = 1.0f;
     QPointF m_panOffset;
 
+    // Current render target: the cached layer or the window's pass
+    QMatrix4x4 m_targetTransform; // Item clip space to target clip space
+    QSize m_targetSize;           // Physical pixels
+    float m_edgeSmoothing = 0.0f;
+
     bool m_initialized = false;
     bool m_gridDirty = true;
     bool m_componentsDirty = true;
     bool m_wiresDirty = true;
     bool m_dotsDirty = true;
+    bool m_subcircuitsDirty = true;
+    bool m_textLayoutDirty = true;
+    bool m_textCullDirty = true;
+    bool m_staticLayerDirty = true;
+    bool m_terminalsDirty = true;
 
     // Vertex counts for rendering
     int m_gridVertexCount = 0;
     int m_componentVertexCount = 0;
+    int m_wireVertexCount = 0;
+    int m_textGlyphCount = 0;
+    int m_terminalCount = 0;
 };
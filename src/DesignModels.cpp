@@ -0,0 +1,123 @@
+#include "DesignModels.h"
+#include "CircuitViewport.h"
+
+#include <QVariantList>
+
+void DesignListModel::rowsChanged(int first, int last, const QList<int>& roles)
+{
+    if (first < 0 || first > last || last >= rowCount())
+        return;
+    emit dataChanged(index(first), index(last), roles);
+}
+
+// --- ComponentListModel ---
+
+ComponentListModel::ComponentListModel(const QVector<Component>& components, QObject* parent)
+    : DesignListModel(parent), m_components(components)
+{
+}
+
+int ComponentListModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : int(m_components.size());
+}
+
+QVariant ComponentListModel::data(const QModelIndex& index, int role) const
+{
+    if (!checkIndex(index, CheckIndexOption::IndexIsValid | CheckIndexOption::ParentIsInvalid))
+        return QVariant();
+
+    const Component& comp = m_components[index.row()];
+    switch (role)
+    {
+    case Qt::DisplayRole:
+    case LabelRole:
+        return comp.label;
+    case IdRole:
+        return comp.id;
+    case TypeRole:
+        return comp.type;
+    case ValueRole:
+        return comp.value;
+    case XRole:
+        return comp.position.x();
+    case YRole:
+        return comp.position.y();
+    case RotationRole:
+        return comp.rotation;
+    case SelectedRole:
+        return comp.selected;
+    case SubcircuitRole:
+        return comp.subcircuitId;
+    case ColorRole:
+        return comp.color;
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> ComponentListModel::roleNames() const
+{
+    return {
+        {IdRole, "componentId"},
+        {TypeRole, "type"},
+        {LabelRole, "label"},
+        {ValueRole, "value"},
+        {XRole, "positionX"},
+        {YRole, "positionY"},
+        {RotationRole, "rotation"},
+        {SelectedRole, "selected"},
+        {SubcircuitRole, "subcircuitId"},
+        {ColorRole, "color"},
+    };
+}
+
+// --- WireListModel ---
+
+WireListModel::WireListModel(const QVector<Wire>& wires, QObject* parent)
+    : DesignListModel(parent), m_wires(wires)
+{
+}
+
+int WireListModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : int(m_wires.size());
+}
+
+QVariant WireListModel::data(const QModelIndex& index, int role) const
+{
+    if (!checkIndex(index, CheckIndexOption::IndexIsValid | CheckIndexOption::ParentIsInvalid))
+        return QVariant();
+
+    const Wire& wire = m_wires[index.row()];
+    switch (role)
+    {
+    case FromRole:
+        return wire.fromComponentId;
+    case ToRole:
+        return wire.toComponentId;
+    case ColorRole:
+        return wire.color;
+    case PointsRole:
+    {
+        // Converted on demand; most delegates never ask for the path
+        QVariantList points;
+        points.reserve(wire.points.size());
+        for (const QPointF& point : wire.points)
+            points.append(point);
+        return points;
+    }
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> WireListModel::roleNames() const
+{
+    return {
+        {FromRole, "fromId"},
+        {ToRole, "toId"},
+        {ColorRole, "color"},
+        {PointsRole, "points"},
+    };
+}
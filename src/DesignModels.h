@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <QtQml/qqmlregistration.h>
+
+struct Component;
+struct Wire;
+
+// Read-only list views of CircuitViewport's parts and wires for QML panels.
+// The models read the viewport's own vectors, so they hold no copy; the
+// viewport brackets each edit of a vector with the matching row signals.
+// Parts are removed by moving the last part into the freed slot, which the
+// models report as removing the last row and changing the filled one.
+class DesignListModel : public QAbstractListModel
+{
+    Q_OBJECT
+    QML_ANONYMOUS
+
+public:
+    using QAbstractListModel::QAbstractListModel;
+
+    // Called by CircuitViewport around its edits
+    void beginInsert(int first, int last) { beginInsertRows(QModelIndex(), first, last); }
+    void endInsert() { endInsertRows(); }
+    void beginRemove(int first, int last) { beginRemoveRows(QModelIndex(), first, last); }
+    void endRemove() { endRemoveRows(); }
+    void beginReset() { beginResetModel(); }
+    void endReset() { endResetModel(); }
+    void rowsChanged(int first, int last, const QList<int>& roles = QList<int>());
+};
+
+class ComponentListModel : public DesignListModel
+{
+    Q_OBJECT
+    QML_ANONYMOUS
+
+public:
+    enum Role
+    {
+        IdRole = Qt::UserRole + 1,
+        TypeRole,
+        LabelRole,
+        ValueRole,
+        XRole,
+        YRole,
+        RotationRole,
+        SelectedRole,
+        SubcircuitRole,
+        ColorRole
+    };
+    Q_ENUM(Role)
+
+    ComponentListModel(const QVector<Component>& components, QObject* parent);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+private:
+    const QVector<Component>& m_components;
+};
+
+class WireListModel : public DesignListModel
+{
+    Q_OBJECT
+    QML_ANONYMOUS
+
+public:
+    enum Role
+    {
+        FromRole = Qt::UserRole + 1,
+        ToRole,
+        ColorRole,
+        PointsRole
+    };
+    Q_ENUM(Role)
+
+    WireListModel(const QVector<Wire>& wires, QObject* parent);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+private:
+    const QVector<Wire>& m_wires;
+};
@@ -0,0 +1,570 @@
+#include "DomainDecomposition.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+// Pivots below this are taken as a singular block, as in the dense LU
+constexpr double PivotTolerance = 1e-18;
+
+// Breadth-first orders over subsets of a graph's vertices, the graph given as
+// adjacency lists
+class LevelOrder
+{
+public:
+    LevelOrder(const QVector<int>& start, const QVector<int>& adjacency)
+        : m_start(start)
+        , m_adjacency(adjacency)
+        , m_member(start.size() - 1, 0)
+        , m_done(start.size() - 1, 0)
+        , m_seen(start.size() - 1, 0)
+    {
+    }
+
+    // Every vertex of the subset, each connected piece from a pseudo-peripheral
+    // vertex so that its levels are many and narrow. With byDegree, neighbours
+    // follow in order of degree, as Cuthill-McKee has it.
+    QVector<int> order(const QVector<int>& vertices, bool byDegree)
+    {
+        ++m_subset;
+        for (int vertex : vertices)
+            m_member[vertex] = m_subset;
+
+        QVector<int> result;
+        result.reserve(vertices.size());
+        for (int seed : vertices)
+        {
+            if (m_done[seed] == m_subset)
+                continue;
+            const qsizetype first = result.size();
+            result.append(peripheral(seed));
+            m_done[result.last()] = m_subset;
+            traverse(result, first, byDegree);
+        }
+        return result;
+    }
+
+private:
+    template<typename Visit>
+    void forEachNeighbour(int vertex, Visit visit) const
+    {
+        for (int p = m_start[vertex]; p < m_start[vertex + 1]; ++p)
+        {
+            if (m_member[m_adjacency[p]] == m_subset)
+                visit(m_adjacency[p]);
+        }
+    }
+
+    // Appends the unvisited neighbours of order[head] and of everything after it
+    void traverse(QVector<int>& order, qsizetype head, bool byDegree)
+    {
+        QVector<int> neighbours;
+        for (; head < order.size(); ++head)
+        {
+            neighbours.clear();
+            forEachNeighbour(order[head], [&](int next) {
+                if (m_done[next] != m_subset)
+                {
+                    m_done[next] = m_subset;
+                    neighbours.append(next);
+                }
+            });
+            if (byDegree)
+                std::stable_sort(neighbours.begin(), neighbours.end(),
+                                 [this](int a, int b) { return degree(a) < degree(b); });
+            order.append(neighbours);
+        }
+    }
+
+    int degree(int vertex) const
+    {
+        int count = 0;
+        forEachNeighbour(vertex, [&count](int) { ++count; });
+        return count;
+    }
+
+    // Levels of a breadth-first search from root, and the lowest degree vertex
+    // of the last level
+    int levelsFrom(int root, int& farthest)
+    {
+        ++m_search;
+        m_seen[root] = m_search;
+        QVector<int> level{root};
+        QVector<int> next;
+        int levels = 0;
+        while (!level.isEmpty())
+        {
+            ++levels;
+            farthest = *std::min_element(level.cbegin(), level.cend(),
+                                         [this](int a, int b) { return degree(a) < degree(b); });
+            next.clear();
+            for (int vertex : std::as_const(level))
+            {
+                forEachNeighbour(vertex, [&](int neighbour) {
+                    if (m_seen[neighbour] != m_search)
+                    {
+                        m_seen[neighbour] = m_search;
+                        next.append(neighbour);
+                    }
+                });
+            }
+            std::swap(level, next);
+        }
+        return levels;
+    }
+
+    // Gibbs-Poole-Stockmeyer's start: walk to the far end while that gets farther
+    int peripheral(int seed)
+    {
+        int root = seed;
+        int farthest = seed;
+        int depth = levelsFrom(root, farthest);
+        for (int round = 0; round < 4; ++round)
+        {
+            int next = farthest;
+            const int candidateDepth = levelsFrom(farthest, next);
+            if (candidateDepth <= depth)
+                break;
+            root = farthest;
+            depth = candidateDepth;
+            farthest = next;
+        }
+        return root;
+    }
+
+    const QVector<int>& m_start;
+    const QVector<int>& m_adjacency;
+    QVector<int> m_member; // Stamped with the subset being ordered
+    QVector<int> m_done;
+    QVector<int> m_seen; // Stamped per search
+    int m_subset = 0;
+    int m_search = 0;
+};
+
+// Splits the vertices into parts of equal size along a level order, which cuts
+// few edges in the mesh-like graphs of circuits
+void bisect(LevelOrder& levels, const QVector<int>& vertices, int parts, int firstPart, QVector<int>& part)
+{
+    if (parts == 1 || vertices.size() < 2)
+    {
+        for (int vertex : vertices)
+            part[vertex] = firstPart;
+        return;
+    }
+    const QVector<int> order = levels.order(vertices, false);
+    const int leftParts = parts / 2;
+    const qsizetype split = vertices.size() * leftParts / parts;
+    bisect(levels, order.mid(0, split), leftParts, firstPart, part);
+    bisect(levels, order.mid(split), parts - leftParts, firstPart + leftParts, part);
+}
+
+double largestMagnitude(const QVector<double>& values)
+{
+    double largest = 0.0;
+    for (double value : values)
+        largest = qMax(largest, std::abs(value));
+    return largest;
+}
+
+bool withinOf(const QVector<double>& values, const QVector<double>& reference, double threshold)
+{
+    if (values.size() != reference.size())
+        return false;
+    for (qsizetype i = 0; i < values.size(); ++i)
+    {
+        if (!(std::abs(values[i] - reference[i]) <= threshold))
+            return false;
+    }
+    return true;
+}
+} // namespace
+
+// --- BandedLu ---
+
+bool DomainDecomposition::BandedLu::factor(int size, const QVector<SparseMatrix::Entry>& entries)
+{
+    int lower = 0;
+    int upper = 0;
+    for (const SparseMatrix::Entry& entry : entries)
+    {
+        lower = qMax(lower, entry.row - entry.col);
+        upper = qMax(upper, entry.col - entry.row);
+    }
+    // Row swaps widen the upper band by the lower one
+    m_size = size;
+    m_lower = lower;
+    m_width = 2 * lower + upper + 1;
+    m_band.fill(0.0, qsizetype(size) * m_width);
+    m_pivot.resize(size);
+    const auto at = [this](int row, int col) -> double& { return m_band[qsizetype(row) * m_width + col - row + m_lower]; };
+    for (const SparseMatrix::Entry& entry : entries)
+        at(entry.row, entry.col) += entry.value;
+
+    for (int k = 0; k < size; ++k)
+    {
+        const int lastRow = qMin(size - 1, k + m_lower);
+        const int lastCol = qMin(size - 1, k + m_width - 1 - m_lower);
+        int pivot = k;
+        double largest = std::abs(at(k, k));
+        for (int row = k + 1; row <= lastRow; ++row)
+        {
+            if (std::abs(at(row, k)) > largest)
+            {
+                largest = std::abs(at(row, k));
+                pivot = row;
+            }
+        }
+        if (largest < PivotTolerance)
+            return false;
+
+        m_pivot[k] = pivot;
+        if (pivot != k)
+        {
+            for (int col = k; col <= lastCol; ++col)
+                std::swap(at(k, col), at(pivot, col));
+        }
+        for (int row = k + 1; row <= lastRow; ++row)
+        {
+            double& target = at(row, k);
+            if (target == 0.0)
+                continue;
+            target /= at(k, k);
+            for (int col = k + 1; col <= lastCol; ++col)
+                at(row, col) -= target * at(k, col);
+        }
+    }
+    return true;
+}
+
+void DomainDecomposition::BandedLu::solve(QVector<double>& x, int firstNonZero, int firstNeeded) const
+{
+    const auto at = [this](int row, int col) { return m_band[qsizetype(row) * m_width + col - row + m_lower]; };
+    // Rows can only be swapped up from within the lower band
+    for (int k = qMax(0, firstNonZero - m_lower); k < m_size; ++k)
+    {
+        if (m_pivot[k] != k)
+            std::swap(x[k], x[m_pivot[k]]);
+        const int lastRow = qMin(m_size - 1, k + m_lower);
+        for (int row = k + 1; row <= lastRow; ++row)
+            x[row] -= at(row, k) * x[k];
+    }
+    for (int k = m_size - 1; k >= firstNeeded; --k)
+    {
+        const int lastCol = qMin(m_size - 1, k + m_width - 1 - m_lower);
+        double sum = x[k];
+        for (int col = k + 1; col <= lastCol; ++col)
+            sum -= at(k, col) * x[col];
+        x[k] = sum / at(k, k);
+    }
+}
+
+qint64 DomainDecomposition::BandedLu::byteSize() const
+{
+    return m_band.capacity() * qint64(sizeof(double)) + m_pivot.capacity() * qint64(sizeof(int));
+}
+
+// --- DomainDecomposition ---
+
+int DomainDecomposition::partition(int parts, QVector<int>& part, QVector<bool>& isInterface) const
+{
+    QVector<int> vertices(m_size);
+    std::iota(vertices.begin(), vertices.end(), 0);
+    part.fill(0, m_size);
+    LevelOrder levels(m_adjacencyStart, m_adjacency);
+    bisect(levels, vertices, parts, 0, part);
+
+    // Of two neighbours in different blocks, the one in the later block joins
+    // the interface, which leaves no edge between the blocks themselves
+    isInterface.fill(false, m_size);
+    for (int vertex = 0; vertex < m_size; ++vertex)
+    {
+        for (int p = m_adjacencyStart[vertex]; p < m_adjacencyStart[vertex + 1]; ++p)
+        {
+            if (part[m_adjacency[p]] < part[vertex])
+            {
+                isInterface[vertex] = true;
+                break;
+            }
+        }
+    }
+
+    // A source's branch row has no diagonal and only makes sense beside the
+    // nodes it ties together; left in a block without them it is singular
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (int vertex = 0; vertex < m_size; ++vertex)
+        {
+            if (isInterface[vertex] || m_diagonal[vertex] != 0.0)
+                continue;
+            for (int p = m_adjacencyStart[vertex]; p < m_adjacencyStart[vertex + 1]; ++p)
+            {
+                if (isInterface[m_adjacency[p]])
+                {
+                    isInterface[vertex] = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    return int(std::count(isInterface.cbegin(), isInterface.cend(), true));
+}
+
+bool DomainDecomposition::factor(const SparseMatrix& matrix, int parts, int interfaceLimit)
+{
+    m_size = matrix.size();
+    m_blocks.clear();
+    m_interface.clear();
+    m_schur = DenseLu();
+    m_latentBlocks = 0;
+    m_errorString.clear();
+
+    const QVector<int>& rowStart = matrix.rowStarts();
+    const QVector<int>& columns = matrix.columns();
+    const QVector<double>& values = matrix.values();
+
+    // Neighbours through an entry either way round
+    QVector<QVector<int>> neighbours(m_size);
+    m_diagonal.resize(m_size);
+    for (int row = 0; row < m_size; ++row)
+    {
+        m_diagonal[row] = values[matrix.diagonal()[row]];
+        for (int p = rowStart[row]; p < rowStart[row + 1]; ++p)
+        {
+            if (columns[p] == row)
+                continue;
+            neighbours[row].append(columns[p]);
+            neighbours[columns[p]].append(row);
+        }
+    }
+    m_adjacencyStart.resize(m_size + 1);
+    m_adjacency.clear();
+    for (int row = 0; row < m_size; ++row)
+    {
+        QVector<int>& list = neighbours[row];
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+        m_adjacencyStart[row] = m_adjacency.size();
+        m_adjacency.append(list);
+        list = QVector<int>();
+    }
+    m_adjacencyStart[m_size] = m_adjacency.size();
+
+    // More blocks mean a longer interface; halve them until its Schur
+    // complement is affordable
+    QVector<int> part;
+    QVector<bool> isInterface;
+    int interfaceSize = partition(parts, part, isInterface);
+    while (interfaceSize > interfaceLimit && parts > 2)
+    {
+        parts /= 2;
+        interfaceSize = partition(parts, part, isInterface);
+    }
+    if (interfaceSize > interfaceLimit)
+    {
+        m_errorString = QStringLiteral("an interface of %1 unknowns is too large for a Schur complement").arg(interfaceSize);
+        return false;
+    }
+
+    QVector<QVector<int>> members(parts);
+    QVector<int> interfaceOf(m_size, -1);
+    for (int unknown = 0; unknown < m_size; ++unknown)
+    {
+        if (isInterface[unknown])
+        {
+            interfaceOf[unknown] = m_interface.size();
+            m_interface.append(unknown);
+        }
+        else
+        {
+            members[part[unknown]].append(unknown);
+        }
+    }
+
+    // Reverse Cuthill-McKee keeps each block's band narrow
+    QVector<int> blockOf(m_size, -1);
+    QVector<int> localOf(m_size, -1);
+    LevelOrder levels(m_adjacencyStart, m_adjacency);
+    for (const QVector<int>& unknowns : std::as_const(members))
+    {
+        if (unknowns.isEmpty())
+            continue;
+        Block block;
+        block.unknowns = levels.order(unknowns, true);
+        std::reverse(block.unknowns.begin(), block.unknowns.end());
+        for (int local = 0; local < block.unknowns.size(); ++local)
+        {
+            blockOf[block.unknowns[local]] = m_blocks.size();
+            localOf[block.unknowns[local]] = local;
+        }
+        m_blocks.append(std::move(block));
+    }
+
+    // A_gg starts the Schur complement; A_gi goes to the blocks
+    const int interfaceCount = m_interface.size();
+    QVector<double> schur(qsizetype(interfaceCount) * interfaceCount, 0.0);
+    for (int row = 0; row < interfaceCount; ++row)
+    {
+        const int unknown = m_interface[row];
+        for (int p = rowStart[unknown]; p < rowStart[unknown + 1]; ++p)
+        {
+            const int col = columns[p];
+            if (isInterface[col])
+                schur[qsizetype(row) * interfaceCount + interfaceOf[col]] += values[p];
+            else
+                m_blocks[blockOf[col]].fromInterface.append({localOf[col], row, values[p]});
+        }
+    }
+
+    // Each block factors itself and works out its share of the Schur
+    // complement on its own thread
+    QVector<int> indices(m_blocks.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    QVector<QVector<SparseMatrix::Entry>> updates(m_blocks.size());
+    QVector<char> singular(m_blocks.size(), 0);
+    Block* blocks = m_blocks.data();
+    QtConcurrent::blockingMap(indices, [&](int index) {
+        Block& block = blocks[index];
+        const int size = block.unknowns.size();
+        QVector<SparseMatrix::Entry> entries;
+        for (int local = 0; local < size; ++local)
+        {
+            const int unknown = block.unknowns[local];
+            for (int p = rowStart[unknown]; p < rowStart[unknown + 1]; ++p)
+            {
+                const int col = columns[p];
+                if (isInterface[col])
+                    block.toInterface.append({local, interfaceOf[col], values[p]});
+                else
+                    entries.append({local, localOf[col], values[p]});
+            }
+        }
+        if (!block.lu.factor(size, entries))
+        {
+            singular[index] = 1;
+            return;
+        }
+
+        std::sort(block.toInterface.begin(), block.toInterface.end(), [](const Coupling& a, const Coupling& b) {
+            return a.boundary < b.boundary || (a.boundary == b.boundary && a.local < b.local);
+        });
+        // A column of A_ig is only needed where A_gi reads it
+        int needed = size;
+        for (const Coupling& coupling : std::as_const(block.fromInterface))
+            needed = qMin(needed, coupling.local);
+        QVector<double> column(size);
+        for (qsizetype first = 0; first < block.toInterface.size();)
+        {
+            const int boundary = block.toInterface[first].boundary;
+            column.fill(0.0);
+            int nonZero = size;
+            qsizetype last = first;
+            for (; last < block.toInterface.size() && block.toInterface[last].boundary == boundary; ++last)
+            {
+                column[block.toInterface[last].local] += block.toInterface[last].value;
+                nonZero = qMin(nonZero, block.toInterface[last].local);
+            }
+            block.inputs.append(boundary);
+            block.lu.solve(column, nonZero, needed);
+            for (const Coupling& coupling : std::as_const(block.fromInterface))
+                updates[index].append({coupling.boundary, boundary, -coupling.value * column[coupling.local]});
+            first = last;
+        }
+    });
+
+    for (int index = 0; index < m_blocks.size(); ++index)
+    {
+        if (singular[index])
+        {
+            m_errorString = QStringLiteral("a block of %1 unknowns is singular").arg(m_blocks[index].unknowns.size());
+            return false;
+        }
+        for (const SparseMatrix::Entry& update : std::as_const(updates[index]))
+            schur[qsizetype(update.row) * interfaceCount + update.col] += update.value;
+    }
+    if (!m_schur.factor(std::move(schur), interfaceCount))
+    {
+        m_errorString = QStringLiteral("the interface between %1 blocks is singular").arg(m_blocks.size());
+        return false;
+    }
+    return true;
+}
+
+void DomainDecomposition::solve(const QVector<double>& rhs, QVector<double>& x, double latency)
+{
+    QVector<int> indices(m_blocks.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    Block* blocks = m_blocks.data();
+
+    // Eliminate the blocks from the interface equations
+    const double rhsThreshold = latency * largestMagnitude(rhs);
+    QtConcurrent::blockingMap(indices, [&](int index) {
+        Block& block = blocks[index];
+        const int size = block.unknowns.size();
+        block.rhs.resize(size);
+        for (int local = 0; local < size; ++local)
+            block.rhs[local] = rhs[block.unknowns[local]];
+        block.rhsLatent = withinOf(block.rhs, block.solvedRhs, rhsThreshold);
+        if (block.rhsLatent)
+            return;
+
+        QVector<double> eliminated = block.rhs;
+        block.lu.solve(eliminated);
+        block.contribution.resize(block.fromInterface.size());
+        for (qsizetype i = 0; i < block.fromInterface.size(); ++i)
+            block.contribution[i] = block.fromInterface[i].value * eliminated[block.fromInterface[i].local];
+        block.solvedRhs = block.rhs;
+    });
+
+    QVector<double> interfaceValues(m_interface.size());
+    for (int row = 0; row < m_interface.size(); ++row)
+        interfaceValues[row] = rhs[m_interface[row]];
+    for (const Block& block : std::as_const(m_blocks))
+    {
+        for (qsizetype i = 0; i < block.fromInterface.size(); ++i)
+            interfaceValues[block.fromInterface[i].boundary] -= block.contribution[i];
+    }
+    m_schur.solve(interfaceValues);
+
+    // Back-substitute the interface into the blocks
+    x.resize(m_size);
+    double* out = x.data();
+    const double inputThreshold = latency * largestMagnitude(interfaceValues);
+    QtConcurrent::blockingMap(indices, [&](int index) {
+        Block& block = blocks[index];
+        QVector<double> inputs(block.inputs.size());
+        for (qsizetype i = 0; i < inputs.size(); ++i)
+            inputs[i] = interfaceValues[block.inputs[i]];
+        block.latent = block.rhsLatent && withinOf(inputs, block.solvedInputs, inputThreshold);
+        if (!block.latent)
+        {
+            block.solution = block.rhs;
+            for (const Coupling& coupling : std::as_const(block.toInterface))
+                block.solution[coupling.local] -= coupling.value * interfaceValues[coupling.boundary];
+            block.lu.solve(block.solution);
+            block.solvedInputs = inputs;
+        }
+        for (int local = 0; local < block.unknowns.size(); ++local)
+            out[block.unknowns[local]] = block.solution[local];
+    });
+    for (int row = 0; row < m_interface.size(); ++row)
+        out[m_interface[row]] = interfaceValues[row];
+
+    m_latentBlocks = int(std::count_if(m_blocks.cbegin(), m_blocks.cend(), [](const Block& block) { return block.latent; }));
+}
+
+qint64 DomainDecomposition::byteSize() const
+{
+    qint64 bytes = m_schur.byteSize() + (m_adjacencyStart.capacity() + m_adjacency.capacity() + m_interface.capacity()) * qint64(sizeof(int)) + m_diagonal.capacity() * qint64(sizeof(double));
+    for (const Block& block : m_blocks)
+    {
+        bytes += block.lu.byteSize() + block.unknowns.capacity() * qint64(sizeof(int));
+        bytes += (block.toInterface.capacity() + block.fromInterface.capacity()) * qint64(sizeof(Coupling));
+        bytes += (block.rhs.capacity() + block.solvedRhs.capacity() + block.solvedInputs.capacity() + block.solution.capacity() + block.contribution.capacity()) * qint64(sizeof(double));
+    }
+    return bytes;
+}
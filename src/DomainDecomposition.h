@@ -0,0 +1,96 @@
+#pragma once
+
+#include "LinearSolver.h"
+
+#include <QString>
+#include <QVector>
+
+// Direct solver for large sparse systems that keeps every core busy. A
+// balanced recursive bisection of the matrix graph splits the unknowns into
+// blocks that only meet through interface unknowns. Each block is reordered
+// to a narrow band (reverse Cuthill-McKee) and factored on its own thread,
+// and the interface is solved with the dense Schur complement
+//
+//   S = A_gg - sum over blocks i of A_gi A_ii^-1 A_ig
+//
+// A solve eliminates the blocks in parallel, solves S, then back-substitutes
+// the blocks in parallel again. A block whose right-hand side and interface
+// values barely changed since it was last solved keeps its solution, so the
+// settled parts of a transient cost next to nothing while others move.
+class DomainDecomposition
+{
+public:
+    // Fewer unknowns per block leave the interface larger than the blocks
+    static constexpr int MinimumBlockSize = 256;
+
+    // parts: blocks to aim for; fewer are used while the interface has more
+    // than interfaceLimit unknowns
+    bool factor(const SparseMatrix& matrix, int parts, int interfaceLimit);
+    // latency: change in a block's inputs, relative to the largest input, that
+    // still counts as no change
+    void solve(const QVector<double>& rhs, QVector<double>& x, double latency = 0.0);
+
+    int blockCount() const { return m_blocks.size(); }
+    int interfaceSize() const { return m_interface.size(); }
+    int latentBlocks() const { return m_latentBlocks; } // Not solved again in the last solve
+    QString errorString() const { return m_errorString; }
+    qint64 byteSize() const;
+
+private:
+    // LU factors of a band matrix, with partial pivoting inside the band
+    class BandedLu
+    {
+    public:
+        bool factor(int size, const QVector<SparseMatrix::Entry>& entries);
+        // x is zero before firstNonZero, and only its entries from firstNeeded
+        // on are solved for
+        void solve(QVector<double>& x, int firstNonZero = 0, int firstNeeded = 0) const;
+        qint64 byteSize() const;
+
+    private:
+        int m_size = 0;
+        int m_lower = 0;
+        int m_width = 0;       // Stored columns per row: the lower band, the diagonal and the upper band with fill
+        QVector<double> m_band; // Row-major, column c of row r at r * m_width + c - r + m_lower
+        QVector<int> m_pivot;
+    };
+
+    struct Coupling
+    {
+        int local;     // Unknown in the block's band order
+        int boundary; // Index into m_interface
+        double value;
+    };
+
+    struct Block
+    {
+        QVector<int> unknowns; // In band order
+        BandedLu lu;
+        QVector<Coupling> toInterface;   // A_ig, sorted by interface column
+        QVector<Coupling> fromInterface; // A_gi
+        QVector<int> inputs;             // Interface columns A_ig reads
+
+        // Solve state: the right-hand side and interface values last solved
+        // for, and what came of them
+        QVector<double> rhs;
+        QVector<double> solvedRhs;
+        QVector<double> solvedInputs;
+        QVector<double> solution;
+        QVector<double> contribution; // A_gi A_ii^-1 b_i per fromInterface entry
+        bool rhsLatent = false;
+        bool latent = false;
+    };
+
+    // Assigns every unknown a block and returns the size of the interface
+    int partition(int parts, QVector<int>& part, QVector<bool>& isInterface) const;
+
+    int m_size = 0;
+    QVector<int> m_adjacencyStart; // Symmetric pattern of the matrix without its diagonal
+    QVector<int> m_adjacency;
+    QVector<double> m_diagonal;
+    QVector<Block> m_blocks;
+    QVector<int> m_interface; // Global unknowns
+    DenseLu m_schur;
+    int m_latentBlocks = 0;
+    QString m_errorString;
+};
@@ -0,0 +1,366 @@
+#include "EditCommands.h"
+
+// --- AddComponentCommand ---
+
+AddComponentCommand::AddComponentCommand(const Component& component)
+    : m_component(component)
+{
+    m_component.selected = false;
+}
+
+void AddComponentCommand::undo(CircuitViewport& viewport)
+{
+    viewport.removeComponent(m_component.id);
+}
+
+void AddComponentCommand::redo(CircuitViewport& viewport)
+{
+    viewport.insertComponent(m_component);
+}
+
+qint64 AddComponentCommand::byteSize() const
+{
+    return sizeof(*this) + componentByteSize(m_component) - qint64(sizeof(Component));
+}
+
+QString AddComponentCommand::text() const
+{
+    return QStringLiteral("Add %1").arg(m_component.label);
+}
+
+// --- MoveComponentsCommand ---
+
+MoveComponentsCommand::MoveComponentsCommand(const QVector<int>& ids, const QPointF& delta)
+    : m_ids(ids), m_delta(delta)
+{
+}
+
+void MoveComponentsCommand::undo(CircuitViewport& viewport)
+{
+    viewport.translateComponents(m_ids, -m_delta);
+}
+
+void MoveComponentsCommand::redo(CircuitViewport& viewport)
+{
+    viewport.translateComponents(m_ids, m_delta);
+}
+
+qint64 MoveComponentsCommand::byteSize() const
+{
+    return sizeof(*this) + m_ids.size() * qint64(sizeof(int));
+}
+
+bool MoveComponentsCommand::mergeWith(const EditCommand& other)
+{
+    // Consecutive drag steps of the same parts collapse into one offset
+    auto move = dynamic_cast<const MoveComponentsCommand*>(&other);
+    if (!move || move->m_ids != m_ids)
+        return false;
+    m_delta += move->m_delta;
+    return true;
+}
+
+QString MoveComponentsCommand::text() const
+{
+    return QStringLiteral("Move %1 part(s)").arg(m_ids.size());
+}
+
+// --- PlaceComponentsCommand ---
+
+PlaceComponentsCommand::PlaceComponentsCommand(const QVector<int>& ids, const QVector<QPointF>& before,
+                                               const QVector<QPointF>& after)
+    : m_ids(ids), m_before(before), m_after(after)
+{
+}
+
+void PlaceComponentsCommand::undo(CircuitViewport& viewport)
+{
+    viewport.placeComponents(m_ids, m_before);
+}
+
+void PlaceComponentsCommand::redo(CircuitViewport& viewport)
+{
+    viewport.placeComponents(m_ids, m_after);
+}
+
+qint64 PlaceComponentsCommand::byteSize() const
+{
+    return sizeof(*this) + m_ids.size() * qint64(sizeof(int) + 2 * sizeof(QPointF));
+}
+
+QString PlaceComponentsCommand::text() const
+{
+    return QStringLiteral("Snap %1 part(s)").arg(m_ids.size());
+}
+
+// --- AddWireCommand ---
+
+AddWireCommand::AddWireCommand(const Wire& wire, int index)
+    : m_wire(wire), m_index(index)
+{
+}
+
+void AddWireCommand::undo(CircuitViewport& viewport)
+{
+    viewport.removeWire(m_index);
+}
+
+void AddWireCommand::redo(CircuitViewport& viewport)
+{
+    viewport.insertWire(m_wire);
+}
+
+qint64 AddWireCommand::byteSize() const
+{
+    return sizeof(*this) + wireByteSize(m_wire) - qint64(sizeof(Wire));
+}
+
+QString AddWireCommand::text() const
+{
+    return QStringLiteral("Add wire");
+}
+
+// --- ClearDesignCommand ---
+
+ClearDesignCommand::ClearDesignCommand(const QVector<Component>& components, const QVector<Wire>& wires)
+    : m_components(components), m_wires(wires), m_bytes(sizeof(*this))
+{
+    for (const Component& comp : m_components)
+        m_bytes += componentByteSize(comp);
+    for (const Wire& wire : m_wires)
+        m_bytes += wireByteSize(wire);
+}
+
+void ClearDesignCommand::undo(CircuitViewport& viewport)
+{
+    viewport.replaceDesign(m_components, m_wires);
+}
+
+void ClearDesignCommand::redo(CircuitViewport& viewport)
+{
+    viewport.clearDesign();
+}
+
+qint64 ClearDesignCommand::byteSize() const
+{
+    return m_bytes;
+}
+
+QString ClearDesignCommand::text() const
+{
+    return QStringLiteral("Clear design");
+}
+
+// --- SetPropertiesCommand ---
+
+SetPropertiesCommand::SetPropertiesCommand(int componentId, const QString& oldLabel, double oldValue,
+                                           const QString& newLabel, double newValue)
+    : m_componentId(componentId), m_oldLabel(oldLabel), m_oldValue(oldValue), m_newLabel(newLabel), m_newValue(newValue)
+{
+}
+
+void SetPropertiesCommand::undo(CircuitViewport& viewport)
+{
+    viewport.setComponentProperties(m_componentId, m_oldLabel, m_oldValue);
+}
+
+void SetPropertiesCommand::redo(CircuitViewport& viewport)
+{
+    viewport.setComponentProperties(m_componentId, m_newLabel, m_newValue);
+}
+
+qint64 SetPropertiesCommand::byteSize() const
+{
+    return sizeof(*this) + (m_oldLabel.size() + m_newLabel.size()) * qint64(sizeof(QChar));
+}
+
+bool SetPropertiesCommand::mergeWith(const EditCommand& other)
+{
+    // Only reached inside an undo group, e.g. the ticks of a value slider
+    auto edit = dynamic_cast<const SetPropertiesCommand*>(&other);
+    if (!edit || edit->m_componentId != m_componentId)
+        return false;
+    m_newLabel = edit->m_newLabel;
+    m_newValue = edit->m_newValue;
+    return true;
+}
+
+QString SetPropertiesCommand::text() const
+{
+    return QStringLiteral("Edit properties");
+}
+
+// --- DefineSubcircuitCommand ---
+
+DefineSubcircuitCommand::DefineSubcircuitCommand(const SubcircuitDefinition* before, const SubcircuitDefinition& after)
+    : m_hadBefore(before != nullptr), m_after(after)
+{
+    if (before)
+        m_before = *before;
+}
+
+void DefineSubcircuitCommand::undo(CircuitViewport& viewport)
+{
+    if (m_hadBefore)
+        viewport.setSubcircuitDefinition(m_before);
+    else
+        viewport.removeSubcircuitDefinition(m_after.id);
+}
+
+void DefineSubcircuitCommand::redo(CircuitViewport& viewport)
+{
+    viewport.setSubcircuitDefinition(m_after);
+}
+
+qint64 DefineSubcircuitCommand::byteSize() const
+{
+    return sizeof(*this) + subcircuitByteSize(m_before) + subcircuitByteSize(m_after);
+}
+
+QString DefineSubcircuitCommand::text() const
+{
+    return m_hadBefore ? QStringLiteral("Redefine %1").arg(m_after.name) : QStringLiteral("Define %1").arg(m_after.name);
+}
+
+// --- AddComponentsCommand ---
+
+AddComponentsCommand::AddComponentsCommand(const QVector<Component>& components)
+    : m_components(components)
+{
+    m_ids.reserve(m_components.size());
+    for (Component& comp : m_components)
+    {
+        comp.selected = false;
+        m_ids.append(comp.id);
+    }
+}
+
+void AddComponentsCommand::undo(CircuitViewport& viewport)
+{
+    viewport.eraseComponents(m_ids);
+}
+
+void AddComponentsCommand::redo(CircuitViewport& viewport)
+{
+    viewport.insertComponents(m_components);
+}
+
+qint64 AddComponentsCommand::byteSize() const
+{
+    qint64 bytes = sizeof(*this) + m_ids.size() * qint64(sizeof(int));
+    for (const Component& comp : m_components)
+        bytes += componentByteSize(comp);
+    return bytes;
+}
+
+QString AddComponentsCommand::text() const
+{
+    return QStringLiteral("Add %1 part(s)").arg(m_components.size());
+}
+
+// --- DeleteComponentsCommand ---
+
+DeleteComponentsCommand::DeleteComponentsCommand(const QVector<Component>& components, const QVector<int>& wireIndices,
+                                                 const QVector<Wire>& wires)
+    : m_components(components), m_wireIndices(wireIndices), m_wires(wires)
+{
+    m_ids.reserve(m_components.size());
+    for (Component& comp : m_components)
+    {
+        comp.selected = false;
+        m_ids.append(comp.id);
+    }
+}
+
+void DeleteComponentsCommand::undo(CircuitViewport& viewport)
+{
+    viewport.insertComponents(m_components);
+    viewport.insertWires(m_wireIndices, m_wires);
+}
+
+void DeleteComponentsCommand::redo(CircuitViewport& viewport)
+{
+    viewport.eraseWires(m_wireIndices);
+    viewport.eraseComponents(m_ids);
+}
+
+qint64 DeleteComponentsCommand::byteSize() const
+{
+    qint64 bytes = sizeof(*this) + (m_ids.size() + m_wireIndices.size()) * qint64(sizeof(int));
+    for (const Component& comp : m_components)
+        bytes += componentByteSize(comp);
+    for (const Wire& wire : m_wires)
+        bytes += wireByteSize(wire);
+    return bytes;
+}
+
+QString DeleteComponentsCommand::text() const
+{
+    return QStringLiteral("Delete %1 part(s)").arg(m_components.size());
+}
+
+// --- AddWiresCommand ---
+
+AddWiresCommand::AddWiresCommand(const QVector<int>& indices, const QVector<Wire>& wires)
+    : m_indices(indices), m_wires(wires)
+{
+}
+
+void AddWiresCommand::undo(CircuitViewport& viewport)
+{
+    viewport.eraseWires(m_indices);
+}
+
+void AddWiresCommand::redo(CircuitViewport& viewport)
+{
+    viewport.insertWires(m_indices, m_wires);
+}
+
+qint64 AddWiresCommand::byteSize() const
+{
+    qint64 bytes = sizeof(*this) + m_indices.size() * qint64(sizeof(int));
+    for (const Wire& wire : m_wires)
+        bytes += wireByteSize(wire);
+    return bytes;
+}
+
+QString AddWiresCommand::text() const
+{
+    return QStringLiteral("Add %1 wire(s)").arg(m_wires.size());
+}
+
+// --- BatchCommand ---
+
+BatchCommand::BatchCommand(std::vector<std::unique_ptr<EditCommand>> commands)
+    : m_commands(std::move(commands))
+{
+}
+
+void BatchCommand::undo(CircuitViewport& viewport)
+{
+    viewport.beginBatch();
+    for (auto it = m_commands.rbegin(); it != m_commands.rend(); ++it)
+        (*it)->undo(viewport);
+    viewport.endBatch();
+}
+
+void BatchCommand::redo(CircuitViewport& viewport)
+{
+    viewport.beginBatch();
+    for (const auto& command : m_commands)
+        command->redo(viewport);
+    viewport.endBatch();
+}
+
+qint64 BatchCommand::byteSize() const
+{
+    qint64 bytes = sizeof(*this);
+    for (const auto& command : m_commands)
+        bytes += command->byteSize();
+    return bytes;
+}
+
+QString BatchCommand::text() const
+{
+    return QStringLiteral("%1 edits").arg(m_commands.size());
+}
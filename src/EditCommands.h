@@ -0,0 +1,193 @@
+#pragma once
+
+#include "UndoHistory.h"
+#include "CircuitViewport.h"
+
+#include <QPointF>
+#include <QVector>
+#include <memory>
+#include <vector>
+
+// Undoable edits recorded by CircuitViewport. Each stores a delta of the
+// model: ids and offsets for moves, the affected records for adds.
+
+class AddComponentCommand : public EditCommand
+{
+public:
+    explicit AddComponentCommand(const Component& component);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    Component m_component;
+};
+
+class MoveComponentsCommand : public EditCommand
+{
+public:
+    MoveComponentsCommand(const QVector<int>& ids, const QPointF& delta);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    bool mergeWith(const EditCommand& other) override;
+    QString text() const override;
+
+private:
+    QVector<int> m_ids;
+    QPointF m_delta;
+};
+
+class PlaceComponentsCommand : public EditCommand
+{
+public:
+    PlaceComponentsCommand(const QVector<int>& ids, const QVector<QPointF>& before, const QVector<QPointF>& after);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    QVector<int> m_ids;
+    QVector<QPointF> m_before;
+    QVector<QPointF> m_after;
+};
+
+class AddWireCommand : public EditCommand
+{
+public:
+    AddWireCommand(const Wire& wire, int index);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    Wire m_wire;
+    int m_index;
+};
+
+// Holds the cleared design through implicit sharing rather than a copy
+class ClearDesignCommand : public EditCommand
+{
+public:
+    ClearDesignCommand(const QVector<Component>& components, const QVector<Wire>& wires);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    QVector<Component> m_components;
+    QVector<Wire> m_wires;
+    qint64 m_bytes; // Summed once; the history asks on every push and trim
+};
+
+class SetPropertiesCommand : public EditCommand
+{
+public:
+    SetPropertiesCommand(int componentId, const QString& oldLabel, double oldValue,
+                         const QString& newLabel, double newValue);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    bool mergeWith(const EditCommand& other) override;
+    QString text() const override;
+
+private:
+    int m_componentId;
+    QString m_oldLabel;
+    double m_oldValue;
+    QString m_newLabel;
+    double m_newValue;
+};
+
+// Creating or redefining a block; stores the definition before and after
+class DefineSubcircuitCommand : public EditCommand
+{
+public:
+    DefineSubcircuitCommand(const SubcircuitDefinition* before, const SubcircuitDefinition& after);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    bool m_hadBefore;
+    SubcircuitDefinition m_before;
+    SubcircuitDefinition m_after;
+};
+
+// Bulk placement; undo removes the parts by id
+class AddComponentsCommand : public EditCommand
+{
+public:
+    explicit AddComponentsCommand(const QVector<Component>& components);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    QVector<Component> m_components;
+    QVector<int> m_ids;
+};
+
+// Deleted parts and the wires attached to them; undo puts the wires back at
+// their old indices so that earlier wire commands still refer to them
+class DeleteComponentsCommand : public EditCommand
+{
+public:
+    DeleteComponentsCommand(const QVector<Component>& components, const QVector<int>& wireIndices,
+                            const QVector<Wire>& wires);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    QVector<Component> m_components;
+    QVector<int> m_ids;
+    QVector<int> m_wireIndices;
+    QVector<Wire> m_wires;
+};
+
+class AddWiresCommand : public EditCommand
+{
+public:
+    AddWiresCommand(const QVector<int>& indices, const QVector<Wire>& wires);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    QVector<int> m_indices;
+    QVector<Wire> m_wires;
+};
+
+// The edits of one CircuitViewport batch, undone in reverse order
+class BatchCommand : public EditCommand
+{
+public:
+    explicit BatchCommand(std::vector<std::unique_ptr<EditCommand>> commands);
+
+    void undo(CircuitViewport& viewport) override;
+    void redo(CircuitViewport& viewport) override;
+    qint64 byteSize() const override;
+    QString text() const override;
+
+private:
+    std::vector<std::unique_ptr<EditCommand>> m_commands;
+};
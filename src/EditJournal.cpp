@@ -0,0 +1,703 @@
+#include "EditJournal.h"
+#include "CircuitViewport.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+
+#ifdef Q_OS_WIN
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+constexpr char SegmentMagic[4] = {'A', 'M', 'B', 'J'};
+constexpr quint32 SegmentVersion = 2; // 2: components carry their subcircuit id
+constexpr int SegmentHeaderSize = 16;
+constexpr int RecordHeaderSize = 8;
+constexpr unsigned long FlushIntervalMs = 250;
+constexpr qint64 MaxQueuedBytes = 1 << 20;
+
+quint32 crc32(const char* data, qsizetype size)
+{
+    static const auto table = []()
+    {
+        std::array<quint32, 256> t{};
+        for (quint32 i = 0; i < 256; ++i)
+        {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    quint32 crc = 0xFFFFFFFFu;
+    for (qsizetype i = 0; i < size; ++i)
+        crc = table[(crc ^ quint8(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Plain file descriptors: QFile offers no portable way to fsync
+int openForAppend(const QString& path)
+{
+#ifdef Q_OS_WIN
+    return _wopen(reinterpret_cast<const wchar_t*>(path.utf16()), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY,
+                  _S_IREAD | _S_IWRITE);
+#else
+    return ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+}
+
+bool writeAll(int fd, const char* data, qint64 size)
+{
+    while (size > 0)
+    {
+#ifdef Q_OS_WIN
+        int written = _write(fd, data, unsigned(qMin<qint64>(size, 1 << 30)));
+#else
+        ssize_t written = ::write(fd, data, size_t(size));
+#endif
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool syncFile(int fd)
+{
+#ifdef Q_OS_WIN
+    return _commit(fd) == 0;
+#else
+    return ::fsync(fd) == 0;
+#endif
+}
+
+void closeFile(int fd)
+{
+#ifdef Q_OS_WIN
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+QDataStream& writeComponent(QDataStream& out, const Component& comp)
+{
+    out << qint32(comp.id) << comp.type << comp.label << comp.value << comp.color << comp.position
+        << comp.width << comp.height << comp.rotation << qint32(comp.subcircuitId);
+    return out;
+}
+
+Component readComponent(QDataStream& in, quint32 segmentVersion)
+{
+    qint32 id;
+    QString type, label;
+    double value;
+    QColor color;
+    QPointF position;
+    float width, height, rotation;
+    qint32 subcircuitId = -1;
+    in >> id >> type >> label >> value >> color >> position >> width >> height >> rotation;
+    if (segmentVersion >= 2)
+        in >> subcircuitId;
+
+    Component comp(id, type, position, color, width, height);
+    comp.label = label;
+    comp.value = value;
+    comp.rotation = rotation;
+    comp.subcircuitId = subcircuitId;
+    comp.setupTerminals();
+    return comp;
+}
+
+QDataStream& writeWire(QDataStream& out, const Wire& wire)
+{
+    out << qint32(wire.fromComponentId) << qint32(wire.toComponentId) << wire.color << wire.points;
+    return out;
+}
+
+Wire readWire(QDataStream& in)
+{
+    qint32 from, to;
+    QColor color;
+    QVector<QPointF> points;
+    in >> from >> to >> color >> points;
+
+    Wire wire(from, to, color);
+    wire.points = points;
+    return wire;
+}
+
+QDataStream& writeSubcircuit(QDataStream& out, const SubcircuitDefinition& definition)
+{
+    out << qint32(definition.id) << definition.name << definition.size << qint32(definition.inputComponentId)
+        << qint32(definition.outputComponentId) << quint32(definition.components.size());
+    for (const Component& comp : definition.components)
+        writeComponent(out, comp);
+    out << quint32(definition.wires.size());
+    for (const Wire& wire : definition.wires)
+        writeWire(out, wire);
+    return out;
+}
+
+SubcircuitDefinition readSubcircuit(QDataStream& in, quint32 segmentVersion)
+{
+    SubcircuitDefinition definition;
+    qint32 id, inputId, outputId;
+    quint32 componentCount, wireCount;
+    in >> id >> definition.name >> definition.size >> inputId >> outputId >> componentCount;
+    definition.id = id;
+    definition.inputComponentId = inputId;
+    definition.outputComponentId = outputId;
+    for (quint32 i = 0; i < componentCount && in.status() == QDataStream::Ok; ++i)
+        definition.components.append(readComponent(in, segmentVersion));
+    in >> wireCount;
+    for (quint32 i = 0; i < wireCount && in.status() == QDataStream::Ok; ++i)
+        definition.wires.append(readWire(in));
+    return definition;
+}
+
+// Fixed stream settings so segments replay identically across Qt versions
+void setupStream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+}
+} // namespace
+
+EditJournal::~EditJournal()
+{
+    close();
+}
+
+void EditJournal::open(const QString& schematicPath, quint64 firstSegment)
+{
+    close();
+
+    m_path = schematicPath;
+    m_segment = qMax<quint64>(firstSegment, 1);
+    m_bytesSinceRotate = 0;
+    m_stop = false;
+    m_flushRequested = false;
+    m_enqueuedRecords = 0;
+    m_writtenRecords = 0;
+
+    QDir().mkpath(QFileInfo(schematicPath).absolutePath());
+    m_writer = QThread::create([this, schematicPath]()
+    {
+        writerLoop(schematicPath);
+    });
+    m_writer->start();
+
+    qDebug() << "Journaling" << schematicPath << "from segment" << m_segment;
+}
+
+void EditJournal::close()
+{
+    if (!m_writer)
+        return;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stop = true;
+        m_wake.wakeAll();
+    }
+    m_writer->wait();
+    delete m_writer;
+    m_writer = nullptr;
+    m_queue.clear();
+    m_queuedBytes = 0;
+}
+
+void EditJournal::logAddComponent(const Component& component)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    writeComponent(out, component);
+    append(AddComponent, payload);
+}
+
+void EditJournal::logMoveComponents(const QVector<int>& ids, const QPointF& delta)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << ids << delta;
+    append(MoveComponents, payload);
+}
+
+void EditJournal::logSetPositions(const QVector<int>& ids, const QVector<QPointF>& positions)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << ids << positions;
+    append(SetPositions, payload);
+}
+
+void EditJournal::logAddWire(const Wire& wire)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    writeWire(out, wire);
+    append(AddWire, payload);
+}
+
+void EditJournal::logClear()
+{
+    append(Clear, QByteArray());
+}
+
+void EditJournal::logSetProperties(int id, const QString& label, double value)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << qint32(id) << label << value;
+    append(SetProperties, payload);
+}
+
+void EditJournal::logRemoveComponent(int id)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << qint32(id);
+    append(RemoveComponent, payload);
+}
+
+void EditJournal::logRemoveWire(int index)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << qint32(index);
+    append(RemoveWire, payload);
+}
+
+void EditJournal::logDefineSubcircuit(const SubcircuitDefinition& definition)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    writeSubcircuit(out, definition);
+    append(DefineSubcircuit, payload);
+}
+
+void EditJournal::logRemoveSubcircuit(int definitionId)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << qint32(definitionId);
+    append(RemoveSubcircuit, payload);
+}
+
+void EditJournal::logAddComponents(const QVector<Component>& components)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << quint32(components.size());
+    for (const Component& comp : components)
+        writeComponent(out, comp);
+    append(AddComponents, payload);
+}
+
+void EditJournal::logRemoveComponents(const QVector<int>& ids)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << ids;
+    append(RemoveComponents, payload);
+}
+
+void EditJournal::logInsertWires(const QVector<int>& indices, const QVector<Wire>& wires)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << indices;
+    for (const Wire& wire : wires)
+        writeWire(out, wire);
+    append(InsertWires, payload);
+}
+
+void EditJournal::logRemoveWires(const QVector<int>& indices)
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    setupStream(out);
+    out << indices;
+    append(RemoveWires, payload);
+}
+
+void EditJournal::append(RecordType type, const QByteArray& payload)
+{
+    if (!isOpen())
+        return;
+
+    QByteArray record(RecordHeaderSize, Qt::Uninitialized);
+    record.reserve(RecordHeaderSize + 1 + payload.size());
+    record.append(char(type));
+    record.append(payload);
+
+    const char* body = record.constData() + RecordHeaderSize;
+    qsizetype bodySize = record.size() - RecordHeaderSize;
+    qToLittleEndian<quint32>(quint32(bodySize), record.data());
+    qToLittleEndian<quint32>(crc32(body, bodySize), record.data() + 4);
+
+    m_bytesSinceRotate += record.size();
+
+    QMutexLocker locker(&m_mutex);
+    if (m_queue.isEmpty() || m_queue.last().segment != m_segment || m_queue.last().discardBefore != 0)
+    {
+        Chunk chunk;
+        chunk.segment = m_segment;
+        m_queue.append(chunk);
+    }
+    m_queue.last().data.append(record);
+    m_queuedBytes += record.size();
+    ++m_enqueuedRecords;
+
+    // The writer batches on a timer; only wake it early when a lot piles up
+    if (m_queuedBytes > MaxQueuedBytes)
+        m_wake.wakeOne();
+}
+
+quint64 EditJournal::rotate()
+{
+    ++m_segment;
+    m_bytesSinceRotate = 0;
+    return m_segment;
+}
+
+void EditJournal::discardSegmentsBefore(quint64 segment)
+{
+    if (!isOpen())
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    Chunk chunk;
+    chunk.segment = m_segment;
+    chunk.discardBefore = segment;
+    m_queue.append(chunk);
+}
+
+void EditJournal::flush()
+{
+    if (!isOpen())
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    const quint64 target = m_enqueuedRecords;
+    m_flushRequested = true;
+    m_wake.wakeAll();
+    while (m_writtenRecords < target)
+        m_written.wait(&m_mutex);
+}
+
+void EditJournal::writerLoop(const QString& schematicPath)
+{
+    int fd = -1;
+    quint64 openSegment = 0;
+    bool reportedError = false;
+
+    auto closeSegment = [&fd]()
+    {
+        if (fd >= 0)
+        {
+            syncFile(fd);
+            closeFile(fd);
+            fd = -1;
+        }
+    };
+
+    QMutexLocker locker(&m_mutex);
+    while (true)
+    {
+        if (!m_stop && !m_flushRequested)
+            m_wake.wait(&m_mutex, FlushIntervalMs);
+
+        QVector<Chunk> batch;
+        batch.swap(m_queue);
+        m_queuedBytes = 0;
+        m_flushRequested = false;
+        const quint64 batchRecords = m_enqueuedRecords;
+        const bool stop = m_stop;
+        locker.unlock();
+
+        bool ok = true;
+        bool wrote = false;
+        for (const Chunk& chunk : batch)
+        {
+            if (chunk.discardBefore != 0)
+            {
+                if (openSegment < chunk.discardBefore)
+                    closeSegment();
+                removeSegments(schematicPath, chunk.discardBefore);
+                continue;
+            }
+
+            if (fd < 0 || chunk.segment != openSegment)
+            {
+                closeSegment();
+                QString path = segmentPath(schematicPath, chunk.segment);
+                bool fresh = !QFile::exists(path);
+                fd = openForAppend(path);
+                openSegment = chunk.segment;
+                if (fd >= 0 && fresh)
+                {
+                    char header[SegmentHeaderSize];
+                    std::memcpy(header, SegmentMagic, 4);
+                    qToLittleEndian<quint32>(SegmentVersion, header + 4);
+                    qToLittleEndian<quint64>(chunk.segment, header + 8);
+                    ok = writeAll(fd, header, SegmentHeaderSize) && ok;
+                }
+            }
+
+            ok = fd >= 0 && writeAll(fd, chunk.data.constData(), chunk.data.size()) && ok;
+            wrote = true;
+        }
+
+        if (wrote && fd >= 0)
+            ok = syncFile(fd) && ok;
+
+        if (!ok && !reportedError)
+        {
+            qWarning() << "Journal write failed for" << schematicPath;
+            reportedError = true;
+        }
+
+        locker.relock();
+        m_writtenRecords = batchRecords;
+        m_written.wakeAll();
+        if (stop && m_queue.isEmpty())
+            break;
+    }
+    locker.unlock();
+
+    closeSegment();
+}
+
+QString EditJournal::segmentPath(const QString& schematicPath, quint64 segment)
+{
+    return schematicPath + QStringLiteral(".journal.") + QString::number(segment);
+}
+
+QVector<quint64> EditJournal::segments(const QString& schematicPath)
+{
+    QFileInfo info(schematicPath);
+    QString prefix = info.fileName() + QStringLiteral(".journal.");
+    QStringList names = info.absoluteDir().entryList({prefix + QStringLiteral("*")}, QDir::Files);
+
+    QVector<quint64> result;
+    for (const QString& name : names)
+    {
+        bool ok = false;
+        quint64 segment = name.mid(prefix.size()).toULongLong(&ok);
+        if (ok)
+            result.append(segment);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void EditJournal::removeSegments(const QString& schematicPath, quint64 before)
+{
+    for (quint64 segment : segments(schematicPath))
+    {
+        if (segment < before)
+            QFile::remove(segmentPath(schematicPath, segment));
+    }
+}
+
+bool EditJournal::replay(const QString& schematicPath, quint64 fromSegment, Target& target, QString* errorString)
+{
+    auto fail = [errorString](const QString& message)
+    {
+        if (errorString)
+            *errorString = message;
+        qWarning() << "Journal replay:" << message;
+        return false;
+    };
+
+    int replayed = 0;
+    for (quint64 segment : segments(schematicPath))
+    {
+        if (segment < fromSegment)
+            continue;
+
+        QString path = segmentPath(schematicPath, segment);
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly))
+            return fail(file.errorString());
+
+        QByteArray data = file.readAll();
+        if (data.size() < SegmentHeaderSize || std::memcmp(data.constData(), SegmentMagic, 4) != 0 ||
+            qFromLittleEndian<quint32>(data.constData() + 4) > SegmentVersion)
+            return fail(QStringLiteral("%1 is not a journal segment").arg(path));
+        const quint32 version = qFromLittleEndian<quint32>(data.constData() + 4);
+
+        qsizetype pos = SegmentHeaderSize;
+        while (data.size() - pos >= RecordHeaderSize)
+        {
+            quint32 bodySize = qFromLittleEndian<quint32>(data.constData() + pos);
+            quint32 checksum = qFromLittleEndian<quint32>(data.constData() + pos + 4);
+            const char* body = data.constData() + pos + RecordHeaderSize;
+
+            // A torn or corrupt tail ends the session; everything before it is intact
+            if (bodySize == 0 || bodySize > quint64(data.size() - pos - RecordHeaderSize) ||
+                crc32(body, bodySize) != checksum)
+                return fail(QStringLiteral("Corrupt record in %1 after %2 records").arg(path).arg(replayed));
+
+            QByteArray payload = QByteArray::fromRawData(body + 1, bodySize - 1);
+            QDataStream in(payload);
+            setupStream(in);
+
+            // Decode fully before touching the target so a malformed record has no effect
+            bool known = true;
+            std::function<void()> apply;
+            switch (RecordType(quint8(body[0])))
+            {
+            case AddComponent:
+            {
+                Component component = readComponent(in, version);
+                apply = [&target, component]() { target.replayAddComponent(component); };
+                break;
+            }
+            case MoveComponents:
+            {
+                QVector<int> ids;
+                QPointF delta;
+                in >> ids >> delta;
+                apply = [&target, ids, delta]() { target.replayMoveComponents(ids, delta); };
+                break;
+            }
+            case SetPositions:
+            {
+                QVector<int> ids;
+                QVector<QPointF> positions;
+                in >> ids >> positions;
+                apply = [&target, ids, positions]() { target.replaySetPositions(ids, positions); };
+                break;
+            }
+            case AddWire:
+            {
+                Wire wire = readWire(in);
+                apply = [&target, wire]() { target.replayAddWire(wire); };
+                break;
+            }
+            case Clear:
+                apply = [&target]() { target.replayClear(); };
+                break;
+            case SetProperties:
+            {
+                qint32 id;
+                QString label;
+                double value;
+                in >> id >> label >> value;
+                apply = [&target, id, label, value]() { target.replaySetProperties(id, label, value); };
+                break;
+            }
+            case RemoveComponent:
+            {
+                qint32 id;
+                in >> id;
+                apply = [&target, id]() { target.replayRemoveComponent(id); };
+                break;
+            }
+            case RemoveWire:
+            {
+                qint32 index;
+                in >> index;
+                apply = [&target, index]() { target.replayRemoveWire(index); };
+                break;
+            }
+            case DefineSubcircuit:
+            {
+                SubcircuitDefinition definition = readSubcircuit(in, version);
+                apply = [&target, definition]() { target.replayDefineSubcircuit(definition); };
+                break;
+            }
+            case RemoveSubcircuit:
+            {
+                qint32 id;
+                in >> id;
+                apply = [&target, id]() { target.replayRemoveSubcircuit(id); };
+                break;
+            }
+            case AddComponents:
+            {
+                quint32 count;
+                in >> count;
+                QVector<Component> components;
+                for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+                    components.append(readComponent(in, version));
+                apply = [&target, components]() { target.replayAddComponents(components); };
+                break;
+            }
+            case RemoveComponents:
+            {
+                QVector<int> ids;
+                in >> ids;
+                apply = [&target, ids]() { target.replayRemoveComponents(ids); };
+                break;
+            }
+            case InsertWires:
+            {
+                QVector<int> indices;
+                in >> indices;
+                QVector<Wire> wires;
+                for (qsizetype i = 0; i < indices.size() && in.status() == QDataStream::Ok; ++i)
+                    wires.append(readWire(in));
+                apply = [&target, indices, wires]() { target.replayInsertWires(indices, wires); };
+                break;
+            }
+            case RemoveWires:
+            {
+                QVector<int> indices;
+                in >> indices;
+                apply = [&target, indices]() { target.replayRemoveWires(indices); };
+                break;
+            }
+            default:
+                known = false;
+                break;
+            }
+
+            if (!known)
+                return fail(QStringLiteral("Unknown record type %1 in %2").arg(int(quint8(body[0]))).arg(path));
+            if (in.status() != QDataStream::Ok)
+                return fail(QStringLiteral("Malformed record in %1").arg(path));
+            apply();
+
+            pos += RecordHeaderSize + bodySize;
+            ++replayed;
+        }
+    }
+
+    qDebug() << "Replayed" << replayed << "journal records for" << schematicPath;
+    return true;
+}
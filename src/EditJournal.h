@@ -0,0 +1,138 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMutex>
+#include <QPointF>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+struct Component;
+struct Wire;
+struct SubcircuitDefinition;
+
+// Append-only log of model mutations used for crash-safe autosave.
+//
+// The journal for a schematic "design.amb" is a series of segment files
+// "design.amb.journal.<n>". Each record is framed as
+//   quint32 body length, quint32 CRC-32 of the body, body = type byte + payload
+// and replay stops at the first torn or corrupt record.
+//
+// A schematic snapshot stores a revision: the first segment whose records it
+// does not contain. Recovery loads the snapshot and replays the segments from
+// that revision on. Compaction rotates to a new segment, writes a snapshot with
+// the new segment as its revision and then discards the older segments.
+//
+// Records are queued on the calling thread and written, in batches, by a
+// writer thread that fsyncs after every batch.
+class EditJournal
+{
+public:
+    enum RecordType : quint8
+    {
+        AddComponent = 1,
+        MoveComponents = 2,
+        SetPositions = 3,
+        AddWire = 4,
+        Clear = 5,
+        SetProperties = 6,
+        RemoveComponent = 7,
+        RemoveWire = 8,
+        DefineSubcircuit = 9,
+        RemoveSubcircuit = 10,
+        AddComponents = 11,
+        RemoveComponents = 12,
+        InsertWires = 13,
+        RemoveWires = 14
+    };
+
+    // Receives decoded records during replay
+    class Target
+    {
+    public:
+        virtual ~Target() = default;
+        virtual void replayAddComponent(const Component& component) = 0;
+        virtual void replayMoveComponents(const QVector<int>& ids, const QPointF& delta) = 0;
+        virtual void replaySetPositions(const QVector<int>& ids, const QVector<QPointF>& positions) = 0;
+        virtual void replayAddWire(const Wire& wire) = 0;
+        virtual void replayClear() = 0;
+        virtual void replaySetProperties(int id, const QString& label, double value) = 0;
+        virtual void replayRemoveComponent(int id) = 0;
+        virtual void replayRemoveWire(int index) = 0;
+        virtual void replayDefineSubcircuit(const SubcircuitDefinition& definition) = 0;
+        virtual void replayRemoveSubcircuit(int definitionId) = 0;
+        virtual void replayAddComponents(const QVector<Component>& components) = 0;
+        virtual void replayRemoveComponents(const QVector<int>& ids) = 0;
+        virtual void replayInsertWires(const QVector<int>& indices, const QVector<Wire>& wires) = 0;
+        virtual void replayRemoveWires(const QVector<int>& indices) = 0;
+    };
+
+    EditJournal() = default;
+    ~EditJournal();
+
+    // Starts logging into segments of the given schematic. firstSegment must be
+    // newer than any segment already on disk.
+    void open(const QString& schematicPath, quint64 firstSegment);
+    // Writes out everything queued and stops the writer thread
+    void close();
+    bool isOpen() const { return m_writer != nullptr; }
+    QString schematicPath() const { return m_path; }
+    quint64 segment() const { return m_segment; }
+    qint64 bytesSinceRotate() const { return m_bytesSinceRotate; }
+
+    void logAddComponent(const Component& component);
+    void logMoveComponents(const QVector<int>& ids, const QPointF& delta);
+    void logSetPositions(const QVector<int>& ids, const QVector<QPointF>& positions);
+    void logAddWire(const Wire& wire);
+    void logClear();
+    void logSetProperties(int id, const QString& label, double value);
+    void logRemoveComponent(int id);
+    void logRemoveWire(int index);
+    void logDefineSubcircuit(const SubcircuitDefinition& definition);
+    void logRemoveSubcircuit(int definitionId);
+    // Bulk edits, one record each; wire indices are ascending
+    void logAddComponents(const QVector<Component>& components);
+    void logRemoveComponents(const QVector<int>& ids);
+    void logInsertWires(const QVector<int>& indices, const QVector<Wire>& wires);
+    void logRemoveWires(const QVector<int>& indices);
+
+    // Subsequent records go to a new segment, whose number is returned
+    quint64 rotate();
+    // Deletes segments older than the given one once queued records are written
+    void discardSegmentsBefore(quint64 segment);
+    // Blocks until every queued record is on disk
+    void flush();
+
+    static QString segmentPath(const QString& schematicPath, quint64 segment);
+    static QVector<quint64> segments(const QString& schematicPath);
+    static void removeSegments(const QString& schematicPath, quint64 before = ~quint64(0));
+    static bool replay(const QString& schematicPath, quint64 fromSegment, Target& target, QString* errorString = nullptr);
+
+private:
+    struct Chunk
+    {
+        quint64 segment = 0;
+        QByteArray data;
+        quint64 discardBefore = 0; // Non-zero for a discard request
+    };
+
+    void append(RecordType type, const QByteArray& payload);
+    void writerLoop(const QString& schematicPath);
+
+    QString m_path;
+    quint64 m_segment = 0;
+    qint64 m_bytesSinceRotate = 0;
+    QThread* m_writer = nullptr;
+
+    // Shared with the writer thread
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QWaitCondition m_written;
+    QVector<Chunk> m_queue;
+    qint64 m_queuedBytes = 0;
+    quint64 m_enqueuedRecords = 0;
+    quint64 m_writtenRecords = 0;
+    bool m_flushRequested = false;
+    bool m_stop = false;
+};
@@ -0,0 +1,215 @@
+#include "GlyphAtlas.h"
+
+#include <QDebug>
+#include <QFontMetricsF>
+#include <QPainter>
+#include <QPainterPath>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace
+{
+// Rasterisation size and the distance, in atlas pixels, covered by the field
+constexpr int GlyphPixelSize = 48;
+constexpr int Spread = 6;
+constexpr int AtlasWidth = 1024;
+
+// One-dimensional squared distance transform (Felzenszwalb & Huttenlocher)
+void distanceTransform1D(const float* f, float* d, int n, std::vector<int>& v, std::vector<float>& z)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    int k = 0;
+    v[0] = 0;
+    z[0] = -inf;
+    z[1] = inf;
+    for (int q = 1; q < n; ++q)
+    {
+        float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * q - 2.0f * v[k]);
+        while (s <= z[k])
+        {
+            --k;
+            s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * q - 2.0f * v[k]);
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = inf;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q)
+    {
+        while (z[k + 1] < q)
+            ++k;
+        d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
+
+// Squared distance from every pixel to the nearest pixel where seed is set
+std::vector<float> squaredDistances(const std::vector<quint8>& seed, int width, int height)
+{
+    const float inf = 1e20f;
+    const int n = qMax(width, height);
+    std::vector<float> grid(size_t(width) * height);
+    std::vector<float> f(n), d(n), z(n + 1);
+    std::vector<int> v(n);
+
+    for (size_t i = 0; i < grid.size(); ++i)
+        grid[i] = seed[i] ? 0.0f : inf;
+
+    for (int x = 0; x < width; ++x)
+    {
+        for (int y = 0; y < height; ++y)
+            f[y] = grid[size_t(y) * width + x];
+        distanceTransform1D(f.data(), d.data(), height, v, z);
+        for (int y = 0; y < height; ++y)
+            grid[size_t(y) * width + x] = d[y];
+    }
+    for (int y = 0; y < height; ++y)
+    {
+        float* row = grid.data() + size_t(y) * width;
+        std::copy(row, row + width, f.begin());
+        distanceTransform1D(f.data(), d.data(), width, v, z);
+        std::copy(d.begin(), d.begin() + width, row);
+    }
+    return grid;
+}
+} // namespace
+
+QString GlyphAtlas::defaultCharacters()
+{
+    QString characters;
+    for (char16_t c = 0x20; c < 0x7f; ++c)
+        characters.append(QChar(c));
+    characters.append(QChar(0x00b5)); // Micro
+    characters.append(QChar(0x03a9)); // Ohm
+    return characters;
+}
+
+bool GlyphAtlas::build(const QString& characters, const QFont& baseFont)
+{
+    QFont font(baseFont);
+    font.setPixelSize(GlyphPixelSize);
+    font.setHintingPreference(QFont::PreferNoHinting);
+    QFontMetricsF metrics(font);
+
+    m_glyphs.clear();
+    m_fallbackAdvance = metrics.averageCharWidth() / GlyphPixelSize;
+
+    struct Placed
+    {
+        char16_t code;
+        QRect cell;
+        QRectF bounds;
+    };
+    QVector<Placed> placed;
+
+    // Shelf-pack the padded glyph boxes
+    int penX = 0, penY = 0, shelfHeight = 0;
+    for (QChar c : characters)
+    {
+        if (m_glyphs.contains(c.unicode()))
+            continue;
+
+        Glyph glyph;
+        glyph.advance = metrics.horizontalAdvance(c) / GlyphPixelSize;
+        QRectF bounds = metrics.tightBoundingRect(QString(c));
+        if (bounds.isEmpty())
+        {
+            glyph.uv = QRectF();
+            glyph.plane = QRectF();
+            m_glyphs.insert(c.unicode(), glyph);
+            continue;
+        }
+
+        const int w = int(std::ceil(bounds.width())) + 2 * Spread;
+        const int h = int(std::ceil(bounds.height())) + 2 * Spread;
+        if (penX + w > AtlasWidth)
+        {
+            penX = 0;
+            penY += shelfHeight;
+            shelfHeight = 0;
+        }
+        placed.append(Placed{c.unicode(), QRect(penX, penY, w, h), bounds});
+        m_glyphs.insert(c.unicode(), glyph);
+        penX += w;
+        shelfHeight = qMax(shelfHeight, h);
+    }
+
+    int atlasHeight = 1;
+    while (atlasHeight < penY + shelfHeight)
+        atlasHeight *= 2;
+
+    m_image = QImage(AtlasWidth, atlasHeight, QImage::Format_Grayscale8);
+    if (m_image.isNull())
+    {
+        qWarning() << "Failed to allocate glyph atlas" << AtlasWidth << "x" << atlasHeight;
+        return false;
+    }
+    m_image.fill(0);
+
+    for (const Placed& p : placed)
+    {
+        const int w = p.cell.width();
+        const int h = p.cell.height();
+
+        // Coverage mask with the glyph's tight box inset by the spread
+        QImage mask(w, h, QImage::Format_ARGB32_Premultiplied);
+        mask.fill(Qt::transparent);
+        {
+            QPainter painter(&mask);
+            painter.setRenderHint(QPainter::Antialiasing);
+            QPainterPath path;
+            path.addText(Spread - p.bounds.left(), Spread - p.bounds.top(), font, QString(QChar(p.code)));
+            painter.fillPath(path, Qt::white);
+        }
+
+        std::vector<quint8> inside(size_t(w) * h), outside(size_t(w) * h);
+        for (int y = 0; y < h; ++y)
+        {
+            const QRgb* row = reinterpret_cast<const QRgb*>(mask.constScanLine(y));
+            for (int x = 0; x < w; ++x)
+            {
+                inside[size_t(y) * w + x] = qAlpha(row[x]) >= 128;
+                outside[size_t(y) * w + x] = qAlpha(row[x]) < 128;
+            }
+        }
+        std::vector<float> toInside = squaredDistances(inside, w, h);
+        std::vector<float> toOutside = squaredDistances(outside, w, h);
+
+        for (int y = 0; y < h; ++y)
+        {
+            uchar* row = m_image.scanLine(p.cell.top() + y) + p.cell.left();
+            for (int x = 0; x < w; ++x)
+            {
+                const size_t i = size_t(y) * w + x;
+                const float distance = std::sqrt(toOutside[i]) - std::sqrt(toInside[i]);
+                const float value = 0.5f + distance / (2.0f * Spread);
+                row[x] = uchar(qBound(0.0f, value, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+
+        Glyph& glyph = m_glyphs[p.code];
+        glyph.uv = QRectF(double(p.cell.left()) / AtlasWidth, double(p.cell.top()) / atlasHeight,
+                          double(w) / AtlasWidth, double(h) / atlasHeight);
+        glyph.plane = QRectF((p.bounds.left() - Spread) / GlyphPixelSize, (p.bounds.top() - Spread) / GlyphPixelSize,
+                             double(w) / GlyphPixelSize, double(h) / GlyphPixelSize);
+    }
+
+    qDebug() << "Built glyph atlas with" << m_glyphs.size() << "glyphs," << AtlasWidth << "x" << atlasHeight;
+    return true;
+}
+
+const GlyphAtlas::Glyph* GlyphAtlas::glyph(QChar c) const
+{
+    auto it = m_glyphs.constFind(c.unicode());
+    return it == m_glyphs.constEnd() ? nullptr : &it.value();
+}
+
+float GlyphAtlas::advance(QChar c) const
+{
+    const Glyph* g = glyph(c);
+    return g ? g->advance : m_fallbackAdvance;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QFont>
+#include <QHash>
+#include <QImage>
+#include <QRectF>
+#include <QString>
+
+// Signed distance field glyph atlas. Glyphs are rasterised once at a large
+// size and stored as distances to their outline (0.5 on the edge, larger
+// inside), so one texture renders crisp text at any scale.
+class GlyphAtlas
+{
+public:
+    struct Glyph
+    {
+        QRectF uv;       // Normalised atlas coordinates
+        QRectF plane;    // Quad relative to the pen on the baseline, in ems
+        float advance;   // In ems
+    };
+
+    // Characters used by labels and values; anything else is skipped
+    static QString defaultCharacters();
+
+    bool build(const QString& characters, const QFont& font = QFont());
+
+    const QImage& image() const { return m_image; } // Format_Grayscale8
+    const Glyph* glyph(QChar c) const;
+    float advance(QChar c) const;
+
+private:
+    QImage m_image;
+    QHash<char16_t, Glyph> m_glyphs;
+    float m_fallbackAdvance = 0.5f;
+};
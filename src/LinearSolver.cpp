@@ -0,0 +1,529 @@
+#include "LinearSolver.h"
+#include "DomainDecomposition.h"
+
+#include <QDebug>
+#include <QPair>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Pivots below this are taken as a singular system
+constexpr double PivotTolerance = 1e-18;
+// Rows below which a product is not worth handing to other threads
+constexpr int ParallelRows = 16384;
+
+double dot(const QVector<double>& a, const QVector<double>& b)
+{
+    double sum = 0.0;
+    for (qsizetype i = 0; i < a.size(); ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+double norm(const QVector<double>& a)
+{
+    return std::sqrt(dot(a, a));
+}
+
+// y += alpha * x
+void addScaled(QVector<double>& y, double alpha, const QVector<double>& x)
+{
+    double* out = y.data();
+    for (qsizetype i = 0; i < x.size(); ++i)
+        out[i] += alpha * x[i];
+}
+
+int iterationLimit(int size)
+{
+    return qBound(1000, 2 * size, 20000);
+}
+} // namespace
+
+// --- SparseMatrix ---
+
+SparseMatrix SparseMatrix::fromEntries(int size, QVector<Entry> entries)
+{
+    for (int row = 0; row < size; ++row)
+        entries.append({row, row, 0.0});
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+    {
+        return a.row != b.row ? a.row < b.row : a.col < b.col;
+    });
+
+    SparseMatrix matrix;
+    matrix.m_size = size;
+    matrix.m_rowStart.fill(0, size + 1);
+    matrix.m_diagonal.fill(-1, size);
+    for (const Entry& entry : std::as_const(entries))
+    {
+        if (entry.row < 0 || entry.row >= size || entry.col < 0 || entry.col >= size)
+            continue;
+        const bool repeated = !matrix.m_columns.isEmpty() && matrix.m_rowStart[entry.row + 1] > 0 &&
+                              matrix.m_columns.last() == entry.col;
+        if (repeated)
+        {
+            matrix.m_values.last() += entry.value;
+            continue;
+        }
+        if (entry.row == entry.col)
+            matrix.m_diagonal[entry.row] = matrix.m_columns.size();
+        matrix.m_columns.append(entry.col);
+        matrix.m_values.append(entry.value);
+        matrix.m_rowStart[entry.row + 1] = matrix.m_columns.size();
+    }
+    // Every row has at least its diagonal, so the ends only need carrying over
+    for (int row = 0; row < size; ++row)
+        matrix.m_rowStart[row + 1] = qMax(matrix.m_rowStart[row + 1], matrix.m_rowStart[row]);
+    return matrix;
+}
+
+bool SparseMatrix::isSymmetric(double tolerance) const
+{
+    for (int row = 0; row < m_size; ++row)
+    {
+        for (int k = m_rowStart[row]; k < m_rowStart[row + 1]; ++k)
+        {
+            const int col = m_columns[k];
+            if (col <= row)
+                continue;
+            const auto begin = m_columns.cbegin() + m_rowStart[col];
+            const auto end = m_columns.cbegin() + m_rowStart[col + 1];
+            const auto mirror = std::lower_bound(begin, end, row);
+            const double other = mirror != end && *mirror == row ? m_values[mirror - m_columns.cbegin()] : 0.0;
+            const double scale = qMax(std::abs(m_values[k]), std::abs(other));
+            if (std::abs(m_values[k] - other) > tolerance * scale)
+                return false;
+        }
+    }
+    return true;
+}
+
+QVector<double> SparseMatrix::toDense() const
+{
+    QVector<double> dense(qsizetype(m_size) * m_size, 0.0);
+    for (int row = 0; row < m_size; ++row)
+    {
+        for (int k = m_rowStart[row]; k < m_rowStart[row + 1]; ++k)
+            dense[qsizetype(row) * m_size + m_columns[k]] = m_values[k];
+    }
+    return dense;
+}
+
+qint64 SparseMatrix::byteSize() const
+{
+    return (m_rowStart.capacity() + m_columns.capacity() + m_diagonal.capacity()) * qint64(sizeof(int)) +
+           m_values.capacity() * qint64(sizeof(double));
+}
+
+void SparseMatrix::multiply(const QVector<double>& x, QVector<double>& y) const
+{
+    y.resize(m_size);
+    const double* in = x.constData();
+    double* out = y.data();
+    auto rows = [this, in, out](int first, int last)
+    {
+        for (int row = first; row < last; ++row)
+        {
+            double sum = 0.0;
+            for (int k = m_rowStart[row]; k < m_rowStart[row + 1]; ++k)
+                sum += m_values[k] * in[m_columns[k]];
+            out[row] = sum;
+        }
+    };
+
+    if (m_size < ParallelRows)
+    {
+        rows(0, m_size);
+        return;
+    }
+
+    // A few blocks per thread keep the threads busy when rows differ in length
+    const int blockCount = qMax(1, QThread::idealThreadCount() * 4);
+    const int blockRows = (m_size + blockCount - 1) / blockCount;
+    QVector<QPair<int, int>> blocks;
+    for (int first = 0; first < m_size; first += blockRows)
+        blocks.append({first, qMin(first + blockRows, m_size)});
+    QtConcurrent::blockingMap(blocks, [&rows](const QPair<int, int>& block) { rows(block.first, block.second); });
+}
+
+// --- DenseLu ---
+
+bool DenseLu::factor(QVector<double> matrix, int size)
+{
+    m_size = size;
+    m_lu = std::move(matrix);
+    m_pivot.resize(size);
+    for (int k = 0; k < size; ++k)
+    {
+        int pivot = k;
+        double largest = std::abs(m_lu[qsizetype(k) * size + k]);
+        for (int row = k + 1; row < size; ++row)
+        {
+            const double candidate = std::abs(m_lu[qsizetype(row) * size + k]);
+            if (candidate > largest)
+            {
+                largest = candidate;
+                pivot = row;
+            }
+        }
+        if (largest < PivotTolerance)
+            return false;
+
+        m_pivot[k] = pivot;
+        if (pivot != k)
+        {
+            for (int col = 0; col < size; ++col)
+                std::swap(m_lu[qsizetype(k) * size + col], m_lu[qsizetype(pivot) * size + col]);
+        }
+
+        const double* pivotRow = m_lu.constData() + qsizetype(k) * size;
+        for (int row = k + 1; row < size; ++row)
+        {
+            double* target = m_lu.data() + qsizetype(row) * size;
+            if (target[k] == 0.0)
+                continue;
+            const double factor = target[k] / pivotRow[k];
+            target[k] = factor;
+            for (int col = k + 1; col < size; ++col)
+                target[col] -= factor * pivotRow[col];
+        }
+    }
+    return true;
+}
+
+void DenseLu::solve(QVector<double>& x) const
+{
+    const int size = m_size;
+    for (int k = 0; k < size; ++k)
+    {
+        if (m_pivot[k] != k)
+            std::swap(x[k], x[m_pivot[k]]);
+    }
+    for (int row = 1; row < size; ++row)
+    {
+        const double* lu = m_lu.constData() + qsizetype(row) * size;
+        double sum = x[row];
+        for (int col = 0; col < row; ++col)
+            sum -= lu[col] * x[col];
+        x[row] = sum;
+    }
+    for (int row = size - 1; row >= 0; --row)
+    {
+        const double* lu = m_lu.constData() + qsizetype(row) * size;
+        double sum = x[row];
+        for (int col = row + 1; col < size; ++col)
+            sum -= lu[col] * x[col];
+        x[row] = sum / lu[row];
+    }
+}
+
+qint64 DenseLu::byteSize() const
+{
+    return m_lu.capacity() * qint64(sizeof(double)) + m_pivot.capacity() * qint64(sizeof(int));
+}
+
+// --- LinearSolver ---
+
+LinearSolver::LinearSolver() = default;
+LinearSolver::~LinearSolver() = default;
+
+LinearSolver::Method LinearSolver::choose(const SparseMatrix& matrix, qint64 solves)
+{
+    if (matrix.size() <= DirectLimit)
+        return Direct;
+    // A factorization pays for itself over many right-hand sides
+    if (solves > 1)
+        return Partitioned;
+    return matrix.isSymmetric() ? ConjugateGradient : BiCgStab;
+}
+
+QString LinearSolver::methodName(Method method)
+{
+    switch (method)
+    {
+    case Automatic:
+        return QStringLiteral("auto");
+    case Direct:
+        return QStringLiteral("direct");
+    case ConjugateGradient:
+        return QStringLiteral("cg");
+    case BiCgStab:
+        return QStringLiteral("bicgstab");
+    case Partitioned:
+        return QStringLiteral("partitioned");
+    }
+    return QString();
+}
+
+bool LinearSolver::fromName(const QString& name, Method& method)
+{
+    for (Method candidate : {Automatic, Direct, ConjugateGradient, BiCgStab, Partitioned})
+    {
+        if (name == methodName(candidate))
+        {
+            method = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LinearSolver::prepare(const SparseMatrix& matrix, Method method, qint64 solves)
+{
+    m_matrix = matrix;
+    m_size = matrix.size();
+    m_method = method == Automatic ? choose(matrix, solves) : method;
+    m_dense = DenseLu();
+    m_ilu.clear();
+    m_decomposition.reset();
+    m_errorString.clear();
+    if (m_method == Direct)
+        return factorDense();
+
+    if (m_method == Partitioned)
+    {
+        // Blocks of a few hundred unknowns at least, one per core at most
+        const int parts = qBound(2, m_size / DomainDecomposition::MinimumBlockSize, QThread::idealThreadCount());
+        m_decomposition = std::make_unique<DomainDecomposition>();
+        if (m_decomposition->factor(matrix, parts, FallbackLimit))
+            return true;
+        qWarning() << "Domain decomposition of" << m_size << "unknowns failed:" << m_decomposition->errorString()
+                   << "- solving iteratively";
+        m_decomposition.reset();
+        m_method = matrix.isSymmetric() ? ConjugateGradient : BiCgStab;
+    }
+    return factorIncomplete();
+}
+
+bool LinearSolver::factorIncomplete()
+{
+    // ILU(0): Gaussian elimination that keeps only the matrix's own pattern
+    const SparseMatrix& matrix = m_matrix;
+    const QVector<int>& rowStart = matrix.rowStarts();
+    const QVector<int>& columns = matrix.columns();
+    const QVector<int>& diagonal = matrix.diagonal();
+    m_ilu = matrix.values();
+    double* lu = m_ilu.data();
+    for (int row = 0; row < m_size; ++row)
+    {
+        const int end = rowStart[row + 1];
+        for (int p = rowStart[row]; p < diagonal[row]; ++p)
+        {
+            const int k = columns[p];
+            lu[p] /= lu[diagonal[k]];
+            // Subtract l(row, k) * u(k, j) where (row, j) is in the pattern
+            int q = diagonal[k] + 1;
+            int r = p + 1;
+            const int endK = rowStart[k + 1];
+            while (q < endK && r < end)
+            {
+                if (columns[q] == columns[r])
+                    lu[r++] -= lu[p] * lu[q++];
+                else if (columns[q] < columns[r])
+                    ++q;
+                else
+                    ++r;
+            }
+        }
+
+        // A pivot that cancelled out, e.g. a source row, is replaced by the
+        // row's scale; the preconditioner gets rougher but stays usable
+        double scale = 0.0;
+        for (int p = rowStart[row]; p < end; ++p)
+            scale = qMax(scale, std::abs(matrix.values()[p]));
+        double& pivot = lu[diagonal[row]];
+        if (std::abs(pivot) <= 1e-12 * scale || !std::isfinite(pivot))
+        {
+            if (scale == 0.0)
+            {
+                m_errorString = QStringLiteral("singular circuit matrix (row %1 is empty)").arg(row);
+                return false;
+            }
+            pivot = pivot < 0.0 ? -scale : scale;
+        }
+    }
+    return true;
+}
+
+bool LinearSolver::factorDense()
+{
+    if (m_dense.factor(m_matrix.toDense(), m_size))
+        return true;
+    m_errorString = QStringLiteral("singular circuit matrix (a loop of voltage sources and inductors?)");
+    return false;
+}
+
+bool LinearSolver::solve(const QVector<double>& rhs, QVector<double>& x)
+{
+    m_lastIterations = 0;
+    if (m_method == Partitioned)
+    {
+        m_decomposition->solve(rhs, x, tolerance);
+        return true;
+    }
+    if (m_method != Direct)
+    {
+        if (x.size() != m_size)
+            x.fill(0.0, m_size);
+        const bool converged = m_method == ConjugateGradient ? conjugateGradient(rhs, x) : biCgStab(rhs, x);
+        if (converged)
+            return true;
+        if (m_size > FallbackLimit)
+            return false;
+
+        qWarning() << LinearSolver::methodName(m_method) << "did not converge in" << m_lastIterations
+                   << "iterations; factoring the" << m_size << "unknowns densely";
+        m_method = Direct;
+        m_ilu.clear();
+        if (!factorDense())
+            return false;
+    }
+
+    x = rhs;
+    m_dense.solve(x);
+    return true;
+}
+
+void LinearSolver::precondition(const QVector<double>& r, QVector<double>& z) const
+{
+    const QVector<int>& rowStart = m_matrix.rowStarts();
+    const QVector<int>& columns = m_matrix.columns();
+    const QVector<int>& diagonal = m_matrix.diagonal();
+    z.resize(m_size);
+    double* out = z.data();
+
+    // Unit lower, then upper triangular solve on the ILU(0) factors
+    for (int row = 0; row < m_size; ++row)
+    {
+        double sum = r[row];
+        for (int p = rowStart[row]; p < diagonal[row]; ++p)
+            sum -= m_ilu[p] * out[columns[p]];
+        out[row] = sum;
+    }
+    for (int row = m_size - 1; row >= 0; --row)
+    {
+        double sum = out[row];
+        for (int p = diagonal[row] + 1; p < rowStart[row + 1]; ++p)
+            sum -= m_ilu[p] * out[columns[p]];
+        out[row] = sum / m_ilu[diagonal[row]];
+    }
+}
+
+bool LinearSolver::conjugateGradient(const QVector<double>& rhs, QVector<double>& x)
+{
+    // ILU(0) of a symmetric matrix is L D L^T, so it is a valid CG preconditioner
+    const double target = tolerance * norm(rhs);
+    if (target == 0.0)
+    {
+        x.fill(0.0, m_size);
+        return true;
+    }
+
+    QVector<double> r;
+    m_matrix.multiply(x, r);
+    for (int i = 0; i < m_size; ++i)
+        r[i] = rhs[i] - r[i];
+    QVector<double> z;
+    precondition(r, z);
+    QVector<double> p = z;
+    QVector<double> q;
+    double rz = dot(r, z);
+
+    const int limit = iterationLimit(m_size);
+    for (m_lastIterations = 0; m_lastIterations < limit; ++m_lastIterations)
+    {
+        if (norm(r) <= target)
+            return true;
+        m_matrix.multiply(p, q);
+        const double pq = dot(p, q);
+        if (pq == 0.0)
+            break;
+        const double alpha = rz / pq;
+        addScaled(x, alpha, p);
+        addScaled(r, -alpha, q);
+        precondition(r, z);
+        const double rzNext = dot(r, z);
+        const double beta = rzNext / rz;
+        rz = rzNext;
+        for (int i = 0; i < m_size; ++i)
+            p[i] = z[i] + beta * p[i];
+    }
+    return norm(r) <= target;
+}
+
+bool LinearSolver::biCgStab(const QVector<double>& rhs, QVector<double>& x)
+{
+    const double target = tolerance * norm(rhs);
+    if (target == 0.0)
+    {
+        x.fill(0.0, m_size);
+        return true;
+    }
+
+    // Right preconditioned, so the residual checked is the true one
+    QVector<double> r;
+    m_matrix.multiply(x, r);
+    for (int i = 0; i < m_size; ++i)
+        r[i] = rhs[i] - r[i];
+    const QVector<double> shadow = r;
+    QVector<double> p(m_size, 0.0);
+    QVector<double> v(m_size, 0.0);
+    QVector<double> pHat;
+    QVector<double> s(m_size);
+    QVector<double> sHat;
+    QVector<double> t;
+    double rho = 1.0;
+    double alpha = 1.0;
+    double omega = 1.0;
+
+    const int limit = iterationLimit(m_size);
+    for (m_lastIterations = 0; m_lastIterations < limit; ++m_lastIterations)
+    {
+        if (norm(r) <= target)
+            return true;
+
+        const double rhoNext = dot(shadow, r);
+        if (rhoNext == 0.0 || omega == 0.0)
+            break; // Breakdown
+        const double beta = (rhoNext / rho) * (alpha / omega);
+        rho = rhoNext;
+        for (int i = 0; i < m_size; ++i)
+            p[i] = r[i] + beta * (p[i] - omega * v[i]);
+
+        precondition(p, pHat);
+        m_matrix.multiply(pHat, v);
+        const double shadowV = dot(shadow, v);
+        if (shadowV == 0.0)
+            break;
+        alpha = rho / shadowV;
+        for (int i = 0; i < m_size; ++i)
+            s[i] = r[i] - alpha * v[i];
+        if (norm(s) <= target)
+        {
+            addScaled(x, alpha, pHat);
+            ++m_lastIterations;
+            return true;
+        }
+
+        precondition(s, sHat);
+        m_matrix.multiply(sHat, t);
+        const double tt = dot(t, t);
+        omega = tt > 0.0 ? dot(t, s) / tt : 0.0;
+        addScaled(x, alpha, pHat);
+        addScaled(x, omega, sHat);
+        for (int i = 0; i < m_size; ++i)
+            r[i] = s[i] - omega * t[i];
+    }
+    return norm(r) <= target;
+}
+
+qint64 LinearSolver::byteSize() const
+{
+    // The iterative methods also keep about eight work vectors while solving
+    const qint64 work = m_method == Direct || m_method == Partitioned ? 0 : 8 * qint64(m_size) * qint64(sizeof(double));
+    const qint64 decomposition = m_decomposition ? m_decomposition->byteSize() : 0;
+    return m_matrix.byteSize() + m_dense.byteSize() + m_ilu.capacity() * qint64(sizeof(double)) + decomposition + work;
+}
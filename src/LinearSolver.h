@@ -0,0 +1,133 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+#include <memory>
+
+class DomainDecomposition;
+
+// Square matrix in compressed sparse rows. Every row stores its diagonal,
+// zero or not, so that incomplete factorizations always have a pivot slot.
+class SparseMatrix
+{
+public:
+    struct Entry
+    {
+        int row;
+        int col;
+        double value;
+    };
+
+    SparseMatrix() = default;
+    // Entries at the same position are summed
+    static SparseMatrix fromEntries(int size, QVector<Entry> entries);
+
+    int size() const { return m_size; }
+    qsizetype nonZeros() const { return m_values.size(); }
+    bool isSymmetric(double tolerance = 1e-12) const;
+    QVector<double> toDense() const; // Row-major
+    qint64 byteSize() const;
+
+    // y = A x. Large matrices split their rows over the global thread pool.
+    void multiply(const QVector<double>& x, QVector<double>& y) const;
+
+    const QVector<int>& rowStarts() const { return m_rowStart; } // size + 1 offsets into columns()
+    const QVector<int>& columns() const { return m_columns; }    // Ascending within a row
+    const QVector<double>& values() const { return m_values; }
+    const QVector<int>& diagonal() const { return m_diagonal; } // Index of each row's diagonal entry
+
+private:
+    int m_size = 0;
+    QVector<int> m_rowStart;
+    QVector<int> m_columns;
+    QVector<double> m_values;
+    QVector<int> m_diagonal;
+};
+
+// LU factors of a dense square matrix, with partial pivoting
+class DenseLu
+{
+public:
+    bool factor(QVector<double> matrix, int size); // Row-major; false when singular
+    void solve(QVector<double>& x) const;          // Overwrites the right-hand side with the solution
+
+    int size() const { return m_size; }
+    qint64 byteSize() const;
+
+private:
+    int m_size = 0;
+    QVector<double> m_lu; // Unit lower and upper factors in one array
+    QVector<int> m_pivot; // Row swapped with each row during elimination
+};
+
+// Solves A x = b for one matrix and many right-hand sides, as the steps of a
+// transient need. Small systems are factored densely with partial pivoting.
+// Large ones use a Krylov method instead, which needs no fill-in: conjugate
+// gradients when the matrix is symmetric (resistor and capacitor meshes) and
+// BiCGSTAB otherwise (sources and inductors add unsymmetric branch rows),
+// both preconditioned with ILU(0). An iterative solve that does not converge
+// falls back to the dense factorization while that is affordable. Large
+// systems solved many times over, as in a transient, are factored by domain
+// decomposition instead: in parallel blocks joined by a Schur complement.
+class LinearSolver
+{
+public:
+    enum Method
+    {
+        Automatic,
+        Direct,
+        ConjugateGradient,
+        BiCgStab,
+        Partitioned
+    };
+
+    // Largest system Automatic factors densely, and the largest an iterative
+    // method may fall back to or a Schur complement may have
+    static constexpr int DirectLimit = 1000;
+    static constexpr int FallbackLimit = 4000;
+
+    LinearSolver();
+    ~LinearSolver();
+
+    // solves: right-hand sides expected for this matrix, e.g. transient steps
+    static Method choose(const SparseMatrix& matrix, qint64 solves = 1);
+    static QString methodName(Method method);
+    static bool fromName(const QString& name, Method& method); // "auto", "direct", "cg", "bicgstab" or "partitioned"
+
+    // False when the matrix is singular (direct) or has no usable pivots.
+    // A partitioning that cannot be factored falls back to an iterative method.
+    bool prepare(const SparseMatrix& matrix, Method method = Automatic, qint64 solves = 1);
+    // x holds the initial guess of an iterative method, e.g. the previous time
+    // step, and receives the solution
+    bool solve(const QVector<double>& rhs, QVector<double>& x);
+
+    Method method() const { return m_method; }
+    int lastIterations() const { return m_lastIterations; }
+    QString errorString() const { return m_errorString; }
+    qint64 byteSize() const;
+
+    // Relative residual at which an iterative solve stops, and relative change
+    // below which a partitioned solve leaves a block's solution as it was
+    double tolerance = 1e-10;
+
+private:
+    bool factorDense();
+    bool factorIncomplete();
+    bool conjugateGradient(const QVector<double>& rhs, QVector<double>& x);
+    bool biCgStab(const QVector<double>& rhs, QVector<double>& x);
+    void precondition(const QVector<double>& r, QVector<double>& z) const;
+
+    Method m_method = Direct;
+    SparseMatrix m_matrix;
+    int m_size = 0;
+
+    DenseLu m_dense;
+
+    // Iterative: ILU(0) factors on the matrix's pattern, unit lower part implied
+    QVector<double> m_ilu;
+
+    std::unique_ptr<DomainDecomposition> m_decomposition;
+
+    int m_lastIterations = 0;
+    QString m_errorString;
+};
@@ -0,0 +1,618 @@
+#include "LiveOperatingPoint.h"
+
+#include <QHash>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+QString validate(const Netlist& netlist)
+{
+    if (netlist.elements.isEmpty())
+        return QStringLiteral("the design has no elements");
+    for (const NetlistElement& element : netlist.elements)
+    {
+        if (element.nodeA < 0 || element.nodeA >= netlist.nodeCount || element.nodeB < 0
+            || element.nodeB >= netlist.nodeCount)
+            return QStringLiteral("%1: not connected").arg(element.name);
+        if (element.isType("Resistor"))
+        {
+            if (!(element.value > 0.0))
+                return QStringLiteral("%1: resistance must be positive").arg(element.name);
+        }
+        else if (!element.isType("Capacitor") && !element.hasBranch())
+        {
+            return QStringLiteral("%1: unsupported element type \"%2\"").arg(element.name, element.type);
+        }
+    }
+    return QString();
+}
+
+// Sorted by unknown, without duplicates or zeros
+template <typename Terms>
+Terms normalized(Terms terms)
+{
+    std::sort(terms.begin(), terms.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    Terms merged;
+    for (const auto& term : std::as_const(terms))
+    {
+        if (term.first < 0)
+            continue;
+        if (!merged.isEmpty() && merged.last().first == term.first)
+            merged.last().second += term.second;
+        else
+            merged.append(term);
+    }
+    merged.erase(std::remove_if(merged.begin(), merged.end(), [](const auto& term) { return term.second == 0.0; }),
+                 merged.end());
+    return merged;
+}
+
+template <typename Terms>
+double dot(const Terms& terms, const QVector<double>& x)
+{
+    double sum = 0.0;
+    for (const auto& term : terms)
+        sum += term.second * x[term.first];
+    return sum;
+}
+} // namespace
+
+bool LiveOperatingPoint::update(const Netlist& netlist)
+{
+    m_refactored = false;
+    m_errorString = validate(netlist);
+    if (!m_errorString.isEmpty())
+    {
+        const QString error = m_errorString;
+        clear();
+        m_errorString = error;
+        return false;
+    }
+    if (!m_factored)
+        return refactor(netlist);
+
+    // Elements pair up by name, the k-th of a name with the k-th one before
+    QHash<QString, QVector<int>> byName;
+    for (int j = 0; j < m_current.elements.size(); ++j)
+        byName[m_current.elements[j].name].append(j);
+    QHash<QString, int> occurrences;
+    QVector<int> residentElement(netlist.elements.size(), -1);
+    QVector<bool> kept(m_current.elements.size(), false);
+    for (int i = 0; i < netlist.elements.size(); ++i)
+    {
+        const NetlistElement& element = netlist.elements[i];
+        const int occurrence = occurrences[element.name]++;
+        const QVector<int> candidates = byName.value(element.name);
+        if (occurrence < candidates.size() && m_current.elements[candidates[occurrence]].type == element.type)
+        {
+            residentElement[i] = candidates[occurrence];
+            kept[candidates[occurrence]] = true;
+        }
+    }
+
+    NodePlan plan;
+    if (!assignNodes(netlist, residentElement, plan))
+        return refactor(netlist);
+
+    Netlist next;
+    next.elements = netlist.elements;
+    next.nodeCount = m_current.nodeCount;
+    next.groundNode = 0;
+    QVector<int> branchOf(next.elements.size(), -1);
+    QVector<QPair<Terms, Terms>> changes;
+    QHash<qint64, double> conductanceChanges;
+    const qint64 nodeCount = m_current.nodeCount;
+    const auto conductance = [&conductanceChanges, nodeCount](int a, int b, double g) {
+        if (a != b)
+            conductanceChanges[qint64(qMin(a, b)) * nodeCount + qMax(a, b)] += g;
+    };
+    for (int i = 0; i < next.elements.size(); ++i)
+    {
+        NetlistElement& element = next.elements[i];
+        element.nodeA = plan.nodeA[i];
+        element.nodeB = plan.nodeB[i];
+        if (residentElement[i] < 0)
+        {
+            // A new source or inductor would add an unknown
+            if (element.hasBranch())
+                return refactor(netlist);
+            if (element.isType("Resistor"))
+                conductance(element.nodeA, element.nodeB, 1.0 / element.value);
+            continue;
+        }
+
+        const NetlistElement& before = m_current.elements[residentElement[i]];
+        const bool moved = element.nodeA != before.nodeA || element.nodeB != before.nodeB;
+        if (element.hasBranch())
+        {
+            // Its column is the incidence of its nodes; its row the same for
+            // an inductor (v(A) - v(B) = 0) and negated for a source
+            const int branch = m_branchOf[residentElement[i]];
+            branchOf[i] = branch;
+            if (!moved)
+                continue;
+            const Terms column{{unknownOf(element.nodeA), 1.0}, {unknownOf(element.nodeB), -1.0},
+                               {unknownOf(before.nodeA), -1.0}, {unknownOf(before.nodeB), 1.0}};
+            const double sign = element.isType("Voltage Source") ? -1.0 : 1.0;
+            Terms row = column;
+            for (auto& term : row)
+                term.second *= sign;
+            changes.append({column, Terms{{branch, 1.0}}});
+            changes.append({Terms{{branch, 1.0}}, row});
+        }
+        else if (element.isType("Resistor"))
+        {
+            if (!moved && element.value == before.value)
+                continue;
+            if (moved)
+            {
+                conductance(before.nodeA, before.nodeB, -1.0 / before.value);
+                conductance(element.nodeA, element.nodeB, 1.0 / element.value);
+            }
+            else
+            {
+                conductance(element.nodeA, element.nodeB, 1.0 / element.value - 1.0 / before.value);
+            }
+        }
+        // Capacitors are open at DC
+    }
+    for (int j = 0; j < m_current.elements.size(); ++j)
+    {
+        const NetlistElement& removed = m_current.elements[j];
+        if (kept[j])
+            continue;
+        if (removed.hasBranch())
+            return refactor(netlist);
+        if (removed.isType("Resistor"))
+            conductance(removed.nodeA, removed.nodeB, -1.0 / removed.value);
+    }
+
+    // A free slot's row reads i = 0; a short's column is the incidence of
+    // its nodes and its row v(a) - v(b) = 0
+    const auto shortChange = [this, &changes](const Short& branch, double sign) {
+        const Terms incidence{{unknownOf(branch.a), sign}, {unknownOf(branch.b), -sign}};
+        Terms row = incidence;
+        row.append({branch.branch, -sign});
+        changes.append({incidence, Terms{{branch.branch, 1.0}}});
+        changes.append({Terms{{branch.branch, 1.0}}, row});
+    };
+    for (int node : std::as_const(plan.unanchored))
+        changes.append({Terms{{unknownOf(node), 1.0}}, Terms{{unknownOf(node), Netlist::MinimumConductance - 1.0}}});
+    for (const Short& branch : std::as_const(plan.released))
+        shortChange(branch, -1.0);
+    for (const Short& branch : std::as_const(plan.added))
+        shortChange(branch, 1.0);
+
+    QHash<qint64, int> updateAcross;
+    for (int k = 0; k < m_updates.size(); ++k)
+    {
+        if (m_updates[k].across >= 0)
+            updateAcross.insert(m_updates[k].across, k);
+    }
+    int rank = m_updates.size() + changes.size();
+    for (auto it = conductanceChanges.constBegin(); it != conductanceChanges.constEnd(); ++it)
+    {
+        if (!updateAcross.contains(it.key()))
+            ++rank;
+    }
+    if (rank > MaximumRank)
+        return refactor(netlist);
+
+    m_current = std::move(next);
+    m_branchOf = std::move(branchOf);
+    m_residentOf = std::move(plan.residentOf);
+    m_shorts = std::move(plan.shorts);
+    m_spareBranches = std::move(plan.spareBranches);
+    for (int node : std::as_const(plan.unanchored))
+        m_anchored[node] = false;
+    bool changed = false;
+    for (auto it = conductanceChanges.constBegin(); it != conductanceChanges.constEnd(); ++it)
+    {
+        if (it.value() == 0.0)
+            continue;
+        changed = true;
+        const auto existing = updateAcross.constFind(it.key());
+        if (existing != updateAcross.constEnd())
+        {
+            Update& update = m_updates[existing.value()];
+            update.conductance += it.value();
+            update.v = update.u;
+            for (auto& term : update.v)
+                term.second *= update.conductance;
+            continue;
+        }
+        const int a = int(it.key() / nodeCount);
+        const int b = int(it.key() % nodeCount);
+        const Terms across{{unknownOf(a), 1.0}, {unknownOf(b), -1.0}};
+        if (!addUpdate(across, Terms{{unknownOf(a), it.value()}, {unknownOf(b), -it.value()}}, it.key(), it.value()))
+            return refactor(netlist);
+    }
+    for (const auto& change : std::as_const(changes))
+    {
+        changed = true;
+        if (!addUpdate(change.first, change.second))
+            return refactor(netlist);
+    }
+    if ((changed && !factorUpdates()) || !solve())
+        return refactor(netlist);
+    return true;
+}
+
+void LiveOperatingPoint::clear()
+{
+    m_current = Netlist();
+    m_branchOf.clear();
+    m_residentOf.clear();
+    m_shorts.clear();
+    m_spareBranches.clear();
+    m_anchored.clear();
+    m_unknownCount = 0;
+    m_factored = false;
+    m_matrix = SparseMatrix();
+    m_solver.reset();
+    m_updates.clear();
+    m_capacitance = DenseLu();
+    m_residentSolution.clear();
+    m_voltages.clear();
+    m_currents.clear();
+    m_errorString.clear();
+}
+
+qint64 LiveOperatingPoint::byteSize() const
+{
+    qint64 bytes = m_matrix.byteSize() + m_capacitance.byteSize() + (m_solver ? m_solver->byteSize() : 0);
+    for (const Update& update : m_updates)
+    {
+        bytes += (update.u.capacity() + update.v.capacity()) * qint64(sizeof(QPair<int, double>));
+        bytes += update.solved.capacity() * qint64(sizeof(double));
+    }
+    bytes += m_shorts.capacity() * qint64(sizeof(Short)) + m_spareBranches.capacity() * qint64(sizeof(int)) +
+             m_anchored.capacity() * qint64(sizeof(bool));
+    return bytes + (m_residentSolution.capacity() + m_voltages.capacity() + m_currents.capacity()) * qint64(sizeof(double));
+}
+
+bool LiveOperatingPoint::refactor(const Netlist& netlist)
+{
+    clear();
+    m_current = netlist;
+    m_current.nodeCount = netlist.nodeCount + SpareNodes;
+    m_residentOf.resize(netlist.nodeCount);
+    for (int node = 0; node < netlist.nodeCount; ++node)
+        m_residentOf[node] = node;
+    m_anchored.fill(false, m_current.nodeCount);
+    std::fill(m_anchored.begin() + netlist.nodeCount, m_anchored.end(), true);
+    m_unknownCount = m_current.nodeCount - 1;
+    m_branchOf.fill(-1, netlist.elements.size());
+    for (int i = 0; i < netlist.elements.size(); ++i)
+    {
+        if (netlist.elements[i].hasBranch())
+            m_branchOf[i] = m_unknownCount++;
+    }
+    for (int k = 0; k < SpareBranches; ++k)
+        m_spareBranches.append(m_unknownCount++);
+
+    // Solved every frame while the design is edited, and once more per update
+    m_matrix = assemble();
+    m_solver = std::make_unique<LinearSolver>();
+    if (!m_solver->prepare(m_matrix, LinearSolver::Automatic, MaximumRank + 1))
+    {
+        const QString error = m_solver->errorString();
+        clear();
+        m_errorString = error;
+        return false;
+    }
+    m_factored = true;
+    m_refactored = true;
+    if (!solve())
+    {
+        const QString error = m_errorString;
+        clear();
+        m_errorString = error;
+        return false;
+    }
+    return true;
+}
+
+bool LiveOperatingPoint::assignNodes(const Netlist& netlist, const QVector<int>& residentElement,
+                                     NodePlan& plan) const
+{
+    const int residentCount = m_current.nodeCount;
+    const int nodeCount = netlist.nodeCount;
+
+    // Resident nodes with a terminal or a short on them; the others are spare
+    QVector<bool> inUse(residentCount, false);
+    inUse[0] = true;
+    for (const NetlistElement& element : m_current.elements)
+    {
+        inUse[element.nodeA] = true;
+        inUse[element.nodeB] = true;
+    }
+    for (const Short& branch : m_shorts)
+    {
+        inUse[branch.a] = true;
+        inUse[branch.b] = true;
+    }
+
+    // Each terminal of a kept element votes for its net on the resident node
+    // it was on. A resident node goes to the net with most votes, the
+    // reference to the ground net.
+    QVector<QHash<int, int>> votes(residentCount);
+    for (int i = 0; i < netlist.elements.size(); ++i)
+    {
+        if (residentElement[i] < 0)
+            continue;
+        const NetlistElement& element = netlist.elements[i];
+        const NetlistElement& before = m_current.elements[residentElement[i]];
+        ++votes[before.nodeA][element.nodeA];
+        ++votes[before.nodeB][element.nodeB];
+    }
+    QVector<int> owner(residentCount, -1);
+    QVector<QVector<int>> owned(nodeCount);
+    owner[0] = 0;
+    owned[0].append(0);
+    for (int resident = 1; resident < residentCount; ++resident)
+    {
+        int mostVotes = 0;
+        for (auto it = votes[resident].constBegin(); it != votes[resident].constEnd(); ++it)
+        {
+            if (it.value() > mostVotes || (it.value() == mostVotes && it.key() < owner[resident]))
+            {
+                mostVotes = it.value();
+                owner[resident] = it.key();
+            }
+        }
+        if (owner[resident] >= 0)
+            owned[owner[resident]].append(resident);
+    }
+
+    // Terminals whose net lost their resident node, and those of new
+    // elements, go to a node their net has, or to a spare one: a net split.
+    // Nodes emptied by earlier edits come before the anchored ones.
+    int emptied = 1;
+    int anchored = 1;
+    const auto place = [&](int net) {
+        if (!owned[net].isEmpty())
+            return owned[net].first();
+        const auto isFree = [&](int node) { return !inUse[node] && owner[node] < 0; };
+        while (emptied < residentCount && (!isFree(emptied) || m_anchored[emptied]))
+            ++emptied;
+        while (emptied == residentCount && anchored < residentCount && !isFree(anchored))
+            ++anchored;
+        const int spare = emptied < residentCount ? emptied : anchored;
+        if (spare == residentCount)
+            return -1;
+        if (m_anchored[spare])
+            plan.unanchored.append(spare);
+        owner[spare] = net;
+        owned[net].append(spare);
+        return spare;
+    };
+    plan.nodeA.resize(netlist.elements.size());
+    plan.nodeB.resize(netlist.elements.size());
+    for (int i = 0; i < netlist.elements.size(); ++i)
+    {
+        const NetlistElement& element = netlist.elements[i];
+        int a = -1;
+        int b = -1;
+        if (residentElement[i] >= 0)
+        {
+            a = m_current.elements[residentElement[i]].nodeA;
+            b = m_current.elements[residentElement[i]].nodeB;
+        }
+        if (a < 0 || owner[a] != element.nodeA)
+            a = place(element.nodeA);
+        if (b < 0 || owner[b] != element.nodeB)
+            b = place(element.nodeB);
+        if (a < 0 || b < 0)
+            return false;
+        plan.nodeA[i] = a;
+        plan.nodeB[i] = b;
+    }
+    plan.residentOf.resize(nodeCount);
+    for (int node = 0; node < nodeCount; ++node)
+    {
+        plan.residentOf[node] = place(node);
+        if (plan.residentOf[node] < 0)
+            return false;
+    }
+
+    // A net on several resident nodes is held together by shorts: those
+    // already in place that stay within one net and close no loop are kept,
+    // the rest freed, and a spanning tree completed from the free slots
+    QVector<int> parent(residentCount);
+    std::iota(parent.begin(), parent.end(), 0);
+    const auto find = [&parent](int node) {
+        while (parent[node] != node)
+            node = parent[node] = parent[parent[node]];
+        return node;
+    };
+    plan.spareBranches = m_spareBranches;
+    for (const Short& branch : m_shorts)
+    {
+        if (owner[branch.a] >= 0 && owner[branch.a] == owner[branch.b] && find(branch.a) != find(branch.b))
+        {
+            parent[find(branch.a)] = find(branch.b);
+            plan.shorts.append(branch);
+        }
+        else
+        {
+            plan.released.append(branch);
+            plan.spareBranches.append(branch.branch);
+        }
+    }
+    for (const QVector<int>& nodes : std::as_const(owned))
+    {
+        for (int k = 1; k < nodes.size(); ++k)
+        {
+            if (find(nodes[k]) == find(nodes[0]))
+                continue;
+            if (plan.spareBranches.isEmpty())
+                return false;
+            const Short branch{plan.spareBranches.takeLast(), nodes[0], nodes[k]};
+            parent[find(nodes[k])] = find(nodes[0]);
+            plan.shorts.append(branch);
+            plan.added.append(branch);
+        }
+    }
+    return true;
+}
+
+bool LiveOperatingPoint::addUpdate(const Terms& u, const Terms& v, qint64 across, double conductance)
+{
+    Update update;
+    update.u = normalized(u);
+    update.v = normalized(v);
+    update.across = across;
+    update.conductance = conductance;
+    if (update.u.isEmpty() || update.v.isEmpty())
+        return true;
+
+    QVector<double> rhs(m_unknownCount, 0.0);
+    for (const auto& term : std::as_const(update.u))
+        rhs[term.first] = term.second;
+    if (!m_solver->solve(rhs, update.solved))
+        return false;
+    m_updates.append(std::move(update));
+    return true;
+}
+
+bool LiveOperatingPoint::factorUpdates()
+{
+    const int rank = m_updates.size();
+    QVector<double> capacitance(qsizetype(rank) * rank, 0.0);
+    for (int row = 0; row < rank; ++row)
+    {
+        for (int col = 0; col < rank; ++col)
+            capacitance[qsizetype(row) * rank + col] = (row == col ? 1.0 : 0.0) + dot(m_updates[row].v, m_updates[col].solved);
+    }
+    return m_capacitance.factor(std::move(capacitance), rank);
+}
+
+bool LiveOperatingPoint::solve()
+{
+    QVector<double> rhs(m_unknownCount, 0.0);
+    for (int i = 0; i < m_current.elements.size(); ++i)
+    {
+        if (m_branchOf[i] >= 0 && m_current.elements[i].isType("Voltage Source"))
+            rhs[m_branchOf[i]] = m_current.elements[i].value;
+    }
+    if (!m_solver->solve(rhs, m_residentSolution))
+    {
+        m_errorString = m_solver->errorString().isEmpty()
+                            ? QStringLiteral("%1 solver did not converge").arg(LinearSolver::methodName(m_solver->method()))
+                            : m_solver->errorString();
+        return false;
+    }
+
+    QVector<double> x = m_residentSolution;
+    if (!m_updates.isEmpty())
+    {
+        // x = A^-1 b - A^-1 U (I + V^T A^-1 U)^-1 V^T A^-1 b
+        QVector<double> weights(m_updates.size());
+        for (int k = 0; k < m_updates.size(); ++k)
+            weights[k] = dot(m_updates[k].v, m_residentSolution);
+        m_capacitance.solve(weights);
+        for (int k = 0; k < m_updates.size(); ++k)
+        {
+            const QVector<double>& solved = m_updates[k].solved;
+            for (int row = 0; row < m_unknownCount; ++row)
+                x[row] -= weights[k] * solved[row];
+        }
+
+        // (A + U V^T) x - b, to tell when the updates have drifted too far
+        QVector<double> residual;
+        m_matrix.multiply(x, residual);
+        for (const Update& update : std::as_const(m_updates))
+        {
+            const double along = dot(update.v, x);
+            for (const auto& term : update.u)
+                residual[term.first] += term.second * along;
+        }
+        double largestResidual = 0.0;
+        double largestRhs = 0.0;
+        for (int row = 0; row < m_unknownCount; ++row)
+        {
+            largestResidual = qMax(largestResidual, std::abs(residual[row] - rhs[row]));
+            largestRhs = qMax(largestRhs, std::abs(rhs[row]));
+        }
+        if (largestResidual > RefactorTolerance * largestRhs)
+        {
+            m_errorString = QStringLiteral("updated solution has a relative residual of %1").arg(largestResidual / largestRhs);
+            return false;
+        }
+    }
+
+    // In the node numbers of the netlist last given
+    m_voltages.fill(0.0, m_residentOf.size());
+    for (int node = 1; node < m_residentOf.size(); ++node)
+    {
+        const int unknown = unknownOf(m_residentOf[node]);
+        m_voltages[node] = unknown >= 0 ? x[unknown] : 0.0;
+    }
+    m_currents.fill(0.0, m_current.elements.size());
+    for (int i = 0; i < m_current.elements.size(); ++i)
+    {
+        const NetlistElement& element = m_current.elements[i];
+        if (m_branchOf[i] >= 0)
+        {
+            m_currents[i] = x[m_branchOf[i]];
+        }
+        else if (element.isType("Resistor"))
+        {
+            const double a = element.nodeA > 0 ? x[unknownOf(element.nodeA)] : 0.0;
+            const double b = element.nodeB > 0 ? x[unknownOf(element.nodeB)] : 0.0;
+            m_currents[i] = (a - b) / element.value;
+        }
+    }
+    m_errorString.clear();
+    return true;
+}
+
+SparseMatrix LiveOperatingPoint::assemble() const
+{
+    // The operating point stamps of Simulator: capacitors open, inductors shorted
+    QVector<SparseMatrix::Entry> entries;
+    entries.reserve(m_unknownCount + 4 * m_current.elements.size());
+    const auto add = [&entries](int row, int col, double value) {
+        if (row >= 0 && col >= 0)
+            entries.append({row, col, value});
+    };
+    for (int node = 1; node < m_current.nodeCount; ++node)
+        add(unknownOf(node), unknownOf(node), m_anchored[node] ? 1.0 : Netlist::MinimumConductance);
+    for (int branch : m_spareBranches)
+        add(branch, branch, 1.0);
+    for (const Short& branch : m_shorts)
+    {
+        add(unknownOf(branch.a), branch.branch, 1.0);
+        add(unknownOf(branch.b), branch.branch, -1.0);
+        add(branch.branch, unknownOf(branch.a), 1.0);
+        add(branch.branch, unknownOf(branch.b), -1.0);
+    }
+
+    for (int i = 0; i < m_current.elements.size(); ++i)
+    {
+        const NetlistElement& element = m_current.elements[i];
+        const int a = unknownOf(element.nodeA);
+        const int b = unknownOf(element.nodeB);
+        const int branch = m_branchOf[i];
+        if (element.isType("Resistor"))
+        {
+            const double g = 1.0 / element.value;
+            add(a, a, g);
+            add(b, b, g);
+            add(a, b, -g);
+            add(b, a, -g);
+        }
+        else if (branch >= 0)
+        {
+            add(a, branch, 1.0);
+            add(b, branch, -1.0);
+            const double sign = element.isType("Voltage Source") ? -1.0 : 1.0;
+            add(branch, a, sign);
+            add(branch, b, -sign);
+        }
+    }
+    return SparseMatrix::fromEntries(m_unknownCount, std::move(entries));
+}
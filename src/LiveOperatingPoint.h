@@ -0,0 +1,134 @@
+#pragma once
+
+#include "LinearSolver.h"
+#include "Netlist.h"
+
+#include <QPair>
+#include <QString>
+#include <QVector>
+#include <memory>
+
+// Operating point kept current while a design is edited. The DC matrix of the
+// first netlist stays factored, and the matrices of the netlists that follow
+// are expressed as that one plus a sum of rank-one updates, which the
+// Sherman-Morrison-Woodbury identity
+//
+//   (A + U V^T)^-1 = A^-1 - A^-1 U (I + V^T A^-1 U)^-1 V^T A^-1
+//
+// folds into each solve at the cost of one resident solve and a small dense
+// one. Changing a resistor's value adds one update, however often it changes
+// again, and moving it between nodes two; rewiring a source or an inductor
+// adds two. Source values and capacitors touch only the right-hand side or
+// nothing at all.
+//
+// Nodes are matched to the resident ones through the elements they connect,
+// by name, so a renumbering of the netlist costs nothing. The resident system
+// carries spare nodes and spare branch slots that no element uses: when a net
+// splits, the terminals that left move onto a spare node, and nets that merge
+// are held at one voltage by a zero-volt branch in a spare slot, two updates
+// per merge. The matrix is factored afresh when sources or inductors come or
+// go, when the spares run out, when the updates add up to more than
+// MaximumRank, or when the residual of an updated solution shows that they
+// have cost too much accuracy.
+class LiveOperatingPoint
+{
+public:
+    // Each update costs a resident solve to add and a few operations per
+    // unknown in every solve after it; beyond this many refactoring is cheaper
+    static constexpr int MaximumRank = 32;
+    // Largest residual of an updated solution, relative to the right-hand side
+    static constexpr double RefactorTolerance = 1e-8;
+    // Nodes and branch slots kept free for splitting and merging nets. Until
+    // first used each holds a unit diagonal, which keeps the resident matrix
+    // well conditioned; a spare node taken adds an update that swaps it for
+    // the minimum conductance.
+    static constexpr int SpareNodes = 16;
+    static constexpr int SpareBranches = 16;
+
+    // Solves the netlist's operating point, updating the resident
+    // factorization where that is possible. False with errorString() set when
+    // the netlist cannot be solved.
+    bool update(const Netlist& netlist);
+    // Drops the resident factorization
+    void clear();
+
+    // Of the last netlist solved: the voltage of each node, the reference
+    // included, and the current of each element, flowing from nodeA to nodeB
+    const QVector<double>& nodeVoltages() const { return m_voltages; }
+    const QVector<double>& elementCurrents() const { return m_currents; }
+
+    int rank() const { return m_updates.size(); }
+    bool lastUpdateRefactored() const { return m_refactored; }
+    QString errorString() const { return m_errorString; }
+    qint64 byteSize() const;
+
+private:
+    using Terms = QVector<QPair<int, double>>; // Sparse vector: unknown and value
+
+    // A += u v^T, with A^-1 u kept for the solves. A change of conductance g
+    // between nodes a and b is u = e_a - e_b, v = g u, so that later changes
+    // between the same nodes, a value dragged from frame to frame, only add
+    // to g and keep the rank as it is.
+    struct Update
+    {
+        Terms u;
+        Terms v;
+        QVector<double> solved;
+        qint64 across = -1; // a * node count + b, a < b, for a change of conductance
+        double conductance = 0.0;
+    };
+
+    // A zero-volt branch in a spare slot, holding two resident nodes of one
+    // net at the same voltage
+    struct Short
+    {
+        int branch;
+        int a;
+        int b;
+    };
+
+    // Where the elements of the next netlist go in the resident system
+    struct NodePlan
+    {
+        QVector<int> nodeA; // Resident nodes of each element
+        QVector<int> nodeB;
+        QVector<int> residentOf; // A resident node of each of the netlist's nodes
+        QVector<Short> shorts;
+        QVector<Short> added;
+        QVector<Short> released;
+        QVector<int> spareBranches;
+        QVector<int> unanchored; // Spare nodes used for the first time
+    };
+
+    bool refactor(const Netlist& netlist);
+    // Keeps terminals on the resident node they were on where its net allows,
+    // false when the spares run out
+    bool assignNodes(const Netlist& netlist, const QVector<int>& residentElement, NodePlan& plan) const;
+    bool addUpdate(const Terms& u, const Terms& v, qint64 across = -1, double conductance = 0.0);
+    bool factorUpdates();
+    bool solve();
+    SparseMatrix assemble() const;
+    int unknownOf(int node) const { return node > 0 ? node - 1 : -1; }
+
+    // The last netlist solved, in resident node numbers, and the branch
+    // unknown of each of its sources and inductors
+    Netlist m_current;
+    QVector<int> m_branchOf;
+    QVector<int> m_residentOf; // Resident node of each node of the last netlist
+    QVector<Short> m_shorts;
+    QVector<int> m_spareBranches; // Free branch slots; their row reads i = 0
+    QVector<bool> m_anchored; // Spare nodes never used, with a unit diagonal
+    int m_unknownCount = 0;
+
+    bool m_factored = false;
+    SparseMatrix m_matrix; // A, as factored
+    std::unique_ptr<LinearSolver> m_solver;
+    QVector<Update> m_updates;
+    DenseLu m_capacitance; // I + V^T A^-1 U
+
+    QVector<double> m_residentSolution; // A^-1 b, the guess for the next iterative solve
+    QVector<double> m_voltages;
+    QVector<double> m_currents;
+    bool m_refactored = false;
+    QString m_errorString;
+};
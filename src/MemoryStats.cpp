@@ -0,0 +1,137 @@
+#include "MemoryStats.h"
+
+#include <QLocale>
+#include <QTextStream>
+#include <algorithm>
+
+namespace
+{
+QString formatBytes(qint64 bytes)
+{
+    return QLocale::c().formattedDataSize(bytes, 1, QLocale::DataSizeTraditionalFormat);
+}
+} // namespace
+
+void MemoryStats::Counter::change(qint64 delta)
+{
+    bytes += delta;
+    peakBytes = qMax(peakBytes, bytes);
+}
+
+MemoryStats::Charge::Charge(Subsystem subsystem, const QString& item, qint64 bytes)
+    : m_subsystem(subsystem), m_item(item), m_bytes(bytes)
+{
+    add(m_subsystem, m_item, m_bytes);
+}
+
+MemoryStats::Charge::~Charge()
+{
+    add(m_subsystem, m_item, -m_bytes);
+}
+
+MemoryStats& MemoryStats::instance()
+{
+    static MemoryStats stats;
+    return stats;
+}
+
+void MemoryStats::changeLocked(Subsystem subsystem, const QString& item, qint64 delta)
+{
+    if (delta == 0)
+        return;
+    m_items[qMakePair(int(subsystem), item)].change(delta);
+    m_totals[subsystem].change(delta);
+}
+
+void MemoryStats::set(Subsystem subsystem, const QString& item, qint64 bytes)
+{
+    MemoryStats& stats = instance();
+    QMutexLocker locker(&stats.m_mutex);
+    const auto it = stats.m_items.constFind(qMakePair(int(subsystem), item));
+    const qint64 current = it != stats.m_items.constEnd() ? it->bytes : 0;
+    stats.changeLocked(subsystem, item, bytes - current);
+}
+
+void MemoryStats::add(Subsystem subsystem, const QString& item, qint64 bytes)
+{
+    MemoryStats& stats = instance();
+    QMutexLocker locker(&stats.m_mutex);
+    stats.changeLocked(subsystem, item, bytes);
+}
+
+void MemoryStats::clear(Subsystem subsystem)
+{
+    MemoryStats& stats = instance();
+    QMutexLocker locker(&stats.m_mutex);
+    for (auto it = stats.m_items.begin(); it != stats.m_items.end(); ++it)
+    {
+        if (it.key().first == subsystem)
+            it->bytes = 0;
+    }
+    stats.m_totals[subsystem].bytes = 0;
+}
+
+void MemoryStats::resetPeaks()
+{
+    MemoryStats& stats = instance();
+    QMutexLocker locker(&stats.m_mutex);
+    for (Counter& counter : stats.m_items)
+        counter.peakBytes = counter.bytes;
+    for (Counter& counter : stats.m_totals)
+        counter.peakBytes = counter.bytes;
+}
+
+QVector<MemoryStats::SubsystemUsage> MemoryStats::snapshot()
+{
+    MemoryStats& stats = instance();
+    QVector<SubsystemUsage> usage(SubsystemCount);
+    {
+        QMutexLocker locker(&stats.m_mutex);
+        for (int i = 0; i < SubsystemCount; ++i)
+        {
+            usage[i].total = {subsystemName(Subsystem(i)), stats.m_totals[i].bytes, stats.m_totals[i].peakBytes};
+        }
+        for (auto it = stats.m_items.cbegin(); it != stats.m_items.cend(); ++it)
+            usage[it.key().first].items.append({it.key().second, it->bytes, it->peakBytes});
+    }
+    for (SubsystemUsage& subsystem : usage)
+    {
+        std::sort(subsystem.items.begin(), subsystem.items.end(),
+                  [](const Usage& a, const Usage& b) { return a.name < b.name; });
+    }
+    return usage;
+}
+
+QString MemoryStats::report()
+{
+    QString text;
+    QTextStream out(&text);
+    for (const SubsystemUsage& subsystem : snapshot())
+    {
+        out << subsystem.total.name << ": " << formatBytes(subsystem.total.bytes) << " (peak "
+            << formatBytes(subsystem.total.peakBytes) << ")\n";
+        for (const Usage& item : subsystem.items)
+        {
+            out << "    " << item.name << ": " << formatBytes(item.bytes) << " (peak " << formatBytes(item.peakBytes)
+                << ")\n";
+        }
+    }
+    return text;
+}
+
+QString MemoryStats::subsystemName(Subsystem subsystem)
+{
+    switch (subsystem)
+    {
+    case DesignModel:
+        return QStringLiteral("Design model");
+    case RendererCopies:
+        return QStringLiteral("Renderer copies");
+    case GpuBuffers:
+        return QStringLiteral("GPU buffers");
+    case Simulation:
+        return QStringLiteral("Simulation");
+    default:
+        return QString();
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+// Process-wide byte counts per subsystem, each with its peak. Owners report
+// what they hold when it changes: set() for state they own outright, add()
+// for work that several threads do at once (batch simulations). The numbers
+// are estimates from container sizes and buffer allocations, not allocator
+// statistics, so they show where memory goes rather than the exact RSS.
+class MemoryStats
+{
+public:
+    enum Subsystem
+    {
+        DesignModel,    // Parts, wires, their indexes and the undo history
+        RendererCopies, // The renderer's CPU-side data
+        GpuBuffers,     // Vertex buffers, textures and framebuffers
+        Simulation,     // Matrices, results and waveform caches
+        SubsystemCount
+    };
+
+    struct Usage
+    {
+        QString name;
+        qint64 bytes = 0;
+        qint64 peakBytes = 0;
+    };
+
+    struct SubsystemUsage
+    {
+        Usage total;
+        QVector<Usage> items; // By name
+    };
+
+    // Adds bytes to an item for as long as it lives, for work in progress
+    class Charge
+    {
+    public:
+        Charge(Subsystem subsystem, const QString& item, qint64 bytes);
+        ~Charge();
+        Q_DISABLE_COPY_MOVE(Charge)
+
+    private:
+        Subsystem m_subsystem;
+        QString m_item;
+        qint64 m_bytes;
+    };
+
+    static void set(Subsystem subsystem, const QString& item, qint64 bytes);
+    static void add(Subsystem subsystem, const QString& item, qint64 bytes); // Negative to release
+    static void clear(Subsystem subsystem);                                  // Keeps the peaks
+    static void resetPeaks();                                                // Peaks drop to the current values
+
+    static QVector<SubsystemUsage> snapshot();
+    static QString report(); // One line per subsystem and item, current and peak
+    static QString subsystemName(Subsystem subsystem);
+
+private:
+    struct Counter
+    {
+        qint64 bytes = 0;
+        qint64 peakBytes = 0;
+
+        void change(qint64 delta);
+    };
+
+    static MemoryStats& instance();
+    void changeLocked(Subsystem subsystem, const QString& item, qint64 delta);
+
+    QMutex m_mutex;
+    Counter m_totals[SubsystemCount];
+    QHash<QPair<int, QString>, Counter> m_items;
+};
@@ -0,0 +1,364 @@
+#include "ModelReduction.h"
+#include "LinearSolver.h"
+#include "MemoryStats.h"
+
+#include <QDebug>
+#include <QHash>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+// A Krylov vector left with less than this share of its norm after
+// orthogonalization adds nothing to the basis
+constexpr double DeflationTolerance = 1e-8;
+
+// Elements a macromodel may replace; anything else makes its nodes ports
+bool isReducible(const NetlistElement& element)
+{
+    if (element.isType("Resistor"))
+        return element.value > 0.0;
+    return (element.isType("Capacitor") || element.isType("Inductor")) && element.value >= 0.0;
+}
+
+class DisjointSets
+{
+public:
+    explicit DisjointSets(int count)
+        : m_parent(count)
+    {
+        std::iota(m_parent.begin(), m_parent.end(), 0);
+    }
+
+    int find(int item)
+    {
+        while (m_parent[item] != item)
+        {
+            m_parent[item] = m_parent[m_parent[item]];
+            item = m_parent[item];
+        }
+        return item;
+    }
+
+    void unite(int a, int b) { m_parent[find(a)] = find(b); }
+
+private:
+    QVector<int> m_parent;
+};
+
+double dot(const QVector<double>& a, const QVector<double>& b)
+{
+    double sum = 0.0;
+    for (qsizetype i = 0; i < a.size(); ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+// Orthogonalizes v against the basis, twice as modified Gram-Schmidt loses
+// orthogonality, and appends it normalized unless nothing new is left
+bool extendBasis(QVector<QVector<double>>& basis, QVector<double> v)
+{
+    const double initial = std::sqrt(dot(v, v));
+    if (!(initial > 0.0) || !std::isfinite(initial))
+        return false;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (const QVector<double>& column : std::as_const(basis))
+        {
+            const double projection = dot(column, v);
+            for (qsizetype i = 0; i < v.size(); ++i)
+                v[i] -= projection * column[i];
+        }
+    }
+    const double remaining = std::sqrt(dot(v, v));
+    if (!(remaining > DeflationTolerance * initial))
+        return false;
+    for (double& value : v)
+        value /= remaining;
+    basis.append(std::move(v));
+    return true;
+}
+
+// Q^T A Q for an orthonormal basis Q, row-major
+QVector<double> project(const SparseMatrix& matrix, const QVector<QVector<double>>& basis)
+{
+    const int order = basis.size();
+    QVector<double> reduced(qsizetype(order) * order);
+    QVector<double> product;
+    for (int col = 0; col < order; ++col)
+    {
+        matrix.multiply(basis[col], product);
+        for (int row = 0; row < order; ++row)
+            reduced[qsizetype(row) * order + col] = dot(basis[row], product);
+    }
+    return reduced;
+}
+
+} // namespace
+
+qint64 Macromodel::byteSize() const
+{
+    const qint64 doubles = conductance.capacity() + capacitance.capacity() + incidence.capacity()
+                           + nodeBasis.capacity() + inductorBasis.capacity();
+    const qint64 ints = elements.capacity() + ports.capacity() + internalNodes.capacity() + inductors.capacity();
+    return doubles * qint64(sizeof(double)) + ints * qint64(sizeof(int));
+}
+
+bool ModelReduction::reduce(const Netlist& netlist, const RlcSubnetwork& subnetwork, int moments, double expansion,
+                            Macromodel& model)
+{
+    const int portCount = subnetwork.ports.size();
+    const int nodeUnknowns = portCount + subnetwork.internalNodes.size();
+    const int size = subnetwork.size();
+
+    QHash<int, int> unknownOf; // Netlist node to local unknown; the reference has none
+    for (int k = 0; k < portCount; ++k)
+        unknownOf.insert(subnetwork.ports[k], k);
+    for (int j = 0; j < subnetwork.internalNodes.size(); ++j)
+        unknownOf.insert(subnetwork.internalNodes[j], portCount + j);
+
+    // G x + C dx/dt = B i, with B selecting the ports
+    QVector<SparseMatrix::Entry> g;
+    QVector<SparseMatrix::Entry> c;
+    const auto add = [](QVector<SparseMatrix::Entry>& entries, int row, int col, double value) {
+        if (row >= 0 && col >= 0)
+            entries.append({row, col, value});
+    };
+    const auto conductance = [&add](QVector<SparseMatrix::Entry>& entries, int a, int b, double value) {
+        add(entries, a, a, value);
+        add(entries, b, b, value);
+        add(entries, a, b, -value);
+        add(entries, b, a, -value);
+    };
+
+    for (int node = portCount; node < nodeUnknowns; ++node)
+        add(g, node, node, Netlist::MinimumConductance);
+    int branch = nodeUnknowns;
+    for (int i : subnetwork.elements)
+    {
+        const NetlistElement& element = netlist.elements[i];
+        const int a = unknownOf.value(element.nodeA, -1);
+        const int b = unknownOf.value(element.nodeB, -1);
+        if (element.isType("Resistor"))
+        {
+            conductance(g, a, b, 1.0 / element.value);
+        }
+        else if (element.isType("Capacitor"))
+        {
+            conductance(c, a, b, element.value);
+        }
+        else
+        {
+            // v(A) - v(B) = L di/dt, written so that G + G^T stays semidefinite
+            add(g, a, branch, 1.0);
+            add(g, b, branch, -1.0);
+            add(g, branch, a, -1.0);
+            add(g, branch, b, 1.0);
+            add(c, branch, branch, element.value);
+            ++branch;
+        }
+    }
+
+    // At DC the port voltages are held instead: a subnetwork driven by port
+    // currents alone may float, which the minimum conductance only turns into
+    // an ill-conditioned system
+    QVector<SparseMatrix::Entry> clamped;
+    clamped.reserve(g.size());
+    for (const SparseMatrix::Entry& entry : std::as_const(g))
+    {
+        if (entry.row >= portCount)
+            clamped.append(entry);
+    }
+    for (int k = 0; k < portCount; ++k)
+        add(clamped, k, k, 1.0);
+
+    // The simulator stamps the minimum conductance on the ports as well
+    QVector<SparseMatrix::Entry> shifted = g;
+    for (int k = 0; k < portCount; ++k)
+        add(shifted, k, k, Netlist::MinimumConductance);
+    for (const SparseMatrix::Entry& entry : std::as_const(c))
+        shifted.append({entry.row, entry.col, expansion * entry.value});
+
+    const SparseMatrix capacitance = SparseMatrix::fromEntries(size, c);
+    LinearSolver atDc;
+    LinearSolver atExpansion;
+    if (!atDc.prepare(SparseMatrix::fromEntries(size, std::move(clamped)))
+        || !atExpansion.prepare(SparseMatrix::fromEntries(size, std::move(shifted))))
+    {
+        qWarning() << "Not reducing a subnetwork of" << size << "unknowns:" << atDc.errorString()
+                   << atExpansion.errorString();
+        return false;
+    }
+    const MemoryStats::Charge charge(MemoryStats::Simulation, QStringLiteral("solvers"),
+                                     atDc.byteSize() + atExpansion.byteSize());
+
+    // Block Arnoldi on (G + s0 C)^-1 C from (G + s0 C)^-1 B. Each block only
+    // grows from the previous one, so the span keeps every moment at s0.
+    QVector<QVector<double>> basis;
+    QVector<QVector<double>> block;
+    QVector<double> rhs(size, 0.0);
+    QVector<double> solution;
+    for (int k = 0; k < portCount; ++k)
+    {
+        rhs.fill(0.0);
+        rhs[k] = 1.0;
+        solution.clear();
+        if (!atExpansion.solve(rhs, solution))
+            break;
+        if (extendBasis(basis, solution))
+            block.append(basis.last());
+    }
+    for (int moment = 1; moment < moments && !block.isEmpty(); ++moment)
+    {
+        QVector<QVector<double>> next;
+        for (const QVector<double>& column : std::as_const(block))
+        {
+            capacitance.multiply(column, rhs);
+            solution.clear();
+            if (!atExpansion.solve(rhs, solution))
+                break;
+            if (extendBasis(basis, solution))
+                next.append(basis.last());
+        }
+        block = next;
+    }
+
+    // Then the subnetwork's state at DC for each port voltage, which puts the
+    // operating point in the span and so makes it exact
+    for (int k = 0; k < portCount; ++k)
+    {
+        rhs.fill(0.0);
+        rhs[k] = 1.0;
+        solution.clear();
+        if (atDc.solve(rhs, solution))
+            extendBasis(basis, solution);
+    }
+
+    const int order = basis.size();
+    if (order == 0 || 2 * order > size)
+        return false;
+
+    model.ports = subnetwork.ports;
+    model.elements = subnetwork.elements;
+    model.order = order;
+    model.fullOrder = size;
+    model.conductance = project(SparseMatrix::fromEntries(size, std::move(g)), basis);
+    model.capacitance = project(capacitance, basis);
+    model.incidence.resize(qsizetype(order) * portCount);
+    for (int row = 0; row < order; ++row)
+    {
+        for (int k = 0; k < portCount; ++k)
+            model.incidence[qsizetype(row) * portCount + k] = basis[row][k];
+    }
+
+    model.internalNodes = subnetwork.internalNodes;
+    model.nodeBasis.resize(qsizetype(subnetwork.internalNodes.size()) * order);
+    for (int j = 0; j < subnetwork.internalNodes.size(); ++j)
+    {
+        for (int col = 0; col < order; ++col)
+            model.nodeBasis[qsizetype(j) * order + col] = basis[col][portCount + j];
+    }
+    model.inductors = subnetwork.inductors;
+    model.inductorBasis.resize(qsizetype(subnetwork.inductors.size()) * order);
+    for (int l = 0; l < subnetwork.inductors.size(); ++l)
+    {
+        for (int col = 0; col < order; ++col)
+            model.inductorBasis[qsizetype(l) * order + col] = basis[col][nodeUnknowns + l];
+    }
+    return true;
+}
+
+QVector<RlcSubnetwork> ModelReduction::subnetworks(const Netlist& netlist, int moments)
+{
+    QVector<RlcSubnetwork> result;
+    const int nodeCount = netlist.nodeCount;
+    if (moments < 1 || nodeCount < 2)
+        return result;
+
+    // Nodes that any other element touches are ports; node 0 is the reference
+    QVector<bool> isPort(nodeCount, false);
+    for (const NetlistElement& element : netlist.elements)
+    {
+        if (isReducible(element))
+            continue;
+        for (int node : {element.nodeA, element.nodeB})
+        {
+            if (node > 0 && node < nodeCount)
+                isPort[node] = true;
+        }
+    }
+    const auto isInternal = [&isPort, nodeCount](int node) {
+        return node > 0 && node < nodeCount && !isPort[node];
+    };
+
+    DisjointSets sets(nodeCount);
+    for (const NetlistElement& element : netlist.elements)
+    {
+        if (isReducible(element) && isInternal(element.nodeA) && isInternal(element.nodeB))
+            sets.unite(element.nodeA, element.nodeB);
+    }
+
+    // Keyed by the set of their internal nodes, in netlist order
+    QHash<int, RlcSubnetwork> subnetworks;
+    QVector<int> roots;
+    for (int i = 0; i < netlist.elements.size(); ++i)
+    {
+        const NetlistElement& element = netlist.elements[i];
+        if (!isReducible(element))
+            continue;
+        // Elements between ports and the reference stay as they are
+        const int anchor = isInternal(element.nodeA) ? element.nodeA : element.nodeB;
+        if (!isInternal(anchor))
+            continue;
+
+        const int root = sets.find(anchor);
+        auto it = subnetworks.find(root);
+        if (it == subnetworks.end())
+        {
+            it = subnetworks.insert(root, RlcSubnetwork());
+            roots.append(root);
+        }
+        it->elements.append(i);
+        if (element.isType("Inductor"))
+            it->inductors.append(i);
+        for (int node : {element.nodeA, element.nodeB})
+        {
+            if (node > 0 && node < nodeCount && isPort[node] && !it->ports.contains(node))
+                it->ports.append(node);
+        }
+    }
+    for (int node = 1; node < nodeCount; ++node)
+    {
+        if (!isInternal(node))
+            continue;
+        auto it = subnetworks.find(sets.find(node));
+        if (it != subnetworks.end())
+            it->internalNodes.append(node);
+    }
+
+    for (int root : std::as_const(roots))
+    {
+        const RlcSubnetwork& subnetwork = subnetworks[root];
+        // A subnetwork without ports is never driven, and one that could not
+        // shrink to half its size is not worth the projection
+        const int largestOrder = (moments + 1) * subnetwork.ports.size();
+        if (subnetwork.ports.isEmpty() || subnetwork.size() < MinimumUnknowns || 2 * largestOrder > subnetwork.size())
+            continue;
+        result.append(subnetwork);
+    }
+    return result;
+}
+
+QVector<Macromodel> ModelReduction::reduce(const Netlist& netlist, int moments, double expansion)
+{
+    QVector<Macromodel> models;
+    if (!(expansion > 0.0))
+        return models;
+    for (const RlcSubnetwork& subnetwork : subnetworks(netlist, moments))
+    {
+        Macromodel model;
+        if (reduce(netlist, subnetwork, moments, expansion, model))
+            models.append(std::move(model));
+    }
+    return models;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Netlist.h"
+
+#include <QVector>
+
+// Reduced-order model of a linear RLC subnetwork as seen from its ports:
+//
+//   G z + C dz/dt = B i,   v = B^T z
+//
+// where i are the currents flowing into the subnetwork at its port nodes and v
+// the port voltages. The states z are the subnetwork's node voltages and
+// inductor currents projected onto an orthonormal basis, so those are
+// recovered, approximately, as basis * z.
+struct Macromodel
+{
+    QVector<int> elements; // Netlist elements it replaces
+    QVector<int> ports;    // Netlist nodes, never the reference
+    int order = 0;
+    int fullOrder = 0;           // Unknowns of the subnetwork it replaces
+    QVector<double> conductance; // G, order x order, row-major
+    QVector<double> capacitance; // C, order x order
+    QVector<double> incidence;   // B, order x ports
+
+    QVector<int> internalNodes;    // Netlist nodes that only the replaced elements touch
+    QVector<double> nodeBasis;     // internalNodes x order
+    QVector<int> inductors;        // Replaced inductors, as netlist elements
+    QVector<double> inductorBasis; // inductors x order
+
+    qint64 byteSize() const;
+};
+
+// Connected resistors, capacitors and inductors between sources. Their MNA
+// unknowns are the ports, then the internal nodes, then one branch current per
+// inductor.
+struct RlcSubnetwork
+{
+    QVector<int> elements;      // Netlist elements, in netlist order
+    QVector<int> ports;         // Nodes shared with other elements, in order of first use
+    QVector<int> internalNodes; // Ascending
+    QVector<int> inductors;     // Netlist elements, in netlist order
+
+    int size() const { return ports.size() + internalNodes.size() + inductors.size(); }
+};
+
+// PRIMA: passive reduced-order interconnect macromodeling. The resistors,
+// capacitors and inductors between sources fall into connected subnetworks
+// whose ports are the nodes they share with the sources. Each large enough
+// subnetwork is projected onto a block Krylov basis of its MNA equations,
+// which matches the port response at DC and its first moments around the
+// expansion point. The projection is a congruence, so the macromodel stays
+// passive and a stable circuit stays stable.
+class ModelReduction
+{
+public:
+    // Subnetworks with fewer unknowns than this are cheaper to keep whole
+    static constexpr int MinimumUnknowns = 100;
+
+    // The subnetworks worth reducing to the given number of moments
+    static QVector<RlcSubnetwork> subnetworks(const Netlist& netlist, int moments);
+
+    // moments: block moments matched at the expansion point, each adding up to
+    // one state per port. expansion: angular frequency in rad/s, best inside
+    // the band of interest, between 1 / stop time and 1 / step of a transient.
+    static bool reduce(const Netlist& netlist, const RlcSubnetwork& subnetwork, int moments, double expansion,
+                       Macromodel& model);
+    // Every subnetwork worth it
+    static QVector<Macromodel> reduce(const Netlist& netlist, int moments, double expansion);
+};
@@ -0,0 +1,198 @@
+#include "Netlist.h"
+#include "CircuitViewport.h"
+
+#include <QTextStream>
+#include <QDebug>
+
+namespace
+{
+// Guards against definitions that (through a corrupt file) contain themselves
+constexpr int MaxNestingDepth = 32;
+
+class Flattener
+{
+public:
+    explicit Flattener(const QHash<int, SubcircuitDefinition>& subcircuits)
+        : m_subcircuits(subcircuits)
+    {
+    }
+
+    // Expands one level of the hierarchy. Terminals are numbered as they are
+    // created and joined by wires; every part maps to its (input, output) pair.
+    void expand(const QVector<Component>& components, const QVector<Wire>& wires, const QString& prefix, int depth,
+                QHash<int, QPair<int, int>>& terminals)
+    {
+        terminals.reserve(components.size());
+        for (const Component& comp : components)
+        {
+            const SubcircuitDefinition* definition = nullptr;
+            if (comp.subcircuitId >= 0)
+            {
+                auto it = m_subcircuits.constFind(comp.subcircuitId);
+                if (it != m_subcircuits.constEnd() && depth < MaxNestingDepth)
+                    definition = &it.value();
+                else
+                    qWarning() << "Netlist: cannot expand" << comp.label << "(definition" << comp.subcircuitId << ")";
+            }
+
+            if (definition)
+            {
+                QHash<int, QPair<int, int>> inner;
+                expand(definition->components, definition->wires, prefix + comp.label + QLatin1Char('.'), depth + 1,
+                       inner);
+                auto input = inner.constFind(definition->inputComponentId);
+                auto output = inner.constFind(definition->outputComponentId);
+                terminals.insert(comp.id, qMakePair(input != inner.constEnd() ? input->first : newTerminal(),
+                                                    output != inner.constEnd() ? output->second : newTerminal()));
+            }
+            else if (comp.subcircuitId >= 0)
+            {
+                // Unresolved block: keep its ports so wires still attach
+                terminals.insert(comp.id, qMakePair(newTerminal(), newTerminal()));
+            }
+            else
+            {
+                NetlistElement element;
+                element.name = prefix + comp.label;
+                element.type = comp.type;
+                element.value = comp.value;
+                element.nodeA = newTerminal();
+                element.nodeB = newTerminal();
+                terminals.insert(comp.id, qMakePair(element.nodeA, element.nodeB));
+                if (depth == 0)
+                    m_componentElements.insert(comp.id, m_elements.size());
+                m_elements.append(element);
+            }
+        }
+
+        // A wire joins the source part's output to the target part's input
+        for (const Wire& wire : wires)
+        {
+            auto from = terminals.constFind(wire.fromComponentId);
+            auto to = terminals.constFind(wire.toComponentId);
+            if (from != terminals.constEnd() && to != terminals.constEnd())
+                unite(from->second, to->first);
+        }
+    }
+
+    int newTerminal()
+    {
+        m_parent.append(m_parent.size());
+        return m_parent.size() - 1;
+    }
+
+    int find(int terminal)
+    {
+        while (m_parent[terminal] != terminal)
+        {
+            m_parent[terminal] = m_parent[m_parent[terminal]];
+            terminal = m_parent[terminal];
+        }
+        return terminal;
+    }
+
+    void unite(int a, int b)
+    {
+        a = find(a);
+        b = find(b);
+        if (a != b)
+            m_parent[qMax(a, b)] = qMin(a, b);
+    }
+
+    QVector<NetlistElement>& elements() { return m_elements; }
+    QHash<int, int>& componentElements() { return m_componentElements; }
+    int terminalCount() const { return m_parent.size(); }
+
+private:
+    const QHash<int, SubcircuitDefinition>& m_subcircuits;
+    QVector<int> m_parent;
+    QVector<NetlistElement> m_elements;
+    QHash<int, int> m_componentElements;
+};
+} // namespace
+
+Netlist Netlist::flatten(const QVector<Component>& components, const QVector<Wire>& wires,
+                         const QHash<int, SubcircuitDefinition>& subcircuits)
+{
+    Flattener flattener(subcircuits);
+    QHash<int, QPair<int, int>> terminals;
+    flattener.expand(components, wires, QString(), 0, terminals);
+
+    // Number the connected terminal groups densely
+    QVector<int> nodeOfRoot(flattener.terminalCount(), -1);
+    int nodeCount = 0;
+    auto nodeOf = [&](int terminal)
+    {
+        int root = flattener.find(terminal);
+        if (nodeOfRoot[root] < 0)
+            nodeOfRoot[root] = nodeCount++;
+        return nodeOfRoot[root];
+    };
+
+    Netlist netlist;
+    netlist.elements = std::move(flattener.elements());
+    netlist.componentElements = std::move(flattener.componentElements());
+    for (NetlistElement& element : netlist.elements)
+    {
+        element.nodeA = nodeOf(element.nodeA);
+        element.nodeB = nodeOf(element.nodeB);
+    }
+    netlist.componentNodes.reserve(terminals.size());
+    for (auto it = terminals.constBegin(); it != terminals.constEnd(); ++it)
+    {
+        netlist.componentNodes.insert(it.key(), qMakePair(nodeOf(it->first), nodeOf(it->second)));
+    }
+    netlist.nodeCount = nodeCount;
+
+    if (netlist.elements.isEmpty())
+        return netlist;
+
+    // Reference the negative side of the first source, or of the first part,
+    // and renumber so that it becomes node 0
+    int ground = netlist.elements.first().nodeA;
+    for (const NetlistElement& element : netlist.elements)
+    {
+        if (element.isType("Voltage Source"))
+        {
+            ground = element.nodeA;
+            break;
+        }
+    }
+    auto swapGround = [ground](int& node)
+    {
+        if (node == ground)
+            node = 0;
+        else if (node == 0)
+            node = ground;
+    };
+    for (NetlistElement& element : netlist.elements)
+    {
+        swapGround(element.nodeA);
+        swapGround(element.nodeB);
+    }
+    for (auto it = netlist.componentNodes.begin(); it != netlist.componentNodes.end(); ++it)
+    {
+        swapGround(it->first);
+        swapGround(it->second);
+    }
+    netlist.groundNode = 0;
+    return netlist;
+}
+
+QString Netlist::toText() const
+{
+    QString text;
+    QTextStream out(&text);
+    out << "* Amble netlist: " << elements.size() << " elements, " << nodeCount << " nodes\n";
+    for (const NetlistElement& element : elements)
+    {
+        // Sources list the positive node first
+        if (element.isType("Voltage Source"))
+            out << element.name << ' ' << element.nodeB << ' ' << element.nodeA;
+        else
+            out << element.name << ' ' << element.nodeA << ' ' << element.nodeB;
+        out << ' ' << QString::number(element.value, 'g', 12) << '\n';
+    }
+    out << ".end\n";
+    return text;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+struct Component;
+struct Wire;
+struct SubcircuitDefinition;
+
+// Flat view of a hierarchical design for analysis. Subcircuit instances are
+// expanded recursively; element names carry the instance path, e.g. "X3.R1".
+struct NetlistElement
+{
+    QString name;
+    QString type;
+    double value = 0.0;
+    int nodeA = -1; // Input terminal; the negative side of a source
+    int nodeB = -1; // Output terminal; the positive side of a source
+
+    bool isType(const char* typeName) const { return type == QLatin1String(typeName); }
+    // Voltage sources and inductors add their branch current to the unknowns
+    bool hasBranch() const { return isType("Voltage Source") || isType("Inductor"); }
+};
+
+struct Netlist
+{
+    // Conductance from every node to the reference (SPICE's GMIN). The
+    // simulator, the live operating point and the reduced models all stamp
+    // it, so their results agree.
+    static constexpr double MinimumConductance = 1e-12;
+
+    QVector<NetlistElement> elements;
+    int nodeCount = 0;
+    int groundNode = -1; // Reference node, -1 when the design has no elements
+
+    // Nodes of each top-level part's input and output terminal
+    QHash<int, QPair<int, int>> componentNodes;
+    // Element of each top-level primitive part
+    QHash<int, int> componentElements;
+
+    static Netlist flatten(const QVector<Component>& components, const QVector<Wire>& wires,
+                           const QHash<int, SubcircuitDefinition>& subcircuits);
+
+    // SPICE-style listing, node 0 being the reference
+    QString toText() const;
+};
@@ -0,0 +1,281 @@
+#include "ResultCache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+#include <algorithm>
+#include <numeric>
+
+namespace
+{
+constexpr quint32 ResultMagic = 0x414D4252;     // "AMBR"
+constexpr quint32 MacromodelMagic = 0x414D424D; // "AMBM"
+
+void setupStream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+}
+
+QByteArray resultKey(const CanonicalNetlist& netlist, const AnalysisSettings& settings, int moments,
+                     double expansion)
+{
+    QByteArray listing;
+    QDataStream out(&listing, QIODevice::WriteOnly);
+    setupStream(out);
+    out << ResultMagic << ResultCache::FormatVersion << netlist.hash << qint32(settings.kind)
+        << qint32(settings.solver);
+    // Only what the analysis reads, so that an operating point survives a
+    // change of the transient's times
+    if (settings.kind == AnalysisSettings::Transient)
+        out << settings.step << settings.stop;
+    out << qint32(moments);
+    if (moments > 0)
+        out << expansion;
+    return QCryptographicHash::hash(listing, QCryptographicHash::Sha256);
+}
+
+// The subnetwork's equations in its own unknowns, ports first, which are all a
+// macromodel depends on
+QByteArray macromodelKey(const Netlist& netlist, const RlcSubnetwork& subnetwork, int moments, double expansion)
+{
+    QHash<int, int> localOf;
+    for (int k = 0; k < subnetwork.ports.size(); ++k)
+        localOf.insert(subnetwork.ports[k], k);
+    for (int j = 0; j < subnetwork.internalNodes.size(); ++j)
+        localOf.insert(subnetwork.internalNodes[j], subnetwork.ports.size() + j);
+
+    QByteArray listing;
+    QDataStream out(&listing, QIODevice::WriteOnly);
+    setupStream(out);
+    out << MacromodelMagic << ResultCache::FormatVersion << qint32(subnetwork.ports.size())
+        << qint32(subnetwork.internalNodes.size()) << qint32(subnetwork.elements.size()) << qint32(moments)
+        << expansion;
+    for (int i : subnetwork.elements)
+    {
+        const NetlistElement& element = netlist.elements[i];
+        out << element.type << element.value << qint32(localOf.value(element.nodeA, -1))
+            << qint32(localOf.value(element.nodeB, -1));
+    }
+    return QCryptographicHash::hash(listing, QCryptographicHash::Sha256);
+}
+
+bool writeFile(const QString& path, const QByteArray& data)
+{
+    if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+    {
+        qWarning() << "ResultCache: cannot create" << QFileInfo(path).absolutePath();
+        return false;
+    }
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+    {
+        qWarning() << "ResultCache: cannot write" << path << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+// A missing entry is an ordinary miss and reads as empty
+QByteArray readFile(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+} // namespace
+
+// --- CanonicalNetlist ---
+
+CanonicalNetlist CanonicalNetlist::of(const Netlist& netlist)
+{
+    CanonicalNetlist canonical;
+    const QVector<NetlistElement>& elements = netlist.elements;
+    const int nodeCount = netlist.nodeCount;
+
+    canonical.elementOrder.resize(elements.size());
+    std::iota(canonical.elementOrder.begin(), canonical.elementOrder.end(), 0);
+    std::stable_sort(canonical.elementOrder.begin(), canonical.elementOrder.end(),
+                     [&elements](int a, int b) { return elements[a].name < elements[b].name; });
+
+    QVector<int> canonicalOf(nodeCount, -1);
+    const auto number = [&canonical, &canonicalOf, nodeCount](int node) {
+        if (node >= 0 && node < nodeCount && canonicalOf[node] < 0)
+        {
+            canonicalOf[node] = canonical.nodeOrder.size();
+            canonical.nodeOrder.append(node);
+        }
+    };
+    number(0);
+    for (int i : std::as_const(canonical.elementOrder))
+    {
+        number(elements[i].nodeA);
+        number(elements[i].nodeB);
+    }
+    // Terminals of unresolved blocks touch no element but still have a voltage
+    for (int node = 0; node < nodeCount; ++node)
+        number(node);
+
+    // Names only decide the order; renaming a part alone keeps the hash
+    QByteArray listing;
+    QDataStream out(&listing, QIODevice::WriteOnly);
+    setupStream(out);
+    out << qint32(nodeCount) << qint32(elements.size());
+    for (int i : std::as_const(canonical.elementOrder))
+    {
+        const NetlistElement& element = elements[i];
+        const auto canonicalNode = [&canonicalOf, nodeCount](int node) {
+            return qint32(node >= 0 && node < nodeCount ? canonicalOf[node] : -1);
+        };
+        out << element.type << element.value << canonicalNode(element.nodeA) << canonicalNode(element.nodeB);
+    }
+    canonical.hash = QCryptographicHash::hash(listing, QCryptographicHash::Sha256);
+    return canonical;
+}
+
+// --- ResultCache ---
+
+ResultCache::ResultCache(const QString& directory)
+    : m_directory(directory)
+{
+}
+
+QString ResultCache::defaultDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/results");
+}
+
+QString ResultCache::pathOf(const QByteArray& key, const char* suffix) const
+{
+    // Fanned out by the first byte so that no directory grows too large
+    const QString hex = QString::fromLatin1(key.toHex());
+    return m_directory + QLatin1Char('/') + hex.left(2) + QLatin1Char('/') + hex + QLatin1String(suffix);
+}
+
+bool ResultCache::loadResult(const CanonicalNetlist& netlist, const AnalysisSettings& settings, int moments,
+                             double expansion, SimulationResult& result) const
+{
+    const QString path = pathOf(resultKey(netlist, settings, moments, expansion), ".result");
+    const QByteArray data = readFile(path);
+    if (data.isEmpty())
+        return false;
+
+    QDataStream in(data);
+    setupStream(in);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint32 nodeCount = 0;
+    qint32 elementCount = 0;
+    SimulationResult cached;
+    QVector<double> voltages;
+    QVector<double> currents;
+    in >> magic >> version >> nodeCount >> elementCount >> cached.solver >> cached.time >> voltages >> currents;
+    const qsizetype samples = cached.time.size();
+    if (in.status() != QDataStream::Ok || magic != ResultMagic || version != FormatVersion
+        || nodeCount != netlist.nodeOrder.size() || elementCount != netlist.elementOrder.size()
+        || voltages.size() != samples * nodeCount || currents.size() != samples * elementCount)
+    {
+        qWarning() << "ResultCache: ignoring corrupt entry" << path;
+        return false;
+    }
+
+    // Stored in canonical order
+    cached.nodeCount = nodeCount;
+    cached.elementCount = elementCount;
+    cached.nodeVoltages.resize(voltages.size());
+    cached.elementCurrents.resize(currents.size());
+    for (qsizetype sample = 0; sample < samples; ++sample)
+    {
+        for (int node = 0; node < nodeCount; ++node)
+            cached.nodeVoltages[sample * nodeCount + netlist.nodeOrder[node]] = voltages[sample * nodeCount + node];
+        for (int i = 0; i < elementCount; ++i)
+            cached.elementCurrents[sample * elementCount + netlist.elementOrder[i]] = currents[sample * elementCount + i];
+    }
+    result = std::move(cached);
+    return true;
+}
+
+bool ResultCache::storeResult(const CanonicalNetlist& netlist, const AnalysisSettings& settings, int moments,
+                              double expansion, const SimulationResult& result) const
+{
+    if (!result.isValid() || result.nodeCount != netlist.nodeOrder.size()
+        || result.elementCount != netlist.elementOrder.size())
+        return false;
+
+    const int nodeCount = result.nodeCount;
+    const int elementCount = result.elementCount;
+    const qsizetype samples = result.sampleCount();
+    QVector<double> voltages(samples * nodeCount);
+    QVector<double> currents(samples * elementCount);
+    for (qsizetype sample = 0; sample < samples; ++sample)
+    {
+        for (int node = 0; node < nodeCount; ++node)
+            voltages[sample * nodeCount + node] = result.nodeVoltages[sample * nodeCount + netlist.nodeOrder[node]];
+        for (int i = 0; i < elementCount; ++i)
+            currents[sample * elementCount + i] = result.elementCurrents[sample * elementCount + netlist.elementOrder[i]];
+    }
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    setupStream(out);
+    out << ResultMagic << FormatVersion << qint32(nodeCount) << qint32(elementCount) << result.solver << result.time
+        << voltages << currents;
+    return writeFile(pathOf(resultKey(netlist, settings, moments, expansion), ".result"), data);
+}
+
+bool ResultCache::loadMacromodel(const Netlist& netlist, const RlcSubnetwork& subnetwork, int moments,
+                                 double expansion, Macromodel& model) const
+{
+    const QString path = pathOf(macromodelKey(netlist, subnetwork, moments, expansion), ".macromodel");
+    const QByteArray data = readFile(path);
+    if (data.isEmpty())
+        return false;
+
+    QDataStream in(data);
+    setupStream(in);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint32 order = 0;
+    qint32 fullOrder = 0;
+    Macromodel cached;
+    in >> magic >> version >> order >> fullOrder >> cached.conductance >> cached.capacitance >> cached.incidence
+        >> cached.nodeBasis >> cached.inductorBasis;
+    const qsizetype square = qsizetype(order) * order;
+    if (in.status() != QDataStream::Ok || magic != MacromodelMagic || version != FormatVersion || order <= 0
+        || fullOrder != subnetwork.size() || cached.conductance.size() != square
+        || cached.capacitance.size() != square || cached.incidence.size() != qsizetype(order) * subnetwork.ports.size()
+        || cached.nodeBasis.size() != qsizetype(order) * subnetwork.internalNodes.size()
+        || cached.inductorBasis.size() != qsizetype(order) * subnetwork.inductors.size())
+    {
+        qWarning() << "ResultCache: ignoring corrupt entry" << path;
+        return false;
+    }
+
+    // Stored in the subnetwork's local unknowns, which the key pins down
+    cached.order = order;
+    cached.fullOrder = fullOrder;
+    cached.elements = subnetwork.elements;
+    cached.ports = subnetwork.ports;
+    cached.internalNodes = subnetwork.internalNodes;
+    cached.inductors = subnetwork.inductors;
+    model = std::move(cached);
+    return true;
+}
+
+bool ResultCache::storeMacromodel(const Netlist& netlist, const RlcSubnetwork& subnetwork, int moments,
+                                  double expansion, const Macromodel& model) const
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    setupStream(out);
+    out << MacromodelMagic << FormatVersion << qint32(model.order) << qint32(model.fullOrder) << model.conductance
+        << model.capacitance << model.incidence << model.nodeBasis << model.inductorBasis;
+    return writeFile(pathOf(macromodelKey(netlist, subnetwork, moments, expansion), ".macromodel"), data);
+}
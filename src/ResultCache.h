@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ModelReduction.h"
+#include "Netlist.h"
+#include "Simulator.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+// A netlist in a form that does not depend on the order in which the design
+// lists its parts: elements sorted by name and nodes numbered by first use,
+// the reference staying node 0. The hash covers the canonical listing of
+// types, values and nodes, so renumbered or reordered copies of a circuit
+// share it while any change of value or connection does not.
+struct CanonicalNetlist
+{
+    QByteArray hash;           // SHA-256
+    QVector<int> elementOrder; // Netlist element at each canonical position
+    QVector<int> nodeOrder;    // Netlist node of each canonical node
+
+    static CanonicalNetlist of(const Netlist& netlist);
+};
+
+// Content-addressed store of simulation results and macromodels on local disk.
+// A result is keyed by the canonical netlist and every setting that shapes it,
+// so a rerun of an unchanged design reads its waveforms back instead of
+// simulating. A macromodel is keyed by its RLC subnetwork alone: after an edit
+// elsewhere in the circuit the waveforms change, since everything is coupled,
+// but the reductions of the untouched subnetworks are reused.
+//
+// Entries are written atomically and never modified, so several processes may
+// share a directory. Nothing is ever evicted; delete the directory to reclaim
+// the space.
+class ResultCache
+{
+public:
+    // Bumped whenever the simulator or the reduction would compute different
+    // numbers for the same key, which orphans every older entry
+    static constexpr quint32 FormatVersion = 1;
+
+    explicit ResultCache(const QString& directory = defaultDirectory());
+
+    // The user's cache location
+    static QString defaultDirectory();
+    QString directory() const { return m_directory; }
+
+    // moments and expansion are those of ModelReduction, moments 0 meaning the
+    // full netlist
+    bool loadResult(const CanonicalNetlist& netlist, const AnalysisSettings& settings, int moments, double expansion,
+                    SimulationResult& result) const;
+    bool storeResult(const CanonicalNetlist& netlist, const AnalysisSettings& settings, int moments, double expansion,
+                     const SimulationResult& result) const;
+
+    bool loadMacromodel(const Netlist& netlist, const RlcSubnetwork& subnetwork, int moments, double expansion,
+                        Macromodel& model) const;
+    bool storeMacromodel(const Netlist& netlist, const RlcSubnetwork& subnetwork, int moments, double expansion,
+                         const Macromodel& model) const;
+
+private:
+    QString pathOf(const QByteArray& key, const char* suffix) const;
+
+    QString m_directory;
+};
@@ -0,0 +1,223 @@
+#include "RuleChecker.h"
+
+#include <numeric>
+
+namespace
+{
+// Union-find over densely numbered items
+class DisjointSets
+{
+public:
+    explicit DisjointSets(int count)
+        : m_parent(count)
+    {
+        std::iota(m_parent.begin(), m_parent.end(), 0);
+    }
+
+    int find(int item)
+    {
+        while (m_parent[item] != item)
+        {
+            m_parent[item] = m_parent[m_parent[item]];
+            item = m_parent[item];
+        }
+        return item;
+    }
+
+    void unite(int a, int b) { m_parent[find(a)] = find(b); }
+
+private:
+    QVector<int> m_parent;
+};
+} // namespace
+
+RuleCheckDelta::PartKind RuleCheckDelta::kindOf(const QString& type)
+{
+    if (type == QLatin1String("Voltage Source"))
+        return Source;
+    if (type == QLatin1String("Inductor"))
+        return Inductor;
+    return Passive;
+}
+
+void RuleChecker::link(qint64 a, qint64 b, int count)
+{
+    auto update = [this](qint64 from, qint64 to, int count)
+    {
+        QHash<qint64, int>& links = m_links[from];
+        int& wires = links[to];
+        wires += count;
+        if (wires <= 0)
+        {
+            links.remove(to);
+            if (links.isEmpty())
+                m_links.remove(from);
+        }
+    };
+    update(a, b, count);
+    update(b, a, count);
+}
+
+void RuleChecker::apply(const RuleCheckDelta& delta)
+{
+    if (delta.reset)
+    {
+        m_parts.clear();
+        m_links.clear();
+    }
+
+    // Terminals whose nets may have changed. A removed part keeps its links
+    // until its wires are removed too; the viewport removes them together.
+    QSet<qint64> seeds;
+    QVector<int> evaluated;
+    for (int id : delta.removedParts)
+    {
+        m_parts.remove(id);
+        seeds.insert(terminalOf(id, false));
+        seeds.insert(terminalOf(id, true));
+        evaluated.append(id); // Clears its findings
+    }
+    for (auto it = delta.addedParts.cbegin(); it != delta.addedParts.cend(); ++it)
+    {
+        m_parts.insert(it.key(), it.value());
+        seeds.insert(terminalOf(it.key(), false));
+        seeds.insert(terminalOf(it.key(), true));
+    }
+    for (auto it = delta.wires.cbegin(); it != delta.wires.cend(); ++it)
+    {
+        const qint64 from = terminalOf(it.key().first, true);
+        const qint64 to = terminalOf(it.key().second, false);
+        link(from, to, it.value());
+        seeds.insert(from);
+        seeds.insert(to);
+    }
+
+    const QVector<Diagnostic> diagnostics = evaluate(seeds, evaluated);
+    emit checked(delta.reset, evaluated, diagnostics);
+}
+
+QVector<Diagnostic> RuleChecker::evaluate(const QSet<qint64>& seeds, QVector<int>& evaluated) const
+{
+    // The touched nets, continued through sources and inductors: a loop of
+    // them can close through nets the edit did not touch
+    QHash<qint64, int> slot; // Region terminal -> dense index
+    QVector<qint64> terminals;
+    QVector<qint64> stack(seeds.cbegin(), seeds.cend());
+    while (!stack.isEmpty())
+    {
+        const qint64 terminal = stack.takeLast();
+        if (slot.contains(terminal))
+            continue;
+        slot.insert(terminal, terminals.size());
+        terminals.append(terminal);
+
+        auto links = m_links.constFind(terminal);
+        if (links != m_links.constEnd())
+        {
+            for (auto it = links->cbegin(); it != links->cend(); ++it)
+                stack.append(it.key());
+        }
+        auto part = m_parts.constFind(componentOf(terminal));
+        if (part != m_parts.constEnd() && part.value() != RuleCheckDelta::Passive)
+            stack.append(terminal ^ 1);
+    }
+
+    // Nets inside the region; every wired neighbour of a region terminal is in it
+    DisjointSets nets(terminals.size());
+    for (qsizetype i = 0; i < terminals.size(); ++i)
+    {
+        auto links = m_links.constFind(terminals[i]);
+        if (links == m_links.constEnd())
+            continue;
+        for (auto it = links->cbegin(); it != links->cend(); ++it)
+            nets.unite(int(i), slot.value(it.key()));
+    }
+
+    auto degree = [this](qint64 terminal)
+    {
+        auto links = m_links.constFind(terminal);
+        if (links == m_links.constEnd())
+            return 0;
+        return int(std::accumulate(links->cbegin(), links->cend(), 0));
+    };
+
+    struct Branch
+    {
+        int componentId;
+        int netA;
+        int netB;
+    };
+
+    QVector<Diagnostic> diagnostics;
+    QVector<Branch> branches;
+    QSet<int> seen;
+    for (qint64 terminal : std::as_const(terminals))
+    {
+        const int id = componentOf(terminal);
+        auto part = m_parts.constFind(id);
+        if (part == m_parts.constEnd() || seen.contains(id))
+            continue;
+        seen.insert(id);
+        evaluated.append(id);
+
+        const bool inputWired = degree(terminalOf(id, false)) > 0;
+        const bool outputWired = degree(terminalOf(id, true)) > 0;
+        if (!inputWired && !outputWired)
+            diagnostics.append({Diagnostic::UnconnectedPart, id, false});
+        else if (!inputWired || !outputWired)
+            diagnostics.append({Diagnostic::FloatingTerminal, id, !outputWired});
+
+        if (part.value() == RuleCheckDelta::Passive)
+            continue;
+        // Both terminals of a source or inductor are in the region
+        const int netA = nets.find(slot.value(terminalOf(id, false)));
+        const int netB = nets.find(slot.value(terminalOf(id, true)));
+        if (part.value() == RuleCheckDelta::Source && netA == netB)
+            diagnostics.append({Diagnostic::ShortedSource, id, false});
+        else
+            branches.append({id, netA, netB});
+    }
+
+    // Sources and inductors as edges between nets: an edge that joins two
+    // nets already connected through such edges closes a loop, made of it
+    // and the path between them
+    DisjointSets joined(terminals.size());
+    QHash<int, QVector<QPair<int, int>>> forest; // Net -> (neighbouring net, part)
+    QSet<int> looped;
+    for (const Branch& branch : std::as_const(branches))
+    {
+        if (branch.netA != branch.netB && joined.find(branch.netA) != joined.find(branch.netB))
+        {
+            joined.unite(branch.netA, branch.netB);
+            forest[branch.netA].append({branch.netB, branch.componentId});
+            forest[branch.netB].append({branch.netA, branch.componentId});
+            continue;
+        }
+
+        looped.insert(branch.componentId);
+        if (branch.netA == branch.netB)
+            continue;
+
+        // Walk the forest from one end to the other
+        QHash<int, QPair<int, int>> cameFrom; // Net -> (previous net, part)
+        QVector<int> queue{branch.netA};
+        cameFrom.insert(branch.netA, {-1, -1});
+        for (qsizetype head = 0; head < queue.size() && !cameFrom.contains(branch.netB); ++head)
+        {
+            for (const auto& edge : forest.value(queue[head]))
+            {
+                if (cameFrom.contains(edge.first))
+                    continue;
+                cameFrom.insert(edge.first, {queue[head], edge.second});
+                queue.append(edge.first);
+            }
+        }
+        for (int net = branch.netB; cameFrom.contains(net) && cameFrom.value(net).first >= 0;
+             net = cameFrom.value(net).first)
+            looped.insert(cameFrom.value(net).second);
+    }
+    for (int id : std::as_const(looped))
+        diagnostics.append({Diagnostic::SourceInductorLoop, id, false});
+
+    return diagnostics;
+}
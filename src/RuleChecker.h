@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QHash>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+// One finding of the electrical rule check
+struct Diagnostic
+{
+    enum Rule
+    {
+        UnconnectedPart,   // Neither terminal is wired
+        FloatingTerminal,  // One terminal is wired, the other is not
+        ShortedSource,     // Both terminals of a voltage source are on one net
+        SourceInductorLoop // Part of a loop made only of voltage sources and inductors
+    };
+
+    Rule rule = UnconnectedPart;
+    int componentId = -1;
+    bool output = false; // The open terminal of a FloatingTerminal finding
+};
+
+// Connectivity edits since the last check, as net changes so that edits
+// which cancel out (a delete and its undo) cost nothing. Only these reach the
+// checker: moves and property edits leave the connectivity, and so the
+// findings, alone.
+struct RuleCheckDelta
+{
+    enum PartKind
+    {
+        Passive,
+        Source,
+        Inductor
+    };
+
+    bool reset = false;              // Forget the previous design first
+    QSet<int> removedParts;          // Applied before the additions
+    QHash<int, PartKind> addedParts;
+    QHash<QPair<int, int>, int> wires; // (output of first, input of second) -> change in wire count
+
+    void addPart(int componentId, PartKind kind) { addedParts.insert(componentId, kind); }
+    void removePart(int componentId)
+    {
+        addedParts.remove(componentId);
+        removedParts.insert(componentId);
+    }
+    void addWire(int fromId, int toId, int count)
+    {
+        int& change = wires[qMakePair(fromId, toId)];
+        change += count;
+        if (change == 0)
+            wires.remove(qMakePair(fromId, toId));
+    }
+    bool isEmpty() const { return !reset && removedParts.isEmpty() && addedParts.isEmpty() && wires.isEmpty(); }
+    static PartKind kindOf(const QString& type);
+};
+
+// Incremental electrical rule checker. It keeps its own copy of the
+// connectivity (terminals and wires, no geometry) and lives on a worker
+// thread. Each delta re-evaluates only the nets it touches, widened across
+// voltage sources and inductors so that loops through untouched nets are
+// still seen; the rest of the design keeps its findings.
+class RuleChecker : public QObject
+{
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+    // Runs on the checker's thread
+    void apply(const RuleCheckDelta& delta);
+
+signals:
+    // The findings of componentIds are replaced by diagnostics; with reset,
+    // all earlier findings are void
+    void checked(bool reset, const QVector<int>& componentIds, const QVector<Diagnostic>& diagnostics);
+
+private:
+    // Terminal key: component id * 2, plus 1 for the output
+    static qint64 terminalOf(int componentId, bool output) { return qint64(componentId) * 2 + (output ? 1 : 0); }
+    static int componentOf(qint64 terminal) { return int(terminal >> 1); }
+
+    void link(qint64 a, qint64 b, int count);
+    QVector<Diagnostic> evaluate(const QSet<qint64>& seeds, QVector<int>& evaluated) const;
+
+    QHash<int, RuleCheckDelta::PartKind> m_parts;
+    QHash<qint64, QHash<qint64, int>> m_links; // Terminal -> wired terminal -> number of wires
+};
@@ -0,0 +1,659 @@
+#include "SchematicFile.h"
+#include "CircuitViewport.h"
+
+#include <QSaveFile>
+#include <QMap>
+#include <QMutexLocker>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+
+// Records are written straight from memory, so the host must match the file
+static_assert(Q_BYTE_ORDER == Q_LITTLE_ENDIAN, "Schematic files require a little-endian host");
+
+using namespace SchematicFormat;
+
+namespace
+{
+qint64 tileKey(const QPointF& pos, float tileSize)
+{
+    qint32 tx = qint32(std::floor(pos.x() / tileSize));
+    qint32 ty = qint32(std::floor(pos.y() / tileSize));
+    return (qint64(tx) << 32) | quint32(ty);
+}
+
+quint64 alignTo8(quint64 value)
+{
+    return (value + 7) & ~quint64(7);
+}
+
+// Records written by an older version may be shorter than T; the missing
+// trailing fields read as zero
+template <typename T>
+T recordAt(const uchar* data, quint32 stride, quint64 index)
+{
+    T record{};
+    std::memcpy(&record, data + index * stride, qMin<size_t>(stride, sizeof(T)));
+    return record;
+}
+
+class StringTable
+{
+public:
+    StringTable()
+    {
+        intern(QString()); // Index 0 is always the empty string
+    }
+
+    quint32 intern(const QString& string)
+    {
+        auto it = m_ids.constFind(string);
+        if (it != m_ids.constEnd())
+            return it.value();
+
+        QByteArray utf8 = string.toUtf8();
+        StringRecord record{quint32(m_data.size()), quint32(utf8.size())};
+        m_data.append(utf8);
+
+        quint32 id = quint32(m_index.size());
+        m_index.append(record);
+        m_ids.insert(string, id);
+        return id;
+    }
+
+    const QVector<StringRecord>& index() const { return m_index; }
+    const QByteArray& data() const { return m_data; }
+
+private:
+    QVector<StringRecord> m_index;
+    QByteArray m_data;
+    QHash<QString, quint32> m_ids;
+};
+
+ComponentRecord encodeComponent(const Component& comp, StringTable& strings)
+{
+    ComponentRecord record{};
+    record.id = comp.id;
+    record.typeString = strings.intern(comp.type);
+    record.labelString = strings.intern(comp.label);
+    record.color = comp.color.rgba();
+    record.x = comp.position.x();
+    record.y = comp.position.y();
+    record.width = comp.width;
+    record.height = comp.height;
+    record.rotation = comp.rotation;
+    record.value = comp.value;
+    record.subcircuitId = comp.subcircuitId;
+    return record;
+}
+
+WireRecord encodeWire(const Wire& wire, QVector<PointRecord>& points)
+{
+    WireRecord record{};
+    record.fromComponentId = wire.fromComponentId;
+    record.toComponentId = wire.toComponentId;
+    record.color = wire.color.rgba();
+    record.firstPoint = quint64(points.size());
+    record.pointCount = quint32(wire.points.size());
+    for (const QPointF& point : wire.points)
+    {
+        points.append(PointRecord{point.x(), point.y()});
+    }
+    return record;
+}
+} // namespace
+
+// --- SchematicWriter ---
+
+bool SchematicWriter::write(const QString& path, const QVector<Component>& components, const QVector<Wire>& wires,
+                            const QHash<int, SubcircuitDefinition>& subcircuits, const SchematicInfo& info,
+                            QString* errorString)
+{
+    const float tileSize = DefaultTileSize;
+
+    // Assign every component and wire to a tile
+    QHash<int, QPointF> positionById;
+    positionById.reserve(components.size());
+    QVector<qint64> componentKeys(components.size());
+    QRectF bounds;
+    for (qsizetype i = 0; i < components.size(); ++i)
+    {
+        const Component& comp = components[i];
+        componentKeys[i] = tileKey(comp.position, tileSize);
+        positionById.insert(comp.id, comp.position);
+        bounds |= QRectF(comp.position, QSizeF(comp.width, comp.height));
+    }
+
+    QVector<qint64> wireKeys(wires.size());
+    for (qsizetype i = 0; i < wires.size(); ++i)
+    {
+        const Wire& wire = wires[i];
+        QPointF anchor = wire.points.isEmpty() ? positionById.value(wire.fromComponentId) : wire.points.first();
+        wireKeys[i] = tileKey(anchor, tileSize);
+    }
+
+    // Stable sort keeps the original order inside each tile
+    QVector<int> componentOrder(components.size());
+    std::iota(componentOrder.begin(), componentOrder.end(), 0);
+    std::stable_sort(componentOrder.begin(), componentOrder.end(),
+                     [&](int a, int b) { return componentKeys[a] < componentKeys[b]; });
+
+    QVector<int> wireOrder(wires.size());
+    std::iota(wireOrder.begin(), wireOrder.end(), 0);
+    std::stable_sort(wireOrder.begin(), wireOrder.end(),
+                     [&](int a, int b) { return wireKeys[a] < wireKeys[b]; });
+
+    // Build the tile table of contents
+    QMap<qint64, TileRecord> tiles;
+    auto tileFor = [&tiles](qint64 key) -> TileRecord&
+    {
+        auto it = tiles.find(key);
+        if (it == tiles.end())
+        {
+            TileRecord tile{};
+            tile.tileX = qint32(key >> 32);
+            tile.tileY = qint32(quint32(key & 0xffffffff));
+            it = tiles.insert(key, tile);
+        }
+        return it.value();
+    };
+
+    for (qsizetype pos = 0; pos < componentOrder.size(); ++pos)
+    {
+        TileRecord& tile = tileFor(componentKeys[componentOrder[pos]]);
+        if (tile.componentCount == 0)
+            tile.firstComponent = quint32(pos);
+        ++tile.componentCount;
+    }
+
+    for (qsizetype pos = 0; pos < wireOrder.size(); ++pos)
+    {
+        TileRecord& tile = tileFor(wireKeys[wireOrder[pos]]);
+        if (tile.wireCount == 0)
+            tile.firstWire = quint32(pos);
+        ++tile.wireCount;
+    }
+
+    // Encode records
+    StringTable strings;
+    QVector<TileRecord> tileRecords(tiles.begin(), tiles.end());
+
+    QVector<ComponentRecord> componentRecords;
+    componentRecords.reserve(components.size());
+    for (int index : componentOrder)
+    {
+        componentRecords.append(encodeComponent(components[index], strings));
+    }
+
+    // Design position of each record, which the tile order loses
+    QVector<OrderRecord> componentOrderRecords;
+    componentOrderRecords.reserve(componentOrder.size());
+    for (int index : componentOrder)
+        componentOrderRecords.append(OrderRecord{quint32(index)});
+    QVector<OrderRecord> wireOrderRecords;
+    wireOrderRecords.reserve(wireOrder.size());
+    for (int index : wireOrder)
+        wireOrderRecords.append(OrderRecord{quint32(index)});
+
+    QVector<WireRecord> wireRecords;
+    QVector<PointRecord> pointRecords;
+    wireRecords.reserve(wires.size());
+    for (int index : wireOrder)
+    {
+        wireRecords.append(encodeWire(wires[index], pointRecords));
+    }
+
+    // Definitions in id order so saves are reproducible
+    QList<int> subcircuitIds = subcircuits.keys();
+    std::sort(subcircuitIds.begin(), subcircuitIds.end());
+    QVector<SubcircuitRecord> subcircuitRecords;
+    QVector<ComponentRecord> definitionComponentRecords;
+    QVector<WireRecord> definitionWireRecords;
+    for (int id : subcircuitIds)
+    {
+        const SubcircuitDefinition& definition = *subcircuits.constFind(id);
+        SubcircuitRecord record{};
+        record.id = definition.id;
+        record.nameString = strings.intern(definition.name);
+        record.width = float(definition.size.width());
+        record.height = float(definition.size.height());
+        record.inputComponentId = definition.inputComponentId;
+        record.outputComponentId = definition.outputComponentId;
+        record.firstComponent = quint32(definitionComponentRecords.size());
+        record.componentCount = quint32(definition.components.size());
+        record.firstWire = quint32(definitionWireRecords.size());
+        record.wireCount = quint32(definition.wires.size());
+        for (const Component& comp : definition.components)
+        {
+            definitionComponentRecords.append(encodeComponent(comp, strings));
+        }
+        for (const Wire& wire : definition.wires)
+        {
+            definitionWireRecords.append(encodeWire(wire, pointRecords));
+        }
+        subcircuitRecords.append(record);
+    }
+
+    struct Payload
+    {
+        quint32 type;
+        quint32 recordSize;
+        const void* data;
+        quint64 count;
+    };
+
+    const Payload payloads[] = {
+        {TileSection, sizeof(TileRecord), tileRecords.constData(), quint64(tileRecords.size())},
+        {ComponentSection, sizeof(ComponentRecord), componentRecords.constData(), quint64(componentRecords.size())},
+        {WireSection, sizeof(WireRecord), wireRecords.constData(), quint64(wireRecords.size())},
+        {SubcircuitSection, sizeof(SubcircuitRecord), subcircuitRecords.constData(), quint64(subcircuitRecords.size())},
+        {DefinitionComponentSection, sizeof(ComponentRecord), definitionComponentRecords.constData(),
+         quint64(definitionComponentRecords.size())},
+        {DefinitionWireSection, sizeof(WireRecord), definitionWireRecords.constData(),
+         quint64(definitionWireRecords.size())},
+        {ComponentOrderSection, sizeof(OrderRecord), componentOrderRecords.constData(),
+         quint64(componentOrderRecords.size())},
+        {WireOrderSection, sizeof(OrderRecord), wireOrderRecords.constData(), quint64(wireOrderRecords.size())},
+        {PointSection, sizeof(PointRecord), pointRecords.constData(), quint64(pointRecords.size())},
+        {StringIndexSection, sizeof(StringRecord), strings.index().constData(), quint64(strings.index().size())},
+        {StringDataSection, 1, strings.data().constData(), quint64(strings.data().size())},
+    };
+    const quint32 sectionCount = quint32(std::size(payloads));
+
+    Header header{};
+    std::memcpy(header.magic, Magic, sizeof(header.magic));
+    header.version = Version;
+    header.headerSize = sizeof(Header);
+    header.sectionCount = sectionCount;
+    header.nextComponentId = info.nextComponentId;
+    header.gridSize = info.gridSize;
+    header.tileSize = tileSize;
+    header.revision = info.revision;
+    header.boundsX = float(bounds.x());
+    header.boundsY = float(bounds.y());
+    header.boundsWidth = float(bounds.width());
+    header.boundsHeight = float(bounds.height());
+
+    QVector<SectionEntry> directory;
+    quint64 offset = alignTo8(sizeof(Header) + sectionCount * sizeof(SectionEntry));
+    for (const Payload& payload : payloads)
+    {
+        directory.append(SectionEntry{payload.type, payload.recordSize, offset, payload.count});
+        offset = alignTo8(offset + payload.count * payload.recordSize);
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    quint64 written = 0;
+    auto writeBytes = [&file, &written](const void* data, quint64 size)
+    {
+        if (size == 0)
+            return true;
+        qint64 result = file.write(static_cast<const char*>(data), qint64(size));
+        written += quint64(qMax<qint64>(result, 0));
+        return result == qint64(size);
+    };
+    auto padTo = [&writeBytes, &written](quint64 target)
+    {
+        static const char zeros[8] = {};
+        return writeBytes(zeros, target - written);
+    };
+
+    bool ok = writeBytes(&header, sizeof(header)) &&
+              writeBytes(directory.constData(), directory.size() * sizeof(SectionEntry));
+    for (qsizetype i = 0; ok && i < directory.size(); ++i)
+    {
+        ok = padTo(directory[i].offset) &&
+             writeBytes(payloads[i].data, payloads[i].count * payloads[i].recordSize);
+    }
+
+    if (!ok || !file.commit())
+    {
+        if (errorString)
+            *errorString = file.errorString();
+        file.cancelWriting();
+        return false;
+    }
+
+    qDebug() << "Saved schematic" << path << "components:" << components.size() << "wires:" << wires.size()
+             << "subcircuits:" << subcircuitRecords.size() << "tiles:" << tileRecords.size();
+    return true;
+}
+
+// --- SchematicReader ---
+
+SchematicReader::~SchematicReader()
+{
+    close();
+}
+
+bool SchematicReader::fail(const QString& message)
+{
+    close();
+    m_errorString = message;
+    return false;
+}
+
+bool SchematicReader::open(const QString& path)
+{
+    close();
+    m_errorString.clear();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return fail(m_file.errorString());
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(Header)))
+        return fail(QStringLiteral("File is too small to be a schematic"));
+
+    m_data = m_file.map(0, m_size);
+    if (!m_data)
+        return fail(QStringLiteral("Unable to map file: %1").arg(m_file.errorString()));
+
+    Header header;
+    std::memcpy(&header, m_data, sizeof(Header));
+    if (std::memcmp(header.magic, Magic, sizeof(header.magic)) != 0)
+        return fail(QStringLiteral("Not an Amble schematic"));
+    if (header.version == 0 || header.version > Version)
+        return fail(QStringLiteral("Unsupported schematic version %1").arg(header.version));
+
+    quint64 directoryEnd = quint64(header.headerSize) + quint64(header.sectionCount) * sizeof(SectionEntry);
+    if (header.headerSize < sizeof(Header) || directoryEnd > quint64(m_size))
+        return fail(QStringLiteral("Corrupt section directory"));
+
+    for (quint32 i = 0; i < header.sectionCount; ++i)
+    {
+        SectionEntry entry = recordAt<SectionEntry>(m_data + header.headerSize, sizeof(SectionEntry), i);
+        if (entry.recordSize == 0 || entry.offset > quint64(m_size) ||
+            entry.count > (quint64(m_size) - entry.offset) / entry.recordSize)
+            return fail(QStringLiteral("Section %1 is out of range").arg(entry.type));
+
+        Section section{m_data + entry.offset, entry.recordSize, entry.count};
+        quint32 minimumSize = 0;
+        Section* target = nullptr;
+        switch (entry.type)
+        {
+        case TileSection:
+            target = &m_tiles;
+            minimumSize = sizeof(TileRecord);
+            break;
+        case ComponentSection:
+            target = &m_components;
+            minimumSize = offsetof(ComponentRecord, subcircuitId); // Version 1 records
+            break;
+        case WireSection:
+            target = &m_wires;
+            minimumSize = sizeof(WireRecord);
+            break;
+        case SubcircuitSection:
+            target = &m_subcircuits;
+            minimumSize = sizeof(SubcircuitRecord);
+            break;
+        case DefinitionComponentSection:
+            target = &m_definitionComponents;
+            minimumSize = sizeof(ComponentRecord);
+            break;
+        case DefinitionWireSection:
+            target = &m_definitionWires;
+            minimumSize = sizeof(WireRecord);
+            break;
+        case PointSection:
+            target = &m_points;
+            minimumSize = sizeof(PointRecord);
+            break;
+        case StringIndexSection:
+            target = &m_stringIndex;
+            minimumSize = sizeof(StringRecord);
+            break;
+        case StringDataSection:
+            target = &m_stringData;
+            minimumSize = 1;
+            break;
+        case ComponentOrderSection:
+            target = &m_componentOrder;
+            minimumSize = sizeof(OrderRecord);
+            break;
+        case WireOrderSection:
+            target = &m_wireOrder;
+            minimumSize = sizeof(OrderRecord);
+            break;
+        default:
+            break; // Unknown sections belong to newer writers
+        }
+
+        if (target)
+        {
+            if (entry.recordSize < minimumSize)
+                return fail(QStringLiteral("Section %1 has a truncated record size").arg(entry.type));
+            *target = section;
+        }
+    }
+
+    // Tiles must reference valid record ranges
+    for (quint64 i = 0; i < m_tiles.count; ++i)
+    {
+        TileRecord tile = recordAt<TileRecord>(m_tiles.data, m_tiles.stride, i);
+        if (quint64(tile.firstComponent) + tile.componentCount > m_components.count ||
+            quint64(tile.firstWire) + tile.wireCount > m_wires.count)
+            return fail(QStringLiteral("Tile %1 references missing records").arg(i));
+    }
+
+    m_info.nextComponentId = header.nextComponentId;
+    m_info.gridSize = header.gridSize;
+    m_info.revision = header.revision;
+    m_bounds = QRectF(header.boundsX, header.boundsY, header.boundsWidth, header.boundsHeight);
+    m_tileSize = header.tileSize > 0.0f ? header.tileSize : DefaultTileSize;
+
+    qDebug() << "Opened schematic" << path << "version" << header.version << "components:" << m_components.count
+             << "wires:" << m_wires.count << "tiles:" << m_tiles.count;
+    return true;
+}
+
+void SchematicReader::close()
+{
+    if (m_data)
+    {
+        m_file.unmap(const_cast<uchar*>(m_data));
+        m_data = nullptr;
+    }
+    m_file.close();
+    m_size = 0;
+    m_tiles = Section();
+    m_components = Section();
+    m_wires = Section();
+    m_points = Section();
+    m_stringIndex = Section();
+    m_stringData = Section();
+    m_subcircuits = Section();
+    m_definitionComponents = Section();
+    m_definitionWires = Section();
+    m_componentOrder = Section();
+    m_wireOrder = Section();
+
+    QMutexLocker locker(&m_stringMutex);
+    m_stringCache.clear();
+}
+
+QRectF SchematicReader::tileRect(int tile) const
+{
+    if (tile < 0 || quint64(tile) >= m_tiles.count)
+        return QRectF();
+    TileRecord record = recordAt<TileRecord>(m_tiles.data, m_tiles.stride, tile);
+    return QRectF(record.tileX * m_tileSize, record.tileY * m_tileSize, m_tileSize, m_tileSize);
+}
+
+QVector<int> SchematicReader::tilesIntersecting(const QRectF& worldRect) const
+{
+    // Records are keyed by their origin, so parts near a tile edge spill into
+    // the neighbouring tile; pad the query to catch them
+    float margin = m_tileSize * 0.25f;
+    QRectF query = worldRect.adjusted(-margin, -margin, margin, margin);
+
+    QVector<int> result;
+    for (quint64 i = 0; i < m_tiles.count; ++i)
+    {
+        if (tileRect(int(i)).intersects(query))
+            result.append(int(i));
+    }
+    return result;
+}
+
+void SchematicReader::readTiles(const QVector<int>& tiles, QVector<Component>& components, QVector<Wire>& wires) const
+{
+    for (int tile : tiles)
+    {
+        if (tile < 0 || quint64(tile) >= m_tiles.count)
+            continue;
+        TileRecord record = recordAt<TileRecord>(m_tiles.data, m_tiles.stride, tile);
+        readComponents(m_components, record.firstComponent, record.componentCount, components);
+        readWires(m_wires, record.firstWire, record.wireCount, wires);
+    }
+}
+
+void SchematicReader::readAll(QVector<Component>& components, QVector<Wire>& wires) const
+{
+    const qsizetype firstComponent = components.size();
+    const qsizetype firstWire = wires.size();
+    readComponents(m_components, 0, m_components.count, components);
+    readWires(m_wires, 0, m_wires.count, wires);
+    restoreOrder(m_componentOrder, components, firstComponent);
+    restoreOrder(m_wireOrder, wires, firstWire);
+}
+
+bool SchematicReader::storedInDesignOrder() const
+{
+    return isIdentity(m_componentOrder) && isIdentity(m_wireOrder);
+}
+
+template <typename T>
+void SchematicReader::restoreOrder(const Section& order, QVector<T>& items, qsizetype first) const
+{
+    // Files without the section, or with one that is not a permutation of
+    // the records, keep the tile order
+    const qsizetype count = items.size() - first;
+    if (order.count != quint64(count) || isIdentity(order))
+        return;
+    QVector<qsizetype> source(count, -1);
+    for (qsizetype i = 0; i < count; ++i)
+    {
+        const quint32 index = recordAt<OrderRecord>(order.data, order.stride, quint64(i)).index;
+        if (index >= quint32(count) || source[index] >= 0)
+            return;
+        source[index] = i;
+    }
+    QVector<T> ordered;
+    ordered.reserve(count);
+    for (qsizetype i : source)
+        ordered.append(std::move(items[first + i]));
+    std::move(ordered.begin(), ordered.end(), items.begin() + first);
+}
+
+bool SchematicReader::isIdentity(const Section& order) const
+{
+    for (quint64 i = 0; i < order.count; ++i)
+    {
+        if (recordAt<OrderRecord>(order.data, order.stride, i).index != i)
+            return false;
+    }
+    return true;
+}
+
+QHash<int, SubcircuitDefinition> SchematicReader::readSubcircuits() const
+{
+    QHash<int, SubcircuitDefinition> definitions;
+    for (quint64 i = 0; i < m_subcircuits.count; ++i)
+    {
+        SubcircuitRecord record = recordAt<SubcircuitRecord>(m_subcircuits.data, m_subcircuits.stride, i);
+        SubcircuitDefinition definition;
+        definition.id = record.id;
+        definition.name = stringAt(record.nameString);
+        definition.size = QSizeF(record.width, record.height);
+        definition.inputComponentId = record.inputComponentId;
+        definition.outputComponentId = record.outputComponentId;
+        readComponents(m_definitionComponents, record.firstComponent, record.componentCount, definition.components);
+        readWires(m_definitionWires, record.firstWire, record.wireCount, definition.wires);
+        definitions.insert(definition.id, definition);
+    }
+    return definitions;
+}
+
+void SchematicReader::readComponents(const Section& section, quint64 first, quint64 count,
+                                     QVector<Component>& components) const
+{
+    count = qMin(count, section.count - qMin(first, section.count));
+    components.reserve(components.size() + qsizetype(count));
+
+    // Version 1 records end before the subcircuit id
+    const bool hasSubcircuit = section.stride >= offsetof(ComponentRecord, subcircuitId) + sizeof(qint32);
+    for (quint64 i = first; i < first + count; ++i)
+    {
+        ComponentRecord record = recordAt<ComponentRecord>(section.data, section.stride, i);
+        Component comp(record.id, sharedStringAt(record.typeString), QPointF(record.x, record.y),
+                       QColor::fromRgba(record.color), record.width, record.height);
+        comp.rotation = record.rotation;
+        comp.label = stringAt(record.labelString);
+        comp.value = record.value;
+        comp.subcircuitId = hasSubcircuit ? record.subcircuitId : -1;
+        if (!qFuzzyIsNull(comp.rotation))
+            comp.setupTerminals();
+        components.append(comp);
+    }
+}
+
+void SchematicReader::readWires(const Section& section, quint64 first, quint64 count, QVector<Wire>& wires) const
+{
+    count = qMin(count, section.count - qMin(first, section.count));
+    wires.reserve(wires.size() + qsizetype(count));
+
+    for (quint64 i = first; i < first + count; ++i)
+    {
+        WireRecord record = recordAt<WireRecord>(section.data, section.stride, i);
+        Wire wire(record.fromComponentId, record.toComponentId, QColor::fromRgba(record.color));
+
+        if (record.firstPoint + record.pointCount <= m_points.count)
+        {
+            wire.points.reserve(record.pointCount);
+            for (quint64 p = record.firstPoint; p < record.firstPoint + record.pointCount; ++p)
+            {
+                PointRecord point = recordAt<PointRecord>(m_points.data, m_points.stride, p);
+                wire.points.append(QPointF(point.x, point.y));
+            }
+        }
+        wires.append(wire);
+    }
+}
+
+QString SchematicReader::stringAt(quint32 index) const
+{
+    if (index >= m_stringIndex.count)
+        return QString();
+
+    StringRecord record = recordAt<StringRecord>(m_stringIndex.data, m_stringIndex.stride, index);
+    if (quint64(record.offset) + record.length > m_stringData.count)
+        return QString();
+
+    return QString::fromUtf8(reinterpret_cast<const char*>(m_stringData.data + record.offset), record.length);
+}
+
+QString SchematicReader::sharedStringAt(quint32 index) const
+{
+    QMutexLocker locker(&m_stringMutex);
+    auto it = m_stringCache.constFind(index);
+    if (it != m_stringCache.constEnd())
+        return it.value();
+
+    QString string = stringAt(index);
+    m_stringCache.insert(index, string);
+    return string;
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+struct Component;
+struct Wire;
+struct SubcircuitDefinition;
+
+// Amble schematic file (.amb)
+//
+// Layout (all values little-endian):
+//   Header
+//   SectionEntry[header.sectionCount]
+//   sections, each 8-byte aligned
+//
+// Every section is an array of fixed-size records. Readers use the stride
+// stored in the section directory, so later versions may append fields to a
+// record, and sections with an unknown type are skipped.
+//
+// Components and wires are sorted by spatial tile. The tile section is a table
+// of contents mapping each tile to a contiguous range of component and wire
+// records, which lets a reader map the file and decode only the visible region.
+//
+// Subcircuit definitions are stored once, outside the tiles: the subcircuit
+// section indexes ranges of the definition component and wire sections, whose
+// records use the same layout as the top-level ones.
+//
+// The order sections give the position in the design of each component and
+// wire record, so that reading the whole file restores the order the design
+// had when it was written. The edit journal addresses wires by that position.
+
+namespace SchematicFormat
+{
+constexpr char Magic[4] = {'A', 'M', 'B', 'L'};
+constexpr quint32 Version = 2; // 2: subcircuits
+constexpr float DefaultTileSize = 1024.0f;
+
+enum SectionType : quint32
+{
+    TileSection = 1,
+    ComponentSection = 2,
+    WireSection = 3,
+    PointSection = 4,
+    StringIndexSection = 5,
+    StringDataSection = 6,
+    SubcircuitSection = 7,
+    DefinitionComponentSection = 8,
+    DefinitionWireSection = 9,
+    ComponentOrderSection = 10,
+    WireOrderSection = 11
+};
+
+struct Header
+{
+    char magic[4];
+    quint32 version;
+    quint32 headerSize;
+    quint32 sectionCount;
+    qint32 nextComponentId;
+    float gridSize;
+    float tileSize;
+    quint32 flags;
+    quint64 revision;
+    float boundsX;
+    float boundsY;
+    float boundsWidth;
+    float boundsHeight;
+    quint64 reserved;
+};
+
+struct SectionEntry
+{
+    quint32 type;
+    quint32 recordSize;
+    quint64 offset;
+    quint64 count;
+};
+
+struct TileRecord
+{
+    qint32 tileX;
+    qint32 tileY;
+    quint32 firstComponent;
+    quint32 componentCount;
+    quint32 firstWire;
+    quint32 wireCount;
+};
+
+struct ComponentRecord
+{
+    qint32 id;
+    quint32 typeString;
+    quint32 labelString;
+    quint32 color; // QRgb
+    double x;
+    double y;
+    float width;
+    float height;
+    float rotation;
+    quint32 flags;
+    double value;
+    qint32 subcircuitId; // Version 2
+    quint32 reserved;
+};
+
+struct WireRecord
+{
+    qint32 fromComponentId;
+    qint32 toComponentId;
+    quint32 color; // QRgb
+    quint32 pointCount;
+    quint64 firstPoint;
+};
+
+struct SubcircuitRecord
+{
+    qint32 id;
+    quint32 nameString;
+    float width;
+    float height;
+    qint32 inputComponentId;
+    qint32 outputComponentId;
+    quint32 firstComponent; // Into the definition component section
+    quint32 componentCount;
+    quint32 firstWire; // Into the definition wire section
+    quint32 wireCount;
+};
+
+struct OrderRecord
+{
+    quint32 index; // Position in the design of the record at this position
+};
+
+struct PointRecord
+{
+    double x;
+    double y;
+};
+
+struct StringRecord
+{
+    quint32 offset; // Into the string data section, UTF-8 without terminator
+    quint32 length;
+};
+
+static_assert(sizeof(Header) == 64, "Header layout changed");
+static_assert(sizeof(SectionEntry) == 24, "SectionEntry layout changed");
+static_assert(sizeof(TileRecord) == 24, "TileRecord layout changed");
+static_assert(sizeof(ComponentRecord) == 64, "ComponentRecord layout changed");
+static_assert(sizeof(SubcircuitRecord) == 40, "SubcircuitRecord layout changed");
+static_assert(sizeof(WireRecord) == 24, "WireRecord layout changed");
+static_assert(sizeof(OrderRecord) == 4, "OrderRecord layout changed");
+static_assert(sizeof(PointRecord) == 16, "PointRecord layout changed");
+static_assert(sizeof(StringRecord) == 8, "StringRecord layout changed");
+} // namespace SchematicFormat
+
+// Document-level values stored next to the model
+struct SchematicInfo
+{
+    int nextComponentId = 1;
+    float gridSize = 20.0f;
+    quint64 revision = 0;
+};
+
+class SchematicWriter
+{
+public:
+    static bool write(const QString& path, const QVector<Component>& components, const QVector<Wire>& wires,
+                      const QHash<int, SubcircuitDefinition>& subcircuits, const SchematicInfo& info,
+                      QString* errorString = nullptr);
+};
+
+// Memory-maps a schematic file and decodes records on demand. After open()
+// succeeds, the read functions are safe to call from any thread.
+class SchematicReader
+{
+public:
+    SchematicReader() = default;
+    ~SchematicReader();
+
+    bool open(const QString& path);
+    void close();
+    bool isOpen() const { return m_data != nullptr; }
+    QString errorString() const { return m_errorString; }
+
+    SchematicInfo info() const { return m_info; }
+    QRectF bounds() const { return m_bounds; }
+    int componentCount() const { return int(m_components.count); }
+    int wireCount() const { return int(m_wires.count); }
+
+    // Spatial table of contents
+    int tileCount() const { return int(m_tiles.count); }
+    QRectF tileRect(int tile) const;
+    QVector<int> tilesIntersecting(const QRectF& worldRect) const;
+
+    void readTiles(const QVector<int>& tiles, QVector<Component>& components, QVector<Wire>& wires) const;
+    // In the order of the design that was written
+    void readAll(QVector<Component>& components, QVector<Wire>& wires) const;
+    // Whether the records are stored in the design's order, so that reading
+    // the tiles in sequence gives the same order as readAll()
+    bool storedInDesignOrder() const;
+    QHash<int, SubcircuitDefinition> readSubcircuits() const;
+
+private:
+    struct Section
+    {
+        const uchar* data = nullptr;
+        quint32 stride = 0;
+        quint64 count = 0;
+    };
+
+    bool fail(const QString& message);
+    void readComponents(const Section& section, quint64 first, quint64 count, QVector<Component>& components) const;
+    void readWires(const Section& section, quint64 first, quint64 count, QVector<Wire>& wires) const;
+    template <typename T>
+    void restoreOrder(const Section& order, QVector<T>& items, qsizetype first) const;
+    bool isIdentity(const Section& order) const;
+    QString stringAt(quint32 index) const;
+    QString sharedStringAt(quint32 index) const;
+
+    QFile m_file;
+    const uchar* m_data = nullptr;
+    qint64 m_size = 0;
+    QString m_errorString;
+    SchematicInfo m_info;
+    QRectF m_bounds;
+    float m_tileSize = SchematicFormat::DefaultTileSize;
+
+    Section m_tiles;
+    Section m_components;
+    Section m_wires;
+    Section m_points;
+    Section m_stringIndex;
+    Section m_stringData;
+    Section m_subcircuits;
+    Section m_definitionComponents;
+    Section m_definitionWires;
+    Section m_componentOrder;
+    Section m_wireOrder;
+
+    // Type names repeat on every record, so their decoded strings are shared
+    mutable QMutex m_stringMutex;
+    mutable QHash<quint32, QString> m_stringCache;
+};
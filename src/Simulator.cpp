@@ -0,0 +1,458 @@
+#include "Simulator.h"
+#include "MemoryStats.h"
+
+#include <QTextStream>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+// Collects matrix entries, dropping the reference row and column
+struct MatrixStamp
+{
+    QVector<SparseMatrix::Entry>& entries;
+
+    void add(int row, int col, double value)
+    {
+        if (row >= 0 && col >= 0)
+            entries.append({row, col, value});
+    }
+
+    void conductance(int a, int b, double g)
+    {
+        add(a, a, g);
+        add(b, b, g);
+        add(a, b, -g);
+        add(b, a, -g);
+    }
+};
+
+QString solverError(const LinearSolver& solver)
+{
+    if (!solver.errorString().isEmpty())
+        return solver.errorString();
+    return QStringLiteral("%1 solver did not converge in %2 iterations")
+        .arg(LinearSolver::methodName(solver.method()))
+        .arg(solver.lastIterations());
+}
+
+void addToRhs(QVector<double>& rhs, int row, double value)
+{
+    if (row >= 0)
+        rhs[row] += value;
+}
+} // namespace
+
+QString AnalysisSettings::name() const
+{
+    return kind == Transient ? QStringLiteral("tran") : QStringLiteral("op");
+}
+
+bool AnalysisSettings::fromName(const QString& name, Kind& kind)
+{
+    if (name == QLatin1String("op"))
+        kind = OperatingPoint;
+    else if (name == QLatin1String("tran"))
+        kind = Transient;
+    else
+        return false;
+    return true;
+}
+
+Simulator::Simulator(const Netlist& netlist, QVector<Macromodel> macromodels)
+    : m_netlist(netlist)
+    , m_macromodels(std::move(macromodels))
+{
+    m_modelOf.fill(-1, netlist.elements.size());
+    m_unknownOf.fill(0, qMax(0, netlist.nodeCount));
+    for (int m = 0; m < m_macromodels.size(); ++m)
+    {
+        for (int i : std::as_const(m_macromodels[m].elements))
+            m_modelOf[i] = m;
+        for (int node : std::as_const(m_macromodels[m].internalNodes))
+            m_unknownOf[node] = -1;
+    }
+    for (int node = 1; node < netlist.nodeCount; ++node)
+    {
+        if (m_unknownOf[node] == 0)
+            m_unknownOf[node] = m_nodeUnknowns++;
+    }
+    if (!m_unknownOf.isEmpty())
+        m_unknownOf[0] = -1;
+
+    m_branchOf.fill(-1, netlist.elements.size());
+    for (int i = 0; i < netlist.elements.size(); ++i)
+    {
+        const NetlistElement& element = netlist.elements[i];
+        if (m_modelOf[i] < 0 && element.hasBranch())
+            m_branchOf[i] = m_nodeUnknowns + m_branchCount++;
+    }
+
+    m_unknownCount = m_nodeUnknowns + m_branchCount;
+    for (const Macromodel& model : std::as_const(m_macromodels))
+    {
+        m_modelStart.append(m_unknownCount);
+        m_unknownCount += model.order + model.ports.size();
+    }
+}
+
+SimulationResult Simulator::run(const AnalysisSettings& settings) const
+{
+    if (settings.kind == AnalysisSettings::Transient)
+        return transient(settings.step, settings.stop, settings.solver);
+    return operatingPoint(settings.solver);
+}
+
+QString Simulator::validate() const
+{
+    if (m_netlist.elements.isEmpty())
+        return QStringLiteral("the design has no elements");
+
+    for (const NetlistElement& element : m_netlist.elements)
+    {
+        if (element.isType("Resistor"))
+        {
+            if (!(element.value > 0.0))
+                return QStringLiteral("%1: resistance must be positive").arg(element.name);
+        }
+        else if (!element.isType("Capacitor") && !element.isType("Inductor") && !element.isType("Voltage Source"))
+        {
+            return QStringLiteral("%1: unsupported element type \"%2\"").arg(element.name, element.type);
+        }
+    }
+    return QString();
+}
+
+SparseMatrix Simulator::assemble(Integration integration, double step) const
+{
+    QVector<SparseMatrix::Entry> entries;
+    entries.reserve(m_nodeUnknowns + 4 * m_netlist.elements.size());
+    MatrixStamp stamp{entries};
+
+    for (int node = 0; node < m_nodeUnknowns; ++node)
+        stamp.add(node, node, Netlist::MinimumConductance);
+
+    // Companion conductance of a capacitor and impedance of an inductor per step
+    const double scale = integration == Trapezoidal ? 2.0 / step : integration == BackwardEuler ? 1.0 / step : 0.0;
+
+    for (int i = 0; i < m_netlist.elements.size(); ++i)
+    {
+        const NetlistElement& element = m_netlist.elements[i];
+        if (m_modelOf[i] >= 0)
+            continue;
+        const int a = unknownOf(element.nodeA);
+        const int b = unknownOf(element.nodeB);
+        const int branch = m_branchOf[i];
+
+        if (element.isType("Resistor"))
+        {
+            stamp.conductance(a, b, 1.0 / element.value);
+        }
+        else if (element.isType("Capacitor"))
+        {
+            if (element.value > 0.0)
+                stamp.conductance(a, b, element.value * scale);
+        }
+        else if (branch >= 0)
+        {
+            // The branch current flows from nodeA to nodeB through the element
+            stamp.add(a, branch, 1.0);
+            stamp.add(b, branch, -1.0);
+            if (element.isType("Voltage Source"))
+            {
+                // v(B) - v(A) = E
+                stamp.add(branch, b, 1.0);
+                stamp.add(branch, a, -1.0);
+            }
+            else
+            {
+                // v(A) - v(B) - L * scale * i = history
+                stamp.add(branch, a, 1.0);
+                stamp.add(branch, b, -1.0);
+                stamp.add(branch, branch, -qMax(element.value, 0.0) * scale);
+            }
+        }
+    }
+
+    // G z + scale * C z - B i = history, and B^T z - v = 0 at the ports
+    for (int m = 0; m < m_macromodels.size(); ++m)
+    {
+        const Macromodel& model = m_macromodels[m];
+        const int order = model.order;
+        const int portCount = model.ports.size();
+        const int states = m_modelStart[m];
+        const int currents = states + order;
+        for (int row = 0; row < order; ++row)
+        {
+            for (int col = 0; col < order; ++col)
+            {
+                const qsizetype at = qsizetype(row) * order + col;
+                stamp.add(states + row, states + col, model.conductance[at] + scale * model.capacitance[at]);
+            }
+            for (int k = 0; k < portCount; ++k)
+            {
+                const double incidence = model.incidence[qsizetype(row) * portCount + k];
+                stamp.add(states + row, currents + k, -incidence);
+                stamp.add(currents + k, states + row, incidence);
+            }
+        }
+        for (int k = 0; k < portCount; ++k)
+        {
+            const int port = unknownOf(model.ports[k]);
+            stamp.add(port, currents + k, 1.0);
+            stamp.add(currents + k, port, -1.0);
+        }
+    }
+    return SparseMatrix::fromEntries(unknownCount(), std::move(entries));
+}
+
+void Simulator::expand(const QVector<double>& solution, QVector<double>& voltages,
+                       QVector<double>& branchCurrents) const
+{
+    voltages.fill(0.0, m_netlist.nodeCount);
+    for (int node = 1; node < m_netlist.nodeCount; ++node)
+    {
+        if (m_unknownOf[node] >= 0)
+            voltages[node] = solution[m_unknownOf[node]];
+    }
+    branchCurrents.fill(0.0, m_netlist.elements.size());
+    for (int i = 0; i < m_netlist.elements.size(); ++i)
+    {
+        if (m_branchOf[i] >= 0)
+            branchCurrents[i] = solution[m_branchOf[i]];
+    }
+
+    for (int m = 0; m < m_macromodels.size(); ++m)
+    {
+        const Macromodel& model = m_macromodels[m];
+        const double* states = solution.constData() + m_modelStart[m];
+        for (int j = 0; j < model.internalNodes.size(); ++j)
+        {
+            const double* basis = model.nodeBasis.constData() + qsizetype(j) * model.order;
+            voltages[model.internalNodes[j]] = std::inner_product(basis, basis + model.order, states, 0.0);
+        }
+        for (int l = 0; l < model.inductors.size(); ++l)
+        {
+            const double* basis = model.inductorBasis.constData() + qsizetype(l) * model.order;
+            branchCurrents[model.inductors[l]] = std::inner_product(basis, basis + model.order, states, 0.0);
+        }
+    }
+}
+
+void Simulator::recordSample(SimulationResult& result, double time, const QVector<double>& voltages,
+                             const QVector<double>& branchCurrents, const QVector<double>& capacitorCurrents) const
+{
+    result.time.append(time);
+    result.nodeVoltages.append(voltages);
+
+    for (int i = 0; i < m_netlist.elements.size(); ++i)
+    {
+        const NetlistElement& element = m_netlist.elements[i];
+        double current = 0.0;
+        if (element.hasBranch())
+            current = branchCurrents[i];
+        else if (element.isType("Resistor"))
+            current = (voltages[element.nodeA] - voltages[element.nodeB]) / element.value;
+        else if (!capacitorCurrents.isEmpty())
+            current = capacitorCurrents[i];
+        result.elementCurrents.append(current);
+    }
+}
+
+SimulationResult Simulator::operatingPoint(LinearSolver::Method method) const
+{
+    SimulationResult result;
+    result.nodeCount = m_netlist.nodeCount;
+    result.elementCount = m_netlist.elements.size();
+    result.errorString = validate();
+    if (!result.isValid())
+        return result;
+
+    const int size = unknownCount();
+    QVector<double> rhs(size, 0.0);
+    for (int i = 0; i < m_netlist.elements.size(); ++i)
+    {
+        if (m_branchOf[i] >= 0 && m_netlist.elements[i].isType("Voltage Source"))
+            rhs[m_branchOf[i]] = m_netlist.elements[i].value;
+    }
+
+    LinearSolver solver;
+    if (!solver.prepare(assemble(Static, 0.0), method))
+    {
+        result.errorString = solver.errorString();
+        return result;
+    }
+    const MemoryStats::Charge charge(MemoryStats::Simulation, QStringLiteral("solvers"), solver.byteSize());
+    QVector<double> solution;
+    if (!solver.solve(rhs, solution))
+    {
+        result.errorString = solverError(solver);
+        return result;
+    }
+    result.solver = LinearSolver::methodName(solver.method());
+    QVector<double> voltages;
+    QVector<double> branchCurrents;
+    expand(solution, voltages, branchCurrents);
+    recordSample(result, 0.0, voltages, branchCurrents, QVector<double>());
+    return result;
+}
+
+SimulationResult Simulator::transient(double step, double stop, LinearSolver::Method method) const
+{
+    SimulationResult result;
+    result.nodeCount = m_netlist.nodeCount;
+    result.elementCount = m_netlist.elements.size();
+    result.errorString = validate();
+    if (!result.isValid())
+        return result;
+    if (!(step > 0.0) || !(stop >= step))
+    {
+        result.errorString = QStringLiteral("invalid transient step %1 s or stop time %2 s").arg(step).arg(stop);
+        return result;
+    }
+
+    const int size = unknownCount();
+    const int elementCount = m_netlist.elements.size();
+    const qint64 steps = qint64(std::ceil(stop / step - 1e-9));
+    result.time.reserve(steps + 1);
+    result.nodeVoltages.reserve((steps + 1) * result.nodeCount);
+    result.elementCurrents.reserve((steps + 1) * elementCount);
+
+    // At rest before the sources switch on
+    QVector<double> solution(size, 0.0);
+    QVector<double> voltages;
+    QVector<double> branchCurrents;
+    expand(solution, voltages, branchCurrents);
+    QVector<double> capacitorCurrents(elementCount, 0.0);
+    recordSample(result, 0.0, voltages, branchCurrents, capacitorCurrents);
+
+    // Backward Euler damps the jump at switch-on; the trapezoidal rule would
+    // carry it on as ringing
+    LinearSolver solver;
+    Integration integration = BackwardEuler;
+    if (!solver.prepare(assemble(integration, step), method, 1))
+    {
+        result.errorString = solver.errorString();
+        return result;
+    }
+    const MemoryStats::Charge charge(MemoryStats::Simulation, QStringLiteral("solvers"), solver.byteSize());
+
+    QVector<double> rhs(size);
+    for (qint64 n = 1; n <= steps; ++n)
+    {
+        if (n == 2)
+        {
+            integration = Trapezoidal;
+            if (!solver.prepare(assemble(integration, step), method, steps - 1))
+            {
+                result.errorString = solver.errorString();
+                return result;
+            }
+        }
+        const double scale = integration == Trapezoidal ? 2.0 / step : 1.0 / step;
+
+        // History terms from the previous solution
+        rhs.fill(0.0);
+        for (int i = 0; i < elementCount; ++i)
+        {
+            const NetlistElement& element = m_netlist.elements[i];
+            if (m_modelOf[i] >= 0)
+                continue;
+            const int a = unknownOf(element.nodeA);
+            const int b = unknownOf(element.nodeB);
+            const double across = voltages[element.nodeA] - voltages[element.nodeB];
+
+            if (element.isType("Capacitor") && element.value > 0.0)
+            {
+                double history = element.value * scale * across;
+                if (integration == Trapezoidal)
+                    history += capacitorCurrents[i];
+                addToRhs(rhs, a, history);
+                addToRhs(rhs, b, -history);
+            }
+            else if (element.isType("Inductor"))
+            {
+                const int branch = m_branchOf[i];
+                double history = -qMax(element.value, 0.0) * scale * solution[branch];
+                if (integration == Trapezoidal)
+                    history -= across;
+                rhs[branch] = history;
+            }
+            else if (element.isType("Voltage Source"))
+            {
+                rhs[m_branchOf[i]] = element.value;
+            }
+        }
+        // C z' = B i - G z at the previous step carries the trapezoidal rule
+        for (int m = 0; m < m_macromodels.size(); ++m)
+        {
+            const Macromodel& model = m_macromodels[m];
+            const int order = model.order;
+            const int portCount = model.ports.size();
+            const double* states = solution.constData() + m_modelStart[m];
+            const double* currents = states + order;
+            for (int row = 0; row < order; ++row)
+            {
+                const qsizetype at = qsizetype(row) * order;
+                double history = scale * std::inner_product(states, states + order, model.capacitance.constData() + at, 0.0);
+                if (integration == Trapezoidal)
+                {
+                    history -= std::inner_product(states, states + order, model.conductance.constData() + at, 0.0);
+                    history += std::inner_product(currents, currents + portCount,
+                                                  model.incidence.constData() + qsizetype(row) * portCount, 0.0);
+                }
+                rhs[m_modelStart[m] + row] = history;
+            }
+        }
+
+        // The previous step is the iterative methods' starting guess
+        const QVector<double> previous = voltages;
+        if (!solver.solve(rhs, solution))
+        {
+            result.errorString = solverError(solver);
+            return result;
+        }
+        expand(solution, voltages, branchCurrents);
+
+        // Capacitor currents for the next step's history and for the output
+        for (int i = 0; i < elementCount; ++i)
+        {
+            const NetlistElement& element = m_netlist.elements[i];
+            if (!element.isType("Capacitor") || !(element.value > 0.0))
+                continue;
+            const double before = previous[element.nodeA] - previous[element.nodeB];
+            const double after = voltages[element.nodeA] - voltages[element.nodeB];
+            double current = element.value * scale * (after - before);
+            if (integration == Trapezoidal)
+                current -= capacitorCurrents[i];
+            capacitorCurrents[i] = current;
+        }
+
+        recordSample(result, qMin(double(n) * step, stop), voltages, branchCurrents, capacitorCurrents);
+    }
+    result.solver = LinearSolver::methodName(solver.method());
+    return result;
+}
+
+QString Simulator::toCsv(const Netlist& netlist, const SimulationResult& result)
+{
+    QString text;
+    QTextStream out(&text);
+    out << "time";
+    for (int node = 1; node < result.nodeCount; ++node)
+        out << ",V(" << node << ')';
+    for (const NetlistElement& element : netlist.elements)
+        out << ",I(" << element.name << ')';
+    out << '\n';
+
+    for (int sample = 0; sample < result.sampleCount(); ++sample)
+    {
+        out << QString::number(result.time[sample], 'g', 12);
+        for (int node = 1; node < result.nodeCount; ++node)
+            out << ',' << QString::number(result.voltage(sample, node), 'g', 12);
+        for (int element = 0; element < result.elementCount; ++element)
+            out << ',' << QString::number(result.current(sample, element), 'g', 12);
+        out << '\n';
+    }
+    return text;
+}
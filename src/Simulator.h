@@ -0,0 +1,109 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+
+#include "LinearSolver.h"
+#include "ModelReduction.h"
+#include "Netlist.h"
+
+struct AnalysisSettings
+{
+    enum Kind
+    {
+        OperatingPoint,
+        Transient
+    };
+
+    Kind kind = OperatingPoint;
+    double step = 1e-6; // Transient time step in seconds
+    double stop = 1e-3; // Transient end time in seconds
+    LinearSolver::Method solver = LinearSolver::Automatic;
+
+    // "op" or "tran", as used on the command line and in result file names
+    QString name() const;
+    static bool fromName(const QString& name, Kind& kind);
+};
+
+// Samples are stored sample-major: one row of node voltages and one row of
+// element currents per time point. An operating point has a single sample.
+struct SimulationResult
+{
+    QVector<double> time;
+    QVector<double> nodeVoltages;    // nodeCount per sample, node 0 is the reference
+    QVector<double> elementCurrents; // One per netlist element, flowing from nodeA to nodeB
+    int nodeCount = 0;
+    int elementCount = 0;
+    QString solver; // Method that solved the system, see LinearSolver::methodName()
+    QString errorString;
+
+    bool isValid() const { return errorString.isEmpty(); }
+    int sampleCount() const { return time.size(); }
+    qint64 byteSize() const
+    {
+        return (time.capacity() + nodeVoltages.capacity() + elementCurrents.capacity()) * qint64(sizeof(double));
+    }
+    double voltage(int sample, int node) const { return nodeVoltages[sample * nodeCount + node]; }
+    double current(int sample, int element) const { return elementCurrents[sample * elementCount + element]; }
+};
+
+// Modified nodal analysis of a flattened netlist. The unknowns are the node
+// voltages (without the reference) followed by one branch current per voltage
+// source and inductor. Capacitors are open and inductors shorted at the
+// operating point; a transient starts from rest (capacitors discharged,
+// sources switched on at t = 0) and integrates with the trapezoidal rule after
+// one backward Euler step.
+//
+// Every node has a tiny conductance to the reference, as in SPICE, so that
+// floating parts do not make the system singular. The system is assembled
+// sparse and handed to a LinearSolver, which picks a dense factorization, a
+// preconditioned iterative method or a parallel partitioned factorization by
+// its size, its symmetry and how many time steps share it.
+//
+// Macromodels from ModelReduction stand in for the elements they replace:
+// their states and port currents follow the branch currents as unknowns, and
+// the voltages and currents inside them are reconstructed for the results.
+//
+// A Simulator only reads its netlist and keeps no state between runs, so one
+// instance may be shared by several threads.
+class Simulator
+{
+public:
+    explicit Simulator(const Netlist& netlist, QVector<Macromodel> macromodels = {});
+
+    SimulationResult run(const AnalysisSettings& settings) const;
+    SimulationResult operatingPoint(LinearSolver::Method method = LinearSolver::Automatic) const;
+    SimulationResult transient(double step, double stop, LinearSolver::Method method = LinearSolver::Automatic) const;
+
+    int unknownCount() const { return m_unknownCount; }
+
+    // Header and one line per sample, for result files
+    static QString toCsv(const Netlist& netlist, const SimulationResult& result);
+
+private:
+    enum Integration
+    {
+        Static,
+        BackwardEuler,
+        Trapezoidal
+    };
+
+    QString validate() const;
+    SparseMatrix assemble(Integration integration, double step) const;
+    // Voltage of every node, the reference included, and current of every
+    // source and inductor (zero for other elements)
+    void expand(const QVector<double>& solution, QVector<double>& voltages, QVector<double>& branchCurrents) const;
+    void recordSample(SimulationResult& result, double time, const QVector<double>& voltages,
+                      const QVector<double>& branchCurrents, const QVector<double>& capacitorCurrents) const;
+    int unknownOf(int node) const { return node > 0 ? m_unknownOf[node] : -1; }
+
+    const Netlist& m_netlist;
+    QVector<Macromodel> m_macromodels;
+    int m_nodeUnknowns = 0;
+    int m_branchCount = 0;
+    int m_unknownCount = 0;
+    QVector<int> m_unknownOf;  // Of each node, -1 for the reference and nodes inside macromodels
+    QVector<int> m_branchOf;   // Branch unknown of each source and inductor, -1 for other elements
+    QVector<int> m_modelOf;    // Macromodel replacing each element, -1 if none
+    QVector<int> m_modelStart; // First unknown of each macromodel: its states, then its port currents
+};
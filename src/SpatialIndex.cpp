@@ -0,0 +1,122 @@
+#include "SpatialIndex.h"
+
+#include <QSet>
+#include <cmath>
+
+SpatialIndex::SpatialIndex(float cellSize)
+    : m_cellSize(cellSize > 0.0f ? cellSize : 256.0f)
+{
+}
+
+void SpatialIndex::clear()
+{
+    m_rects.clear();
+    m_cells.clear();
+}
+
+SpatialIndex::CellRange SpatialIndex::cellsFor(const QRectF& rect) const
+{
+    QRectF r = rect.normalized();
+    return CellRange{qint32(std::floor(r.left() / m_cellSize)), qint32(std::floor(r.top() / m_cellSize)),
+                     qint32(std::floor(r.right() / m_cellSize)), qint32(std::floor(r.bottom() / m_cellSize))};
+}
+
+void SpatialIndex::insert(int id, const QRectF& rect)
+{
+    if (m_rects.contains(id))
+        remove(id);
+
+    m_rects.insert(id, rect);
+    CellRange cells = cellsFor(rect);
+    for (qint32 y = cells.y0; y <= cells.y1; ++y)
+    {
+        for (qint32 x = cells.x0; x <= cells.x1; ++x)
+            m_cells[cellKey(x, y)].append(id);
+    }
+}
+
+void SpatialIndex::remove(int id)
+{
+    auto it = m_rects.find(id);
+    if (it == m_rects.end())
+        return;
+
+    CellRange cells = cellsFor(it.value());
+    for (qint32 y = cells.y0; y <= cells.y1; ++y)
+    {
+        for (qint32 x = cells.x0; x <= cells.x1; ++x)
+        {
+            auto cell = m_cells.find(cellKey(x, y));
+            if (cell == m_cells.end())
+                continue;
+            cell->removeOne(id);
+            if (cell->isEmpty())
+                m_cells.erase(cell);
+        }
+    }
+    m_rects.erase(it);
+}
+
+void SpatialIndex::update(int id, const QRectF& rect)
+{
+    // Moves within the same cells only replace the box
+    auto it = m_rects.find(id);
+    if (it != m_rects.end())
+    {
+        CellRange before = cellsFor(it.value());
+        CellRange after = cellsFor(rect);
+        if (before.x0 == after.x0 && before.y0 == after.y0 && before.x1 == after.x1 && before.y1 == after.y1)
+        {
+            it.value() = rect;
+            return;
+        }
+    }
+    insert(id, rect);
+}
+
+QVector<int> SpatialIndex::query(const QRectF& region) const
+{
+    QVector<int> result;
+    CellRange cells = cellsFor(region);
+
+    // Single-cell queries cannot see duplicates
+    const bool single = cells.x0 == cells.x1 && cells.y0 == cells.y1;
+    QSet<int> seen;
+    for (qint32 y = cells.y0; y <= cells.y1; ++y)
+    {
+        for (qint32 x = cells.x0; x <= cells.x1; ++x)
+        {
+            auto cell = m_cells.constFind(cellKey(x, y));
+            if (cell == m_cells.constEnd())
+                continue;
+            for (int id : *cell)
+            {
+                if (!single && seen.contains(id))
+                    continue;
+                if (m_rects.value(id).intersects(region))
+                {
+                    result.append(id);
+                    if (!single)
+                        seen.insert(id);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+QVector<int> SpatialIndex::query(const QPointF& point) const
+{
+    QVector<int> result;
+    auto cell = m_cells.constFind(cellKey(qint32(std::floor(point.x() / m_cellSize)),
+                                          qint32(std::floor(point.y() / m_cellSize))));
+    if (cell == m_cells.constEnd())
+        return result;
+
+    for (int id : *cell)
+    {
+        if (m_rects.value(id).contains(point))
+            result.append(id);
+    }
+    return result;
+}
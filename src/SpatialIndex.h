@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QHash>
+#include <QRectF>
+#include <QVector>
+
+// Uniform grid over component bounding boxes. Each box is registered in every
+// cell it overlaps, so a region query touches only the cells it covers.
+// Queries are const and safe to run from several threads at once.
+class SpatialIndex
+{
+public:
+    explicit SpatialIndex(float cellSize = 256.0f);
+
+    void clear();
+    void insert(int id, const QRectF& rect);
+    void remove(int id);
+    void update(int id, const QRectF& rect);
+
+    bool contains(int id) const { return m_rects.contains(id); }
+    QRectF rect(int id) const { return m_rects.value(id); }
+    int size() const { return m_rects.size(); }
+
+    // Ids whose boxes intersect the region, each reported once
+    QVector<int> query(const QRectF& region) const;
+    QVector<int> query(const QPointF& point) const;
+
+private:
+    struct CellRange
+    {
+        qint32 x0, y0, x1, y1;
+    };
+
+    CellRange cellsFor(const QRectF& rect) const;
+    static qint64 cellKey(qint32 x, qint32 y) { return (qint64(x) << 32) | quint32(y); }
+
+    float m_cellSize;
+    QHash<int, QRectF> m_rects;
+    QHash<qint64, QVector<int>> m_cells;
+};
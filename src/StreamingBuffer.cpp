@@ -0,0 +1,120 @@
+#include "StreamingBuffer.h"
+
+#include <QDebug>
+#include <cstring>
+
+namespace
+{
+// How long one wait on a region's fence may take before it is retried
+constexpr GLuint64 FenceTimeoutNs = 100 * 1000 * 1000;
+} // namespace
+
+StreamingBuffer::~StreamingBuffer()
+{
+    destroy();
+}
+
+bool StreamingBuffer::create(QOpenGLExtraFunctions* functions, qsizetype regionSize)
+{
+    m_gl = functions;
+    m_regionSize = qMax<qsizetype>(regionSize, 4096);
+    m_buffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    if (!m_buffer.create())
+    {
+        qWarning() << "Failed to create streaming buffer";
+        return false;
+    }
+
+    m_buffer.bind();
+    m_buffer.allocate(int(m_regionSize * RegionCount));
+    m_buffer.release();
+    m_region = RegionCount - 1; // The first upload goes to region 0
+    return true;
+}
+
+void StreamingBuffer::destroy()
+{
+    if (!m_buffer.isCreated())
+        return;
+    deleteFences();
+    m_buffer.destroy();
+}
+
+void StreamingBuffer::deleteFences()
+{
+    for (GLsync& fence : m_fences)
+    {
+        if (fence)
+        {
+            m_gl->glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+}
+
+qsizetype StreamingBuffer::upload(const void* data, qsizetype size)
+{
+    if (!m_buffer.isCreated() || size <= 0)
+        return -1;
+
+    m_buffer.bind();
+    if (size > m_regionSize)
+    {
+        // Orphan the storage: the driver hands out a fresh block while the GPU
+        // finishes with the old one
+        while (m_regionSize < size)
+            m_regionSize *= 2;
+        deleteFences();
+        m_buffer.allocate(int(m_regionSize * RegionCount));
+        m_region = 0;
+    }
+    else
+    {
+        m_region = (m_region + 1) % RegionCount;
+        waitForRegion(m_region);
+    }
+
+    const qsizetype offset = m_region * m_regionSize;
+    void* target = m_buffer.mapRange(int(offset), int(size), QOpenGLBuffer::RangeWrite |
+                                                                 QOpenGLBuffer::RangeInvalidate |
+                                                                 QOpenGLBuffer::RangeUnsynchronized);
+    if (target)
+    {
+        std::memcpy(target, data, size_t(size));
+        m_buffer.unmap();
+    }
+    else
+    {
+        // No buffer mapping (some ES drivers); the fence still keeps the write safe
+        m_buffer.write(int(offset), data, int(size));
+    }
+    return offset;
+}
+
+void StreamingBuffer::waitForRegion(int region)
+{
+    GLsync& fence = m_fences[region];
+    if (!fence)
+        return;
+
+    // Normally signalled long ago; only blocks when the GPU is a whole ring behind
+    GLenum result = m_gl->glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FenceTimeoutNs);
+    while (result == GL_TIMEOUT_EXPIRED)
+        result = m_gl->glClientWaitSync(fence, 0, FenceTimeoutNs);
+    if (result == GL_WAIT_FAILED)
+        qWarning() << "Waiting for a streaming buffer region failed";
+
+    m_gl->glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void StreamingBuffer::fence()
+{
+    if (!m_buffer.isCreated())
+        return;
+
+    GLsync& fence = m_fences[m_region];
+    if (fence)
+        m_gl->glDeleteSync(fence);
+    fence = m_gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
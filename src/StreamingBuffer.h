@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QOpenGLBuffer>
+#include <QOpenGLExtraFunctions>
+
+// Vertex buffer for geometry rebuilt every frame. The storage is split into a
+// ring of regions and each upload goes into the next one, mapped
+// unsynchronized. A fence per region guards its reuse, so an upload never
+// waits for the GPU to finish the previous frame; it only blocks when the GPU
+// is a whole ring behind. Outgrowing a region orphans the storage.
+class StreamingBuffer
+{
+public:
+    static constexpr int RegionCount = 3;
+
+    StreamingBuffer() = default;
+    ~StreamingBuffer();
+
+    // Requires a current context
+    bool create(QOpenGLExtraFunctions* functions, qsizetype regionSize = 256 * 1024);
+    void destroy();
+    bool isCreated() const { return m_buffer.isCreated(); }
+    qsizetype byteSize() const { return m_buffer.isCreated() ? m_regionSize * RegionCount : 0; }
+
+    // Copies size bytes into the next region and returns their byte offset in
+    // the buffer, which is left bound; -1 on failure
+    qsizetype upload(const void* data, qsizetype size);
+    // Call after the draws that read the last upload
+    void fence();
+
+    bool bind() { return m_buffer.bind(); }
+    void release() { m_buffer.release(); }
+
+private:
+    void waitForRegion(int region);
+    void deleteFences();
+
+    QOpenGLExtraFunctions* m_gl = nullptr;
+    QOpenGLBuffer m_buffer{QOpenGLBuffer::VertexBuffer};
+    qsizetype m_regionSize = 0;
+    int m_region = 0;
+    GLsync m_fences[RegionCount] = {};
+};
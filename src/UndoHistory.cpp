@@ -0,0 +1,94 @@
+#include "UndoHistory.h"
+
+#include <QDebug>
+
+void UndoHistory::push(std::unique_ptr<EditCommand> command)
+{
+    // A new edit discards everything that could have been redone
+    while (m_commands.size() > m_index)
+    {
+        m_bytes -= m_commands.back()->byteSize();
+        m_commands.pop_back();
+    }
+
+    if (m_mergeOpen && !m_commands.empty())
+    {
+        EditCommand& last = *m_commands.back();
+        qint64 before = last.byteSize();
+        if (last.mergeWith(*command))
+        {
+            m_bytes += last.byteSize() - before;
+            enforceBudget();
+            return;
+        }
+    }
+
+    m_bytes += command->byteSize();
+    m_commands.push_back(std::move(command));
+    m_index = m_commands.size();
+    m_mergeOpen = true;
+    enforceBudget();
+}
+
+void UndoHistory::undo(CircuitViewport& viewport)
+{
+    if (!canUndo())
+        return;
+
+    m_mergeOpen = false;
+    --m_index;
+    m_commands[m_index]->undo(viewport);
+}
+
+void UndoHistory::redo(CircuitViewport& viewport)
+{
+    if (!canRedo())
+        return;
+
+    m_mergeOpen = false;
+    m_commands[m_index]->redo(viewport);
+    ++m_index;
+}
+
+void UndoHistory::clear()
+{
+    m_commands.clear();
+    m_index = 0;
+    m_bytes = 0;
+    m_mergeOpen = false;
+}
+
+QString UndoHistory::undoText() const
+{
+    return canUndo() ? m_commands[m_index - 1]->text() : QString();
+}
+
+QString UndoHistory::redoText() const
+{
+    return canRedo() ? m_commands[m_index]->text() : QString();
+}
+
+void UndoHistory::setMemoryBudget(qint64 bytes)
+{
+    m_budget = qMax<qint64>(0, bytes);
+    enforceBudget();
+}
+
+void UndoHistory::enforceBudget()
+{
+    // Forget the oldest undo steps first, then the furthest redo steps
+    while (m_bytes > m_budget && m_index > 0)
+    {
+        m_bytes -= m_commands.front()->byteSize();
+        m_commands.pop_front();
+        --m_index;
+    }
+    while (m_bytes > m_budget && m_commands.size() > m_index)
+    {
+        m_bytes -= m_commands.back()->byteSize();
+        m_commands.pop_back();
+    }
+
+    if (m_commands.empty())
+        m_mergeOpen = false;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QString>
+#include <deque>
+#include <memory>
+
+class CircuitViewport;
+
+// One undoable edit. Commands are pushed after the edit has been applied and
+// hold only what the edit touched, so undo and redo cost O(size of the edit).
+class EditCommand
+{
+public:
+    virtual ~EditCommand() = default;
+
+    virtual void undo(CircuitViewport& viewport) = 0;
+    virtual void redo(CircuitViewport& viewport) = 0;
+
+    // Approximate heap footprint, charged against the history's memory budget
+    virtual qint64 byteSize() const = 0;
+
+    // Folds a command that immediately follows this one into it, e.g. the
+    // steps of a drag. Returns false if the two cannot be combined.
+    virtual bool mergeWith(const EditCommand& other)
+    {
+        Q_UNUSED(other);
+        return false;
+    }
+
+    virtual QString text() const = 0;
+};
+
+// Linear undo stack bounded by memory rather than by depth. When the budget
+// is exceeded the oldest commands are dropped.
+class UndoHistory
+{
+public:
+    static constexpr qint64 DefaultMemoryBudget = 64 * 1024 * 1024;
+
+    void push(std::unique_ptr<EditCommand> command);
+    void undo(CircuitViewport& viewport);
+    void redo(CircuitViewport& viewport);
+    void clear();
+
+    // Ends the current merge run, e.g. when a drag is released
+    void closeMergeWindow() { m_mergeOpen = false; }
+
+    bool canUndo() const { return m_index > 0; }
+    bool canRedo() const { return m_index < m_commands.size(); }
+    QString undoText() const;
+    QString redoText() const;
+
+    qint64 memoryBudget() const { return m_budget; }
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryUsage() const { return m_bytes; }
+
+private:
+    void enforceBudget();
+
+    std::deque<std::unique_ptr<EditCommand>> m_commands;
+    size_t m_index = 0; // Commands before this index are applied
+    qint64 m_bytes = 0;
+    qint64 m_budget = DefaultMemoryBudget;
+    bool m_mergeOpen = false;
+};
@@ -0,0 +1,213 @@
+#include "WireRouter.h"
+#include "SpatialIndex.h"
+
+#include <QPoint>
+#include <QRectF>
+#include <QtConcurrent/QtConcurrentMap>
+#include <climits>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace
+{
+// Cells around the endpoints' bounding box that a search may detour through
+constexpr int SearchMargin = 12;
+// Larger windows fall back to a plain L-shaped route
+constexpr qint64 MaxSearchCells = 512 * 512;
+// Extra cost of a corner, in grid steps
+constexpr int BendCost = 3;
+
+// East, south, west, north
+constexpr int StepX[4] = {1, 0, -1, 0};
+constexpr int StepY[4] = {0, 1, 0, -1};
+
+// Unit step pointing away from the part the terminal belongs to
+QPoint escapeDirection(const QPointF& terminal, const QPointF& center)
+{
+    QPointF d = terminal - center;
+    if (qAbs(d.x()) >= qAbs(d.y()))
+        return QPoint(d.x() >= 0 ? 1 : -1, 0);
+    return QPoint(0, d.y() >= 0 ? 1 : -1);
+}
+
+int directionIndex(const QPoint& step)
+{
+    for (int dir = 0; dir < 4; ++dir)
+    {
+        if (StepX[dir] == step.x() && StepY[dir] == step.y())
+            return dir;
+    }
+    return 0;
+}
+
+// Appends an axis-aligned leg, inserting a corner when needed and merging
+// collinear runs
+void lineTo(QVector<QPointF>& path, const QPointF& point)
+{
+    if (path.isEmpty())
+    {
+        path.append(point);
+        return;
+    }
+
+    QPointF last = path.last();
+    if (last == point)
+        return;
+    if (last.x() != point.x() && last.y() != point.y())
+    {
+        lineTo(path, QPointF(point.x(), last.y()));
+        last = path.last();
+    }
+
+    if (path.size() >= 2)
+    {
+        const QPointF& before = path[path.size() - 2];
+        if ((before.x() == last.x() && last.x() == point.x()) || (before.y() == last.y() && last.y() == point.y()))
+        {
+            path.last() = point;
+            return;
+        }
+    }
+    path.append(point);
+}
+} // namespace
+
+QVector<QPointF> WireRouter::route(const SpatialIndex& obstacles, float gridSize, const Request& request)
+{
+    const double g = gridSize > 0.0f ? gridSize : 20.0;
+
+    // Leave each part by one grid step, then snap onto the lattice
+    const QPoint startEscape = escapeDirection(request.start, request.startCenter);
+    const QPoint endEscape = escapeDirection(request.end, request.endCenter);
+    const QPointF startOut = request.start + QPointF(startEscape) * g;
+    const QPointF endOut = request.end + QPointF(endEscape) * g;
+    const QPoint a(qRound(startOut.x() / g), qRound(startOut.y() / g));
+    const QPoint b(qRound(endOut.x() / g), qRound(endOut.y() / g));
+
+    QVector<QPointF> path;
+    lineTo(path, request.start);
+    lineTo(path, startOut);
+    lineTo(path, QPointF(a) * g);
+
+    const int minX = qMin(a.x(), b.x()) - SearchMargin;
+    const int maxX = qMax(a.x(), b.x()) + SearchMargin;
+    const int minY = qMin(a.y(), b.y()) - SearchMargin;
+    const int maxY = qMax(a.y(), b.y()) + SearchMargin;
+    const int width = maxX - minX + 1;
+    const int height = maxY - minY + 1;
+
+    int goalState = -1;
+    std::vector<int> parent;
+    if (qint64(width) * height <= MaxSearchCells)
+    {
+        const int cells = width * height;
+        auto cellIndex = [minX, minY, width](int x, int y) { return (y - minY) * width + (x - minX); };
+
+        // Rasterise the obstacles in the window; lattice points on a part's
+        // outline are blocked so wires never run along a body
+        std::vector<quint8> blocked(cells, 0);
+        QRectF window(minX * g, minY * g, (width - 1) * g, (height - 1) * g);
+        for (int id : obstacles.query(window))
+        {
+            QRectF r = obstacles.rect(id);
+            int x0 = qMax(minX, int(std::ceil(r.left() / g)));
+            int x1 = qMin(maxX, int(std::floor(r.right() / g)));
+            int y0 = qMax(minY, int(std::ceil(r.top() / g)));
+            int y1 = qMin(maxY, int(std::floor(r.bottom() / g)));
+            for (int y = y0; y <= y1; ++y)
+            {
+                for (int x = x0; x <= x1; ++x)
+                    blocked[cellIndex(x, y)] = 1;
+            }
+        }
+        blocked[cellIndex(a.x(), a.y())] = 0;
+        blocked[cellIndex(b.x(), b.y())] = 0;
+
+        // A* over (cell, heading) so corners can be charged
+        std::vector<int> cost(size_t(cells) * 4, INT_MAX);
+        parent.assign(size_t(cells) * 4, -1);
+        auto heuristic = [&b](int x, int y) { return qAbs(x - b.x()) + qAbs(y - b.y()); };
+
+        using Entry = std::pair<int, int>; // f, state
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+        const int startState = cellIndex(a.x(), a.y()) * 4 + directionIndex(startEscape);
+        cost[startState] = 0;
+        open.push({heuristic(a.x(), a.y()), startState});
+
+        while (!open.empty())
+        {
+            const auto [f, state] = open.top();
+            open.pop();
+            const int cell = state / 4;
+            const int dir = state % 4;
+            const int x = cell % width + minX;
+            const int y = cell / width + minY;
+            const int g0 = cost[state];
+            if (f > g0 + heuristic(x, y))
+                continue; // Superseded entry
+            if (x == b.x() && y == b.y())
+            {
+                goalState = state;
+                break;
+            }
+
+            for (int next = 0; next < 4; ++next)
+            {
+                if (next == (dir + 2) % 4)
+                    continue; // No U-turns
+                const int nx = x + StepX[next];
+                const int ny = y + StepY[next];
+                if (nx < minX || nx > maxX || ny < minY || ny > maxY)
+                    continue;
+                const int nextCell = cellIndex(nx, ny);
+                if (blocked[nextCell])
+                    continue;
+                const int ng = g0 + 1 + (next != dir ? BendCost : 0);
+                const int nextState = nextCell * 4 + next;
+                if (ng < cost[nextState])
+                {
+                    cost[nextState] = ng;
+                    parent[nextState] = state;
+                    open.push({ng + heuristic(nx, ny), nextState});
+                }
+            }
+        }
+    }
+
+    if (goalState >= 0)
+    {
+        QVector<QPointF> nodes;
+        for (int state = goalState; state >= 0; state = parent[state])
+        {
+            const int cell = state / 4;
+            nodes.append(QPointF(cell % width + minX, cell / width + minY) * g);
+        }
+        for (auto it = nodes.crbegin(); it != nodes.crend(); ++it)
+            lineTo(path, *it);
+    }
+    else
+    {
+        // No path inside the window: fall back to a single corner
+        lineTo(path, QPointF(b) * g);
+    }
+
+    lineTo(path, endOut);
+    lineTo(path, request.end);
+    return path;
+}
+
+QVector<QVector<QPointF>> WireRouter::routeAll(const SpatialIndex& obstacles, float gridSize,
+                                               const QVector<Request>& requests)
+{
+    // A single wire is not worth a trip through the thread pool
+    if (requests.size() == 1)
+        return {route(obstacles, gridSize, requests.first())};
+
+    return QtConcurrent::blockingMapped<QVector<QVector<QPointF>>>(requests, [&obstacles, gridSize](const Request& request)
+    {
+        return route(obstacles, gridSize, request);
+    });
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QPointF>
+#include <QVector>
+
+class SpatialIndex;
+
+// Orthogonal wire router. Wires leave each terminal away from its part, then
+// follow an A* path on the grid lattice that avoids component bodies and
+// penalises bends. Routing only reads the obstacle index, so independent
+// wires are routed in parallel.
+class WireRouter
+{
+public:
+    struct Request
+    {
+        QPointF start;       // Terminal positions
+        QPointF end;
+        QPointF startCenter; // Centers of the parts the terminals belong to
+        QPointF endCenter;
+    };
+
+    static QVector<QPointF> route(const SpatialIndex& obstacles, float gridSize, const Request& request);
+    static QVector<QVector<QPointF>> routeAll(const SpatialIndex& obstacles, float gridSize,
+                                              const QVector<Request>& requests);
+};